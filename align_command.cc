@@ -19,17 +19,19 @@
 
 #include <argp.h>
 
+#include <cerrno>
+#include <cstdlib>
 #include <fstream>
-#include <limits>
-#include <regex>
-#include <sstream>
+#include <memory>
 #include <string>
 #include <string_view>
-#include <tuple>
 #include <utility>
 #include <vector>
 
 #include "auto_cleanup.h"
+#include "git_object_store.h"
+#include "profiler.h"
+#include "unified_diff.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace
@@ -40,6 +42,10 @@ struct AlignArgs {
 	char *patched_c = nullptr;
 	char *patch = nullptr;
 	char *suffix = nullptr;
+	char *fuzz = nullptr;
+	char *strip = nullptr;
+	char *git = nullptr;
+	bool apply = false;
 };
 
 const char kAlignArgsDoc[] = "<original.c> <patched.c>";
@@ -52,6 +58,18 @@ const struct argp_option kAlignOptions[] = {
 	  /*flag=*/0, /*doc=*/"Patch file" },
 	{ /*name=*/"suffix", /*key=*/'s', /*arg=*/"SUFFIX",
 	  /*flag=*/0, /*doc=*/"Suffix for output file" },
+	{ /*name=*/"apply", /*key=*/'a', /*arg=*/nullptr,
+	  /*flag=*/0,
+	  /*doc=*/"Apply patch to DIFFED_FILE in memory and write <original.c> and <patched.c>" },
+	{ /*name=*/"fuzz", /*key=*/'F', /*arg=*/"FUZZ",
+	  /*flag=*/0,
+	  /*doc=*/"Max lines of context to ignore on applying patch. default: 2, same as patch" },
+	{ /*name=*/"strip", /*key=*/'S', /*arg=*/"NUM",
+	  /*flag=*/0,
+	  /*doc=*/"Strip NUM leading components from paths in PATCH, same as patch -pNUM. default: 1" },
+	{ /*name=*/"git", /*key=*/'g', /*arg=*/"BASE..FIX",
+	  /*flag=*/0,
+	  /*doc=*/"Read DIFFED_FILE at commits BASE and FIX from git in cwd and write <original.c> and <patched.c>" },
 	{ nullptr }
 };
 
@@ -71,6 +89,18 @@ error_t ParseAlignOpt(int key, char *arg, struct argp_state *state)
 	case 's':
 		args->suffix = arg;
 		break;
+	case 'a':
+		args->apply = true;
+		break;
+	case 'F':
+		args->fuzz = arg;
+		break;
+	case 'S':
+		args->strip = arg;
+		break;
+	case 'g':
+		args->git = arg;
+		break;
 	case ARGP_KEY_ARG:
 		if (!args->original_c) {
 			args->original_c = arg;
@@ -98,6 +128,20 @@ error_t ParseAlignOpt(int key, char *arg, struct argp_state *state)
 			llvm::errs() << "patch file is not given\n";
 			argp_usage(state);
 		}
+		if (args->git) {
+			std::string_view range(args->git);
+			size_t dots = range.find("..");
+			if (dots == 0 || dots == std::string_view::npos ||
+			    dots + 2 == range.size()) {
+				llvm::errs() << "invalid commit range: "
+					     << range << "\n";
+				argp_usage(state);
+			}
+			if (args->apply) {
+				llvm::errs() << "--apply can't be used w/ --git\n";
+				argp_usage(state);
+			}
+		}
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
@@ -105,125 +149,63 @@ error_t ParseAlignOpt(int key, char *arg, struct argp_state *state)
 	return 0;
 }
 
-// Reads in_file and skips lines till read line starts with the given marker. Once this
-// hits the marker, it returns the marked line. If it hits the end of file or stopper, it
-// returns "".
-std::string SkipToMarker(std::fstream &in_file, std::string_view marker,
-			 std::string_view stopper = "")
+// Reads lines of a file.
+std::vector<std::string> ReadLines(const std::string &filename) noexcept(false)
 {
-	const std::regex marker_regex(marker.data());
-	const std::regex stopper_regex(stopper.data());
-	std::string line;
-	while (std::getline(in_file, line)) {
-		if (std::regex_search(line, marker_regex)) {
-			return line;
-		}
-		if (!stopper.empty() &&
-		    std::regex_search(line, stopper_regex)) {
-			return "";
-		}
+	std::fstream in_file(filename, std::ios::in);
+	if (!in_file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
 	}
-	return "";
-}
+	AutoCleanup in_fd_close([&in_file_ = in_file]() { in_file_.close(); });
 
-void CopyLines(std::fstream &in_file, std::fstream &out_file, size_t lines)
-{
+	std::vector<std::string> lines;
 	std::string line;
-	for (size_t i = 0; i < lines && std::getline(in_file, line); i++) {
-		out_file << line << std::endl;
+	while (std::getline(in_file, line)) {
+		lines.push_back(std::move(line));
 	}
+	return lines;
 }
 
-void AddEmptyLines(std::fstream &out_file, size_t lines)
-{
-	out_file << std::string(lines, '\n');
-}
-
-std::pair</*offset*/ size_t, /*lines*/ size_t>
-GetOffsetLinesPair(const std::string &pair)
+// Splits content of a file into lines, same as ReadLines().
+std::vector<std::string> SplitLines(std::string_view content)
 {
-	// format of pair: [-+]${line#},${lines_changed}
-	const auto pos = pair.find(',');
-	std::string offset = pair.substr(1, pos - 1);
-	std::string lines = pair.substr(pos + 1);
-
-	return { std::stoi(offset), std::stoi(lines) };
+	std::vector<std::string> lines;
+	while (!content.empty()) {
+		size_t eol = content.find('\n');
+		lines.emplace_back(content.substr(0, eol));
+		content.remove_prefix(eol == std::string_view::npos ?
+					      content.size() :
+					      eol + 1);
+	}
+	return lines;
 }
 
-// offset in Patch is absolute value from the file start. convert it to relative offset
-// relative to the last changed. Do this because empty lines are added.
-void ConvertToRelativeOffset(std::vector<AlignCommand::Patch> *patches)
+// Reads lines of a file at a commit from git object store.
+std::vector<std::string> ReadLinesAt(GitObjectStore *git, std::string_view rev,
+				     std::string_view filename) noexcept(false)
 {
-	size_t last_patch_line = 0;
-	const size_t patch_size = patches->size();
-	for (size_t i = 0; i < patch_size; i++) {
-		auto [offset, lines] = (*patches)[i];
-		(*patches)[i] = { offset - last_patch_line, lines };
-		last_patch_line = offset;
+	std::string content;
+	if (!git->Read(rev, filename, &content)) {
+		llvm::errs() << filename << " doesn't exist at " << rev << "\n";
+		throw std::error_code{ Command::ErrorCode::FILE_OPEN_FAILED };
 	}
+	return SplitLines(content);
 }
 
-std::tuple</*original*/ std::vector<AlignCommand::Patch>,
-	   /*patched*/ std::vector<AlignCommand::Patch>,
-	   /*patch context*/ std::vector<size_t> >
-ParsePatchFile(const std::string &patch, const std::string &original)
-	noexcept(false)
+// Writes lines to a file. Every line ends w/ a newline.
+void WriteLines(const std::string &filename,
+		const std::vector<std::string> &lines) noexcept(false)
 {
-	std::fstream file(patch.data(), std::ios::in);
-	if (!file.is_open()) {
+	std::fstream out_file(filename, std::ios::out);
+	if (!out_file.is_open()) {
 		throw std::error_code{ errno, std::system_category() };
 	}
-	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
-
-	// format: diff -.* ${file1} ${file2}
-	// NOTE: patch file can be generated without using 'git diff'
-	// command. So, regular expression for matching.
-	std::vector<AlignCommand::Patch> original_patch;
-	std::vector<AlignCommand::Patch> patched_patch;
-	std::vector<size_t> patch_context;
-
-	static constexpr std::string_view diff_head = "^diff -.*";
-	std::string diff_file_head = std::string(diff_head) + original + ".*";
-	std::string line = SkipToMarker(file, diff_file_head);
-	if (line.empty()) {
-		// This happens when .c file includes "changed" header file.
-		return {original_patch, patched_patch, patch_context};
-	}
-
-	size_t offset, lines;
-	std::string token;
-	for (line = SkipToMarker(file, "^@@", diff_head); line != "";
-	     line = SkipToMarker(file, "^@@", diff_head)) {
-		// format: @@ -${line#},${lines_changed} +${line#},{lines_changed} @@ ...
-		// e.g.,: @@ -37,16 +37,17 @@ ...
-
-		std::istringstream iss(line);
-		std::getline(iss, token, ' '); // @@. so simply skip
-
-		std::getline(iss, token, ' '); // -${line#},${lines_changed}
-		std::tie(offset, lines) = GetOffsetLinesPair(token);
-		original_patch.emplace_back(offset, lines);
-
-		std::getline(iss, token, ' '); // +${line#},${lines_changed}
-		std::tie(offset, lines) = GetOffsetLinesPair(token);
-		patched_patch.emplace_back(offset, lines);
+	AutoCleanup out_fd_close(
+		[&out_file_ = out_file]() { out_file_.close(); });
 
-		// Then, there are few lines for patch context before actual changes are
-		// specified.
-		size_t i;
-		for (i = 0; std::getline(file, line); i++) {
-			if (line.find('-') == 0 || line.find('+') == 0) {
-				break;
-			}
-		}
-		// the line of context at ${line#}. so, -1 from the context
-		patch_context.push_back(i ? i - 1 : 0);
+	for (const std::string &line : lines) {
+		out_file << line << '\n';
 	}
-
-	ConvertToRelativeOffset(&original_patch);
-	ConvertToRelativeOffset(&patched_patch);
-
-	return { original_patch, patched_patch, patch_context };
 }
 
 } // namespace
@@ -255,52 +237,68 @@ AlignCommand::AlignCommand(int argc, char **argv) noexcept(false)
 	patch_filename_ = arguments.patch;
 	output_suffix_ =
 		arguments.suffix ? arguments.suffix : kDefaultAlignSuffix;
+	apply_ = arguments.apply;
+	if (arguments.fuzz) {
+		fuzz_ = std::strtoul(arguments.fuzz, nullptr, 10);
+	}
+	if (arguments.strip) {
+		strip_ = std::strtoul(arguments.strip, nullptr, 10);
+	}
+	if (arguments.git) {
+		std::string_view range(arguments.git);
+		size_t dots = range.find("..");
+		base_commit_ = range.substr(0, dots);
+		fix_commit_ = range.substr(dots + 2);
+	}
 }
 
 std::error_code AlignCommand::Run()
 {
-	auto [original, patched, context] =
-		ParsePatchFile(patch_filename_, diffed_file_);
-
-	AlignFile(original_filename_, original, patched, context);
-	AlignFile(patched_filename_, patched, original, context);
-
-	return Command::ErrorCode::NO_ERROR;
-}
-
-void AlignCommand::AlignFile(std::string_view filename,
-			     const std::vector<Patch> &from,
-			     const std::vector<Patch> &to,
-			     const std::vector<size_t> &context)
-{
-	std::fstream in_file(filename.data(), std::ios::in);
-	if (!in_file.is_open()) {
-		throw std::error_code{ errno, std::system_category() };
-	}
-	AutoCleanup in_fd_close([&in_file_ = in_file]() { in_file_.close(); });
-
-	std::fstream out_file(std::string(filename) + output_suffix_,
-			      std::ios::out);
-	if (!out_file.is_open()) {
-		throw std::error_code{ errno, std::system_category() };
+	std::unique_ptr<UnifiedDiff> diff;
+	std::vector<std::string> original, patched;
+	{
+		Profiler::Stage stage("parse");
+		diff = std::make_unique<UnifiedDiff>(patch_filename_,
+						     diffed_file_, strip_);
+		// a file not in the patch, e.g., a C file including a header
+		// changed by the patch, is aligned as is. But, a file in the
+		// patch w/o hunks, e.g., a truncated patch, can't be aligned.
+		if (diff->has_file() && diff->hunks().empty()) {
+			llvm::errs() << "no hunks for " << diffed_file_ << " in "
+				     << patch_filename_ << "\n";
+			return Command::ErrorCode::INVALID_PATCH_FILE;
+		}
+		if (!base_commit_.empty()) {
+			// both sides are read by a single git process.
+			GitObjectStore git(".");
+			original = ReadLinesAt(&git, base_commit_, diffed_file_);
+			patched = ReadLinesAt(&git, fix_commit_, diffed_file_);
+		} else {
+			original = ReadLines(apply_ ? diffed_file_ :
+						      original_filename_);
+			if (!apply_) {
+				patched = ReadLines(patched_filename_);
+			}
+		}
 	}
-	AutoCleanup out_fd_close(
-		[&out_file_ = out_file]() { out_file_.close(); });
 
-	size_t patch_size = from.size();
-	std::string line;
-	for (size_t i = 0; i < patch_size; i++) {
-		// NOTE: *offset is relative offset from the last change
-		auto [from_file_offset, from_file_lines] = from[i];
-		auto [to_file_offset, to_file_lines] = to[i];
-		CopyLines(in_file, out_file, from_file_offset);
-		if (from_file_lines < to_file_lines) {
-			// Skip over patch contexts and add empty lines after the contexts.
-			CopyLines(in_file, out_file, context[i]);
-			AddEmptyLines(out_file,
-				      to_file_lines - from_file_lines);
+	Profiler::Stage stage("render");
+	std::vector<std::string> aligned_original, aligned_patched;
+	if (apply_) {
+		diff->Apply(original, fuzz_, &patched, &aligned_original,
+			    &aligned_patched);
+		WriteLines(original_filename_, original);
+		WriteLines(patched_filename_, patched);
+	} else {
+		diff->Align(original, patched, &aligned_original,
+			    &aligned_patched);
+		if (!base_commit_.empty()) {
+			WriteLines(original_filename_, original);
+			WriteLines(patched_filename_, patched);
 		}
 	}
-	// Copy to the end
-	CopyLines(in_file, out_file, std::numeric_limits<size_t>::max());
+	WriteLines(original_filename_ + output_suffix_, aligned_original);
+	WriteLines(patched_filename_ + output_suffix_, aligned_patched);
+
+	return Command::ErrorCode::NO_ERROR;
 }
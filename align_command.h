@@ -21,7 +21,6 @@
 #include <string>
 #include <string_view>
 #include <system_error>
-#include <vector>
 
 #include "command.h"
 
@@ -35,20 +34,16 @@
 // c's __LINE__ macros used after patch's change is translated onto different # in a final
 // ELF binary and LLVM IR file. This, in turn, makes unexpected diffs for kernel livepatch
 // generation.
+//
+// With --apply option, the command doesn't need patched.c prepared by 'patch'. It reads
+// the diffed file, applies .patch to it in memory, and writes original.c and patched.c
+// along w/ their aligned files. So, kernel tree is not modified.
+//
+// With --git=BASE..FIX option, the diffed file is read at the commits, BASE and FIX,
+// from git object store, and .patch is only used for aligning. So, neither the kernel
+// tree nor its work tree state matters, e.g., files checked out or patched by others.
 class AlignCommand : public Command {
     public:
-	// struct Patch contains "relative" offset from the previous patched lines and how
-	// many lines are changed from the offset.
-	struct Patch {
-		Patch(size_t offset, size_t lines)
-			: offset(offset), lines(lines)
-		{
-		}
-		~Patch() = default;
-		size_t offset = 0;
-		size_t lines = 0;
-	};
-
 	static constexpr std::string_view kCommandName = "align";
 
 	AlignCommand(int argc, char **argv) noexcept(false);
@@ -61,11 +56,6 @@ class AlignCommand : public Command {
 	// Runs align command for __LINE__ macro in original.c and patched.c.
 	std::error_code Run() override;
 
-	void AlignFile(std::string_view filename,
-		       const std::vector<Patch> &from,
-		       const std::vector<Patch> &to,
-		       const std::vector<size_t> &context);
-
     private:
 	// name of original diffed file. this is used as a marker while parsing .patch
 	// file.
@@ -74,6 +64,17 @@ class AlignCommand : public Command {
 	std::string patched_filename_;
 	std::string patch_filename_;
 	std::string output_suffix_;
+	// if true, patched.c is created by applying .patch to the diffed file.
+	bool apply_ = false;
+	// max lines of context to ignore when applying .patch. 2 is the
+	// default of 'patch'.
+	size_t fuzz_ = 2;
+	// leading components stripped from paths in .patch, i.e., 'patch -p'.
+	size_t strip_ = 1;
+	// if given, original.c and patched.c are the diffed file at the
+	// commits.
+	std::string base_commit_;
+	std::string fix_commit_;
 };
 
 #endif // ALIGN_COMMAND_H_
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ *
+ * This file implements global operator new/delete hooks to count allocations
+ * and account heaps of work units for the profiler. They simply forward to
+ * malloc/free after counting. The
+ * hooks are linked into livepatch binary only, not liblivepatch, so that
+ * programs embedding the library keep their own allocator.
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "profiler.h"
+
+void *operator new(std::size_t size)
+{
+	Profiler::CountAlloc(size);
+	if (void *ptr = std::malloc(size ? size : 1)) {
+		Profiler::CountHeapAlloc(ptr);
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	Profiler::CountAlloc(size);
+	void *ptr = std::malloc(size ? size : 1);
+	Profiler::CountHeapAlloc(ptr);
+	return ptr;
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	return ::operator new(size, std::nothrow);
+}
+
+void *operator new(std::size_t size, std::align_val_t align)
+{
+	Profiler::CountAlloc(size);
+	const size_t alignment = static_cast<size_t>(align);
+	// aligned_alloc requires size to be a multiple of alignment.
+	const size_t aligned_size =
+		((size ? size : 1) + alignment - 1) & ~(alignment - 1);
+	if (void *ptr = std::aligned_alloc(alignment, aligned_size)) {
+		Profiler::CountHeapAlloc(ptr);
+		return ptr;
+	}
+	throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size, std::align_val_t align)
+{
+	return ::operator new(size, align);
+}
+
+void operator delete(void *ptr) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::align_val_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept
+{
+	Profiler::CountHeapFree(ptr);
+	std::free(ptr);
+}
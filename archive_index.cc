@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "archive_index.h"
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+std::unique_ptr<ArchiveIndex>
+ArchiveIndex::Create(const std::vector<std::string> &specs)
+{
+	if (specs.empty())
+		return nullptr;
+
+	auto index = std::make_unique<ArchiveIndex>();
+	for (std::string_view spec : specs) {
+		size_t eq = spec.find('=');
+		index->Add(spec.substr(0, eq), spec.substr(eq + 1));
+	}
+	return index;
+}
+
+void ArchiveIndex::Add(std::string_view obj_name, std::string_view filename)
+{
+	std::string name(obj_name);
+	archives_.erase(name);
+	filenames_[name] = filename;
+}
+
+int ArchiveIndex::QuerySymbol(const std::string &obj_name,
+			      const std::string &symbol,
+			      const std::string &filename) const
+{
+	auto archive = archives_.find(obj_name);
+	if (archive == archives_.end()) {
+		auto archive_filename = filenames_.find(obj_name);
+		if (archive_filename == filenames_.end()) {
+			return 0;
+		}
+		archive = archives_
+				  .emplace(obj_name,
+					   std::make_unique<ThinArchive>(
+						   archive_filename->second))
+				  .first;
+	}
+
+	return archive->second->QuerySymbol(symbol, filename);
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef ARCHIVE_INDEX_H_
+#define ARCHIVE_INDEX_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "thin_archive.h"
+
+// This class holds thin archives of several objects, vmlinux and kernel
+// modules, keyed by object name. The name is "vmlinux" or the module name
+// in .modinfo, same as ${mod_name} in the symbol map. So, duplicated
+// symbols of an object are not mixed up w/ the ones of other objects.
+//
+// An archive is a text file for ThinArchive. It's parsed on the first query
+// for its object, so archives that no symbol refers to are never parsed.
+// Note that this class is not thread-safe.
+class ArchiveIndex final {
+    public:
+	ArchiveIndex() = default;
+	~ArchiveIndex() = default;
+
+	// Don't allow copy.
+	ArchiveIndex(const ArchiveIndex &rhs) = delete;
+	ArchiveIndex &operator=(const ArchiveIndex &rhs) = delete;
+
+	// Adds a text file for thin archive of an object.
+	void Add(std::string_view obj_name, std::string_view filename);
+
+	// Returns pos for given symbol and filename in thin archive of
+	// obj_name. See ThinArchive::QuerySymbol(). If no archive is added for
+	// obj_name, returns 0 same as no thin archive is given.
+	int QuerySymbol(const std::string &obj_name, const std::string &symbol,
+			const std::string &filename) const noexcept(false);
+
+	// Creates an index out of "${obj_name}=${filename}" specs. If specs is
+	// empty, returns nullptr.
+	static std::unique_ptr<ArchiveIndex>
+	Create(const std::vector<std::string> &specs);
+
+    private:
+	// key: object name, value: text file for its thin archive
+	std::unordered_map<std::string, std::string> filenames_;
+	// key: object name, value: parsed thin archive
+	mutable std::unordered_map<std::string, std::unique_ptr<ThinArchive> >
+		archives_;
+};
+
+#endif // ARCHIVE_INDEX_H_
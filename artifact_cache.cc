@@ -0,0 +1,754 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "artifact_cache.h"
+
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "auto_cleanup.h"
+#include "command.h"
+#include "cpu_profiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// SHA-256 as specified in FIPS 180-4.
+class Sha256 final {
+    public:
+	void Update(std::string_view data)
+	{
+		for (unsigned char c : data) {
+			block_[block_size_++] = c;
+			if (block_size_ == block_.size()) {
+				Transform();
+				block_size_ = 0;
+			}
+		}
+		length_ += data.size();
+	}
+
+	std::string HexDigest()
+	{
+		const uint64_t bit_length = length_ * 8;
+		Update(std::string_view("\x80", 1));
+		while (block_size_ != 56) {
+			Update(std::string_view("\0", 1));
+		}
+		for (int i = 7; i >= 0; i--) {
+			block_[block_size_++] = bit_length >> (i * 8);
+		}
+		Transform();
+
+		static constexpr char kHex[] = "0123456789abcdef";
+		std::string digest;
+		for (uint32_t h : state_) {
+			for (int i = 28; i >= 0; i -= 4) {
+				digest.push_back(kHex[(h >> i) & 0xf]);
+			}
+		}
+		return digest;
+	}
+
+    private:
+	static uint32_t Rotr(uint32_t x, int n)
+	{
+		return (x >> n) | (x << (32 - n));
+	}
+
+	void Transform()
+	{
+		static constexpr uint32_t kK[64] = {
+			0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b,
+			0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01,
+			0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7,
+			0xc19bf174, 0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+			0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152,
+			0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+			0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc,
+			0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+			0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+			0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08,
+			0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f,
+			0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+			0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+		};
+
+		uint32_t w[64];
+		for (int i = 0; i < 16; i++) {
+			w[i] = (block_[i * 4] << 24) | (block_[i * 4 + 1] << 16) |
+			       (block_[i * 4 + 2] << 8) | block_[i * 4 + 3];
+		}
+		for (int i = 16; i < 64; i++) {
+			uint32_t s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^
+				      (w[i - 15] >> 3);
+			uint32_t s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^
+				      (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		uint32_t a = state_[0], b = state_[1], c = state_[2],
+			 d = state_[3], e = state_[4], f = state_[5],
+			 g = state_[6], h = state_[7];
+		for (int i = 0; i < 64; i++) {
+			uint32_t s1 = Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25);
+			uint32_t ch = (e & f) ^ (~e & g);
+			uint32_t t1 = h + s1 + ch + kK[i] + w[i];
+			uint32_t s0 = Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22);
+			uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+			uint32_t t2 = s0 + maj;
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+		state_[0] += a;
+		state_[1] += b;
+		state_[2] += c;
+		state_[3] += d;
+		state_[4] += e;
+		state_[5] += f;
+		state_[6] += g;
+		state_[7] += h;
+	}
+
+	std::array<uint32_t, 8> state_ = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+					   0xa54ff53a, 0x510e527f, 0x9b05688c,
+					   0x1f83d9ab, 0x5be0cd19 };
+	std::array<unsigned char, 64> block_ = {};
+	size_t block_size_ = 0;
+	uint64_t length_ = 0;
+};
+
+// Minimal protobuf encoding for ActionResult in the remote execution API.
+//
+//   message Digest { string hash = 1; int64 size_bytes = 2; }
+//   message OutputFile { string path = 1; Digest digest = 2; }
+//   message ActionResult { repeated OutputFile output_files = 2; }
+constexpr std::string_view kArtifactPath = "artifact";
+
+void EncodeVarint(uint64_t value, std::string *out)
+{
+	while (value >= 0x80) {
+		out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out->push_back(static_cast<char>(value));
+}
+
+void EncodeField(uint32_t field, std::string_view value, std::string *out)
+{
+	// wire type 2: length-delimited
+	EncodeVarint((field << 3) | 2, out);
+	EncodeVarint(value.size(), out);
+	out->append(value);
+}
+
+bool DecodeVarint(std::string_view *in, uint64_t *value)
+{
+	*value = 0;
+	for (int shift = 0; shift < 64 && !in->empty(); shift += 7) {
+		uint8_t byte = in->front();
+		in->remove_prefix(1);
+		*value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// Finds the first length-delimited field in a given message. Other fields
+// are skipped.
+bool FindField(std::string_view message, uint32_t field, std::string_view *value)
+{
+	while (!message.empty()) {
+		uint64_t tag, length;
+		if (!DecodeVarint(&message, &tag)) {
+			return false;
+		}
+
+		switch (tag & 0x7) {
+		case 0: // varint
+			if (!DecodeVarint(&message, &length)) {
+				return false;
+			}
+			continue;
+		case 1: // 64-bit
+			length = 8;
+			break;
+		case 2: // length-delimited
+			if (!DecodeVarint(&message, &length)) {
+				return false;
+			}
+			break;
+		case 5: // 32-bit
+			length = 4;
+			break;
+		default:
+			return false;
+		}
+
+		if (length > message.size()) {
+			return false;
+		}
+		if ((tag >> 3) == field && (tag & 0x7) == 2) {
+			*value = message.substr(0, length);
+			return true;
+		}
+		message.remove_prefix(length);
+	}
+	return false;
+}
+
+std::string EncodeActionResult(const std::string &digest, size_t size)
+{
+	std::string digest_msg;
+	EncodeField(1, digest, &digest_msg);
+	EncodeVarint((2 << 3) | 0, &digest_msg);
+	EncodeVarint(size, &digest_msg);
+
+	std::string output_file;
+	EncodeField(1, kArtifactPath, &output_file);
+	EncodeField(2, digest_msg, &output_file);
+
+	std::string action_result;
+	EncodeField(2, output_file, &action_result);
+	return action_result;
+}
+
+bool DecodeActionResult(std::string_view action_result, std::string *digest)
+{
+	std::string_view output_file, digest_msg, hash;
+	if (!FindField(action_result, 2, &output_file) ||
+	    !FindField(output_file, 2, &digest_msg) ||
+	    !FindField(digest_msg, 1, &hash)) {
+		return false;
+	}
+	digest->assign(hash);
+	return true;
+}
+
+std::string_view KindName(ArtifactCache::Kind kind)
+{
+	return kind == ArtifactCache::Kind::ACTION ? "ac" : "cas";
+}
+
+// Decodes body w/ "Transfer-Encoding: chunked".
+bool DecodeChunked(std::string_view body, std::string *out)
+{
+	while (true) {
+		size_t eol = body.find("\r\n");
+		if (eol == std::string_view::npos) {
+			return false;
+		}
+		size_t chunk_size = std::strtoul(
+			std::string(body.substr(0, eol)).c_str(), nullptr, 16);
+		body.remove_prefix(eol + 2);
+		if (chunk_size == 0) {
+			return true;
+		}
+		if (chunk_size + 2 > body.size()) {
+			return false;
+		}
+		out->append(body.substr(0, chunk_size));
+		body.remove_prefix(chunk_size + 2);
+	}
+}
+
+bool StartsWithNoCase(std::string_view str, std::string_view prefix)
+{
+	if (str.size() < prefix.size()) {
+		return false;
+	}
+	for (size_t i = 0; i < prefix.size(); i++) {
+		if (tolower(str[i]) != tolower(prefix[i])) {
+			return false;
+		}
+	}
+	return true;
+}
+} // namespace
+
+bool ArtifactCache::Get(std::string_view key, std::string *artifact)
+{
+	std::string action_result, digest;
+	if (!Load(Kind::ACTION, Digest(key), &action_result) ||
+	    !DecodeActionResult(action_result, &digest) ||
+	    !Load(Kind::BLOB, digest, artifact)) {
+		return false;
+	}
+
+	// blob may be truncated or corrupted. it's a miss unless it matches
+	// the digest.
+	return Digest(*artifact) == digest;
+}
+
+void ArtifactCache::Put(std::string_view key, std::string artifact)
+{
+	StoreArtifact(Digest(key), artifact);
+}
+
+void ArtifactCache::StoreArtifact(const std::string &key_digest,
+				  const std::string &artifact)
+{
+	// blob should be stored before action result that refers to it.
+	const std::string digest = Digest(artifact);
+	if (!Store(Kind::BLOB, digest, artifact)) {
+		return;
+	}
+	Store(Kind::ACTION, key_digest,
+	      EncodeActionResult(digest, artifact.size()));
+}
+
+std::unique_ptr<ArtifactCache>
+ArtifactCache::Create(const std::string &location) noexcept(false)
+{
+	static constexpr std::string_view kHttp = "http://";
+
+	if (location.empty()) {
+		return nullptr;
+	}
+
+	if (location.find("://") == std::string::npos) {
+		return std::make_unique<LocalCache>(location);
+	}
+
+	if (location.compare(0, kHttp.size(), kHttp) == 0) {
+		return std::make_unique<RemoteCache>(location);
+	}
+
+	llvm::errs() << "unsupported cache location: " << location << "\n";
+	throw std::error_code{ Command::ErrorCode::INVALID_CACHE };
+}
+
+std::string ArtifactCache::Digest(std::string_view data)
+{
+	Sha256 sha256;
+	sha256.Update(data);
+	return sha256.HexDigest();
+}
+
+LocalCache::LocalCache(std::string_view directory) noexcept(false)
+	: directory_(directory)
+{
+	std::error_code ec;
+	for (Kind kind : { Kind::ACTION, Kind::BLOB }) {
+		fs::create_directories(fs::path(directory_) / KindName(kind),
+				       ec);
+		if (ec) {
+			llvm::errs() << "failed to create cache directory: "
+				     << directory_ << "\n";
+			throw std::error_code{ Command::ErrorCode::INVALID_CACHE };
+		}
+	}
+
+	index_ = CacheIndex::Create((fs::path(directory_) / "index").string(),
+				    kIndexSlots, kMaxBytes);
+}
+
+LocalCache::~LocalCache()
+{
+	if (evicted_) {
+		CollectBlobs();
+	}
+}
+
+std::string LocalCache::EntryPath(Kind kind, const std::string &digest) const
+{
+	return (fs::path(directory_) / KindName(kind) / digest).string();
+}
+
+bool LocalCache::Load(Kind kind, const std::string &digest, std::string *data)
+{
+	if (kind == Kind::ACTION && index_) {
+		return LoadIndex(digest, data);
+	}
+
+	std::ifstream file(EntryPath(kind, digest), std::ios::binary);
+	if (!file.is_open()) {
+		return false;
+	}
+
+	std::ostringstream content;
+	content << file.rdbuf();
+	*data = content.str();
+	return !file.bad();
+}
+
+bool LocalCache::Store(Kind kind, const std::string &digest,
+		       std::string_view data)
+{
+	static std::atomic<unsigned> tmp_count{ 0 };
+
+	if (kind == Kind::ACTION && index_) {
+		return StoreIndex(digest, data);
+	}
+
+	// Write to a temporary file and rename it. So, readers in other
+	// processes never see partially written entries.
+	const std::string path = EntryPath(kind, digest);
+	const std::string tmp_path = path + ".tmp." + std::to_string(getpid()) +
+				     "." + std::to_string(tmp_count++);
+	{
+		std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+		file.write(data.data(), data.size());
+		if (!file) {
+			fs::remove(tmp_path);
+			return false;
+		}
+	}
+
+	std::error_code ec;
+	fs::rename(tmp_path, path, ec);
+	if (ec) {
+		fs::remove(tmp_path, ec);
+		return false;
+	}
+	return true;
+}
+
+bool LocalCache::LoadIndex(const std::string &digest, std::string *data)
+{
+	CacheIndex::Digest key;
+	CacheIndex::Entry entry;
+	if (!CacheIndex::ParseHex(digest, &key) || !index_->Lookup(key, &entry)) {
+		return false;
+	}
+	*data = EncodeActionResult(CacheIndex::Hex(entry.blob), entry.size);
+	return true;
+}
+
+bool LocalCache::StoreIndex(const std::string &digest, std::string_view data)
+{
+	std::string blob_digest;
+	CacheIndex::Digest key;
+	CacheIndex::Entry entry;
+	if (!DecodeActionResult(data, &blob_digest) ||
+	    !CacheIndex::ParseHex(digest, &key) ||
+	    !CacheIndex::ParseHex(blob_digest, &entry.blob)) {
+		return false;
+	}
+	// blob is stored before the action result.
+	std::error_code ec;
+	entry.size = fs::file_size(EntryPath(Kind::BLOB, blob_digest), ec);
+	if (ec) {
+		return false;
+	}
+
+	bool evicted = false;
+	const bool stored = index_->Insert(key, entry, &evicted);
+	if (evicted) {
+		evicted_ = true;
+	}
+	return stored;
+}
+
+void LocalCache::CollectBlobs()
+{
+	const std::set<CacheIndex::Digest> blobs = index_->Blobs();
+	const auto expired = fs::file_time_type::clock::now() - kBlobGracePeriod;
+
+	std::error_code ec;
+	for (fs::directory_iterator it(
+		     fs::path(directory_) / KindName(Kind::BLOB), ec),
+	     end;
+	     !ec && it != end; it.increment(ec)) {
+		CacheIndex::Digest blob;
+		// e.g., temporary files of blobs being stored.
+		if (!CacheIndex::ParseHex(it->path().filename().string(),
+					  &blob) ||
+		    blobs.count(blob)) {
+			continue;
+		}
+		// A blob stored again by others in the meantime may be removed
+		// right after checked. Then, the entry just misses.
+		std::error_code time_ec;
+		const fs::file_time_type time =
+			fs::last_write_time(it->path(), time_ec);
+		if (!time_ec && time < expired) {
+			fs::remove(it->path(), time_ec);
+		}
+	}
+}
+
+RemoteCache::RemoteCache(std::string_view url) noexcept(false)
+{
+	static constexpr std::string_view kHttp = "http://";
+
+	// format: http://host[:port][/path]
+	std::string_view authority = url.substr(kHttp.size());
+	size_t path_start = authority.find('/');
+	if (path_start != std::string_view::npos) {
+		path_prefix_ = authority.substr(path_start);
+		authority = authority.substr(0, path_start);
+		while (!path_prefix_.empty() && path_prefix_.back() == '/') {
+			path_prefix_.pop_back();
+		}
+	}
+
+	size_t port_start = authority.rfind(':');
+	if (port_start != std::string_view::npos &&
+	    authority.find(']', port_start) == std::string_view::npos) {
+		host_ = authority.substr(0, port_start);
+		port_ = authority.substr(port_start + 1);
+	} else {
+		host_ = authority;
+		port_ = "80";
+	}
+	// strip brackets for IPv6 address, e.g., [::1]
+	if (host_.size() > 2 && host_.front() == '[' && host_.back() == ']') {
+		host_ = host_.substr(1, host_.size() - 2);
+	}
+
+	if (host_.empty() || port_.empty()) {
+		llvm::errs() << "invalid cache url: " << url << "\n";
+		throw std::error_code{ Command::ErrorCode::INVALID_CACHE };
+	}
+}
+
+RemoteCache::~RemoteCache()
+{
+	Flush();
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	upload_cv_.notify_all();
+	for (std::thread &worker : upload_workers_) {
+		worker.join();
+	}
+}
+
+void RemoteCache::Put(std::string_view key, std::string artifact)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	uploads_.emplace_back([this, key_digest = Digest(key),
+			       artifact = std::move(artifact)]() {
+		StoreArtifact(key_digest, artifact);
+	});
+
+	// Workers are created on demand.
+	if (upload_workers_.size() < kMaxUploads &&
+	    upload_workers_.size() < uploads_.size() + running_uploads_) {
+		upload_workers_.emplace_back(&RemoteCache::UploadWorker, this);
+	}
+	upload_cv_.notify_one();
+}
+
+void RemoteCache::Flush()
+{
+	std::unique_lock<std::mutex> lock(mutex_);
+	flush_cv_.wait(lock, [this]() {
+		return uploads_.empty() && running_uploads_ == 0;
+	});
+}
+
+void RemoteCache::UploadWorker()
+{
+	CpuProfiler::RegisterThread();
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true) {
+		upload_cv_.wait(lock, [this]() {
+			return stopping_ || !uploads_.empty();
+		});
+		if (uploads_.empty()) {
+			return;
+		}
+
+		std::function<void()> upload = std::move(uploads_.front());
+		uploads_.pop_front();
+		running_uploads_++;
+
+		lock.unlock();
+		upload();
+		lock.lock();
+
+		running_uploads_--;
+		if (uploads_.empty() && running_uploads_ == 0) {
+			flush_cv_.notify_all();
+		}
+	}
+}
+
+bool RemoteCache::Load(Kind kind, const std::string &digest,
+		       std::string *data)
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		download_cv_.wait(lock,
+				  [this]() { return downloads_ < kMaxDownloads; });
+		downloads_++;
+	}
+	AutoCleanup release([this]() {
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			downloads_--;
+		}
+		download_cv_.notify_one();
+	});
+
+	const std::string path =
+		path_prefix_ + "/" + std::string(KindName(kind)) + "/" + digest;
+	return Request("GET", path, "", data) == 200;
+}
+
+bool RemoteCache::Store(Kind kind, const std::string &digest,
+			std::string_view data)
+{
+	const std::string path =
+		path_prefix_ + "/" + std::string(KindName(kind)) + "/" + digest;
+	std::string response;
+	int status = Request("PUT", path, data, &response);
+	if (status < 200 || status >= 300) {
+		llvm::errs() << "cache upload failed: " << path << " (" << status
+			     << ")\n";
+		return false;
+	}
+	return true;
+}
+
+int RemoteCache::Request(std::string_view method, const std::string &path,
+			 std::string_view body, std::string *response)
+{
+	static constexpr int kTimeoutSec = 30;
+
+	struct addrinfo hints = {};
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	struct addrinfo *addrs = nullptr;
+	if (getaddrinfo(host_.c_str(), port_.c_str(), &hints, &addrs)) {
+		return -1;
+	}
+	AutoCleanup free_addrs([addrs]() { freeaddrinfo(addrs); });
+
+	int fd = -1;
+	for (struct addrinfo *i = addrs; i; i = i->ai_next) {
+		fd = socket(i->ai_family, i->ai_socktype | SOCK_CLOEXEC,
+			    i->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		struct timeval timeout = { kTimeoutSec, 0 };
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+			   sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			   sizeof(timeout));
+		if (connect(fd, i->ai_addr, i->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	if (fd < 0) {
+		return -1;
+	}
+	AutoCleanup fd_close([fd]() { close(fd); });
+
+	std::string request = std::string(method) + " " + path +
+			      " HTTP/1.1\r\n"
+			      "Host: " +
+			      host_ + "\r\n"
+				      "Connection: close\r\n"
+				      "Content-Length: " +
+			      std::to_string(body.size()) + "\r\n\r\n";
+	request.append(body);
+	for (std::string_view rest(request); !rest.empty();) {
+		ssize_t sent = send(fd, rest.data(), rest.size(), MSG_NOSIGNAL);
+		if (sent <= 0) {
+			return -1;
+		}
+		rest.remove_prefix(sent);
+	}
+
+	// "Connection: close" makes server close connection after response.
+	std::string raw;
+	char buf[64 * 1024];
+	ssize_t received;
+	while ((received = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		raw.append(buf, received);
+	}
+	if (received < 0) {
+		return -1;
+	}
+
+	// format: HTTP/1.1 ${status} ${reason}\r\n${headers}\r\n\r\n${body}
+	size_t header_end = raw.find("\r\n\r\n");
+	size_t status_start = raw.find(' ');
+	if (header_end == std::string::npos || status_start > header_end) {
+		return -1;
+	}
+	int status = std::atoi(raw.c_str() + status_start + 1);
+
+	std::string_view headers(raw.data(), header_end);
+	std::string_view content(raw);
+	content.remove_prefix(header_end + 4);
+
+	bool chunked = false;
+	size_t content_length = content.size();
+	while (!headers.empty()) {
+		size_t eol = headers.find("\r\n");
+		std::string_view header = headers.substr(0, eol);
+		headers.remove_prefix(eol == std::string_view::npos ? headers.size() :
+								      eol + 2);
+		if (StartsWithNoCase(header, "content-length:")) {
+			content_length = std::strtoul(
+				std::string(header.substr(15)).c_str(), nullptr,
+				10);
+		} else if (StartsWithNoCase(header, "transfer-encoding:") &&
+			   header.find("chunked") != std::string_view::npos) {
+			chunked = true;
+		}
+	}
+
+	response->clear();
+	if (chunked) {
+		if (!DecodeChunked(content, response)) {
+			return -1;
+		}
+	} else {
+		if (content_length > content.size()) {
+			// connection is closed before the whole body is
+			// received.
+			return -1;
+		}
+		response->assign(content.substr(0, content_length));
+	}
+	return status;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef ARTIFACT_CACHE_H_
+#define ARTIFACT_CACHE_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "cache_index.h"
+
+// This class is an interface for a content-addressed cache of build
+// artifacts, such as IR files, diff results and indexes. The layout follows
+// the remote cache protocol of Bazel. There are two kinds of entries;
+//
+//   cas/${sha256_of_blob}: blob of an artifact
+//   ac/${sha256_of_key}:   ActionResult protobuf that refers to the blob
+//
+// So, an artifact is looked up by a key that identifies all inputs to build
+// it. Backends implement how to load and store the entries. Note that cache
+// is best effort. Any errors from backends are treated as cache misses.
+class ArtifactCache {
+    public:
+	enum class Kind { ACTION, BLOB };
+
+	virtual ~ArtifactCache() = default;
+
+	// Looks up an artifact for a given key. Returns true if found.
+	bool Get(std::string_view key, std::string *artifact);
+
+	// Stores an artifact for a given key. Backends may store it
+	// asynchronously.
+	virtual void Put(std::string_view key, std::string artifact);
+
+	// Creates a cache for a given location. "http://host[:port][/path]" is
+	// for the remote cache. Otherwise, location is a path to local
+	// directory. If location is empty, nullptr is returned.
+	static std::unique_ptr<ArtifactCache> Create(const std::string &location)
+		noexcept(false);
+
+	// Returns SHA-256 hex digest for given data.
+	static std::string Digest(std::string_view data);
+
+    protected:
+	// Loads/stores an entry. digest is a hex digest used as a name of the
+	// entry.
+	virtual bool Load(Kind kind, const std::string &digest,
+			  std::string *data) = 0;
+	virtual bool Store(Kind kind, const std::string &digest,
+			   std::string_view data) = 0;
+
+	// Stores an artifact synchronously.
+	void StoreArtifact(const std::string &key_digest,
+			   const std::string &artifact);
+};
+
+// This class implements cache backend w/ a local directory. Action results
+// are kept in a CacheIndex, ${directory}/index, shared by processes w/o
+// locks. If the index can't be mapped, they are kept in ac/ files instead.
+// Blobs are shared by entries. So, they aren't removed on eviction, but
+// collected once the cache is closed if any entry is evicted.
+class LocalCache final : public ArtifactCache {
+    public:
+	LocalCache(std::string_view directory) noexcept(false);
+	~LocalCache() override;
+
+	// Don't allow copy.
+	LocalCache(const LocalCache &rhs) = delete;
+	LocalCache &operator=(const LocalCache &rhs) = delete;
+
+    protected:
+	bool Load(Kind kind, const std::string &digest,
+		  std::string *data) override;
+	bool Store(Kind kind, const std::string &digest,
+		   std::string_view data) override;
+
+    private:
+	// 64K entries take ~6MB of index.
+	static constexpr uint64_t kIndexSlots = 1 << 16;
+	static constexpr uint64_t kMaxBytes = 32ULL << 30;
+	// Blobs newer than this are kept, as others may be about to store
+	// action results that refer to them.
+	static constexpr std::chrono::hours kBlobGracePeriod{ 1 };
+
+	std::string EntryPath(Kind kind, const std::string &digest) const;
+
+	bool LoadIndex(const std::string &digest, std::string *data);
+	bool StoreIndex(const std::string &digest, std::string_view data);
+
+	// Removes blobs in cas/ that no entry in the index refers to.
+	void CollectBlobs();
+
+	std::string directory_;
+	std::unique_ptr<CacheIndex> index_;
+	std::atomic<bool> evicted_{ false };
+};
+
+// This class implements a client for HTTP remote cache, e.g., bazel-remote
+// or nginx w/ WebDAV. Entries are downloaded by GET and uploaded by PUT.
+// Uploads are done asynchronously by background threads and the destructor
+// waits for them. The number of concurrent downloads is bounded not to
+// overload the server when many threads look up the cache.
+class RemoteCache final : public ArtifactCache {
+    public:
+	RemoteCache(std::string_view url) noexcept(false);
+	~RemoteCache() override;
+
+	// Don't allow copy.
+	RemoteCache(const RemoteCache &rhs) = delete;
+	RemoteCache &operator=(const RemoteCache &rhs) = delete;
+
+	void Put(std::string_view key, std::string artifact) override;
+
+	// Waits for all pending uploads.
+	void Flush();
+
+    protected:
+	bool Load(Kind kind, const std::string &digest,
+		  std::string *data) override;
+	bool Store(Kind kind, const std::string &digest,
+		   std::string_view data) override;
+
+    private:
+	static constexpr size_t kMaxDownloads = 4;
+	static constexpr size_t kMaxUploads = 2;
+
+	// Sends a request and returns HTTP status code. On connection error,
+	// negative value is returned.
+	int Request(std::string_view method, const std::string &path,
+		    std::string_view body, std::string *response);
+
+	void UploadWorker();
+
+	std::string host_;
+	std::string port_;
+	std::string path_prefix_;
+
+	std::mutex mutex_;
+	std::condition_variable download_cv_;
+	size_t downloads_ = 0;
+	std::condition_variable upload_cv_;
+	std::condition_variable flush_cv_;
+	std::deque<std::function<void()> > uploads_;
+	size_t running_uploads_ = 0;
+	bool stopping_ = false;
+	std::vector<std::thread> upload_workers_;
+};
+
+#endif // ARTIFACT_CACHE_H_
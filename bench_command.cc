@@ -0,0 +1,470 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "bench_command.h"
+
+#include <argp.h>
+#include <fcntl.h>
+#include <gelf.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "auto_cleanup.h"
+#include "elf_bin.h"
+#include "elf_error.h"
+#include "thin_archive.h"
+#include "third_party/llvm-diff/DiffConsumer.h"
+#include "third_party/llvm-diff/DifferenceEngine.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace
+{
+struct BenchArgs {
+	char *op = nullptr;
+	char *steps = nullptr;
+	char *bound = nullptr;
+};
+
+const char kBenchArgsDoc[] = "";
+const char kBenchPrgDoc[] = "common bench options:\n";
+const struct argp_option kBenchOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"op", /*key=*/'o', /*arg=*/"OP",
+	  /*flag=*/0,
+	  /*doc=*/"Run only OP. (update_rela, mod_name, query_symbol, block_diff)" },
+	{ /*name=*/"steps", /*key=*/'s', /*arg=*/"STEPS",
+	  /*flag=*/0, /*doc=*/"Number of input sizes. 3 ~ 6. (default: 5)" },
+	{ /*name=*/"bound", /*key=*/'b', /*arg=*/"BOUND",
+	  /*flag=*/0, /*doc=*/"Override declared bound for growth exponent" },
+	{ nullptr }
+};
+
+constexpr unsigned kDefaultSteps = 5;
+constexpr unsigned kMinSteps = 3;
+// the largest input for ELF benchmarks has 2 * 512 * 2^5 sections, which
+// should be less than SHN_LORESERVE.
+constexpr unsigned kMaxSteps = 6;
+
+error_t ParseBenchOpt(int key, char *arg, struct argp_state *state)
+{
+	BenchArgs *args = static_cast<BenchArgs *>(state->input);
+
+	switch (key) {
+	case 'o':
+		args->op = arg;
+		break;
+	case 's':
+		args->steps = arg;
+		break;
+	case 'b':
+		args->bound = arg;
+		break;
+	case ARGP_KEY_ARG:
+		argp_usage(state);
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+// Temporary file removed when this object goes away.
+class TempFile final {
+    public:
+	TempFile(StringRef suffix) noexcept(false)
+	{
+		std::error_code ec = sys::fs::createTemporaryFile(
+			"livepatch-bench", suffix, path_);
+		if (ec) {
+			throw ec;
+		}
+	}
+	~TempFile()
+	{
+		sys::fs::remove(path_);
+	}
+
+	// Don't allow copy.
+	TempFile(const TempFile &rhs) = delete;
+	TempFile &operator=(const TempFile &rhs) = delete;
+
+	const char *Path()
+	{
+		return path_.c_str();
+	}
+
+    private:
+	SmallString<128> path_;
+};
+
+void throw_gelf_error()
+{
+	throw std::error_code{ static_cast<ElfErrorCode>(elf_errno()) };
+}
+
+// Adds a new section w/ the given header fields and data to elf.
+void AddSection(Elf *elf, size_t name, uint32_t type, Elf_Type data_type,
+		void *buf, size_t size, size_t link = 0, size_t info = 0,
+		size_t entsize = 0)
+{
+	Elf_Scn *scn = elf_newscn(elf);
+	if (!scn) {
+		throw_gelf_error();
+	}
+
+	Elf_Data *data = elf_newdata(scn);
+	if (!data) {
+		throw_gelf_error();
+	}
+	data->d_type = data_type;
+	data->d_buf = buf;
+	data->d_size = size;
+	data->d_align = 8;
+	data->d_version = EV_CURRENT;
+
+	GElf_Shdr shdr;
+	if (!gelf_getshdr(scn, &shdr)) {
+		throw_gelf_error();
+	}
+	shdr.sh_name = name;
+	shdr.sh_type = type;
+	shdr.sh_link = link;
+	shdr.sh_info = info;
+	shdr.sh_entsize = entsize;
+	shdr.sh_addralign = 8;
+	if (!gelf_update_shdr(scn, &shdr)) {
+		throw_gelf_error();
+	}
+}
+
+// Writes a relocatable ELF w/ num_text pairs of text and rela sections,
+// followed by .symtab, .strtab, .modinfo, and .shstrtab.
+void WriteSyntheticElf(const char *filename, size_t num_text) noexcept(false)
+{
+	// offsets of section names in kShStrTab.
+	static constexpr char kShStrTab[] =
+		"\0.rela.text\0.symtab\0.strtab\0.modinfo\0.shstrtab";
+	static constexpr size_t kRelaTextName = 1;
+	static constexpr size_t kTextName = 6;
+	static constexpr size_t kSymTabName = 12;
+	static constexpr size_t kStrTabName = 20;
+	static constexpr size_t kModInfoName = 28;
+	static constexpr size_t kShStrTabName = 37;
+	static char kModInfo[] = "license=GPL\0name=bench";
+	static char kStrTab[] = "";
+	static char kText[16] = {};
+
+	int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([fd]() { close(fd); });
+
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		throw_gelf_error();
+	}
+	Elf *elf = elf_begin(fd, ELF_C_WRITE, nullptr);
+	if (!elf) {
+		throw_gelf_error();
+	}
+	AutoCleanup elf_close([elf]() { elf_end(elf); });
+
+	if (!gelf_newehdr(elf, ELFCLASS64)) {
+		throw_gelf_error();
+	}
+	GElf_Ehdr ehdr;
+	if (!gelf_getehdr(elf, &ehdr)) {
+		throw_gelf_error();
+	}
+	ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+	ehdr.e_type = ET_REL;
+	ehdr.e_machine = EM_X86_64;
+	ehdr.e_version = EV_CURRENT;
+
+	const size_t symtab_idx = 2 * num_text + 1;
+	GElf_Sym null_sym = {};
+	GElf_Rela rela = {};
+	for (size_t i = 0; i < num_text; i++) {
+		AddSection(elf, kTextName, SHT_PROGBITS, ELF_T_BYTE, kText,
+			   sizeof(kText));
+		AddSection(elf, kRelaTextName, SHT_RELA, ELF_T_RELA, &rela,
+			   sizeof(rela), /*link=*/symtab_idx,
+			   /*info=*/2 * i + 1, /*entsize=*/sizeof(rela));
+	}
+	AddSection(elf, kSymTabName, SHT_SYMTAB, ELF_T_SYM, &null_sym,
+		   sizeof(null_sym), /*link=*/symtab_idx + 1, /*info=*/1,
+		   /*entsize=*/sizeof(null_sym));
+	AddSection(elf, kStrTabName, SHT_STRTAB, ELF_T_BYTE, kStrTab,
+		   sizeof(kStrTab));
+	AddSection(elf, kModInfoName, SHT_PROGBITS, ELF_T_BYTE, kModInfo,
+		   sizeof(kModInfo));
+	AddSection(elf, kShStrTabName, SHT_STRTAB, ELF_T_BYTE,
+		   const_cast<char *>(kShStrTab), sizeof(kShStrTab));
+
+	ehdr.e_shstrndx = symtab_idx + 3;
+	if (!gelf_update_ehdr(elf, &ehdr)) {
+		throw_gelf_error();
+	}
+	if (elf_update(elf, ELF_C_WRITE) < 0) {
+		throw_gelf_error();
+	}
+}
+
+using Clock = std::chrono::steady_clock;
+
+std::chrono::nanoseconds BenchUpdateRela(size_t n)
+{
+	TempFile elf_file(".o");
+	WriteSyntheticElf(elf_file.Path(), n);
+
+	ElfBin elf_bin(elf_file.Path());
+	std::vector<ElfRela::RelaEntry> rela_vector;
+	auto start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		elf_bin.UpdateRela(2 * i + 1, &rela_vector);
+	}
+	return Clock::now() - start;
+}
+
+std::chrono::nanoseconds BenchModName(size_t n)
+{
+	TempFile elf_file(".o");
+	WriteSyntheticElf(elf_file.Path(), n);
+
+	ElfBin elf_bin(elf_file.Path());
+	auto start = Clock::now();
+	elf_bin.ModName();
+	return Clock::now() - start;
+}
+
+std::chrono::nanoseconds BenchQuerySymbol(size_t n)
+{
+	TempFile thin_file(".thin");
+	std::vector<std::string> filenames;
+	{
+		std::ofstream out(thin_file.Path());
+		for (size_t i = 0; i < n; i++) {
+			filenames.emplace_back("dir/file" + std::to_string(i) +
+					       ".o");
+			out << "built-in.a[" << filenames.back() << "]:\n"
+			    << "bench_symbol t 0 10\n"
+			    << "bench_unique" << i << " T 0 10\n";
+		}
+	}
+
+	ThinArchive tar(thin_file.Path());
+	const std::string symbol = "bench_symbol";
+	auto start = Clock::now();
+	for (size_t i = 0; i < n; i++) {
+		if (tar.QuerySymbol(symbol, filenames[i]) !=
+		    static_cast<int>(i + 1)) {
+			throw std::error_code{
+				Command::ErrorCode::SYM_FIND_FAILED
+			};
+		}
+	}
+	return Clock::now() - start;
+}
+
+// Creates a function w/ a single basic block of n instructions. Every
+// 'stride'th instruction uses a different constant if stride is non-zero.
+Function *CreateChainFunction(Module *module, StringRef name, size_t n,
+			      size_t stride)
+{
+	LLVMContext &context = module->getContext();
+	Type *int_type = Type::getInt32Ty(context);
+	Function *func =
+		Function::Create(FunctionType::get(int_type, { int_type },
+						   /*isVarArg=*/false),
+				 GlobalValue::ExternalLinkage, name, module);
+	IRBuilder<> builder(BasicBlock::Create(context, "entry", func));
+
+	Value *value = func->getArg(0);
+	for (size_t i = 0; i < n; i++) {
+		const bool changed = stride && (i % stride == stride / 2);
+		const uint32_t addend = changed ? 0 : i + 1;
+		value = builder.CreateAdd(value, builder.getInt32(addend));
+	}
+	builder.CreateRet(value);
+	return func;
+}
+
+std::chrono::nanoseconds BenchBlockDiff(size_t n)
+{
+	static constexpr size_t kChangeStride = 8;
+
+	LLVMContext context;
+	Module original("original", context);
+	Module patched("patched", context);
+	Function *original_func =
+		CreateChainFunction(&original, "bench", n, /*stride=*/0);
+	Function *patched_func =
+		CreateChainFunction(&patched, "bench", n, kChangeStride);
+
+	DiffConsumer consumer(nulls());
+	DifferenceEngine diff_engine(consumer);
+	auto start = Clock::now();
+	diff_engine.diff(original_func, patched_func);
+	return Clock::now() - start;
+}
+
+struct Benchmark {
+	std::string_view name;
+	// size of the smallest input. each step doubles the size.
+	size_t min_size;
+	// declared upper bound for the growth exponent.
+	double bound;
+	std::function<std::chrono::nanoseconds(size_t)> run;
+};
+
+// Bounds have some margin over the ideal exponents since cache misses grow
+// w/ the size of inputs.
+constexpr double kLinearBound = 1.3;
+constexpr double kQuadraticBound = 2.2;
+
+const Benchmark kBenchmarks[] = {
+	{ "update_rela", 512, kLinearBound, BenchUpdateRela },
+	{ "mod_name", 512, kLinearBound, BenchModName },
+	{ "query_symbol", 512, kLinearBound, BenchQuerySymbol },
+	// diff for a basic block is dynamic programming over instructions.
+	{ "block_diff", 128, kQuadraticBound, BenchBlockDiff },
+};
+
+// Runs an operation repeatedly for the given size and returns the fastest
+// run, which is the least noisy one.
+double MeasureSeconds(const Benchmark &bench, size_t n)
+{
+	static constexpr auto kMinTotal = std::chrono::milliseconds(50);
+	static constexpr unsigned kMinRuns = 3;
+	static constexpr unsigned kMaxRuns = 100;
+
+	std::chrono::nanoseconds total{ 0 };
+	std::chrono::nanoseconds fastest = std::chrono::nanoseconds::max();
+	for (unsigned runs = 0; runs < kMaxRuns &&
+				(runs < kMinRuns || total < kMinTotal);
+	     runs++) {
+		std::chrono::nanoseconds elapsed = bench.run(n);
+		total += elapsed;
+		fastest = std::min(fastest, elapsed);
+	}
+	return std::chrono::duration<double>(fastest).count();
+}
+
+// Fits log(time) = k * log(size) + c w/ least squares and returns k.
+double GrowthExponent(const std::vector<std::pair<double, double> > &samples)
+{
+	double sum_x = 0, sum_y = 0;
+	for (auto [size, seconds] : samples) {
+		sum_x += std::log(size);
+		sum_y += std::log(seconds);
+	}
+	const double mean_x = sum_x / samples.size();
+	const double mean_y = sum_y / samples.size();
+
+	double cov = 0, var = 0;
+	for (auto [size, seconds] : samples) {
+		const double dx = std::log(size) - mean_x;
+		cov += dx * (std::log(seconds) - mean_y);
+		var += dx * dx;
+	}
+	return cov / var;
+}
+} // namespace
+
+BenchCommand::BenchCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	BenchArgs arguments;
+	struct argp argp = { /*options=*/kBenchOptions,
+			     /*parser=*/ParseBenchOpt,
+			     /*args_doc=*/kBenchArgsDoc,
+			     /*args_doc=*/kBenchPrgDoc };
+
+	// First argument is a command, 'bench' and it's already consumed. So,
+	// argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	op_ = arguments.op ? arguments.op : "";
+	steps_ = arguments.steps ? std::strtoul(arguments.steps, nullptr, 10) :
+				   kDefaultSteps;
+	if (steps_ < kMinSteps || steps_ > kMaxSteps) {
+		errs() << "steps should be " << kMinSteps << " ~ " << kMaxSteps
+		       << "\n";
+		throw std::error_code{ ErrorCode::INVALID_COMMAND };
+	}
+	bound_ = arguments.bound ? std::strtod(arguments.bound, nullptr) : 0;
+}
+
+std::error_code BenchCommand::Run()
+{
+	bool found = false;
+	bool exceeded = false;
+	for (const Benchmark &bench : kBenchmarks) {
+		if (!op_.empty() && op_ != bench.name) {
+			continue;
+		}
+		found = true;
+
+		std::vector<std::pair<double, double> > samples;
+		for (unsigned i = 0; i < steps_; i++) {
+			const size_t n = bench.min_size << i;
+			const double seconds = MeasureSeconds(bench, n);
+			outs() << format("%-14s %8zu %12.3f ms\n",
+					 bench.name.data(), n, seconds * 1e3);
+			samples.emplace_back(n, seconds);
+		}
+
+		const double bound = bound_ > 0 ? bound_ : bench.bound;
+		const double exponent = GrowthExponent(samples);
+		const bool ok = exponent <= bound;
+		outs() << format("%-14s exponent %.2f (bound %.2f) %s\n",
+				 bench.name.data(), exponent, bound,
+				 ok ? "ok" : "FAILED");
+		exceeded |= !ok;
+	}
+
+	if (!found) {
+		errs() << "unknown op: " << op_ << "\n";
+		return ErrorCode::INVALID_COMMAND;
+	}
+
+	return exceeded ? ErrorCode::BOUND_EXCEEDED : ErrorCode::NO_ERROR;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef BENCH_COMMAND_H_
+#define BENCH_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "command.h"
+
+// This class implements bench command to catch superlinear behavior of hot
+// operations in livepatch generation. The 'bench' command runs each
+// operation over synthetic inputs whose size grows geometrically, fits the
+// empirical growth exponent, k in time = c * size^k, with least squares on
+// log-log scale, and fails if k exceeds the bound declared for the
+// operation. e.g., 1.2 for a linear operation.
+//
+// Operations are as follows.
+//   update_rela:  ElfBin::UpdateRela() for every rela section in ELF
+//   mod_name:     ElfBin::ModName() w/ .modinfo placed after all sections
+//   query_symbol: ThinArchive::QuerySymbol() for all duplicates of a symbol
+//   block_diff:   DifferenceEngine for a basic block w/ scattered changes
+class BenchCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "bench";
+
+	BenchCommand(int argc, char **argv) noexcept(false);
+	~BenchCommand() override = default;
+
+	// Don't allow copy.
+	BenchCommand(const BenchCommand &rhs) = delete;
+	BenchCommand &operator=(const BenchCommand &rhs) = delete;
+
+	// Runs benchmarks and returns an error if any of them exceeds its
+	// bound.
+	std::error_code Run() override;
+
+    private:
+	// name of operation to run. empty means all operations.
+	std::string op_;
+	// number of input sizes. each size doubles the previous one.
+	unsigned steps_ = 0;
+	// if positive, this overrides the declared bounds.
+	double bound_ = 0;
+};
+
+#endif // BENCH_COMMAND_H_
@@ -0,0 +1,125 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef BOUNDED_QUEUE_H_
+#define BOUNDED_QUEUE_H_
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+#include "profiler.h"
+
+// This class implements a blocking queue w/ a fixed capacity between
+// pipelined stages. A producer is blocked while the queue is full, so a
+// fast stage can't run ahead of a slow one and memory for items in flight
+// is bounded. Any number of producers and consumers can share a queue.
+// Once the queue is closed, consumers drain the remaining items and then
+// get nothing.
+template <typename T> class BoundedQueue final {
+    public:
+	BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1))
+	{
+		stats_.capacity = capacity_;
+	}
+	~BoundedQueue() = default;
+
+	// Don't allow copy.
+	BoundedQueue(const BoundedQueue &rhs) = delete;
+	BoundedQueue &operator=(const BoundedQueue &rhs) = delete;
+
+	// Pushes an item. Blocks while the queue is full. Returns false if the
+	// queue is closed, and the item is dropped.
+	bool Push(T item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (items_.size() >= capacity_ && !closed_) {
+			auto start = std::chrono::steady_clock::now();
+			not_full_.wait(lock, [this]() {
+				return items_.size() < capacity_ || closed_;
+			});
+			stats_.full_wait += std::chrono::steady_clock::now() - start;
+		}
+		if (closed_) {
+			return false;
+		}
+
+		items_.push_back(std::move(item));
+		stats_.pushes++;
+		stats_.depth_sum += items_.size();
+		stats_.max_depth =
+			std::max<uint64_t>(stats_.max_depth, items_.size());
+		lock.unlock();
+		not_empty_.notify_one();
+		return true;
+	}
+
+	// Pops an item. Blocks while the queue is empty. Returns false if the
+	// queue is closed and empty.
+	bool Pop(T *item)
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		if (items_.empty() && !closed_) {
+			auto start = std::chrono::steady_clock::now();
+			not_empty_.wait(lock, [this]() {
+				return !items_.empty() || closed_;
+			});
+			stats_.empty_wait +=
+				std::chrono::steady_clock::now() - start;
+		}
+		if (items_.empty()) {
+			return false;
+		}
+
+		*item = std::move(items_.front());
+		items_.pop_front();
+		lock.unlock();
+		not_full_.notify_one();
+		return true;
+	}
+
+	// Closes the queue. Blocked producers and consumers are woken up.
+	void Close()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+		}
+		not_full_.notify_all();
+		not_empty_.notify_all();
+	}
+
+	Profiler::QueueStats Stats() const
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return stats_;
+	}
+
+    private:
+	mutable std::mutex mutex_;
+	std::condition_variable not_full_;
+	std::condition_variable not_empty_;
+	std::deque<T> items_;
+	const size_t capacity_;
+	bool closed_ = false;
+	Profiler::QueueStats stats_;
+};
+
+#endif // BOUNDED_QUEUE_H_
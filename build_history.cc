@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "build_history.h"
+
+#include <cerrno>
+#include <fstream>
+#include <istream>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "auto_cleanup.h"
+#include "command.h"
+#include "profiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+uint64_t BuildHistory::Record::TotalUs() const
+{
+	return std::accumulate(stage_us.begin(), stage_us.end(), uint64_t{ 0 });
+}
+
+BuildHistory::BuildHistory(std::string_view filename) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	std::fstream file(filename.data(), std::ios::in);
+	if (!file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
+
+	Parse(file);
+}
+
+BuildHistory::BuildHistory(std::istream &history) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	Parse(history);
+}
+
+void BuildHistory::Parse(std::istream &history) noexcept(false)
+{
+	std::string line;
+	size_t line_num = 0;
+	while (getline(history, line)) {
+		line_num++;
+		std::istringstream tokens(line);
+		Record record;
+		if (!(tokens >> record.path)) {
+			continue;
+		}
+
+		tokens >> record.tu_bytes >> record.ir_bytes >>
+			record.functions >> record.livepatched;
+		for (uint64_t &us : record.stage_us) {
+			tokens >> us;
+		}
+		tokens >> record.peak_rss_kb;
+		std::string extra;
+		if (tokens.fail() || tokens >> extra) {
+			llvm::errs() << "invalid record at line " << line_num
+				     << " of history: " << line << "\n";
+			throw std::error_code{
+				Command::ErrorCode::INVALID_HISTORY
+			};
+		}
+
+		paths_[record.path].push_back(records_.size());
+		records_.push_back(std::move(record));
+	}
+}
+
+std::vector<const BuildHistory::Record *>
+BuildHistory::Find(const std::string &path) const
+{
+	std::vector<const Record *> found;
+	auto entry = paths_.find(path);
+	if (entry != paths_.end()) {
+		for (size_t i : entry->second) {
+			found.push_back(&records_[i]);
+		}
+	}
+	return found;
+}
+
+void BuildHistory::Append(const std::string &filename,
+			  const std::vector<Record> &records) noexcept(false)
+{
+	if (records.empty()) {
+		return;
+	}
+
+	// records are written at once not to be interleaved w/ other
+	// builders.
+	std::string lines;
+	llvm::raw_string_ostream out(lines);
+	for (const Record &record : records) {
+		out << record.path << " " << record.tu_bytes << " "
+		    << record.ir_bytes << " " << record.functions << " "
+		    << record.livepatched;
+		for (uint64_t us : record.stage_us) {
+			out << " " << us;
+		}
+		out << " " << record.peak_rss_kb << "\n";
+	}
+	out.flush();
+
+	std::fstream file(filename, std::ios::out | std::ios::app);
+	if (!file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
+
+	file << lines;
+}
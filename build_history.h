@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef BUILD_HISTORY_H_
+#define BUILD_HISTORY_H_
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// This class is a local database of measured costs to diff a C file, i.e.,
+// a work unit of livepatch generation. w/ --history, 'diff' appends a
+// record per work unit, and 'estimate' predicts costs of a new .patch file
+// from the records. The format of the history is as follows, a record per
+// line;
+//
+// ${path} ${tu_bytes} ${ir_bytes} ${functions} ${livepatched}
+//   ${read_us} ${parse_us} ${diff_us} ${write_us} ${peak_rss_kb}
+// kernel/fork.c 81234 3456789 412 2 120 45000 3000 200 512000
+//
+// tu_bytes is the size of the C file and ir_bytes is the size of the
+// 'original' and the 'patched' IR files. functions is the number of
+// functions defined in the 'original' and livepatched is the number of
+// functions in the output. peak_rss_kb is the high-water mark of memory
+// allocated for the work unit by operator new, i.e., Profiler::Heap, rather
+// than RSS of the process, which is shared by work units diffed in
+// parallel. It's 0 w/o the allocation hook. Lines are appended as a whole,
+// so builders can append to the same history.
+class BuildHistory final {
+    public:
+	// stages of a work unit in the order of the record.
+	static constexpr std::array<std::string_view, 4> kStages = {
+		"read", "parse", "diff", "write"
+	};
+
+	struct Record {
+		std::string path;
+		uint64_t tu_bytes = 0;
+		uint64_t ir_bytes = 0;
+		uint64_t functions = 0;
+		uint64_t livepatched = 0;
+		std::array<uint64_t, kStages.size()> stage_us = {};
+		uint64_t peak_rss_kb = 0;
+
+		// Returns time for all stages.
+		uint64_t TotalUs() const;
+	};
+
+	BuildHistory(std::string_view filename) noexcept(false);
+	// Parses the history from a stream, e.g., one in memory.
+	BuildHistory(std::istream &history) noexcept(false);
+	~BuildHistory() = default;
+
+	// Don't allow copy.
+	BuildHistory(const BuildHistory &rhs) = delete;
+	BuildHistory &operator=(const BuildHistory &rhs) = delete;
+
+	const std::vector<Record> &records() const
+	{
+		return records_;
+	}
+
+	// Returns records for a given path. It's empty if the path has never
+	// been diffed.
+	std::vector<const Record *> Find(const std::string &path) const;
+
+	// Appends records to the history.
+	static void Append(const std::string &filename,
+			   const std::vector<Record> &records) noexcept(false);
+
+    private:
+	void Parse(std::istream &history) noexcept(false);
+
+	std::vector<Record> records_;
+	// key: path, value: indexes of records_
+	std::unordered_map<std::string, std::vector<size_t> > paths_;
+};
+
+#endif // BUILD_HISTORY_H_
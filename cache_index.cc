@@ -0,0 +1,540 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "cache_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <set>
+#include <string>
+#include <string_view>
+
+#include "auto_cleanup.h"
+
+namespace
+{
+constexpr uint64_t kMagic = 0x5844495050434c4cULL; // "LLCPPIDX"
+constexpr uint32_t kVersion = 2;
+// slots are placed after the header page.
+constexpr size_t kHeaderSize = 4096;
+// number of slots to probe from the home slot of a key.
+constexpr size_t kMaxProbes = 32;
+// A slot is filled in microseconds. So, a slot busy longer than this is
+// taken as claimed by a crashed process.
+constexpr std::chrono::seconds kClaimTimeout = std::chrono::minutes(10);
+
+// A state of slot is (owner << 32) | (generation << 2) | kind. Owner is a
+// random tag of the thread that made it busy, which is unique across pid
+// namespaces and pid reuse unlike pid. Generation is bumped whenever the
+// slot is claimed or evicted, so readers notice a slot changed while
+// copying it.
+enum SlotKind : uint64_t {
+	kEmpty = 0,
+	kBusy = 1,
+	kReady = 2,
+	kDeleted = 3,
+};
+
+uint64_t Kind(uint64_t state)
+{
+	return state & 0x3;
+}
+
+uint64_t Owner()
+{
+	thread_local pid_t pid = 0;
+	thread_local uint32_t tag = 0;
+
+	// a forked child gets a new tag.
+	if (pid != getpid()) {
+		std::random_device random;
+		pid = getpid();
+		tag = random() | 1;
+	}
+	return tag;
+}
+
+uint64_t NextState(uint64_t state, uint64_t kind)
+{
+	const uint64_t generation = ((state & 0xffffffff) >> 2) + 1;
+	return (Owner() << 32) | ((generation << 2) & 0xffffffff) | kind;
+}
+
+// Returns wall clock time in seconds, as the index outlives boots.
+uint64_t Now()
+{
+	return std::chrono::duration_cast<std::chrono::seconds>(
+		       std::chrono::system_clock::now().time_since_epoch())
+		.count();
+}
+
+std::array<uint64_t, 4> Words(const CacheIndex::Digest &digest)
+{
+	std::array<uint64_t, 4> words;
+	std::memcpy(words.data(), digest.data(), digest.size());
+	return words;
+}
+} // namespace
+
+struct CacheIndex::Header {
+	uint64_t magic;
+	uint32_t version;
+	uint32_t slot_size;
+	uint64_t num_slots;
+	uint64_t max_bytes;
+	// logical clock for access time of entries.
+	std::atomic<uint64_t> clock;
+	// total size of blobs of entries.
+	std::atomic<uint64_t> total_bytes;
+};
+
+struct CacheIndex::Slot {
+	std::atomic<uint64_t> state;
+	std::array<std::atomic<uint64_t>, 4> key;
+	std::array<std::atomic<uint64_t>, 4> blob;
+	std::atomic<uint64_t> size;
+	std::atomic<uint64_t> access;
+	// time when the slot is claimed last.
+	std::atomic<uint64_t> claimed;
+};
+
+// Processes share the index by atomics in the mmap'd file.
+static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+CacheIndex::CacheIndex(void *base, size_t size)
+	: base_(base), size_(size), header_(static_cast<Header *>(base)),
+	  slots_(reinterpret_cast<Slot *>(static_cast<char *>(base) +
+					  kHeaderSize))
+{
+}
+
+CacheIndex::~CacheIndex()
+{
+	munmap(base_, size_);
+}
+
+std::unique_ptr<CacheIndex> CacheIndex::Create(const std::string &filename,
+					       uint64_t num_slots,
+					       uint64_t max_bytes)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		int fd = open(filename.c_str(), O_RDWR | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno != ENOENT ||
+			    !Initialize(filename, num_slots, max_bytes,
+					/*replace=*/false)) {
+				return nullptr;
+			}
+			continue;
+		}
+		AutoCleanup fd_close([fd]() { close(fd); });
+
+		struct stat st;
+		if (fstat(fd, &st) < 0) {
+			return nullptr;
+		}
+		const size_t size = st.st_size;
+		if (size > kHeaderSize) {
+			void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+					  MAP_SHARED, fd, 0);
+			if (base == MAP_FAILED) {
+				return nullptr;
+			}
+			const Header *header = static_cast<Header *>(base);
+			if (header->magic == kMagic &&
+			    header->version == kVersion &&
+			    header->slot_size == sizeof(Slot) &&
+			    header->num_slots != 0 &&
+			    size == kHeaderSize + header->num_slots * sizeof(Slot)) {
+				std::unique_ptr<CacheIndex> index(
+					new CacheIndex(base, size));
+				index->Recover();
+				return index;
+			}
+			munmap(base, size);
+		}
+
+		// e.g., truncated or an index of another version.
+		if (!Initialize(filename, num_slots, max_bytes,
+				/*replace=*/true)) {
+			return nullptr;
+		}
+	}
+	return nullptr;
+}
+
+bool CacheIndex::Initialize(const std::string &filename, uint64_t num_slots,
+			    uint64_t max_bytes, bool replace)
+{
+	static std::atomic<unsigned> tmp_count{ 0 };
+
+	// The index is created under a temporary name and moved in at once.
+	// So, others never map a partially initialized index.
+	const std::string tmp_path = filename + ".tmp." +
+				     std::to_string(getpid()) + "." +
+				     std::to_string(tmp_count++);
+	int fd = open(tmp_path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC,
+		      0644);
+	if (fd < 0) {
+		return false;
+	}
+	AutoCleanup cleanup([fd, &tmp_path]() {
+		close(fd);
+		unlink(tmp_path.c_str());
+	});
+
+	if (ftruncate(fd, kHeaderSize + num_slots * sizeof(Slot)) < 0) {
+		return false;
+	}
+	void *base = mmap(nullptr, kHeaderSize, PROT_READ | PROT_WRITE,
+			  MAP_SHARED, fd, 0);
+	if (base == MAP_FAILED) {
+		return false;
+	}
+	Header *header = static_cast<Header *>(base);
+	header->magic = kMagic;
+	header->version = kVersion;
+	header->slot_size = sizeof(Slot);
+	header->num_slots = num_slots;
+	header->max_bytes = max_bytes;
+	munmap(base, kHeaderSize);
+
+	if (replace) {
+		return rename(tmp_path.c_str(), filename.c_str()) == 0;
+	}
+	// link() fails if others created the index first, which is fine.
+	return link(tmp_path.c_str(), filename.c_str()) == 0 || errno == EEXIST;
+}
+
+CacheIndex::Slot *CacheIndex::SlotAt(uint64_t home, size_t i) const
+{
+	return &slots_[(home + i) % header_->num_slots];
+}
+
+bool CacheIndex::Lookup(const Digest &key, Entry *entry)
+{
+	const std::array<uint64_t, 4> key_words = Words(key);
+	for (size_t i = 0; i < kMaxProbes; i++) {
+		Slot *slot = SlotAt(key_words[0], i);
+		const uint64_t state = slot->state.load(std::memory_order_acquire);
+		if (Kind(state) == kEmpty) {
+			return false;
+		}
+		if (Kind(state) != kReady) {
+			continue;
+		}
+
+		bool match = true;
+		for (size_t w = 0; w < key_words.size(); w++) {
+			match &= slot->key[w].load(std::memory_order_relaxed) ==
+				 key_words[w];
+		}
+		if (!match) {
+			continue;
+		}
+		std::array<uint64_t, 4> blob_words;
+		for (size_t w = 0; w < blob_words.size(); w++) {
+			blob_words[w] =
+				slot->blob[w].load(std::memory_order_relaxed);
+		}
+		const uint64_t size = slot->size.load(std::memory_order_relaxed);
+
+		// the slot might be evicted or reused while it's copied.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->state.load(std::memory_order_relaxed) != state) {
+			continue;
+		}
+
+		slot->access.store(
+			header_->clock.fetch_add(1, std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+		std::memcpy(entry->blob.data(), blob_words.data(),
+			    entry->blob.size());
+		entry->size = size;
+		return true;
+	}
+	return false;
+}
+
+bool CacheIndex::Claim(Slot *slot, uint64_t *state, bool *evicted)
+{
+	const uint64_t size = slot->size.load(std::memory_order_relaxed);
+
+	// claim time is written before the claim. So, Recover() never sees a
+	// claim time older than the claim, even if others fail to claim.
+	slot->claimed.store(Now(), std::memory_order_relaxed);
+	// size read above is valid only if nobody claimed the slot in the
+	// meantime.
+	const uint64_t busy = NextState(*state, kBusy);
+	if (!slot->state.compare_exchange_strong(*state, busy,
+						 std::memory_order_acq_rel)) {
+		return false;
+	}
+	// stores to the slot made by the claimer aren't ordered before the
+	// busy state by the CAS itself. The fence pairs w/ the acquire fence
+	// in Lookup() so that a reader copying the slot sees the state
+	// changed if it sees any of them.
+	std::atomic_thread_fence(std::memory_order_release);
+	if (Kind(*state) == kReady) {
+		*evicted = true;
+		header_->total_bytes.fetch_sub(size, std::memory_order_relaxed);
+	}
+	*state = busy;
+	return true;
+}
+
+bool CacheIndex::Evict(Slot *slot, uint64_t state, bool *evicted)
+{
+	if (!Claim(slot, &state, evicted)) {
+		return false;
+	}
+	// fails only if the claim timed out and others reclaimed the slot.
+	slot->state.compare_exchange_strong(state, NextState(state, kDeleted),
+					    std::memory_order_release,
+					    std::memory_order_relaxed);
+	return true;
+}
+
+bool CacheIndex::Insert(const Digest &key, const Entry &entry, bool *evicted)
+{
+	Entry existing;
+	if (Lookup(key, &existing) && existing.blob == entry.blob) {
+		return true;
+	}
+
+	const std::array<uint64_t, 4> key_words = Words(key);
+	const std::array<uint64_t, 4> blob_words = Words(entry.blob);
+	Slot *claimed = nullptr;
+	uint64_t claimed_state = 0;
+	for (int attempt = 0; attempt < 3 && !claimed; attempt++) {
+		Slot *free_slot = nullptr;
+		uint64_t free_state = 0;
+		Slot *victim = nullptr;
+		uint64_t victim_state = 0;
+		uint64_t victim_access = std::numeric_limits<uint64_t>::max();
+		for (size_t i = 0; i < kMaxProbes; i++) {
+			Slot *slot = SlotAt(key_words[0], i);
+			uint64_t state =
+				slot->state.load(std::memory_order_acquire);
+			if (Kind(state) == kReady) {
+				bool match = true;
+				for (size_t w = 0; w < key_words.size(); w++) {
+					match &= slot->key[w].load(
+							 std::memory_order_relaxed) ==
+						 key_words[w];
+				}
+				if (!match) {
+					const uint64_t access = slot->access.load(
+						std::memory_order_relaxed);
+					if (access < victim_access) {
+						victim = slot;
+						victim_state = state;
+						victim_access = access;
+					}
+					continue;
+				}
+				// a stale entry for the key is replaced.
+				if (!Evict(slot, state, evicted)) {
+					continue;
+				}
+				state = slot->state.load(
+					std::memory_order_acquire);
+			}
+			if (Kind(state) == kEmpty || Kind(state) == kDeleted) {
+				if (!free_slot) {
+					free_slot = slot;
+					free_state = state;
+				}
+				if (Kind(state) == kEmpty) {
+					break;
+				}
+			}
+		}
+
+		if (free_slot && Claim(free_slot, &free_state, evicted)) {
+			claimed = free_slot;
+			claimed_state = free_state;
+		} else if (!free_slot && victim &&
+			   Claim(victim, &victim_state, evicted)) {
+			claimed = victim;
+			claimed_state = victim_state;
+		}
+	}
+	if (!claimed) {
+		return false;
+	}
+
+	for (size_t w = 0; w < key_words.size(); w++) {
+		claimed->key[w].store(key_words[w], std::memory_order_relaxed);
+		claimed->blob[w].store(blob_words[w], std::memory_order_relaxed);
+	}
+	claimed->size.store(entry.size, std::memory_order_relaxed);
+	claimed->access.store(
+		header_->clock.fetch_add(1, std::memory_order_relaxed) + 1,
+		std::memory_order_relaxed);
+	// counted before published. So, eviction never makes it negative.
+	// If the process crashes before the slot is published, Recover()
+	// recounts the size.
+	header_->total_bytes.fetch_add(entry.size, std::memory_order_relaxed);
+	// If the claim timed out and others reclaimed the slot, the size is
+	// left counted until Recover() rather than subtracted twice.
+	if (!claimed->state.compare_exchange_strong(
+		    claimed_state, NextState(claimed_state, kReady),
+		    std::memory_order_release, std::memory_order_relaxed)) {
+		return false;
+	}
+
+	// evicts the least recently accessed entries in the probe window
+	// while blobs exceed the limit.
+	while (header_->total_bytes.load(std::memory_order_relaxed) >
+	       header_->max_bytes) {
+		Slot *victim = nullptr;
+		uint64_t victim_state = 0;
+		uint64_t victim_access = std::numeric_limits<uint64_t>::max();
+		for (size_t i = 0; i < kMaxProbes; i++) {
+			Slot *slot = SlotAt(key_words[0], i);
+			const uint64_t state =
+				slot->state.load(std::memory_order_acquire);
+			const uint64_t access =
+				slot->access.load(std::memory_order_relaxed);
+			if (slot != claimed && Kind(state) == kReady &&
+			    access < victim_access) {
+				victim = slot;
+				victim_state = state;
+				victim_access = access;
+			}
+		}
+		if (!victim || !Evict(victim, victim_state, evicted)) {
+			break;
+		}
+	}
+	return true;
+}
+
+std::set<CacheIndex::Digest> CacheIndex::Blobs() const
+{
+	std::set<Digest> blobs;
+	for (uint64_t i = 0; i < header_->num_slots; i++) {
+		const Slot *slot = &slots_[i];
+		const uint64_t state = slot->state.load(std::memory_order_acquire);
+		if (Kind(state) != kReady) {
+			continue;
+		}
+		std::array<uint64_t, 4> blob_words;
+		for (size_t w = 0; w < blob_words.size(); w++) {
+			blob_words[w] =
+				slot->blob[w].load(std::memory_order_relaxed);
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->state.load(std::memory_order_relaxed) != state) {
+			continue;
+		}
+		Digest blob;
+		std::memcpy(blob.data(), blob_words.data(), blob.size());
+		blobs.insert(blob);
+	}
+	return blobs;
+}
+
+void CacheIndex::Recover()
+{
+	const uint64_t now = Now();
+	const auto timeout = static_cast<uint64_t>(kClaimTimeout.count());
+	uint64_t total_bytes =
+		header_->total_bytes.load(std::memory_order_acquire);
+	uint64_t ready_bytes = 0;
+	bool busy = false;
+	for (uint64_t i = 0; i < header_->num_slots; i++) {
+		Slot *slot = &slots_[i];
+		uint64_t state = slot->state.load(std::memory_order_acquire);
+		if (Kind(state) == kReady) {
+			ready_bytes += slot->size.load(std::memory_order_relaxed);
+			continue;
+		}
+		if (Kind(state) != kBusy) {
+			continue;
+		}
+		// the owner crashed while filling the slot. Claim time is
+		// checked rather than the owner, which may be in other pid
+		// namespace or host sharing the index. Either direction
+		// counts, as wall clock may be set back.
+		const uint64_t claimed =
+			slot->claimed.load(std::memory_order_relaxed);
+		const uint64_t elapsed =
+			now > claimed ? now - claimed : claimed - now;
+		if (elapsed <= timeout ||
+		    !slot->state.compare_exchange_strong(
+			    state, NextState(state, kDeleted),
+			    std::memory_order_acq_rel)) {
+			busy = true;
+		}
+	}
+
+	// Sizes counted by crashed processes are never subtracted. So, total
+	// size is recounted from entries. It's valid only if no slot is
+	// being filled and total size isn't changed in the meantime.
+	if (!busy) {
+		header_->total_bytes.compare_exchange_strong(
+			total_bytes, ready_bytes, std::memory_order_acq_rel);
+	}
+}
+
+bool CacheIndex::ParseHex(std::string_view hex, Digest *digest)
+{
+	if (hex.size() != digest->size() * 2) {
+		return false;
+	}
+	auto nibble = [](char c) -> int {
+		if (c >= '0' && c <= '9') {
+			return c - '0';
+		}
+		if (c >= 'a' && c <= 'f') {
+			return c - 'a' + 10;
+		}
+		return -1;
+	};
+	for (size_t i = 0; i < digest->size(); i++) {
+		const int hi = nibble(hex[i * 2]);
+		const int lo = nibble(hex[i * 2 + 1]);
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+		(*digest)[i] = (hi << 4) | lo;
+	}
+	return true;
+}
+
+std::string CacheIndex::Hex(const Digest &digest)
+{
+	static constexpr char kHex[] = "0123456789abcdef";
+	std::string hex;
+	for (uint8_t c : digest) {
+		hex.push_back(kHex[c >> 4]);
+		hex.push_back(kHex[c & 0xf]);
+	}
+	return hex;
+}
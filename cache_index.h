@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef CACHE_INDEX_H_
+#define CACHE_INDEX_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <set>
+#include <string>
+#include <string_view>
+
+// This class is an index of the local artifact cache kept in a mmap'd file,
+// which maps digest of a key to digest and size of its blob. So, processes
+// and threads sharing the cache look up and fill action results w/o a file
+// per entry or locks. Blobs stay in content-addressed files, cas/.
+//
+// The index is an open-addressed hash table w/ linear probing. Each slot has
+// an atomic state w/ a generation, and its fields are written before the
+// state is published. Readers check the state before and after copying a
+// slot, same as seqlock, and take a slot changed in the meantime as a miss.
+// So, readers never block and writers claim slots by compare-and-swap.
+//
+// Probing is bounded. If no free slot is found, the least recently accessed
+// entry in the probe window is evicted, and so are entries while total size
+// of blobs exceeds the limit. Blobs of evicted entries are left to the
+// owner of cas/, as other entries may refer to them. Slots claimed long ago
+// are taken as claimed by crashed processes and reclaimed when the index is
+// opened. Then, total size is recounted from entries, and an index w/ a bad
+// header is recreated. Note that atomics in a mmap'd file are coherent only
+// among processes on the same host. The cache dir should be on local disk.
+class CacheIndex final {
+    public:
+	// binary SHA-256 digest.
+	using Digest = std::array<uint8_t, 32>;
+
+	struct Entry {
+		Digest blob = {};
+		uint64_t size = 0;
+	};
+
+	~CacheIndex();
+
+	// Don't allow copy.
+	CacheIndex(const CacheIndex &rhs) = delete;
+	CacheIndex &operator=(const CacheIndex &rhs) = delete;
+
+	// Looks up an entry for a given key. Returns true if found.
+	bool Lookup(const Digest &key, Entry *entry);
+
+	// Inserts an entry for a given key. evicted is set if any entry is
+	// evicted. Returns false if all slots in the probe window are busy.
+	bool Insert(const Digest &key, const Entry &entry, bool *evicted);
+
+	// Returns blobs that entries in the index refer to.
+	std::set<Digest> Blobs() const;
+
+	// Opens or creates an index file w/ num_slots slots and limit of
+	// total size of blobs. An existing index keeps its parameters. If the
+	// file can't be mapped, nullptr is returned.
+	static std::unique_ptr<CacheIndex> Create(const std::string &filename,
+						  uint64_t num_slots,
+						  uint64_t max_bytes);
+
+	// Converts a hex digest to binary and vice versa.
+	static bool ParseHex(std::string_view hex, Digest *digest);
+	static std::string Hex(const Digest &digest);
+
+    private:
+	struct Header;
+	struct Slot;
+
+	CacheIndex(void *base, size_t size);
+
+	// Creates a zero-filled index file. If replace is false, an index
+	// created by others in the meantime is kept.
+	static bool Initialize(const std::string &filename, uint64_t num_slots,
+			       uint64_t max_bytes, bool replace);
+
+	Slot *SlotAt(uint64_t home, size_t i) const;
+	// Makes slot busy if its state is still *state, and updates *state to
+	// the busy state. If the slot has an entry, the entry is evicted.
+	bool Claim(Slot *slot, uint64_t *state, bool *evicted);
+	// Evicts an entry in slot if its state is still state.
+	bool Evict(Slot *slot, uint64_t state, bool *evicted);
+	// Reclaims slots left busy by crashed processes and recounts total
+	// size of blobs.
+	void Recover();
+
+	void *base_;
+	size_t size_;
+	Header *header_;
+	Slot *slots_;
+};
+
+#endif // CACHE_INDEX_H_
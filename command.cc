@@ -22,9 +22,15 @@
 #include <system_error>
 
 #include "align_command.h"
+#include "bench_command.h"
 #include "diff_command.h"
+#include "estimate_command.h"
 #include "gen_command.h"
 #include "fixup_command.h"
+#include "parity_command.h"
+#include "prune_command.h"
+#include "rebase_command.h"
+#include "stalls_command.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace
@@ -75,6 +81,33 @@ std::string CommandErrorCategory::message(int ev) const
 	case Command::ErrorCode::NO_SYM_MAP:
 		msg = "no symbol map file to resolve symbol alias";
 		break;
+	case Command::ErrorCode::BOUND_EXCEEDED:
+		msg = "growth exponent exceeds declared bound";
+		break;
+	case Command::ErrorCode::INVALID_CACHE:
+		msg = "invalid cache location";
+		break;
+	case Command::ErrorCode::PATCH_FAILED:
+		msg = "failed to apply patch";
+		break;
+	case Command::ErrorCode::INVALID_FILE_IDS:
+		msg = "invalid file ID table";
+		break;
+	case Command::ErrorCode::INCOMPATIBLE_CHANGE:
+		msg = "incompatible change of struct layout or prototype";
+		break;
+	case Command::ErrorCode::INVALID_HISTORY:
+		msg = "invalid build history";
+		break;
+	case Command::ErrorCode::STALE_DIFF:
+		msg = "diff depends on changed functions";
+		break;
+	case Command::ErrorCode::CODEGEN_MISMATCH:
+		msg = "machine code differs from kbuild";
+		break;
+	case Command::ErrorCode::UNEXPECTED_ERROR:
+		msg = "unexpected error";
+		break;
 	default:
 		msg = "unrecognized error";
 		break;
@@ -106,6 +139,18 @@ std::unique_ptr<Command> Command::Create(int argc, char **argv) noexcept(false)
 		return FixupCommand::Create(argc, argv);
 	} else if (command == AlignCommand::kCommandName) {
 		return std::make_unique<AlignCommand>(argc, argv);
+	} else if (command == BenchCommand::kCommandName) {
+		return std::make_unique<BenchCommand>(argc, argv);
+	} else if (command == EstimateCommand::kCommandName) {
+		return std::make_unique<EstimateCommand>(argc, argv);
+	} else if (command == ParityCommand::kCommandName) {
+		return std::make_unique<ParityCommand>(argc, argv);
+	} else if (command == PruneCommand::kCommandName) {
+		return std::make_unique<PruneCommand>(argc, argv);
+	} else if (command == RebaseCommand::kCommandName) {
+		return std::make_unique<RebaseCommand>(argc, argv);
+	} else if (command == StallsCommand::kCommandName) {
+		return std::make_unique<StallsCommand>(argc, argv);
 	} else if (command == UsageCommand::kCommandName) {
 		return std::make_unique<UsageCommand>(exec_name);
 	}
@@ -123,11 +168,26 @@ std::error_code UsageCommand::Run()
 		   "Available commands:\n"
 		   "\n"
 		   "align    align __LINE__ for original.c and patched.c for a given .patch\n"
-		   "         by adding empty lines\n"
+		   "         by adding empty lines. w/ --apply, patched.c is created by\n"
+		   "         applying .patch in memory\n"
+		   "bench    run hot operations over growing inputs and check their\n"
+		   "         growth exponents\n"
 		   "diff     diff two LLVM IR files and output a new LLVM IR file\n"
 		   "         that distills changed/new functions and global variables\n"
+		   "         w/ --batch, diff pairs of files in a list in a pipeline\n"
+		   "estimate predict time and memory to diff files changed by a .patch\n"
+		   "         from history of previous diffs\n"
 		   "fixup    rename UND symbols and create a relocation section for klp.\n"
-		   "gen      generate livepatch wrapper, makefile, and linker script\n";
+		   "         w/ livepatch wrapper in LLVM IR, rename LLpatch symbols in it\n"
+		   "gen      generate livepatch wrapper, makefile, and linker script\n"
+		   "parity   compare machine code of an object compiled by livepatch-compile\n"
+		   "         w/ the one built by kbuild\n"
+		   "prune    drop livepatched functions w/ the same machine code in\n"
+		   "         objects of the original and klp_diff\n"
+		   "rebase   check if klp_diff of a previous build is still valid\n"
+		   "         for the 'original' of a new kernel\n"
+		   "stalls   report tasks blocking livepatch transition w/ patched\n"
+		   "         functions on their stacks in a /proc and /sys snapshot\n";
 
 	return {};
 }
@@ -42,6 +42,15 @@ struct Command {
 		INVALID_SYM_MAP = 9,
 		ALIAS_FIND_FAILED = 10,
 		NO_SYM_MAP = 11,
+		BOUND_EXCEEDED = 12,
+		INVALID_CACHE = 13,
+		PATCH_FAILED = 14,
+		INVALID_FILE_IDS = 15,
+		INCOMPATIBLE_CHANGE = 16,
+		INVALID_HISTORY = 17,
+		STALE_DIFF = 18,
+		CODEGEN_MISMATCH = 19,
+		UNEXPECTED_ERROR = 20,
 	};
 
 	virtual ~Command() = default;
@@ -0,0 +1,641 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "cpu_profiler.h"
+
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <link.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <map>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "elf_bin.h"
+#include "elf_symbol.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace
+{
+constexpr std::string_view kOption = "--cpu-profile";
+
+// Returns pc of the interrupted code.
+uintptr_t ContextPc(void *context)
+{
+	const ucontext_t *uc = static_cast<const ucontext_t *>(context);
+#if defined(__x86_64__)
+	return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+	return uc->uc_mcontext.pc;
+#else
+	(void)uc;
+	return 0;
+#endif
+}
+
+// glibc before 2.35 doesn't name the field for SIGEV_THREAD_ID.
+#if defined(SIGEV_THREAD_ID) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+struct itimerspec Interval(int hz)
+{
+	const long interval_ns = 1000000000L / hz;
+	struct itimerspec interval = {};
+	interval.it_interval.tv_sec = interval_ns / 1000000000L;
+	interval.it_interval.tv_nsec = interval_ns % 1000000000L;
+	interval.it_value = interval.it_interval;
+	return interval;
+}
+
+// A symbolized frame.
+struct Frame {
+	std::string name;
+	std::string system_name;
+	std::string filename;
+};
+
+// This class symbolizes pcs w/ symbols of loaded modules, i.e., the binary
+// and shared libraries. .symtab of a module is read on the first pc in the
+// module. If the module is stripped, dladdr() looks up its dynamic symbols.
+class Symbolizer final {
+    public:
+	Symbolizer()
+	{
+		dl_iterate_phdr(AddModule, this);
+	}
+
+	Frame Symbolize(uintptr_t pc)
+	{
+		Frame frame;
+		Module *module = FindModule(pc);
+		if (module) {
+			frame.filename = module->path;
+			const Symbol *symbol = FindSymbol(module, pc);
+			if (symbol) {
+				frame.system_name = symbol->name;
+			}
+		}
+
+		Dl_info info;
+		if (frame.system_name.empty() &&
+		    dladdr(reinterpret_cast<void *>(pc), &info) &&
+		    info.dli_sname) {
+			frame.system_name = info.dli_sname;
+		}
+		if (frame.system_name.empty()) {
+			std::string_view path = frame.filename;
+			path = path.substr(path.rfind('/') + 1);
+			llvm::raw_string_ostream name(frame.system_name);
+			name << path << "+0x";
+			name.write_hex(pc - (module ? module->bias : 0));
+			name.flush();
+			frame.name = frame.system_name;
+			return frame;
+		}
+
+		frame.name = llvm::demangle(frame.system_name);
+		return frame;
+	}
+
+    private:
+	struct Symbol {
+		uintptr_t start = 0;
+		uintptr_t size = 0;
+		std::string name;
+	};
+
+	struct Module {
+		std::string path;
+		uintptr_t bias = 0;
+		// [start, end) of executable segments.
+		std::vector<std::pair<uintptr_t, uintptr_t> > ranges;
+		bool loaded = false;
+		// sorted by start.
+		std::vector<Symbol> symbols;
+	};
+
+	static int AddModule(struct dl_phdr_info *info, size_t size, void *data)
+	{
+		Symbolizer *symbolizer = static_cast<Symbolizer *>(data);
+		Module module;
+		// The first one w/o name is the binary.
+		module.path = info->dlpi_name && info->dlpi_name[0] ?
+				      info->dlpi_name :
+				      symbolizer->modules_.empty() ?
+				      "/proc/self/exe" :
+				      "";
+		module.bias = info->dlpi_addr;
+		for (int i = 0; i < info->dlpi_phnum; i++) {
+			const ElfW(Phdr) &phdr = info->dlpi_phdr[i];
+			if (phdr.p_type == PT_LOAD && (phdr.p_flags & PF_X)) {
+				const uintptr_t start = info->dlpi_addr +
+							phdr.p_vaddr;
+				module.ranges.emplace_back(start,
+							   start + phdr.p_memsz);
+			}
+		}
+		symbolizer->modules_.push_back(std::move(module));
+		return 0;
+	}
+
+	Module *FindModule(uintptr_t pc)
+	{
+		for (Module &module : modules_) {
+			for (const auto &[start, end] : module.ranges) {
+				if (pc >= start && pc < end) {
+					return &module;
+				}
+			}
+		}
+		return nullptr;
+	}
+
+	const Symbol *FindSymbol(Module *module, uintptr_t pc)
+	{
+		if (!module->loaded) {
+			module->loaded = true;
+			LoadSymbols(module);
+		}
+
+		auto it = std::upper_bound(module->symbols.begin(),
+					   module->symbols.end(), pc,
+					   [](uintptr_t pc, const Symbol &symbol) {
+						   return pc < symbol.start;
+					   });
+		if (it == module->symbols.begin()) {
+			return nullptr;
+		}
+		--it;
+		// e.g., _init doesn't cover .plt after it.
+		if (pc >= it->start + it->size) {
+			return nullptr;
+		}
+		return &*it;
+	}
+
+	static void LoadSymbols(Module *module)
+	{
+		if (module->path.empty()) {
+			return;
+		}
+		try {
+			ElfBin bin(module->path, ElfBin::OpenMode::LAZY);
+			for (ElfSymbol *i : bin.Symbols()) {
+				if (i->Type() != ElfSymbol::SymbolType::FUNC ||
+				    i->Value() == 0 || i->Size() == 0) {
+					continue;
+				}
+				module->symbols.push_back(
+					{ module->bias + i->Value(), i->Size(),
+					  std::string(i->Name()) });
+			}
+		} catch (std::error_code e) {
+			// e.g., stripped or vdso. dladdr() is used instead.
+			module->symbols.clear();
+			return;
+		}
+
+		std::sort(module->symbols.begin(), module->symbols.end(),
+			  [](const Symbol &lhs, const Symbol &rhs) {
+				  return lhs.start < rhs.start;
+			  });
+	}
+
+	std::vector<Module> modules_;
+};
+
+// Minimal protobuf encoding for profile.proto of pprof.
+void EncodeVarint(uint64_t value, std::string *out)
+{
+	while (value >= 0x80) {
+		out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+		value >>= 7;
+	}
+	out->push_back(static_cast<char>(value));
+}
+
+void EncodeInt(uint32_t field, uint64_t value, std::string *out)
+{
+	// wire type 0: varint
+	EncodeVarint(field << 3, out);
+	EncodeVarint(value, out);
+}
+
+void EncodeField(uint32_t field, std::string_view value, std::string *out)
+{
+	// wire type 2: length-delimited
+	EncodeVarint((field << 3) | 2, out);
+	EncodeVarint(value.size(), out);
+	out->append(value);
+}
+
+void EncodePacked(uint32_t field, const std::vector<uint64_t> &values,
+		  std::string *out)
+{
+	std::string packed;
+	for (uint64_t value : values) {
+		EncodeVarint(value, &packed);
+	}
+	EncodeField(field, packed, out);
+}
+
+//   message ValueType { int64 type = 1; int64 unit = 2; }
+std::string EncodeValueType(uint64_t type, uint64_t unit)
+{
+	std::string value_type;
+	EncodeInt(1, type, &value_type);
+	EncodeInt(2, unit, &value_type);
+	return value_type;
+}
+} // namespace
+
+// This class holds a timer of a thread, which is deleted when the thread
+// exits.
+class CpuProfiler::ThreadTimer final {
+    public:
+	~ThreadTimer()
+	{
+		if (armed) {
+			CpuProfiler::Get().StopThreadTimer(generation, timer);
+		}
+	}
+
+	bool armed = false;
+	uint64_t generation = 0;
+	timer_t timer;
+};
+
+CpuProfiler &CpuProfiler::Get()
+{
+	static CpuProfiler profiler;
+	return profiler;
+}
+
+bool CpuProfiler::Start(const std::string &filename, int hz)
+{
+	if (running_ || hz <= 0) {
+		return false;
+	}
+
+	// backtrace() loads the unwinder on its first call, which is not safe
+	// in a signal handler.
+	void *warmup[1];
+	backtrace(warmup, 1);
+
+	if (!buffer_) {
+		void *buffer = mmap(nullptr, kBufferWords * sizeof(uintptr_t),
+				    PROT_READ | PROT_WRITE,
+				    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+				    -1, 0);
+		if (buffer == MAP_FAILED) {
+			return false;
+		}
+		buffer_ = static_cast<uintptr_t *>(buffer);
+	}
+	filename_ = filename;
+	hz_ = hz;
+	used_ = 0;
+	dropped_ = 0;
+	start_ = std::chrono::system_clock::now();
+
+	struct sigaction action = {};
+	action.sa_sigaction = HandleSignal;
+	action.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&action.sa_mask);
+	if (sigaction(SIGPROF, &action, nullptr) < 0) {
+		return false;
+	}
+
+	// ITIMER_PROF counts CPU time of the whole process. So, SIGPROF goes
+	// to whichever thread runs when it expires, which is biased and
+	// coalesced w/ many threads.
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		per_thread_ = true;
+	}
+	if (StartThreadTimer()) {
+		running_ = true;
+		return true;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		per_thread_ = false;
+	}
+
+	const struct itimerspec interval = Interval(hz);
+	struct itimerval timer = {};
+	timer.it_interval.tv_sec = interval.it_interval.tv_sec;
+	timer.it_interval.tv_usec = interval.it_interval.tv_nsec / 1000;
+	timer.it_value = timer.it_interval;
+	if (setitimer(ITIMER_PROF, &timer, nullptr) < 0) {
+		signal(SIGPROF, SIG_IGN);
+		return false;
+	}
+	running_ = true;
+	return true;
+}
+
+void CpuProfiler::RegisterThread()
+{
+	Get().StartThreadTimer();
+}
+
+bool CpuProfiler::StartThreadTimer()
+{
+#ifdef SIGEV_THREAD_ID
+	thread_local ThreadTimer thread_timer;
+
+	// per_thread_ is cleared by Stop(). So, no timer is left after it.
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (!per_thread_) {
+		return false;
+	}
+	if (thread_timer.armed && thread_timer.generation == generation_) {
+		return true;
+	}
+
+	struct sigevent event = {};
+	event.sigev_notify = SIGEV_THREAD_ID;
+	event.sigev_signo = SIGPROF;
+	event.sigev_notify_thread_id = syscall(SYS_gettid);
+	timer_t timer;
+	if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) < 0) {
+		return false;
+	}
+	const struct itimerspec interval = Interval(hz_);
+	if (timer_settime(timer, 0, &interval, nullptr) < 0) {
+		timer_delete(timer);
+		return false;
+	}
+	timers_.push_back(timer);
+	thread_timer.armed = true;
+	thread_timer.generation = generation_;
+	thread_timer.timer = timer;
+	return true;
+#else
+	return false;
+#endif
+}
+
+void CpuProfiler::StopThreadTimer(uint64_t generation, timer_t timer)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (generation != generation_) {
+		return;
+	}
+	timer_delete(timer);
+	timers_.erase(std::remove(timers_.begin(), timers_.end(), timer),
+		      timers_.end());
+}
+
+void CpuProfiler::Stop()
+{
+	if (!running_.exchange(false)) {
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (per_thread_) {
+			for (timer_t timer : timers_) {
+				timer_delete(timer);
+			}
+			timers_.clear();
+			generation_++;
+			per_thread_ = false;
+		} else {
+			struct itimerval timer = {};
+			setitimer(ITIMER_PROF, &timer, nullptr);
+		}
+	}
+	// a pending SIGPROF would terminate the process by default.
+	signal(SIGPROF, SIG_IGN);
+
+	const auto duration = std::chrono::system_clock::now() - start_;
+	Write(std::chrono::duration_cast<std::chrono::nanoseconds>(duration)
+		      .count());
+}
+
+void CpuProfiler::HandleSignal(int sig, siginfo_t *info, void *context)
+{
+	const int saved_errno = errno;
+	CpuProfiler &profiler = Get();
+
+	// frames of this handler and the signal trampoline are skipped by
+	// starting from the interrupted pc.
+	void *frames[kMaxDepth + 2];
+	const int num_frames = backtrace(frames, kMaxDepth + 2);
+	const uintptr_t pc = ContextPc(context);
+	int begin = 0;
+	while (begin < num_frames &&
+	       reinterpret_cast<uintptr_t>(frames[begin]) != pc) {
+		begin++;
+	}
+
+	uintptr_t stack[kMaxDepth];
+	size_t depth = 0;
+	if (begin == num_frames) {
+		if (pc) {
+			stack[depth++] = pc;
+		}
+		begin = std::min(num_frames, 2);
+	}
+	for (int i = begin; i < num_frames && depth < kMaxDepth; i++) {
+		stack[depth++] = reinterpret_cast<uintptr_t>(frames[i]);
+	}
+
+	if (depth) {
+		const size_t pos =
+			profiler.used_.fetch_add(depth + 1, std::memory_order_relaxed);
+		if (pos + depth + 1 <= kBufferWords) {
+			std::copy(stack, stack + depth, profiler.buffer_ + pos + 1);
+			profiler.buffer_[pos] = depth;
+		} else {
+			profiler.dropped_.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	errno = saved_errno;
+}
+
+void CpuProfiler::Write(uint64_t duration_ns) const
+{
+	// key: stack w/ the leaf first, value: number of samples
+	std::map<std::vector<uintptr_t>, uint64_t> stacks;
+	const size_t used = std::min(used_.load(), kBufferWords);
+	for (size_t pos = 0; pos < used;) {
+		const size_t depth = buffer_[pos];
+		// reserved by a sample that is never written.
+		if (depth == 0 || pos + 1 + depth > used) {
+			break;
+		}
+		stacks[std::vector<uintptr_t>(buffer_ + pos + 1,
+					      buffer_ + pos + 1 + depth)]++;
+		pos += 1 + depth;
+	}
+
+	std::vector<std::string> strings = { "" };
+	std::unordered_map<std::string, uint64_t> string_ids = { { "", 0 } };
+	auto string_id = [&strings, &string_ids](const std::string &str) {
+		auto [it, inserted] = string_ids.emplace(str, strings.size());
+		if (inserted) {
+			strings.push_back(str);
+		}
+		return it->second;
+	};
+
+	//   message Sample { repeated uint64 location_id = 1;
+	//                    repeated int64 value = 2; }
+	//   message Location { uint64 id = 1; uint64 address = 3;
+	//                      repeated Line line = 4; }
+	//   message Line { uint64 function_id = 1; }
+	//   message Function { uint64 id = 1; int64 name = 2;
+	//                      int64 system_name = 3; int64 filename = 4; }
+	Symbolizer symbolizer;
+	std::string samples, locations, functions;
+	std::unordered_map<uintptr_t, uint64_t> location_ids;
+	std::unordered_map<std::string, uint64_t> function_ids;
+	const uint64_t period_ns = 1000000000 / hz_;
+	uint64_t num_samples = 0;
+	for (const auto &[stack, count] : stacks) {
+		std::vector<uint64_t> ids;
+		for (size_t i = 0; i < stack.size(); i++) {
+			// callers are at return addresses. -1 is in the call.
+			const uintptr_t address = i == 0 ? stack[i] :
+							   stack[i] - 1;
+			auto [it, inserted] = location_ids.emplace(
+				address, location_ids.size() + 1);
+			ids.push_back(it->second);
+			if (!inserted) {
+				continue;
+			}
+
+			Frame frame = symbolizer.Symbolize(address);
+			auto [fn, new_fn] = function_ids.emplace(
+				frame.system_name, function_ids.size() + 1);
+			if (new_fn) {
+				std::string function;
+				EncodeInt(1, fn->second, &function);
+				EncodeInt(2, string_id(frame.name), &function);
+				EncodeInt(3, string_id(frame.system_name),
+					  &function);
+				EncodeInt(4, string_id(frame.filename),
+					  &function);
+				EncodeField(5, function, &functions);
+			}
+
+			std::string line, location;
+			EncodeInt(1, fn->second, &line);
+			EncodeInt(1, it->second, &location);
+			EncodeInt(3, address, &location);
+			EncodeField(4, line, &location);
+			EncodeField(4, location, &locations);
+		}
+
+		std::string sample;
+		EncodePacked(1, ids, &sample);
+		EncodePacked(2, { count, count * period_ns }, &sample);
+		EncodeField(2, sample, &samples);
+		num_samples += count;
+	}
+
+	//   message Profile { repeated ValueType sample_type = 1;
+	//                     repeated Sample sample = 2;
+	//                     repeated Location location = 4;
+	//                     repeated Function function = 5;
+	//                     repeated string string_table = 6;
+	//                     int64 time_nanos = 9; int64 duration_nanos = 10;
+	//                     ValueType period_type = 11; int64 period = 12;
+	//                     repeated int64 comment = 13; }
+	std::string profile;
+	EncodeField(1,
+		    EncodeValueType(string_id("samples"), string_id("count")),
+		    &profile);
+	EncodeField(1,
+		    EncodeValueType(string_id("cpu"), string_id("nanoseconds")),
+		    &profile);
+	profile += samples;
+	profile += locations;
+	profile += functions;
+	EncodeInt(9,
+		  std::chrono::duration_cast<std::chrono::nanoseconds>(
+			  start_.time_since_epoch())
+			  .count(),
+		  &profile);
+	EncodeInt(10, duration_ns, &profile);
+	EncodeField(11,
+		    EncodeValueType(string_id("cpu"), string_id("nanoseconds")),
+		    &profile);
+	EncodeInt(12, period_ns, &profile);
+	if (dropped_) {
+		const uint64_t comment = string_id(
+			"dropped " + std::to_string(dropped_) + " samples");
+		EncodeInt(13, comment, &profile);
+	}
+	// string table goes last as ids are assigned above.
+	for (const std::string &str : strings) {
+		EncodeField(6, str, &profile);
+	}
+
+	std::error_code ec;
+	llvm::raw_fd_ostream out(filename_, ec, llvm::sys::fs::OF_None);
+	if (ec) {
+		llvm::errs() << "failed to write CPU profile to " << filename_
+			     << ": " << ec.message() << "\n";
+		return;
+	}
+	out << profile;
+	llvm::errs() << "CPU profile w/ " << num_samples << " samples is written to "
+		     << filename_ << "\n";
+}
+
+std::string CpuProfiler::ParseOption(int *argc, char **argv)
+{
+	std::string filename;
+	int kept = 1;
+	for (int i = 1; i < *argc; i++) {
+		std::string_view arg = argv[i];
+		if (arg == kOption && i + 1 < *argc) {
+			filename = argv[++i];
+			continue;
+		}
+		if (arg.size() > kOption.size() &&
+		    arg.substr(0, kOption.size()) == kOption &&
+		    arg[kOption.size()] == '=') {
+			filename = arg.substr(kOption.size() + 1);
+			continue;
+		}
+		argv[kept++] = argv[i];
+	}
+	*argc = kept;
+	argv[kept] = nullptr;
+	return filename;
+}
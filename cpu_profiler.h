@@ -0,0 +1,110 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef CPU_PROFILER_H_
+#define CPU_PROFILER_H_
+
+#include <signal.h>
+#include <time.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// This class implements a sampling CPU profiler for livepatch commands,
+// e.g., where perf is not available. It's started by --cpu-profile=FILE
+// given to livepatch binary before or after the command name, e.g.,
+//
+//   $ livepatch --cpu-profile=diff.prof diff foo__original.ll foo__patched.ll
+//
+// SIGPROF is delivered to each thread by a timer on CPU time of the thread,
+// and the signal handler captures a stack trace of the thread into a
+// preallocated buffer. Threads started after the profiler call
+// RegisterThread() to have their timer. W/o per-thread timers, ITIMER_PROF
+// is used instead, which delivers SIGPROF to any thread of the process. When the profiler is stopped, stacks are symbolized w/ .symtab of
+// the binary and shared libraries, or their dynamic symbols if stripped,
+// and written out in pprof format, which `pprof` and `go tool pprof` read.
+class CpuProfiler final {
+    public:
+	static constexpr int kDefaultHz = 100;
+
+	// Don't allow copy.
+	CpuProfiler(const CpuProfiler &rhs) = delete;
+	CpuProfiler &operator=(const CpuProfiler &rhs) = delete;
+
+	static CpuProfiler &Get();
+
+	// Starts sampling at hz. Returns false if the profiler is already
+	// started or the timer can't be set.
+	bool Start(const std::string &filename, int hz = kDefaultHz);
+
+	// Stops sampling and writes out the profile. Does nothing if the
+	// profiler is not started.
+	void Stop();
+
+	// Samples the calling thread if the profiler is running. Does nothing
+	// if the thread is already registered or ITIMER_PROF is used.
+	static void RegisterThread();
+
+	// Removes --cpu-profile option from argv and returns its file. If the
+	// option is not given, empty string is returned.
+	static std::string ParseOption(int *argc, char **argv);
+
+    private:
+	// frames captured per sample.
+	static constexpr size_t kMaxDepth = 64;
+	// samples are [depth, pc...]. 8M words are enough for ~40 minutes of
+	// a thread at 100Hz w/ deep stacks.
+	static constexpr size_t kBufferWords = 8 << 20;
+
+	class ThreadTimer;
+
+	CpuProfiler() = default;
+
+	static void HandleSignal(int sig, siginfo_t *info, void *context);
+
+	// Creates a timer on CPU time of the calling thread. Returns false if
+	// per-thread timers are not supported.
+	bool StartThreadTimer();
+	// Deletes a timer of an exiting thread unless Stop() deleted it.
+	void StopThreadTimer(uint64_t generation, timer_t timer);
+
+	// Writes out samples in buffer_ to filename_.
+	void Write(uint64_t duration_ns) const;
+
+	std::string filename_;
+	int hz_ = kDefaultHz;
+	std::chrono::system_clock::time_point start_;
+	uintptr_t *buffer_ = nullptr;
+	std::atomic<size_t> used_{ 0 };
+	std::atomic<uint64_t> dropped_{ 0 };
+	std::atomic<bool> running_{ false };
+
+	std::mutex mutex_;
+	// timers of threads, or empty w/ ITIMER_PROF. Guarded by mutex_,
+	// as well as per_thread_ and generation_.
+	std::vector<timer_t> timers_;
+	bool per_thread_ = false;
+	// bumped by Stop(). So, threads notice their timers are deleted.
+	uint64_t generation_ = 0;
+};
+
+#endif // CPU_PROFILER_H_
@@ -18,19 +18,45 @@
 #include "diff_command.h"
 
 #include <argp.h>
-
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <map>
 #include <memory>
-#include <regex>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <unordered_set>
-
+#include <utility>
+#include <vector>
+
+#include "artifact_cache.h"
+#include "auto_cleanup.h"
+#include "bounded_queue.h"
+#include "build_history.h"
+#include "cpu_profiler.h"
 #include "elf_symbol.h"
+#include "file_id_table.h"
+#include "ir_slice_index.h"
+#include "profiler.h"
 #include "third_party/llvm-diff/DifferenceEngine.h"
+#include "type_precheck.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/Utils/ModuleUtils.h"
@@ -43,7 +69,15 @@ struct DiffArgs {
 	char *original_ll = nullptr;
 	char *patched_ll = nullptr;
 	char *base_dir = nullptr;
+	char *cache = nullptr;
+	char *file_ids = nullptr;
+	char *batch = nullptr;
+	char *jobs = nullptr;
+	char *history = nullptr;
+	char *kdir = nullptr;
 	bool quiet = false;
+	bool full_parse = false;
+	std::vector<std::pair<std::string, std::string> > prefix_map;
 };
 
 const char kDiffArgsDoc[] = "<original.ll> <patched.ll>";
@@ -54,10 +88,35 @@ const struct argp_option kDiffOptions[] = {
 	  /*flag=*/0, /*doc=*/"Quiet mode. don't output diffed functions" },
 	{ /*name=*/"base_dir", /*key=*/'b', /*arg=*/"BASE_DIR",
 	  /*flag=*/0, /*doc=*/"The base directory for the diffed files" },
+	{ /*name=*/"cache", /*key=*/'c', /*arg=*/"CACHE",
+	  /*flag=*/0,
+	  /*doc=*/"Cache for diff results. local dir or http://host[:port][/path]" },
+	{ /*name=*/"full_parse", /*key=*/'f', /*arg=*/nullptr,
+	  /*flag=*/0,
+	  /*doc=*/"Parse all functions w/o skipping unchanged ones" },
+	{ /*name=*/"prefix_map", /*key=*/'m', /*arg=*/"OLD=NEW",
+	  /*flag=*/0,
+	  /*doc=*/"Map path prefix OLD to NEW in the output. can be repeated" },
+	{ /*name=*/"file_ids", /*key=*/'i', /*arg=*/"FILE_IDS",
+	  /*flag=*/0,
+	  /*doc=*/"Use short file IDs in symbol names and append them to FILE_IDS" },
+	{ /*name=*/"batch", /*key=*/'B', /*arg=*/"LIST",
+	  /*flag=*/0,
+	  /*doc=*/"Diff pairs of files in LIST, \"<original.ll> <patched.ll>\" per line" },
+	{ /*name=*/"jobs", /*key=*/'j', /*arg=*/"JOBS",
+	  /*flag=*/0,
+	  /*doc=*/"Number of threads for each of parse and diff w/ --batch. default: # of CPUs" },
+	{ /*name=*/"history", /*key=*/'H', /*arg=*/"HISTORY",
+	  /*flag=*/0,
+	  /*doc=*/"Append costs of each pair w/ --batch to HISTORY for 'estimate'" },
+	{ /*name=*/"kdir", /*key=*/'k', /*arg=*/"KDIR",
+	  /*flag=*/0,
+	  /*doc=*/"Kernel dir w/ source files to measure their sizes for --history" },
 	{ nullptr }
 };
 
 constexpr std::string_view kLivepatchPrefix = "__livepatch_";
+constexpr std::string_view kDiffSuffix = "__klp_diff.ll";
 
 error_t ParseDiffOpt(int key, char *arg, struct argp_state *state)
 {
@@ -70,6 +129,37 @@ error_t ParseDiffOpt(int key, char *arg, struct argp_state *state)
 	case 'b':
 		args->base_dir = arg;
 		break;
+	case 'c':
+		args->cache = arg;
+		break;
+	case 'f':
+		args->full_parse = true;
+		break;
+	case 'i':
+		args->file_ids = arg;
+		break;
+	case 'B':
+		args->batch = arg;
+		break;
+	case 'j':
+		args->jobs = arg;
+		break;
+	case 'H':
+		args->history = arg;
+		break;
+	case 'k':
+		args->kdir = arg;
+		break;
+	case 'm': {
+		std::string_view map(arg);
+		size_t eq = map.find('=');
+		if (eq == std::string_view::npos || eq == 0) {
+			argp_usage(state);
+		}
+		args->prefix_map.emplace_back(map.substr(0, eq),
+					      map.substr(eq + 1));
+		break;
+	}
 	case ARGP_KEY_ARG:
 		if (!args->original_ll) {
 			args->original_ll = arg;
@@ -80,7 +170,13 @@ error_t ParseDiffOpt(int key, char *arg, struct argp_state *state)
 		}
 		break;
 	case ARGP_KEY_END:
-		if (!args->original_ll || !args->patched_ll) {
+		if (args->batch) {
+			if (args->original_ll) {
+				errs() << "<original.ll> <patched.ll> are not allowed "
+					  "w/ --batch\n";
+				argp_usage(state);
+			}
+		} else if (!args->original_ll || !args->patched_ll) {
 			argp_usage(state);
 		}
 		break;
@@ -93,19 +189,194 @@ error_t ParseDiffOpt(int key, char *arg, struct argp_state *state)
 // Loads a LLVM module from a file. On error, nullptr is returned.
 std::unique_ptr<Module> LoadModule(LLVMContext &Context, std::string_view Name)
 {
+	Profiler::Stage stage("parse");
 	SMDiagnostic Diag;
 	return parseIRFile(Name, Diag, Context);
 }
 
-// Dumps a LLVM module to a file.
-std::error_code DumpModule(std::unique_ptr<Module> output)
+// Loads a LLVM module from a buffer read by the read stage of batch diff.
+// On error, nullptr is returned.
+std::unique_ptr<Module> LoadModule(LLVMContext &Context,
+				   const MemoryBuffer &Buf)
 {
+	Profiler::Stage stage("parse");
+	SMDiagnostic Diag;
+	return parseIR(Buf.getMemBufferRef(), Diag, Context);
+}
+
+// Loads original and patched modules from buffers of textual LLVM IR.
+// Bodies of functions unchanged between them are stubbed before parsing.
+// Returns false if either buffer is not textual IR or fails to be parsed.
+bool LoadStubbedModules(LLVMContext &Context, const MemoryBuffer &original_buf,
+			const MemoryBuffer &patched_buf,
+			std::unique_ptr<Module> *original,
+			std::unique_ptr<Module> *patched)
+{
+	Profiler::Stage stage("parse");
+	for (const MemoryBuffer *buf : { &original_buf, &patched_buf }) {
+		if (isBitcode(reinterpret_cast<const unsigned char *>(
+				      buf->getBufferStart()),
+			      reinterpret_cast<const unsigned char *>(
+				      buf->getBufferEnd()))) {
+			return false;
+		}
+	}
+
+	const std::string original_filename =
+		original_buf.getBufferIdentifier().str();
+	const std::string patched_filename =
+		patched_buf.getBufferIdentifier().str();
+	StringRef original_text = original_buf.getBuffer();
+	StringRef patched_text = patched_buf.getBuffer();
+	IrSliceIndex original_index(
+		std::string_view(original_text.data(), original_text.size()));
+	IrSliceIndex patched_index(
+		std::string_view(patched_text.data(), patched_text.size()));
+	IrSliceIndex::StubUnchanged(&original_index, &patched_index);
+
+	SMDiagnostic Diag;
+	std::string text = original_index.Render();
+	*original = parseIR(MemoryBufferRef(text, original_filename), Diag,
+			    Context);
+	text = patched_index.Render();
+	*patched = parseIR(MemoryBufferRef(text, patched_filename), Diag,
+			   Context);
+	if (!*original || !*patched) {
+		original->reset();
+		patched->reset();
+		return false;
+	}
+	return true;
+}
+
+// Loads original and patched modules from textual LLVM IR files. See
+// LoadStubbedModules() above.
+bool LoadStubbedModules(LLVMContext &Context,
+			const std::string &original_filename,
+			const std::string &patched_filename,
+			std::unique_ptr<Module> *original,
+			std::unique_ptr<Module> *patched)
+{
+	auto original_buf = MemoryBuffer::getFile(original_filename);
+	auto patched_buf = MemoryBuffer::getFile(patched_filename);
+	if (!original_buf || !patched_buf) {
+		return false;
+	}
+	return LoadStubbedModules(Context, **original_buf, **patched_buf,
+				  original, patched);
+}
+
+// Dumps a LLVM module to a file named after source_filename of the input.
+std::error_code DumpModule(std::unique_ptr<Module> output,
+			   StringRef source_filename)
+{
+	Profiler::Stage stage("render");
 	std::error_code ec;
-	raw_fd_ostream fout(output->getSourceFileName() + "__klp_diff.ll", ec);
+	raw_fd_ostream fout(source_filename.str() + std::string(kDiffSuffix),
+			   ec);
 	output->print(fout, nullptr);
 	return ec;
 }
 
+// Returns path w/ its prefix replaced by the first matching entry of
+// prefix_map. If nothing matches, path is returned as it is.
+std::string MapPrefix(
+	StringRef path,
+	const std::vector<std::pair<std::string, std::string> > &prefix_map)
+{
+	for (const auto &[old_prefix, new_prefix] : prefix_map) {
+		if (path.startswith(old_prefix)) {
+			return new_prefix + path.substr(old_prefix.size()).str();
+		}
+	}
+	return path.str();
+}
+
+// Returns text w/ all occurrences of prefixes in prefix_map replaced. This
+// is for cache keys, so that the same inputs built under different dirs
+// have the same key.
+std::string MapPrefixes(
+	StringRef text,
+	const std::vector<std::pair<std::string, std::string> > &prefix_map)
+{
+	std::string mapped = text.str();
+	for (const auto &[old_prefix, new_prefix] : prefix_map) {
+		for (size_t pos = mapped.find(old_prefix);
+		     pos != std::string::npos;
+		     pos = mapped.find(old_prefix, pos + new_prefix.size())) {
+			mapped.replace(pos, old_prefix.size(), new_prefix);
+		}
+	}
+	return mapped;
+}
+
+// Maps paths embedded in a LLVM module, i.e., module identifier and
+// source_filename.
+void MapModulePaths(
+	Module *mod,
+	const std::vector<std::pair<std::string, std::string> > &prefix_map)
+{
+	mod->setModuleIdentifier(
+		MapPrefix(mod->getModuleIdentifier(), prefix_map));
+	mod->setSourceFileName(MapPrefix(mod->getSourceFileName(), prefix_map));
+}
+
+// Returns a key for diff result. The key covers all inputs affecting the
+// result. Bump up the version whenever diff changes its output.
+std::string DiffCacheKey(
+	StringRef original, StringRef patched, StringRef base_dir,
+	const std::vector<std::pair<std::string, std::string> > &prefix_map,
+	bool file_ids)
+{
+	static constexpr std::string_view kKeyVersion = "livepatch-diff-v2";
+	// symbol names have file IDs instead of paths.
+	const std::string options = file_ids ? "\nfile_ids" : "";
+	if (prefix_map.empty()) {
+		return std::string(kKeyVersion) + "\n" + base_dir.str() + "\n" +
+		       ArtifactCache::Digest(original) + "\n" +
+		       ArtifactCache::Digest(patched) + options;
+	}
+	return std::string(kKeyVersion) + "\n" +
+	       MapPrefix(base_dir, prefix_map) + "\n" +
+	       ArtifactCache::Digest(MapPrefixes(original, prefix_map)) + "\n" +
+	       ArtifactCache::Digest(MapPrefixes(patched, prefix_map)) + options;
+}
+
+// Appends ID of a source file to the file ID table if the table is given.
+void AppendFileId(const std::string &file_ids, StringRef source_filename,
+		  StringRef base_dir) noexcept(false)
+{
+	if (!file_ids.empty()) {
+		FileIdTable::Append(file_ids,
+				    ElfSymbol::SourcePath(source_filename,
+							  base_dir));
+	}
+}
+
+// Returns source_filename of textual LLVM IR. If it's not found or has
+// escaped characters, "" is returned.
+std::string SourceFilename(StringRef ll)
+{
+	static constexpr StringRef kSourceFilename = "source_filename = \"";
+
+	// source_filename is at the start of a line.
+	size_t start = 0;
+	while (!ll.substr(start).startswith(kSourceFilename)) {
+		start = ll.find('\n', start);
+		if (start == StringRef::npos) {
+			return "";
+		}
+		start++;
+	}
+	start += kSourceFilename.size();
+
+	size_t end = ll.find_first_of("\"\\\n", start);
+	if (end == StringRef::npos || ll[end] != '"') {
+		return "";
+	}
+	return ll.slice(start, end).str();
+}
+
 // Returns true if function is assigned to special sections such as .init*
 // or .exit*.
 bool FuncInSpecialSection(Function *func)
@@ -151,7 +422,8 @@ void RemoveFuncAlias(Module *mod)
 }
 
 std::error_code DistillDiffFunctions(DiffConsumer *consumer, Module *original,
-				     Module *patched, StringRef base_path)
+				     Module *patched, StringRef base_path,
+				     StringRef file_id, raw_ostream &out)
 {
 	DifferenceEngine diff_engine(*consumer);
 	// Assumption: LLVM functions are unique in LLVM module && the iterator
@@ -195,7 +467,7 @@ std::error_code DistillDiffFunctions(DiffConsumer *consumer, Module *original,
 	}
 
 	if (klp_func_set.empty() && new_func_set.empty()) {
-		outs() << "All functions are same but no new functions. Nothing to patch.\n";
+		out << "All functions are same but no new functions. Nothing to patch.\n";
 		throw std::error_code{ Command::ErrorCode::NOTHING_TO_PATCH };
 	}
 
@@ -226,7 +498,7 @@ std::error_code DistillDiffFunctions(DiffConsumer *consumer, Module *original,
 			// source file for this change.
 			RFn.setName(std::string(kLivepatchPrefix) +
 				    ElfSymbol::CreateLivepatchedFunctionName(
-					    RFn, base_path));
+					    RFn, base_path, file_id));
 
 			// clang could remove livepatched function during its
 			// optimization step. To prevent that, the livepatched function
@@ -248,7 +520,7 @@ std::error_code DistillDiffFunctions(DiffConsumer *consumer, Module *original,
 			if (RFn.isDSOLocal()) {
 				RFn.setName(ElfSymbol::CreateLivepatchedSymbolName(
 					RFn.getName(), original->getSourceFileName(),
-					base_path));
+					base_path, file_id));
 			}
 		}
 	}
@@ -290,78 +562,11 @@ bool GvarIsJumpLabel(GlobalVariable *gvar)
 	return false;
 }
 
-// Take a vector of regexs and strings for inline assembly. Then removes any
-// lines in the assembly matched with the regex.
-std::string RemoveInlineAssembly(const std::vector<std::regex> &regex_strs,
-				 std::string_view inline_assembly)
-{
-	std::string original_inline_assembly(inline_assembly);
-	std::string inline_assembly_removed = "";
-	for (const auto &regex : regex_strs) {
-		std::regex_replace(std::back_inserter(inline_assembly_removed),
-				   original_inline_assembly.begin(),
-				   original_inline_assembly.end(), regex, "");
-		original_inline_assembly = inline_assembly_removed;
-		inline_assembly_removed = "";
-	}
-
-	return inline_assembly_removed;
-}
-
-// Remove special global variables for init && exit section, exported symbols.
-// Global variable for init && exit section: starts with __init, __exit
-// Global variable for exported symbols: starts with __kstrtab, __ksymtab
-void RemoveSpecialGlobals(Module *mod)
-{
-	std::vector<GlobalVariable *> spc_vars;
-
-	for (GlobalVariable &GVR : mod->globals()) {
-		auto gvar_name = std::string(GVR.getName());
-		if (gvar_name.find("__init") == 0 ||
-		    gvar_name.find("__exit") == 0 ||
-		    gvar_name.find("__kstrtab") == 0 ||
-		    gvar_name.find("__ksymtab") == 0) {
-			spc_vars.push_back(&GVR);
-		}
-	}
-	for (GlobalVariable *gvr : spc_vars) {
-		gvr->removeFromParent();
-	}
-
-	std::vector<std::regex> regex_strs;
-	// Exported symbol uses inline assembly to define __crc_${global_var}s and assign them
-	// to special sections. Format of inline assembly for exported symbol is as follows;
-	//
-	//    .section "___kcrctab_gpl+${exported_symbol}", "a"
-	//    .weak   __crc_${exported_symbol}
-	//    .long   __crc_${exported_symbol}
-	//    .previous
-	//
-	// Remove the inline assembly for exported symbols.
-	regex_strs.emplace_back(
-		"[ \t]*\\.section.*kcrctab.*\n.*__crc.*\n.*__crc.*\n[ \t]*\\.previous.*\n");
-
-	// Initcall uses inline assembly to instantiate special section. Format of
-	// inline assembly for the initcalls is as follows;
-	//
-	//    .section.*.initcall*"
-	//    __initcall_*"
-	//    .long*"
-	//    .previous.*"
-	//
-	// Remove the inline assembly for init sections
-	regex_strs.emplace_back(
-		"[ \t]*\\.section.*initcall.*\n.*__initcall.*\n.*long.*\n[ \t]*\\.previous.*\n");
-
-	std::string inline_assembly =
-		RemoveInlineAssembly(regex_strs, mod->getModuleInlineAsm());
-	mod->setModuleInlineAsm(inline_assembly);
-}
-
 std::error_code DistillDiffGlobals(Module *original, Module *patched,
-				   StringRef base_path)
+				   StringRef base_path, StringRef file_id,
+				   raw_ostream &err)
 {
-	RemoveSpecialGlobals(patched);
+	DiffCommand::RemoveSpecialGlobals(patched);
 
 	for (GlobalVariable &GVR : patched->globals()) {
 		auto gvar_name = std::string(GVR.getName());
@@ -398,7 +603,7 @@ std::error_code DistillDiffGlobals(Module *original, Module *patched,
 
 		// Both the 'original' and 'patched' have the same global variable.
 		if (GVL->getType()->getTypeID() != GVR.getType()->getTypeID()) {
-			errs() << "WARN: type of global variable, " << gvar_name
+			err << "WARN: type of global variable, " << gvar_name
 			       << ", is changed\n"
 			       << "  type in original: "
 			       << GVL->getType()->getTypeID() << "\n"
@@ -407,7 +612,7 @@ std::error_code DistillDiffGlobals(Module *original, Module *patched,
 		}
 
 		if (GVL->getAttributes() != GVR.getAttributes()) {
-			errs() << "WARN: attributes of global variable, "
+			err << "WARN: attributes of global variable, "
 			       << gvar_name << ", are changed\n";
 		}
 
@@ -415,7 +620,7 @@ std::error_code DistillDiffGlobals(Module *original, Module *patched,
 		    (GVR.hasInitializer() &&
 		     GVL->getInitializer()->getValueID() !=
 			     GVR.getInitializer()->getValueID())) {
-			errs() << "WARN: Initializer mismatch for global variable, "
+			err << "WARN: Initializer mismatch for global variable, "
 			       << gvar_name << ".\n";
 		}
 
@@ -425,15 +630,348 @@ std::error_code DistillDiffGlobals(Module *original, Module *patched,
 		if (GVR.isDSOLocal() && GVR.getName() != "__fentry__") {
 			GVR.setName(ElfSymbol::CreateLivepatchedSymbolName(
 				GVR.getName(), original->getSourceFileName(),
-				base_path));
+				base_path, file_id));
 		}
 	}
 
 	return Command::ErrorCode::NO_ERROR;
 }
 
+
+// Pair of files in the pipeline of batch diff. Each stage fills in its
+// outputs and releases its inputs, so that memory is held only for what
+// the next stages need.
+struct DiffItem {
+	// position in the batch list.
+	size_t index = 0;
+	std::string original_filename;
+	std::string patched_filename;
+	// read stage. cache_key is empty if cache is not used for the item.
+	std::unique_ptr<MemoryBuffer> original_buf;
+	std::unique_ptr<MemoryBuffer> patched_buf;
+	std::string cache_key;
+	bool cached = false;
+	// parse stage. context is declared first to outlive modules in it.
+	std::unique_ptr<LLVMContext> context;
+	std::unique_ptr<Module> original;
+	std::unique_ptr<Module> patched;
+	// diff stage. output is rendered klp_diff to be written.
+	std::string source_filename;
+	std::string output;
+	// messages and errors are printed out in the order of the list.
+	std::string messages;
+	std::string errors;
+	std::error_code ec;
+	// costs for --history. See BuildHistory.
+	std::array<std::chrono::nanoseconds, BuildHistory::kStages.size()>
+		stage_time = {};
+	uint64_t ir_bytes = 0;
+	uint64_t functions = 0;
+	uint64_t livepatched = 0;
+	// memory of the item. items are diffed concurrently, so peak RSS of
+	// the process doesn't tell how much an item takes.
+	Profiler::Heap heap;
+};
+
+// Runs a stage of BuildHistory::kStages for an item and measures its time.
+// Memory allocated in the stage is accounted to the item.
+template <typename Fn> void RunStage(DiffItem *item, size_t stage, Fn &&fn)
+{
+	Profiler::HeapScope heap(&item->heap);
+	auto start = std::chrono::steady_clock::now();
+	fn();
+	item->stage_time[stage] += std::chrono::steady_clock::now() - start;
+}
+
+// Reads pairs of files from a batch list. Empty lines and lines starting
+// w/ '#' are ignored.
+std::vector<std::pair<std::string, std::string> >
+ReadBatchList(const std::string &filename) noexcept(false)
+{
+	std::ifstream in_file(filename);
+	if (!in_file.is_open()) {
+		errs() << "failed to open " << filename << "\n";
+		throw std::error_code{ Command::ErrorCode::FILE_OPEN_FAILED };
+	}
+
+	std::vector<std::pair<std::string, std::string> > pairs;
+	std::string line;
+	while (std::getline(in_file, line)) {
+		StringRef pair = StringRef(line).trim();
+		if (pair.empty() || pair.startswith("#")) {
+			continue;
+		}
+
+		StringRef original =
+			pair.take_until([](char c) { return std::isspace(c); });
+		StringRef patched = pair.drop_front(original.size()).trim();
+		if (patched.empty() ||
+		    patched.find_if([](char c) { return std::isspace(c); }) !=
+			    StringRef::npos) {
+			errs() << "invalid line in " << filename << ": " << line
+			       << "\n";
+			throw std::error_code{ Command::ErrorCode::NOT_ENOUGH_ARGS };
+		}
+		pairs.emplace_back(original.str(), patched.str());
+	}
+	return pairs;
+}
+
+// Asks the kernel to read a file ahead into page cache, so that the read
+// stage doesn't wait for round trips of small reads, e.g., on NFS.
+void Prefetch(const std::string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return;
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+	close(fd);
+}
+
+// Reads a file into memory. The file is read rather than mapped, so that
+// the parse stage doesn't fault in its pages.
+ErrorOr<std::unique_ptr<MemoryBuffer> > ReadFile(const std::string &filename)
+{
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([fd]() { close(fd); });
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		return std::error_code{ errno, std::system_category() };
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return MemoryBuffer::getOpenFile(fd, filename, st.st_size,
+					 /*RequiresNullTerminator=*/true,
+					 /*IsVolatile=*/true);
+}
+
+// Read stage. Inputs are read and looked up in the cache as
+// DiffCommand::Run() does.
+void ReadItem(DiffItem *item, ArtifactCache *cache, StringRef base_dir,
+	      const std::vector<std::pair<std::string, std::string> > &prefix_map,
+	      bool file_ids)
+{
+	Profiler::Stage stage("read");
+	for (auto [filename, buf] :
+	     { std::make_pair(&item->original_filename, &item->original_buf),
+	       std::make_pair(&item->patched_filename, &item->patched_buf) }) {
+		auto file = ReadFile(*filename);
+		if (!file) {
+			item->errors = "failed to read " + *filename + "\n";
+			item->ec = file.getError();
+			return;
+		}
+		item->ir_bytes += (*file)->getBufferSize();
+		*buf = std::move(*file);
+	}
+	if (!cache) {
+		return;
+	}
+
+	const std::string output_filename =
+		SourceFilename(item->patched_buf->getBuffer());
+	if (output_filename.empty()) {
+		return;
+	}
+	item->cache_key = DiffCacheKey(item->original_buf->getBuffer(),
+				       item->patched_buf->getBuffer(), base_dir,
+				       prefix_map, file_ids);
+	if (cache->Get(item->cache_key, &item->output)) {
+		item->cached = true;
+		item->source_filename = output_filename;
+		item->original_buf.reset();
+		item->patched_buf.reset();
+	}
+}
+
+// Parse stage. Modules are loaded as DiffCommand::RunDiff() does.
+void ParseItem(DiffItem *item, bool full_parse)
+{
+	item->context = std::make_unique<LLVMContext>();
+	if (!full_parse &&
+	    !LoadStubbedModules(*item->context, *item->original_buf,
+				*item->patched_buf, &item->original,
+				&item->patched)) {
+		item->context = std::make_unique<LLVMContext>();
+	}
+	if (!item->original) {
+		item->original = LoadModule(*item->context, *item->original_buf);
+	}
+	if (item->original && !item->patched) {
+		item->patched = LoadModule(*item->context, *item->patched_buf);
+	}
+	item->original_buf.reset();
+	item->patched_buf.reset();
+
+	if (!item->original || !item->patched) {
+		item->errors = item->original ?
+				       "Patched file is not valid LLVM\n" :
+				       "Original file is not valid LLVM\n";
+		item->ec = Command::ErrorCode::INVALID_LLVM_FILE;
+		item->original.reset();
+		item->patched.reset();
+		item->context.reset();
+		return;
+	}
+
+	// bodies of unchanged functions are stubbed, not dropped.
+	for (Function &fn : *item->original) {
+		if (!fn.isDeclaration()) {
+			item->functions++;
+		}
+	}
+}
+
+// Diff stage. The klp_diff is rendered here as well, so that the write
+// stage only does I/O.
+void DistillItem(DiffItem *item, StringRef base_dir,
+		 const std::vector<std::pair<std::string, std::string> > &prefix_map,
+		 bool quiet, bool file_ids)
+{
+	item->source_filename = item->patched->getSourceFileName();
+	{
+		raw_string_ostream messages(item->messages);
+		raw_string_ostream errors(item->errors);
+		try {
+			if (DiffCommand::DistillDiff(
+				    item->original.get(), item->patched.get(),
+				    base_dir, quiet ? nulls() : messages,
+				    file_ids, errors)) {
+				item->ec = Command::ErrorCode::DIFF_FAILED;
+			}
+		} catch (std::error_code e) {
+			item->ec = e;
+		}
+	}
+
+	for (Function &fn : *item->patched) {
+		if (!fn.isDeclaration() &&
+		    fn.getName().startswith(kLivepatchPrefix)) {
+			item->livepatched++;
+		}
+	}
+
+	if (!item->ec) {
+		MapModulePaths(item->patched.get(), prefix_map);
+		Profiler::Stage stage("render");
+		raw_string_ostream output(item->output);
+		item->patched->print(output, nullptr);
+	}
+	item->original.reset();
+	item->patched.reset();
+	item->context.reset();
+}
+
+// Write stage. The klp_diff is named after source_filename of the input as
+// DumpModule() does, and stored in the cache if it's computed.
+void WriteItem(DiffItem *item, ArtifactCache *cache)
+{
+	if (item->ec) {
+		return;
+	}
+
+	Profiler::Stage stage("write");
+	const std::string output_path =
+		item->source_filename + std::string(kDiffSuffix);
+	std::error_code ec;
+	{
+		raw_fd_ostream fout(output_path, ec);
+		fout << item->output;
+	}
+	if (ec) {
+		item->errors += "failed to write " + output_path + "\n";
+		item->ec = ec;
+		return;
+	}
+
+	if (cache && !item->cached && !item->cache_key.empty()) {
+		cache->Put(item->cache_key, std::move(item->output));
+	}
+	item->output = std::string();
+}
+
+// Returns costs of a diffed item to append to the history. The path is
+// relative to base_dir as in file IDs.
+BuildHistory::Record HistoryRecord(const DiffItem &item, StringRef base_dir,
+				   const std::string &kdir)
+{
+	BuildHistory::Record record;
+	record.path = ElfSymbol::SourcePath(item.source_filename, base_dir);
+	if (!kdir.empty()) {
+		SmallString<128> source(kdir);
+		sys::path::append(source, record.path);
+		sys::fs::file_size(source, record.tu_bytes);
+	}
+	record.ir_bytes = item.ir_bytes;
+	record.functions = item.functions;
+	record.livepatched = item.livepatched;
+	for (size_t i = 0; i < item.stage_time.size(); i++) {
+		record.stage_us[i] =
+			std::chrono::duration_cast<std::chrono::microseconds>(
+				item.stage_time[i])
+				.count();
+	}
+	record.peak_rss_kb = item.heap.PeakBytes() / 1024;
+	return record;
+}
+
+// Returns true if ec is an error llpatch acts on, e.g., it stops w/ its own
+// message for INCOMPATIBLE_CHANGE, rather than a generic failure. A batch
+// returns such an error over generic ones of other files.
+bool IsActionableError(std::error_code ec)
+{
+	return ec == Command::ErrorCode::INCOMPATIBLE_CHANGE ||
+	       ec == Command::ErrorCode::STALE_DIFF;
+}
+
 } // namespace
 
+// Remove special global variables for init && exit section, exported symbols.
+// Global variable for init && exit section: starts with __init, __exit
+// Global variable for exported symbols: starts with __kstrtab, __ksymtab
+void DiffCommand::RemoveSpecialGlobals(Module *mod)
+{
+	std::vector<GlobalVariable *> spc_vars;
+
+	for (GlobalVariable &GVR : mod->globals()) {
+		auto gvar_name = std::string(GVR.getName());
+		if (gvar_name.find("__init") == 0 ||
+		    gvar_name.find("__exit") == 0 ||
+		    gvar_name.find("__kstrtab") == 0 ||
+		    gvar_name.find("__ksymtab") == 0) {
+			spc_vars.push_back(&GVR);
+		}
+	}
+	for (GlobalVariable *gvr : spc_vars) {
+		gvr->removeFromParent();
+	}
+
+	// Exported symbol uses inline assembly to define __crc_${global_var}s and assign them
+	// to special sections. Format of inline assembly for exported symbol is as follows;
+	//
+	//    .section "___kcrctab_gpl+${exported_symbol}", "a"
+	//    .weak   __crc_${exported_symbol}
+	//    .long   __crc_${exported_symbol}
+	//    .previous
+	//
+	// Initcall uses inline assembly to instantiate special section. Format of
+	// inline assembly for the initcalls is as follows;
+	//
+	//    .section.*.initcall*"
+	//    __initcall_*"
+	//    .long*"
+	//    .previous.*"
+	//
+	// Neither of them should be in livepatch, and nor should other special sections
+	// defined by module-level inline assembly, e.g., ksymtab. So, drop the inline
+	// assembly altogether.
+	mod->setModuleInlineAsm("");
+}
+
 DiffCommand::DiffCommand(int argc, char **argv) noexcept(false)
 {
 	if (argc < 1) {
@@ -454,56 +992,344 @@ DiffCommand::DiffCommand(int argc, char **argv) noexcept(false)
 	argp_parse(&argp, argc, argv, /*flags=*/0,
 		   /*arg_index=*/nullptr, /*input=*/&arguments);
 
-	original_filename_ = arguments.original_ll;
-	patched_filename_ = arguments.patched_ll;
+	if (arguments.original_ll) {
+		original_filename_ = arguments.original_ll;
+		patched_filename_ = arguments.patched_ll;
+	}
 	if (arguments.base_dir) {
 		base_dir_ = arguments.base_dir;
 	}
 	quiet_mode_ = arguments.quiet;
+	full_parse_ = arguments.full_parse;
+	if (arguments.cache) {
+		cache_location_ = arguments.cache;
+	}
+	prefix_map_ = std::move(arguments.prefix_map);
+	if (arguments.file_ids) {
+		file_ids_ = arguments.file_ids;
+	}
+	if (arguments.batch) {
+		batch_filename_ = arguments.batch;
+	}
+	if (arguments.history) {
+		history_filename_ = arguments.history;
+	}
+	if (arguments.kdir) {
+		kdir_ = arguments.kdir;
+	}
+	jobs_ = arguments.jobs ? std::strtoul(arguments.jobs, nullptr, 10) :
+				 std::thread::hardware_concurrency();
+	jobs_ = std::max(jobs_, 1u);
 }
 
 std::error_code DiffCommand::Run()
 {
-	LLVMContext Context;
+	if (!batch_filename_.empty()) {
+		return RunBatch();
+	}
+
+	std::unique_ptr<ArtifactCache> cache =
+		ArtifactCache::Create(cache_location_);
+	if (!cache) {
+		return RunDiff();
+	}
+
+	// Diff result is looked up by digests of input files. Output filename
+	// comes from the 'patched' as DumpModule() does. Cache is not used for
+	// bitcode input.
+	auto original = MemoryBuffer::getFile(original_filename_);
+	auto patched = MemoryBuffer::getFile(patched_filename_);
+	if (!original || !patched) {
+		return RunDiff();
+	}
+	const std::string output_filename =
+		SourceFilename((*patched)->getBuffer());
+	if (output_filename.empty()) {
+		return RunDiff();
+	}
+	const std::string output_path = output_filename + std::string(kDiffSuffix);
+	const std::string key =
+		DiffCacheKey((*original)->getBuffer(), (*patched)->getBuffer(),
+			     base_dir_, prefix_map_, !file_ids_.empty());
+	original->reset();
+	patched->reset();
+
+	std::string output;
+	if (cache->Get(key, &output)) {
+		if (!quiet_mode_) {
+			outs() << "Cached diff: " << output_path << "\n";
+		}
+		std::error_code ec;
+		raw_fd_ostream fout(output_path, ec);
+		fout << output;
+		if (!ec) {
+			AppendFileId(file_ids_, output_filename, base_dir_);
+		}
+		return ec;
+	}
+
+	std::error_code ec = RunDiff();
+	if (ec) {
+		return ec;
+	}
+
+	auto result = MemoryBuffer::getFile(output_path);
+	if (result) {
+		cache->Put(key, (*result)->getBuffer().str());
+	}
+	return ErrorCode::NO_ERROR;
+}
+
+std::error_code DiffCommand::RunBatch()
+{
+	const std::vector<std::pair<std::string, std::string> > pairs =
+		ReadBatchList(batch_filename_);
+	std::unique_ptr<ArtifactCache> cache =
+		ArtifactCache::Create(cache_location_);
+	const bool file_ids = !file_ids_.empty();
+
+	// Queues are as deep as the number of threads in a stage. So, items in
+	// flight are bounded by a few times of jobs_. Files are prefetched as
+	// far ahead as the read stage can go.
+	BoundedQueue<std::unique_ptr<DiffItem> > read_queue(jobs_);
+	BoundedQueue<std::unique_ptr<DiffItem> > parse_queue(jobs_);
+	BoundedQueue<std::unique_ptr<DiffItem> > diff_queue(jobs_);
+	const size_t prefetch_depth = 2 * jobs_;
+
+	std::thread reader([&]() {
+		CpuProfiler::RegisterThread();
+		for (size_t i = 0; i < pairs.size(); i++) {
+			for (size_t j = (i == 0) ? 0 : i + prefetch_depth;
+			     j <= i + prefetch_depth && j < pairs.size(); j++) {
+				Prefetch(pairs[j].first);
+				Prefetch(pairs[j].second);
+			}
+
+			auto item = std::make_unique<DiffItem>();
+			item->index = i;
+			item->original_filename = pairs[i].first;
+			item->patched_filename = pairs[i].second;
+			RunStage(item.get(), 0, [&]() {
+				ReadItem(item.get(), cache.get(), base_dir_,
+					 prefix_map_, file_ids);
+			});
+			read_queue.Push(std::move(item));
+		}
+		read_queue.Close();
+	});
+
+	// The last thread leaving a stage closes its output queue.
+	std::atomic<unsigned> num_parsers{ jobs_ };
+	std::atomic<unsigned> num_differs{ jobs_ };
+	auto parse = [&]() {
+		CpuProfiler::RegisterThread();
+		std::unique_ptr<DiffItem> item;
+		while (read_queue.Pop(&item)) {
+			if (!item->ec && !item->cached) {
+				RunStage(item.get(), 1, [&]() {
+					ParseItem(item.get(), full_parse_);
+				});
+			}
+			parse_queue.Push(std::move(item));
+		}
+		if (--num_parsers == 0) {
+			parse_queue.Close();
+		}
+	};
+	auto diff = [&]() {
+		CpuProfiler::RegisterThread();
+		std::unique_ptr<DiffItem> item;
+		while (parse_queue.Pop(&item)) {
+			if (!item->ec && !item->cached) {
+				RunStage(item.get(), 2, [&]() {
+					DistillItem(item.get(), base_dir_,
+						    prefix_map_, quiet_mode_,
+						    file_ids);
+				});
+			}
+			diff_queue.Push(std::move(item));
+		}
+		if (--num_differs == 0) {
+			diff_queue.Close();
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < jobs_; i++) {
+		workers.emplace_back(parse);
+		workers.emplace_back(diff);
+	}
+
+	// Outputs are written as soon as they are done. Messages and file IDs
+	// wait for the ones before them in the list, so that they don't depend
+	// on scheduling of threads.
+	std::error_code ret;
+	size_t num_nothing_to_patch = 0;
+	std::vector<BuildHistory::Record> records;
+	std::map<size_t, std::unique_ptr<DiffItem> > done;
+	size_t next = 0;
+	std::unique_ptr<DiffItem> item;
+	while (diff_queue.Pop(&item)) {
+		RunStage(item.get(), 3,
+			 [&]() { WriteItem(item.get(), cache.get()); });
+		done.emplace(item->index, std::move(item));
+
+		for (auto i = done.find(next); i != done.end();
+		     i = done.find(++next)) {
+			DiffItem &finished = *i->second;
+			outs() << finished.messages;
+			errs() << finished.errors;
+			if (!finished.ec && finished.cached && !quiet_mode_) {
+				outs() << "Cached diff: " << finished.source_filename
+				       << kDiffSuffix << "\n";
+			}
+			if (!finished.ec) {
+				try {
+					AppendFileId(file_ids_,
+						     finished.source_filename,
+						     base_dir_);
+				} catch (std::error_code e) {
+					finished.ec = e;
+				}
+			}
+
+			if (!history_filename_.empty() && !finished.cached &&
+			    (!finished.ec ||
+			     finished.ec == ErrorCode::NOTHING_TO_PATCH)) {
+				records.push_back(
+					HistoryRecord(finished, base_dir_, kdir_));
+			}
+
+			if (finished.ec == ErrorCode::NOTHING_TO_PATCH) {
+				num_nothing_to_patch++;
+			} else if (finished.ec) {
+				errs() << "failed to diff "
+				       << finished.patched_filename << "\n";
+				if (!ret || (IsActionableError(finished.ec) &&
+					     !IsActionableError(ret))) {
+					ret = finished.ec;
+				}
+			}
+			done.erase(i);
+		}
+	}
+	reader.join();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	Profiler::Get().AddQueue("read", read_queue.Stats());
+	Profiler::Get().AddQueue("parse", parse_queue.Stats());
+	Profiler::Get().AddQueue("diff", diff_queue.Stats());
+
+	// history is best effort. Failing to record costs doesn't fail diff.
+	try {
+		BuildHistory::Append(history_filename_, records);
+	} catch (std::error_code e) {
+		errs() << "failed to append to " << history_filename_ << ": "
+		       << e.message() << "\n";
+	}
+
+	if (ret) {
+		return ret;
+	}
+	if (num_nothing_to_patch == pairs.size()) {
+		return ErrorCode::NOTHING_TO_PATCH;
+	}
+	return ErrorCode::NO_ERROR;
+}
+
+std::error_code DiffCommand::RunDiff()
+{
+	// Context is recreated if stubbed IR fails to be parsed. Types created
+	// by the failed parse would change type names in the output.
+	auto Context = std::make_unique<LLVMContext>();
+	std::unique_ptr<Module> OriginalModule;
+	std::unique_ptr<Module> PatchedModule;
+	if (!full_parse_ &&
+	    !LoadStubbedModules(*Context, original_filename_, patched_filename_,
+				&OriginalModule, &PatchedModule)) {
+		Context = std::make_unique<LLVMContext>();
+	}
 
-	std::unique_ptr<Module> OriginalModule =
-		LoadModule(Context, original_filename_);
+	if (!OriginalModule) {
+		OriginalModule = LoadModule(*Context, original_filename_);
+	}
 	if (!OriginalModule) {
 		errs() << "Original file is not valid LLVM\n";
 		return std::error_code{ ErrorCode::INVALID_LLVM_FILE };
 	}
 
-	std::unique_ptr<Module> PatchedModule =
-		LoadModule(Context, patched_filename_);
+	if (!PatchedModule) {
+		PatchedModule = LoadModule(*Context, patched_filename_);
+	}
 	if (!PatchedModule) {
 		errs() << "Patched file is not valid LLVM\n";
 		return std::error_code{ ErrorCode::INVALID_LLVM_FILE };
 	}
 
+	const std::string source_filename = PatchedModule->getSourceFileName();
 	std::unique_ptr<Module> PatchModule = DistillDiff(
 		std::move(OriginalModule), std::move(PatchedModule));
 	if (!PatchModule) {
 		return std::error_code{ ErrorCode::DIFF_FAILED };
 	}
 
-	return DumpModule(std::move(PatchModule));
+	MapModulePaths(PatchModule.get(), prefix_map_);
+	std::error_code ec =
+		DumpModule(std::move(PatchModule), source_filename);
+	if (ec) {
+		return ec;
+	}
+
+	AppendFileId(file_ids_, source_filename, base_dir_);
+	return ErrorCode::NO_ERROR;
 }
 
 std::unique_ptr<Module>
 DiffCommand::DistillDiff(std::unique_ptr<Module> original,
 			 std::unique_ptr<Module> patched)
 {
-	DiffConsumer consumer(quiet_mode_ ? nulls() : outs());
-	std::error_code ec = DistillDiffFunctions(&consumer, original.get(),
-						  patched.get(), base_dir_);
+	std::error_code ec = DistillDiff(original.get(), patched.get(),
+					 base_dir_, quiet_mode_ ? nulls() : outs(),
+					 !file_ids_.empty());
 	if (ec) {
 		return nullptr;
 	}
 
-	ec = DistillDiffGlobals(original.get(), patched.get(), base_dir_);
+	return patched;
+}
+
+std::error_code DiffCommand::DistillDiff(Module *original, Module *patched,
+					 StringRef base_dir, raw_ostream &out,
+					 bool file_ids, raw_ostream &err)
+{
+	const std::string file_id =
+		file_ids ? FileIdTable::FileId(ElfSymbol::SourcePath(
+				   patched->getSourceFileName(), base_dir)) :
+			   "";
+	{
+		// Functions are not diffed if the livepatch can't be built or
+		// applied safely anyway.
+		Profiler::Stage stage("precheck");
+		TypePrecheck precheck(original, patched);
+		if (precheck.Check(err) > 0) {
+			throw std::error_code{
+				Command::ErrorCode::INCOMPATIBLE_CHANGE
+			};
+		}
+	}
+
+	DiffConsumer consumer(out);
+	std::error_code ec;
+	{
+		Profiler::Stage stage("diff");
+		ec = DistillDiffFunctions(&consumer, original, patched,
+					  base_dir, file_id, out);
+	}
 	if (ec) {
-		return nullptr;
+		return ec;
 	}
 
-	return patched;
+	Profiler::Stage stage("distill");
+	return DistillDiffGlobals(original, patched, base_dir, file_id, err);
 }
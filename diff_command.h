@@ -22,15 +22,27 @@
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <utility>
+#include <vector>
 
 #include "command.h"
+#include "llvm/ADT/StringRef.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
 
 // This class implements diff command for kernel livepatch generation. The
 // 'diff' command inputs two LLVM IR files, original.ll and patched.ll, and
 // distills differences between them for C functions and global
 // variables. The 'diff' command outputs an LLVM IR file with patched/new C
 // functions and global variables in it.
+//
+// w/ --batch, pairs of files in a list are diffed in a pipeline of stages,
+// read, parse, diff and write, connected by bounded queues. Parse and diff
+// run w/ --jobs threads each. So, reading inputs and writing outputs are
+// overlapped w/ parsing and diffing of other pairs, e.g., on NFS. Messages
+// and file IDs are still output in the order of the list. w/ --history,
+// costs of each pair, e.g., time for stages and peak RSS, are appended to a
+// BuildHistory for 'estimate'.
 class DiffCommand : public Command {
     public:
 	static constexpr std::string_view kCommandName = "diff";
@@ -52,11 +64,49 @@ class DiffCommand : public Command {
 	DistillDiff(std::unique_ptr<llvm::Module> original,
 		    std::unique_ptr<llvm::Module> patched);
 
+	// Diffs two LLVM modules in place. patched is left w/ patched/new C
+	// functions and global variables only. Messages are printed out to
+	// out and warnings to err. If file_ids is true, symbol names have a
+	// short ID of the source file instead of its path. See FileIdTable.
+	static std::error_code DistillDiff(llvm::Module *original,
+					   llvm::Module *patched,
+					   llvm::StringRef base_dir,
+					   llvm::raw_ostream &out,
+					   bool file_ids = false,
+					   llvm::raw_ostream &err = llvm::errs());
+
+	// Removes special global variables, e.g., for init and exit sections
+	// and exported symbols, and module-level inline assembly defining
+	// special sections from mod.
+	static void RemoveSpecialGlobals(llvm::Module *mod);
+
     private:
+	// Runs diff w/o cache.
+	std::error_code RunDiff();
+	// Runs diff for pairs of files in batch_filename_.
+	std::error_code RunBatch();
+
 	std::string original_filename_;
 	std::string patched_filename_;
 	std::string base_dir_;
+	std::string cache_location_;
 	bool quiet_mode_ = false;
+	// If false, bodies of unchanged functions are skipped on parsing.
+	bool full_parse_ = false;
+	// (old, new) path prefixes to map paths embedded in the output, e.g.,
+	// source_filename. This makes the output independent of build dirs.
+	std::vector<std::pair<std::string, std::string> > prefix_map_;
+	// file ID table to append to. If empty, symbol names have paths of
+	// source files.
+	std::string file_ids_;
+	// list of "<original.ll> <patched.ll>" lines for batch mode.
+	std::string batch_filename_;
+	// number of threads for each of parse and diff stages in batch mode.
+	unsigned jobs_ = 1;
+	// history to append costs of pairs to w/ --batch. See BuildHistory.
+	std::string history_filename_;
+	// kernel dir w/ source files. tu_bytes of a record is 0 w/o it.
+	std::string kdir_;
 };
 
 #endif // DIFF_COMMAND_H_
@@ -17,17 +17,21 @@
  */
 #include "elf_bin.h"
 
+#include <errno.h>
 #include <fcntl.h>
 #include <gelf.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
 #include <string_view>
 #include <system_error>
+#include <vector>
 
 #include "auto_cleanup.h"
 #include "elf_error.h"
+#include "profiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace
@@ -38,11 +42,62 @@ void throw_gelf_error()
 {
 	throw std::error_code{ static_cast<ElfErrorCode>(elf_errno()) };
 }
+
+void throw_errno()
+{
+	throw std::error_code{ errno, std::system_category() };
+}
+
+// Writes all of data to fd from its current offset.
+void WriteAll(int fd, const char *data, size_t size) noexcept(false)
+{
+	while (size > 0) {
+		ssize_t written = write(fd, data, size);
+		if (written < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw_errno();
+		}
+		data += written;
+		size -= written;
+	}
+}
+
+// Reads the whole file for fd into buf.
+void ReadAll(int fd, std::vector<char> *buf) noexcept(false)
+{
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		throw_errno();
+	}
+	buf->resize(st.st_size);
+
+	size_t offset = 0;
+	while (offset < buf->size()) {
+		ssize_t size = pread(fd, buf->data() + offset,
+				     buf->size() - offset, offset);
+		if (size < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			throw_errno();
+		}
+		if (size == 0) {
+			buf->resize(offset);
+			break;
+		}
+		offset += size;
+	}
+}
 } // namespace
 
-ElfBin::ElfBin(std::string_view elf_filename) noexcept(false)
+ElfBin::ElfBin(std::string_view elf_filename, OpenMode mode) noexcept(false)
+	: mode_(mode)
 {
-	elf_fd_ = open(elf_filename.data(), O_RDWR, 0);
+	Profiler::Stage stage("parse");
+	elf_fd_ = open(elf_filename.data(),
+		       mode_ == OpenMode::LAZY ? O_RDONLY : O_RDWR, 0);
 	if (elf_fd_ < 0) {
 		throw std::error_code{ errno, std::system_category() };
 	}
@@ -52,6 +107,50 @@ ElfBin::ElfBin(std::string_view elf_filename) noexcept(false)
 		throw_gelf_error();
 	}
 
+	// w/ a private mapping, libelf reads headers at open and section data
+	// is paged in on elf_getdata(). Pages are copied on write, if any, and
+	// never written to the file.
+	elf_ = elf_begin(elf_fd_,
+			 mode_ == OpenMode::LAZY ? ELF_C_READ_MMAP_PRIVATE :
+						   ELF_C_RDWR,
+			 nullptr);
+	if (!elf_) {
+		throw_gelf_error();
+	}
+
+	elf_fd_close.Disable();
+}
+
+ElfBin::ElfBin(std::vector<char> *elf_image, OpenMode mode) noexcept(false)
+	: mode_(mode), elf_image_(elf_image)
+{
+	Profiler::Stage stage("parse");
+	if (elf_version(EV_CURRENT) == EV_NONE) {
+		throw_gelf_error();
+	}
+
+	if (mode_ == OpenMode::LAZY) {
+		// read-only. So, libelf works on the image in place.
+		elf_ = elf_memory(elf_image_->data(), elf_image_->size());
+		if (!elf_) {
+			throw_gelf_error();
+		}
+		return;
+	}
+
+	// libelf works on a file descriptor. So, the image is copied to an
+	// anonymous file in memory, which is copied back on ElfUpdate().
+	elf_fd_ = memfd_create("elf_bin", MFD_CLOEXEC);
+	if (elf_fd_ < 0) {
+		throw_errno();
+	}
+	AutoCleanup elf_fd_close([elf_fd = elf_fd_]() { close(elf_fd); });
+
+	WriteAll(elf_fd_, elf_image_->data(), elf_image_->size());
+	if (lseek(elf_fd_, 0, SEEK_SET) < 0) {
+		throw_errno();
+	}
+
 	elf_ = elf_begin(elf_fd_, ELF_C_RDWR, nullptr);
 	if (!elf_) {
 		throw_gelf_error();
@@ -63,7 +162,16 @@ ElfBin::ElfBin(std::string_view elf_filename) noexcept(false)
 ElfBin::~ElfBin()
 {
 	elf_end(elf_);
-	close(elf_fd_);
+	if (elf_fd_ >= 0) {
+		close(elf_fd_);
+	}
+}
+
+void ElfBin::CheckWritable() const noexcept(false)
+{
+	if (mode_ == OpenMode::LAZY) {
+		throw std::error_code{ ElfErrorCode::READ_ONLY_ELF };
+	}
 }
 
 Elf_Data *ElfBin::GetElfSectionData(size_t sec_idx) noexcept(false)
@@ -96,6 +204,21 @@ std::string_view ElfBin::SectionName(size_t sec_idx)
 			  section_header.sh_name);
 }
 
+GElf_Shdr ElfBin::SectionHeader(size_t sec_idx)
+{
+	Elf_Scn *scn = elf_getscn(elf_, sec_idx);
+	if (scn == nullptr) {
+		throw_gelf_error();
+	}
+
+	GElf_Shdr section_header;
+	if (gelf_getshdr(scn, &section_header) == nullptr) {
+		throw_gelf_error();
+	}
+
+	return section_header;
+}
+
 std::string ElfBin::ModName()
 {
 	static constexpr std::string_view kModInfoSecName = ".modinfo";
@@ -121,6 +244,7 @@ std::string ElfBin::ModName()
 void ElfBin::UpdateSection(size_t sec_idx, void *data, size_t size)
 	noexcept(false)
 {
+	CheckWritable();
 	Elf_Data *elf_data = GetElfSectionData(sec_idx);
 
 	elf_data->d_buf = data;
@@ -153,17 +277,29 @@ void ElfBin::UpdateRela(size_t section_id,
 			std::vector<ElfRela::RelaEntry> *rela_vector)
 	noexcept(false)
 {
+	CheckWritable();
 	GElf_Shdr rela_header = {};
-	Elf_Scn *scn = nullptr;
-	while ((scn = elf_nextscn(elf_, scn))) {
-		gelf_getshdr(scn, &rela_header);
-		if (rela_header.sh_type == SHT_RELA &&
-		    rela_header.sh_info == section_id)
-			break;
+	if (rela_sections_.empty()) {
+		// Index rela sections once. Otherwise, updating all rela
+		// sections is quadratic to the number of sections.
+		Elf_Scn *scn = nullptr;
+		while ((scn = elf_nextscn(elf_, scn))) {
+			gelf_getshdr(scn, &rela_header);
+			if (rela_header.sh_type == SHT_RELA) {
+				// emplace() keeps the first one if duplicated.
+				rela_sections_.emplace(rela_header.sh_info, scn);
+			}
+		}
 	}
-	if (scn == nullptr) {
+
+	auto rela_section = rela_sections_.find(section_id);
+	if (rela_section == rela_sections_.end()) {
 		throw std::error_code{ ElfErrorCode::RELA_SECTION_NOT_FOUND };
 	}
+	Elf_Scn *scn = rela_section->second;
+	if (!gelf_getshdr(scn, &rela_header)) {
+		throw_gelf_error();
+	}
 
 	Elf_Data *data = elf_getdata(scn, nullptr);
 	if (!data) {
@@ -174,7 +310,10 @@ void ElfBin::UpdateRela(size_t section_id,
 		throw_gelf_error();
 	}
 
-	data->d_buf = rela_vector->data();
+	// libelf takes data w/o buffer as one not read yet and keeps size of
+	// the section. So, data for an empty section still points to a buffer.
+	static ElfRela::RelaEntry empty_rela = {};
+	data->d_buf = rela_vector->empty() ? &empty_rela : rela_vector->data();
 	data->d_size = rela_vector->size() * sizeof(ElfRela::RelaEntry);
 
 	rela_header.sh_size = rela_vector->size() * sizeof(ElfRela::RelaEntry);
@@ -189,6 +328,7 @@ void ElfBin::CreateKlpRela(size_t section_id, size_t symtab_id,
 			   std::vector<ElfRela::RelaEntry> *rela_vector)
 	noexcept(false)
 {
+	CheckWritable();
 	Elf_Scn *scn = elf_newscn(elf_);
 	if (!scn) {
 		throw_gelf_error();
@@ -230,7 +370,13 @@ void ElfBin::CreateKlpRela(size_t section_id, size_t symtab_id,
 
 void ElfBin::ElfUpdate() noexcept(false)
 {
+	Profiler::Stage stage("update");
+	CheckWritable();
 	if (elf_update(elf_, ELF_C_WRITE) < 0) {
 		throw_gelf_error();
 	}
+
+	if (elf_image_) {
+		ReadAll(elf_fd_, elf_image_);
+	}
 }
@@ -23,6 +23,7 @@
 #include <memory>
 #include <string_view>
 #include <system_error>
+#include <unordered_map>
 #include <vector>
 
 #include "elf_rela.h"
@@ -36,7 +37,24 @@
 // manipulating elf binary.
 class ElfBin final {
     public:
-	ElfBin(std::string_view elf_filename) noexcept(false);
+	// READ_WRITE reads an elf binary to change and write it back by
+	// ElfUpdate(). LAZY maps the binary read-only and only ELF header and
+	// section headers are read at open. Contents of a section, e.g.,
+	// symtab or .modinfo, are paged in when it's accessed first. So,
+	// reading few sections of vmlinux or a module w/ large debug sections
+	// doesn't read the whole file. Changing the binary in LAZY throws
+	// READ_ONLY_ELF.
+	enum class OpenMode {
+		READ_WRITE,
+		LAZY,
+	};
+
+	ElfBin(std::string_view elf_filename,
+	       OpenMode mode = OpenMode::READ_WRITE) noexcept(false);
+	// Works on an elf binary in memory. Changes are written back to the
+	// image by ElfUpdate(). The image should outlive this object.
+	ElfBin(std::vector<char> *elf_image,
+	       OpenMode mode = OpenMode::READ_WRITE) noexcept(false);
 	~ElfBin();
 
 	// Don't allow copy.
@@ -65,6 +83,10 @@ class ElfBin final {
 
 	std::string_view SectionName(size_t sec_idx);
 
+	// Gets header of section w/ given section index, e.g., for its type
+	// and flags.
+	GElf_Shdr SectionHeader(size_t sec_idx) noexcept(false);
+
 	// Locates the section, .modinfo, and returns module name
 	// The section consists of key=value pair seperated by '\0'
 	//
@@ -102,9 +124,17 @@ class ElfBin final {
 
     private:
 	Elf_Data *GetElfSectionData(size_t sec_idx) noexcept(false);
+	// Throws READ_ONLY_ELF if the binary can't be changed.
+	void CheckWritable() const noexcept(false);
 
+	OpenMode mode_;
 	int elf_fd_ = -1;
 	Elf *elf_ = nullptr;
+	// elf binary in memory if the object is created from it.
+	std::vector<char> *elf_image_ = nullptr;
+	// key: index of section to relocate, value: its rela section. This is
+	// lazily built by UpdateRela().
+	std::unordered_map<size_t, Elf_Scn *> rela_sections_;
 };
 
 #endif // ELF_BIN_H_
@@ -49,6 +49,8 @@ std::string ElfErrorCategory::message(int ev) const
 		return "(given) rela section cannot be found";
 	case ElfErrorCode::SAME_SYMBOL_FILENAME:
 		return "ELF contains same symbol && filename combination";
+	case ElfErrorCode::READ_ONLY_ELF:
+		return "ELF is opened read-only";
 	default:
 		return "unrecognized error";
 	}
@@ -34,6 +34,7 @@ enum class ElfErrorCode : int {
 	NO_RELA_SECTION,
 	RELA_SECTION_NOT_FOUND,
 	SAME_SYMBOL_FILENAME,
+	READ_ONLY_ELF,
 };
 
 namespace std
@@ -67,10 +67,19 @@ std::string_view ElfRela::Name()
 	return symbol_.Name(GELF_R_SYM(Entry()->r_info));
 }
 
-void ElfRela::PrintCurrentEntry()
+void ElfRela::PrintCurrentEntry(llvm::raw_ostream &out)
 {
-	llvm::outs()
-		<< "Section: " << SectionId() << ", Symbol: " << Name() << "\n";
+	out << "Section: " << SectionId() << ", Symbol: " << Name() << "\n";
+}
+
+ElfSymbol::SymbolType ElfRela::SymbolType()
+{
+	return symbol_.Type(GELF_R_SYM(Entry()->r_info));
+}
+
+size_t ElfRela::SymbolSection()
+{
+	return symbol_.Section(GELF_R_SYM(Entry()->r_info));
 }
 
 bool ElfRela::HasSectionIndex(ElfSymbol::SectionIndex idx)
@@ -30,6 +30,7 @@
 #include <vector>
 
 #include "elf_symbol.h"
+#include "llvm/Support/raw_ostream.h"
 
 // This class creates an iterator to browse through all rela sections in
 // elf binary where corresponding sections for the rela have 'ALLOC' flag.
@@ -97,9 +98,13 @@ class ElfRela final {
 	{
 		return rela_header_.sh_link;
 	}
+	// Returns type and section index of symbol for current relocation
+	// entry.
+	ElfSymbol::SymbolType SymbolType() noexcept(false);
+	size_t SymbolSection() noexcept(false);
 	bool HasSectionIndex(ElfSymbol::SectionIndex idx);
 	void SetSectionIndex(ElfSymbol::SectionIndex idx);
-	void PrintCurrentEntry();
+	void PrintCurrentEntry(llvm::raw_ostream &out);
 
     private:
 	Elf_Scn *GetNextRela();
@@ -116,6 +116,32 @@ size_t ElfSymbol::GetStringSectionIndex()
 	return str_sec_idx_;
 }
 
+GElf_Addr ElfSymbol::Value() noexcept(false)
+{
+	GElf_Sym sym;
+	GetGElfSymbol(&sym);
+	return sym.st_value;
+}
+
+GElf_Xword ElfSymbol::Size() noexcept(false)
+{
+	GElf_Sym sym;
+	GetGElfSymbol(&sym);
+	return sym.st_size;
+}
+
+size_t ElfSymbol::Section() noexcept(false)
+{
+	return Section(sym_cursor_);
+}
+
+size_t ElfSymbol::Section(size_t cursor) noexcept(false)
+{
+	GElf_Sym sym;
+	GetGElfSymbol(&sym, cursor);
+	return sym.st_shndx;
+}
+
 bool ElfSymbol::HasSectionIndex(ElfSymbol::SectionIndex idx)
 {
 	return HasSectionIndex(idx, sym_cursor_);
@@ -190,24 +216,33 @@ std::string_view ElfSymbol::GetLLpatchSymbolAlias() const noexcept(false)
 	return Name().substr(kLLpatchSym.size(), std::string::npos);
 }
 
+StringRef ElfSymbol::LLpatchSymbolAlias(StringRef name)
+{
+	if (!name.startswith(kLLpatchSym)) {
+		return "";
+	}
+	return name.drop_front(kLLpatchSym.size());
+}
+
 std::string ElfSymbol::CreateKlpLocalSymName(StringRef sym_name)
 {
 	return (Twine(kKLPLocalSym, ":") + Twine(sym_name)).str();
 }
 
-namespace
-{
-std::string RemoveBasePath(StringRef path, StringRef base_path)
+std::string ElfSymbol::SourcePath(StringRef filename, StringRef base_path)
 {
-	return path.split(base_path).second.ltrim("./").str();
+	return filename.split(base_path).second.ltrim("./").str();
 }
-} // namespace
 
 std::string ElfSymbol::CreateLivepatchedFunctionName(const Function &fn,
-						     StringRef base_path)
+						     StringRef base_path,
+						     StringRef file_id)
 {
+	if (!file_id.empty()) {
+		return fn.getName().str() + ":" + file_id.str();
+	}
 	return fn.getName().str() + ":" +
-	       RemoveBasePath(fn.getParent()->getSourceFileName(), base_path);
+	       SourcePath(fn.getParent()->getSourceFileName(), base_path);
 }
 
 // CreateLivepatchedSymbolName - Create a unique name for the global. The
@@ -220,13 +255,19 @@ std::string ElfSymbol::CreateLivepatchedFunctionName(const Function &fn,
 //
 // [A]: Prefix.
 // [B]: The original symbol name.
-// [C]: The source filename, to help with disambiguation.
+// [C]: The source filename, to help with disambiguation. It's a short ID
+//      of the file if file_id is given.
 std::string ElfSymbol::CreateLivepatchedSymbolName(StringRef orig_name,
 						   StringRef filename,
-						   StringRef base_path)
+						   StringRef base_path,
+						   StringRef file_id)
 {
+	if (!file_id.empty()) {
+		return ElfSymbol::CreateKlpLocalSymName(orig_name) + ":" +
+		       file_id.str();
+	}
 	return ElfSymbol::CreateKlpLocalSymName(orig_name) + ":" +
-	       RemoveBasePath(filename, base_path);
+	       SourcePath(filename, base_path);
 }
 
 ElfSymbol::Iterator::Iterator(ElfSymbol *symbol) noexcept(false)
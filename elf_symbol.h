@@ -109,6 +109,15 @@ class ElfSymbol final {
 
 	size_t GetStringSectionIndex();
 
+	// For relocatable object, value is offset of the symbol in its
+	// section.
+	GElf_Addr Value() noexcept(false);
+	GElf_Xword Size() noexcept(false);
+	// Returns index of section that the symbol is defined in. It can be
+	// one of SectionIndex, e.g., UNDEF.
+	size_t Section() noexcept(false);
+	size_t Section(size_t cursor) noexcept(false);
+
 	bool HasSectionIndex(SectionIndex idx);
 	bool HasSectionIndex(SectionIndex idx, size_t cursor);
 	void SetSectionIndex(SectionIndex idx);
@@ -118,14 +127,24 @@ class ElfSymbol final {
 	bool IsLLpatchSymbol() const noexcept(false);
 	std::string_view GetLLpatchSymbolAlias() const;
 
+	// Returns alias of LLpatch symbol, __llpatch_symbol_${alias}. If name
+	// is not LLpatch symbol, empty string is returned.
+	static llvm::StringRef LLpatchSymbolAlias(llvm::StringRef name);
 	static std::string CreateKlpLocalSymName(llvm::StringRef sym_name);
+	// Returns path of a source file relative to base_path.
+	static std::string SourcePath(llvm::StringRef filename,
+				      llvm::StringRef base_path);
+	// If file_id is given, it's used for the source file in the name
+	// instead of its path. See FileIdTable.
 	static std::string
 	CreateLivepatchedFunctionName(const llvm::Function &fn,
-				      llvm::StringRef base_path);
+				      llvm::StringRef base_path,
+				      llvm::StringRef file_id = "");
 	static std::string
 	CreateLivepatchedSymbolName(llvm::StringRef orig_name,
 				    llvm::StringRef filename,
-				    llvm::StringRef base_path);
+				    llvm::StringRef base_path,
+				    llvm::StringRef file_id = "");
 
     private:
 	void GetGElfSymbol(GElf_Sym *sym) const noexcept(false);
@@ -0,0 +1,399 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "estimate_command.h"
+
+#include <argp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <numeric>
+#include <queue>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "auto_cleanup.h"
+#include "build_history.h"
+#include "profiler.h"
+#include "unified_diff.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+struct EstimateArgs {
+	char *history = nullptr;
+	char *kdir = nullptr;
+	char *jobs = nullptr;
+	char *patch_file = nullptr;
+};
+
+const char kEstimateArgsDoc[] = "<.patch>";
+const char kEstimatePrgDoc[] = "common estimate options:\n";
+const struct argp_option kEstimateOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"history", /*key=*/'H', /*arg=*/"HISTORY",
+	  /*flag=*/0, /*doc=*/"History appended by 'diff --history'" },
+	{ /*name=*/"kdir", /*key=*/'k', /*arg=*/"KDIR",
+	  /*flag=*/0, /*doc=*/"Path to kernel dir. default: current dir" },
+	{ /*name=*/"jobs", /*key=*/'j', /*arg=*/"JOBS",
+	  /*flag=*/0, /*doc=*/"Number of workers diffing files. default: 1" },
+	{ nullptr }
+};
+
+error_t ParseEstimateOpt(int key, char *arg, struct argp_state *state)
+{
+	EstimateArgs *args = static_cast<EstimateArgs *>(state->input);
+
+	switch (key) {
+	case 'H':
+		args->history = arg;
+		break;
+	case 'k':
+		args->kdir = arg;
+		break;
+	case 'j':
+		args->jobs = arg;
+		break;
+	case ARGP_KEY_ARG:
+		if (!args->patch_file) {
+			args->patch_file = arg;
+		} else {
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (!args->patch_file || !args->history) {
+			errs() << "<.patch> and --history are not given\n";
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+// Predicted costs to diff a C file.
+struct Estimate {
+	std::string path;
+	uint64_t tu_bytes = 0;
+	// added and removed lines. 0 for a file affected by headers.
+	size_t changed_lines = 0;
+	bool header = false;
+	double time_us = 0;
+	double rss_kb = 0;
+	// # of records for the same file. 0 means the fits over all records.
+	size_t samples = 0;
+};
+
+// y = intercept + slope * x by least squares.
+struct LinearFit {
+	double intercept = 0;
+	double slope = 0;
+
+	double operator()(double x) const
+	{
+		return std::max(intercept + slope * x, 0.0);
+	}
+};
+
+LinearFit Fit(const std::vector<std::pair<double, double> > &points)
+{
+	LinearFit fit;
+	if (points.empty()) {
+		return fit;
+	}
+
+	double x_mean = 0, y_mean = 0;
+	for (auto [x, y] : points) {
+		x_mean += x;
+		y_mean += y;
+	}
+	x_mean /= points.size();
+	y_mean /= points.size();
+
+	double xx = 0, xy = 0;
+	for (auto [x, y] : points) {
+		xx += (x - x_mean) * (x - x_mean);
+		xy += (x - x_mean) * (y - y_mean);
+	}
+	// all records of the same size. the mean is the best guess.
+	fit.slope = xx > 0 ? xy / xx : 0;
+	fit.intercept = y_mean - fit.slope * x_mean;
+	return fit;
+}
+
+double Median(std::vector<double> values)
+{
+	if (values.empty()) {
+		return 0;
+	}
+	auto mid = values.begin() + values.size() / 2;
+	std::nth_element(values.begin(), mid, values.end());
+	return *mid;
+}
+
+// Returns C files that include any of headers, found by deps_ in .*.o.cmd
+// files the same way llpatch does. Hidden dirs, e.g., .git, are skipped.
+std::set<std::string> FindIncludingFiles(const fs::path &kdir,
+					 const std::vector<std::string> &headers)
+{
+	static constexpr std::string_view kCmdSuffix = ".o.cmd";
+
+	std::set<std::string> c_files;
+	std::error_code ec;
+	for (auto entry = fs::recursive_directory_iterator(
+		     kdir, fs::directory_options::skip_permission_denied, ec);
+	     entry != fs::recursive_directory_iterator();
+	     entry.increment(ec)) {
+		const std::string name = entry->path().filename();
+		if (name.empty() || name[0] != '.') {
+			continue;
+		}
+		if (entry->is_directory(ec)) {
+			entry.disable_recursion_pending();
+			continue;
+		}
+		if (!StringRef(name).endswith(kCmdSuffix)) {
+			continue;
+		}
+
+		std::ifstream cmd_file(entry->path());
+		const std::string deps(std::istreambuf_iterator<char>(cmd_file),
+				       {});
+		if (std::none_of(headers.begin(), headers.end(),
+				 [&deps](const std::string &header) {
+					 return deps.find(header) !=
+						std::string::npos;
+				 })) {
+			continue;
+		}
+
+		// .${name}.o.cmd to ${name}.c. objects from assembly are
+		// skipped.
+		const fs::path c_file =
+			entry->path().parent_path() /
+			(name.substr(1, name.size() - 1 - kCmdSuffix.size()) +
+			 ".c");
+		if (fs::exists(c_file, ec)) {
+			c_files.insert(c_file.lexically_relative(kdir));
+		}
+	}
+	return c_files;
+}
+
+// Predicts costs of a C file from records for the file if any. Otherwise,
+// fits over all records are used.
+void Predict(const BuildHistory &history, const LinearFit &time_fit,
+	     const LinearFit &rss_fit, Estimate *estimate)
+{
+	std::vector<const BuildHistory::Record *> records =
+		history.Find(estimate->path);
+	estimate->samples = records.size();
+	if (records.empty()) {
+		estimate->time_us = time_fit(estimate->tu_bytes);
+		estimate->rss_kb = rss_fit(estimate->tu_bytes);
+		return;
+	}
+
+	// the file may have grown or shrunk since it was recorded. memory is
+	// predicted by the worst case for admission.
+	std::vector<double> times;
+	for (const BuildHistory::Record *record : records) {
+		double time = record->TotalUs();
+		if (record->tu_bytes && estimate->tu_bytes) {
+			time *= static_cast<double>(estimate->tu_bytes) /
+				record->tu_bytes;
+		}
+		times.push_back(time);
+		estimate->rss_kb =
+			std::max<double>(estimate->rss_kb, record->peak_rss_kb);
+	}
+	estimate->time_us = Median(times);
+}
+
+// Returns time for jobs workers to diff all files. Each file goes to the
+// least loaded worker w/ the longest first.
+double Makespan(const std::vector<Estimate> &estimates, unsigned jobs)
+{
+	std::priority_queue<double, std::vector<double>, std::greater<double> >
+		workers;
+	for (unsigned i = 0; i < jobs; i++) {
+		workers.push(0);
+	}
+	for (const Estimate &estimate : estimates) {
+		double load = workers.top() + estimate.time_us;
+		workers.pop();
+		workers.push(load);
+	}
+
+	double makespan = 0;
+	for (; !workers.empty(); workers.pop()) {
+		makespan = std::max(makespan, workers.top());
+	}
+	return makespan;
+}
+} // namespace
+
+EstimateCommand::EstimateCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	EstimateArgs arguments;
+	struct argp argp = { /*options=*/kEstimateOptions,
+			     /*parser=*/ParseEstimateOpt,
+			     /*args_doc=*/kEstimateArgsDoc,
+			     /*args_doc=*/kEstimatePrgDoc };
+
+	// First argument is a command, 'estimate' and it's already consumed.
+	// So, argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	history_filename_ = arguments.history;
+	patch_filename_ = arguments.patch_file;
+	kdir_ = arguments.kdir ? arguments.kdir : ".";
+	jobs_ = arguments.jobs ? std::strtoul(arguments.jobs, nullptr, 10) : 1;
+	jobs_ = std::max(jobs_, 1u);
+}
+
+std::error_code EstimateCommand::Run()
+{
+	BuildHistory history(history_filename_);
+
+	// patch index: C files and headers changed by the patch.
+	std::vector<Estimate> estimates;
+	std::vector<std::string> headers;
+	{
+		Profiler::Stage stage("parse");
+		std::fstream patch(patch_filename_, std::ios::in);
+		if (!patch.is_open()) {
+			throw std::error_code{ errno, std::system_category() };
+		}
+		AutoCleanup fd_close([&patch_ = patch]() { patch_.close(); });
+
+		for (auto &[path, lines] : UnifiedDiff::ChangedFiles(patch)) {
+			if (StringRef(path).endswith(".c")) {
+				Estimate &estimate = estimates.emplace_back();
+				estimate.path = path;
+				estimate.changed_lines = lines;
+			} else if (StringRef(path).endswith(".h")) {
+				headers.push_back(path);
+			}
+		}
+	}
+	if (!headers.empty()) {
+		Profiler::Stage stage("read");
+		for (const std::string &path :
+		     FindIncludingFiles(kdir_, headers)) {
+			if (std::none_of(estimates.begin(), estimates.end(),
+					 [&path](const Estimate &estimate) {
+						 return estimate.path == path;
+					 })) {
+				Estimate &estimate = estimates.emplace_back();
+				estimate.path = path;
+				estimate.header = true;
+			}
+		}
+	}
+	if (estimates.empty()) {
+		errs() << "no C file is changed by " << patch_filename_ << "\n";
+		return ErrorCode::NOTHING_TO_PATCH;
+	}
+
+	std::vector<std::pair<double, double> > time_points;
+	std::vector<std::pair<double, double> > rss_points;
+	for (const BuildHistory::Record &record : history.records()) {
+		time_points.emplace_back(record.tu_bytes, record.TotalUs());
+		rss_points.emplace_back(record.tu_bytes, record.peak_rss_kb);
+	}
+	const LinearFit time_fit = Fit(time_points);
+	const LinearFit rss_fit = Fit(rss_points);
+
+	for (Estimate &estimate : estimates) {
+		std::error_code ec;
+		estimate.tu_bytes =
+			fs::file_size(fs::path(kdir_) / estimate.path, ec);
+		if (ec) {
+			estimate.tu_bytes = 0;
+		}
+		Predict(history, time_fit, rss_fit, &estimate);
+	}
+	std::stable_sort(estimates.begin(), estimates.end(),
+			 [](const Estimate &lhs, const Estimate &rhs) {
+				 return lhs.time_us > rhs.time_us;
+			 });
+
+	outs() << "Estimate for " << patch_filename_ << " w/ "
+	       << history.records().size() << " records\n";
+	outs() << right_justify("time(ms)", 10) << " "
+	       << right_justify("rss(MB)", 8) << " "
+	       << right_justify("tu(KB)", 8) << " "
+	       << right_justify("lines", 6) << " "
+	       << left_justify("basis", 11) << " file\n";
+	double total_us = 0;
+	std::vector<double> rss_kb;
+	for (const Estimate &estimate : estimates) {
+		std::string basis = estimate.samples ?
+					    "history:" +
+						    std::to_string(estimate.samples) :
+					    "fit";
+		outs() << format("%10.1f %8.1f %8.1f ", estimate.time_us / 1e3,
+				 estimate.rss_kb / 1024,
+				 estimate.tu_bytes / 1024.0);
+		if (estimate.header) {
+			outs() << right_justify("header", 6);
+		} else {
+			outs() << format("%6zu", estimate.changed_lines);
+		}
+		outs() << " " << left_justify(basis, 11) << " " << estimate.path
+		       << "\n";
+		total_us += estimate.time_us;
+		rss_kb.push_back(estimate.rss_kb);
+	}
+
+	// at most jobs files are diffed at the same time.
+	std::sort(rss_kb.begin(), rss_kb.end(), std::greater<double>());
+	rss_kb.resize(std::min<size_t>(rss_kb.size(), jobs_));
+	const double peak_rss_kb =
+		std::accumulate(rss_kb.begin(), rss_kb.end(), 0.0);
+	outs() << format("total: %.1f ms, %.1f ms w/ %u jobs, peak rss: %.1f MB\n",
+			 total_us / 1e3, Makespan(estimates, jobs_) / 1e3,
+			 jobs_, peak_rss_kb / 1024);
+
+	return ErrorCode::NO_ERROR;
+}
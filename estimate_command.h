@@ -0,0 +1,63 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef ESTIMATE_COMMAND_H_
+#define ESTIMATE_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "command.h"
+
+// This class implements estimate command to predict time and memory to
+// diff C files changed by a .patch file before building anything, e.g.,
+// for a scheduler to order and pack livepatch builds. The 'estimate'
+// command takes a BuildHistory appended by 'diff --history' and a .patch
+// file, e.g.,
+//
+//   $ livepatch estimate --history=history.txt --kdir=linux foo.patch
+//
+// Features are cheap to get; C files in the .patch file, C files including
+// headers in the .patch file found by .*.o.cmd files in the kernel dir,
+// and sizes of the C files. A C file w/ records in the history is
+// predicted from them, scaled by its size. Others are predicted by linear
+// fits of time and peak RSS over sizes of all records. Files are printed
+// out w/ the longest first, along w/ total time for --jobs workers.
+class EstimateCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "estimate";
+
+	EstimateCommand(int argc, char **argv) noexcept(false);
+	~EstimateCommand() override = default;
+
+	// Don't allow copy.
+	EstimateCommand(const EstimateCommand &rhs) = delete;
+	EstimateCommand &operator=(const EstimateCommand &rhs) = delete;
+
+	// Prints out predicted costs for the .patch file.
+	std::error_code Run() override;
+
+    private:
+	std::string history_filename_;
+	std::string patch_filename_;
+	std::string kdir_;
+	// number of workers diffing files in parallel.
+	unsigned jobs_ = 1;
+};
+
+#endif // ESTIMATE_COMMAND_H_
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "file_id_table.h"
+
+#include <cerrno>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "artifact_cache.h"
+#include "auto_cleanup.h"
+#include "command.h"
+#include "profiler.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace
+{
+// # of hex digits of a file ID. 32 bits are enough to tell apart files
+// changed by a .patch file. A collision is detected on loading the table.
+constexpr size_t kFileIdLength = 8;
+} // namespace
+
+std::unique_ptr<FileIdTable> FileIdTable::Create(const std::string &filename)
+{
+	if (filename.empty())
+		return nullptr;
+
+	return std::make_unique<FileIdTable>(filename);
+}
+
+FileIdTable::FileIdTable(std::string_view filename) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	std::fstream file(filename.data(), std::ios::in);
+	if (!file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
+
+	Parse(file);
+}
+
+FileIdTable::FileIdTable(std::istream &table) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	Parse(table);
+}
+
+void FileIdTable::Parse(std::istream &table) noexcept(false)
+{
+	std::string line;
+	while (getline(table, line)) {
+		std::istringstream tokens(line);
+		std::string file_id, path, extra;
+		// path is empty if the source file isn't under base dir.
+		if (!(tokens >> file_id) || (tokens >> path && tokens >> extra)) {
+			throw std::error_code{
+				Command::ErrorCode::INVALID_FILE_IDS
+			};
+		}
+
+		// The same file can be appended more than once.
+		auto [entry, inserted] = paths_.emplace(file_id, path);
+		if (!inserted && entry->second != path) {
+			llvm::errs() << "file ID, " << file_id
+				     << ", for both " << entry->second
+				     << " and " << path << "\n";
+			throw std::error_code{
+				Command::ErrorCode::INVALID_FILE_IDS
+			};
+		}
+	}
+}
+
+const std::string &FileIdTable::QueryPath(const std::string &file_id) const
+{
+	auto entry = paths_.find(file_id);
+	if (entry == paths_.end()) {
+		llvm::errs() << "unknown file ID: " << file_id << "\n";
+		throw std::error_code{ Command::ErrorCode::INVALID_FILE_IDS };
+	}
+
+	return entry->second;
+}
+
+std::string FileIdTable::FileId(std::string_view path)
+{
+	return ArtifactCache::Digest(path).substr(0, kFileIdLength);
+}
+
+void FileIdTable::Append(const std::string &filename, std::string_view path)
+{
+	std::fstream file(filename, std::ios::out | std::ios::app);
+	if (!file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
+
+	file << FileId(path) << " " << path << "\n";
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef FILE_ID_TABLE_H_
+#define FILE_ID_TABLE_H_
+
+#include <istream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// This class maps short file IDs to source files. Symbol names in
+// klp_patch.o have the source file of the symbol, e.g.,
+// klp.local.sym:${symbol}:${path}. w/ --file_ids, 'diff' puts a short ID
+// of the source file there instead of its path and appends the ID to a
+// sidecar table, which 'fixup' and 'gen' load to get the path back. The
+// format of the table is as follows;
+//
+// ${file_id} ${path_to_c_file}
+// 1f0a3c9e kernel/livepatch/core.c
+//
+// A file ID is derived from the path only. So, 'diff' for different files
+// can append to the same table, and the same file always has the same ID.
+class FileIdTable final {
+    public:
+	FileIdTable(std::string_view filename) noexcept(false);
+	// Parses the table from a stream, e.g., one in memory.
+	FileIdTable(std::istream &table) noexcept(false);
+	~FileIdTable() = default;
+
+	// Don't allow copy.
+	FileIdTable(const FileIdTable &rhs) = delete;
+	FileIdTable &operator=(const FileIdTable &rhs) = delete;
+
+	// Returns path for given file ID. If no match found, it throws an
+	// exception.
+	const std::string &QueryPath(const std::string &file_id) const
+		noexcept(false);
+
+	// Returns file ID for given path.
+	static std::string FileId(std::string_view path);
+
+	// Appends an entry for path to the table.
+	static void Append(const std::string &filename, std::string_view path)
+		noexcept(false);
+
+	static std::unique_ptr<FileIdTable> Create(const std::string &filename);
+
+    private:
+	void Parse(std::istream &table) noexcept(false);
+
+	// key: file ID, value: path
+	std::unordered_map<std::string, std::string> paths_;
+};
+
+#endif // FILE_ID_TABLE_H_
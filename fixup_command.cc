@@ -26,6 +26,7 @@
 
 #include <algorithm>
 #include <iterator>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
@@ -33,12 +34,19 @@
 #include <utility>
 #include <vector>
 
+#include "archive_index.h"
 #include "elf_error.h"
 #include "elf_bin.h"
 #include "elf_rela.h"
 #include "elf_symbol.h"
+#include "file_id_table.h"
+#include "profiler.h"
 #include "symbol_map.h"
 #include "thin_archive.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/raw_ostream.h"
 
 using namespace llvm;
@@ -49,11 +57,13 @@ struct FixupArgs {
 	char *mod_filename = nullptr;
 	char *symbol_map = nullptr;
 	char *thin_archive = nullptr;
+	char *file_ids = nullptr;
+	std::vector<std::string> archives;
 	bool create_klp_rela = false;
 	bool quiet_mode = false;
 };
 
-const char kFixupArgsDoc[] = "<klp_patch.o>";
+const char kFixupArgsDoc[] = "<klp_patch.o|livepatch.ll>";
 const char kFixupPrgDoc[] = "common fixup options:\n";
 const struct argp_option kFixupOptions[] = {
 	// name, key, arg, flags, doc,
@@ -63,6 +73,10 @@ const struct argp_option kFixupOptions[] = {
 	  "Symbol map file for LLpatch symbols in livepatch wrapper" },
 	{ "thin_archive", 't', "THIN_ARCHIVE", 0,
 	  "Thin archive file for kernel module or vmlinux" },
+	{ "archive", 'a', "NAME=THIN_ARCHIVE", 0,
+	  "Thin archive file for object NAME, vmlinux or module name. can be repeated" },
+	{ "file_ids", 'i', "FILE_IDS", 0,
+	  "File ID table for symbol names created by 'diff --file_ids'" },
 	{ "rela", 'r', nullptr, 0, "Create relocation section for KLP" },
 	{ "quiet", 'q', nullptr, 0, "Don't print out any messages on fixup" },
 	{ nullptr }
@@ -71,6 +85,15 @@ const struct argp_option kFixupOptions[] = {
 constexpr std::string_view kKlpPrefix = ".klp.sym.";
 constexpr std::string_view kKlpRelaPrefix = ".klp.rela.";
 constexpr std::string_view kObjVmlinux = "vmlinux.";
+constexpr std::string_view kVmlinux = "vmlinux";
+// suffix of livepatch wrapper in LLVM IR
+constexpr std::string_view kIRSuffix = ".ll";
+
+bool IsWrapperIR(std::string_view filename)
+{
+	return filename.size() > kIRSuffix.size() &&
+	       filename.substr(filename.size() - kIRSuffix.size()) == kIRSuffix;
+}
 
 error_t ParseFixupOpt(int key, char *arg, struct argp_state *state)
 {
@@ -92,6 +115,18 @@ error_t ParseFixupOpt(int key, char *arg, struct argp_state *state)
 	case 't':
 		args->thin_archive = arg;
 		break;
+	case 'i':
+		args->file_ids = arg;
+		break;
+	case 'a': {
+		std::string_view archive(arg);
+		size_t eq = archive.find('=');
+		if (eq == std::string_view::npos || eq == 0) {
+			argp_usage(state);
+		}
+		args->archives.emplace_back(archive);
+		break;
+	}
 	case ARGP_KEY_ARG:
 		if (!args->klp_patch_filename) {
 			args->klp_patch_filename = arg;
@@ -103,6 +138,11 @@ error_t ParseFixupOpt(int key, char *arg, struct argp_state *state)
 		if (!args->klp_patch_filename) {
 			argp_usage(state);
 		}
+		// only LLpatch symbols in the wrapper are renamed.
+		if (IsWrapperIR(args->klp_patch_filename) &&
+		    (!args->symbol_map || args->create_klp_rela)) {
+			argp_usage(state);
+		}
 		break;
 	default:
 		return ARGP_ERR_UNKNOWN;
@@ -110,6 +150,45 @@ error_t ParseFixupOpt(int key, char *arg, struct argp_state *state)
 	return 0;
 }
 
+// Gets name of KLP symbol for symbol defined in src_file of obj_name. See
+// FixupCommand::RenameKlpSymbols() for the format. sympos is looked up in
+// thin archive(s) of plan if any.
+std::error_code KlpSymbolName(const FixupCommand::SymbolPlan &plan,
+			      const std::string &obj_name, StringRef symbol,
+			      StringRef src_file, std::string *klp_sym_name)
+{
+	const ThinArchive *tar = plan.thin_archive;
+	const ArchiveIndex *archives = plan.archives;
+	int pos = 0;
+	if (tar || archives) {
+		const auto &symbol_str = symbol.str();
+		const auto &filename = src_file.rsplit('.').first.str() + ".o";
+		pos = tar ? tar->QuerySymbol(symbol_str, filename) :
+			    archives->QuerySymbol(obj_name, symbol_str,
+						  filename);
+		if (pos < 0) {
+			errs() << "Symbol: " << symbol_str
+			       << ", Filename: " << filename << "\n"
+			       << "Fail to find the symbol in thin archive\n";
+			return Command::ErrorCode::SYM_FIND_FAILED;
+		}
+	}
+
+	*klp_sym_name = std::string(kKlpPrefix) + obj_name + "." +
+			symbol.str() + "," + std::to_string(pos);
+	return Command::ErrorCode::NO_ERROR;
+}
+
+// Gets vmlinux or module name from a KLP symbol,
+// .klp.sym.${mod_name}.${symbol},${sympos}.
+std::string KlpModName(std::string_view klp_sym_name)
+{
+	size_t mod_name_start = kKlpPrefix.length();
+	size_t mod_name_end = klp_sym_name.find('.', mod_name_start);
+	return std::string(klp_sym_name.substr(mod_name_start,
+					       mod_name_end - mod_name_start));
+}
+
 } // namespace
 
 // Assumption: there is 1-to-1 correspondence between a relocation section
@@ -121,105 +200,151 @@ error_t ParseFixupOpt(int key, char *arg, struct argp_state *state)
 // [ 2] .rela.text  RELA      0000000000000000 001510 002268 18   I 18   1  8
 //
 // ".rela.text" should be only one relocation section for ".text".
-std::error_code FixupCommand::CreateKlpRela(ElfBin *elf_bin)
+std::error_code FixupCommand::CreateKlpRela(ElfBin *elf_bin,
+					    llvm::raw_ostream &out)
 {
-	ElfRela::KlpRelaEntryMap klp_rela_entry_map;
-	ElfRela::RelaEntryMap rela_entry_map;
+	Profiler::Stage stage("rela");
+	// Relocation entries are partitioned in two passes over rela
+	// sections. The first pass counts entries per destination, i.e., KLP
+	// rela section for (mod_name, section_id) or existing rela section
+	// w/o entries for livepatched symbols. The second pass places entries
+	// into buffers reserved w/ the counts. So, only rela sections w/
+	// livepatched symbols are copied, once, and the buffers are given to
+	// libelf as they are.
+	std::map<std::pair</*mod_name*/ std::string, /*section_id*/ size_t>,
+		 size_t>
+		klp_counts;
+	// key: section_id, value: number of entries for non-livepatched
+	// symbols.
+	std::unordered_map<size_t, size_t> kept_counts;
+	// key: section_id w/ livepatched symbols, value: its symbol table.
 	std::unordered_map<size_t, size_t> symtab_map;
 	for (ElfRela *i : elf_bin->Relas()) {
-		std::string sym_name(i->Name());
+		std::string_view sym_name = i->Name();
 		if (sym_name.find(kKlpPrefix) != 0) {
-			// Store rela entry for non-livepatched symbols.
-			rela_entry_map[i->SectionId()].emplace_back(
-				*(i->Entry()));
+			kept_counts[i->SectionId()]++;
 			continue;
 		}
+		const std::string &mod_name = KlpModName(sym_name);
 		i->SetSectionIndex(ElfSymbol::SectionIndex::LIVEPATCH);
 
-		size_t mod_name_start = kKlpPrefix.length();
-		size_t mod_name_end =
-			sym_name.find('.', mod_name_start) - mod_name_start;
-		const std::string &mod_name =
-			sym_name.substr(mod_name_start, mod_name_end);
+		out << "klp symbol[" << mod_name << "] :: ";
+		i->PrintCurrentEntry(out);
 
-		if (!quiet_mode_) {
-			out_ << "klp symbol[" << mod_name << "] :: ";
-			i->PrintCurrentEntry();
-		}
+		klp_counts[std::make_pair(mod_name, i->SectionId())]++;
+		symtab_map[i->SectionId()] = i->SymTabId();
+	}
+
+	ElfRela::KlpRelaEntryMap klp_rela_entry_map;
+	for (const auto &[entry_key, count] : klp_counts) {
+		klp_rela_entry_map[entry_key].reserve(count);
+	}
+	// rela sections w/o livepatched symbols are kept intact.
+	ElfRela::RelaEntryMap rela_entry_map;
+	for (const auto &[section_id, symtab_id] : symtab_map) {
+		rela_entry_map[section_id].reserve(kept_counts[section_id]);
+	}
 
-		// Collect all relocation entries for livepatched symbols.
-		klp_rela_entry_map[std::make_pair(mod_name, i->SectionId())]
+	for (ElfRela *i : elf_bin->Relas()) {
+		auto kept = rela_entry_map.find(i->SectionId());
+		if (kept == rela_entry_map.end()) {
+			// no livepatched symbols in this section.
+			continue;
+		}
+		std::string_view sym_name = i->Name();
+		if (sym_name.find(kKlpPrefix) != 0) {
+			kept->second.emplace_back(*(i->Entry()));
+			continue;
+		}
+		klp_rela_entry_map[std::make_pair(KlpModName(sym_name),
+						  i->SectionId())]
 			.emplace_back(*(i->Entry()));
-		symtab_map[i->SectionId()] = i->SymTabId();
 	}
 
 	// Update existing rela sections to avoid duplication with KLP rela
 	// sections.
 	for (auto &[section_id, rela_vector] : rela_entry_map) {
-		// Update rela section that has livepatched symbols.
 		elf_bin->UpdateRela(section_id, &rela_vector);
 	}
 
-	// Update RELA sections before adding new KLP RELA sections.
-	elf_bin->ElfUpdate();
+	// Format for The name of a livepatch relocation section:
+	//
+	// .klp.rela.objname.section_name
+	// ^        ^^     ^ ^          ^
+	// |________||_____| |__________|
+	//    [A]      [B]        [C]
+	// [A]: prefix
+	// [B]: vmlinux or module name that the symbol belongs.
+	// [C]: section name to which this relocation section applies. should be "text"
+	std::vector<std::string> klp_rela_names;
+	size_t names_size = 0;
+	for (const auto &[entry_key, rela_vector] : klp_rela_entry_map) {
+		klp_rela_names.emplace_back(
+			std::string(kKlpRelaPrefix) +
+			std::get</*mod_name*/ 0>(entry_key) + "." +
+			std::string(elf_bin->SectionName(
+				std::get</*section_id*/ 1>(entry_key))));
+		names_size += klp_rela_names.back().size() + 1;
+	}
 
-	// Create new relocation section for KLP.
+	// Create new relocation section for KLP. Names of the sections are
+	// appended to the section name string section.
 	std::unique_ptr<std::vector<char> > str_section =
 		elf_bin->GetSection(elf_bin->GetStringSectionIndex());
-
+	str_section->reserve(str_section->size() + names_size);
+	auto klp_rela_name = klp_rela_names.begin();
 	for (auto &[entry_key, rela_vector] : klp_rela_entry_map) {
 		elf_bin->CreateKlpRela(std::get</*section_id*/ 1>(entry_key),
 				       symtab_map[std::get<1>(entry_key)],
 				       str_section->size(), &rela_vector);
 
-		// Format for The name of a livepatch relocation section:
-		//
-		// .klp.rela.objname.section_name
-		// ^        ^^     ^ ^          ^
-		// |________||_____| |__________|
-		//    [A]      [B]        [C]
-		// [A]: prefix
-		// [B]: vmlinux or module name that the symbol belongs.
-		// [C]: section name to which this relocation section applies. should be "text"
-		const std::string kKlpRelaName =
-			std::string(kKlpRelaPrefix) +
-			std::get</*mod_name*/ 0>(entry_key) + "." +
-			std::string(
-				elf_bin->SectionName(std::get<1>(entry_key)));
-
-		llvm::outs() << "KLP rela section::" << kKlpRelaName << "\n";
-		std::copy(kKlpRelaName.begin(), kKlpRelaName.end(),
-			  std::back_insert_iterator<std::vector<char> >(
-				  *str_section));
+		out << "KLP rela section::" << *klp_rela_name << "\n";
+		str_section->insert(str_section->end(), klp_rela_name->begin(),
+				    klp_rela_name->end());
 		str_section->push_back('\0');
+		++klp_rela_name;
 	}
 
 	elf_bin->UpdateSection(elf_bin->GetStringSectionIndex(),
 			       str_section->data(), str_section->size());
 
+	// All sections are written at once.
 	elf_bin->ElfUpdate();
 
 	return Command::ErrorCode::NO_ERROR;
 }
 
+void FixupCommand::LoadModule(ElfBin *mod_bin, SymbolPlan *plan)
+{
+	// Load names for all "defined" symbols in kernel module.
+	for (ElfSymbol *i : mod_bin->Symbols()) {
+		if (i->HasSectionIndex(ElfSymbol::SectionIndex::UNDEF)) {
+			continue;
+		}
+		plan->mod_symbols.insert(std::string(i->Name()));
+	}
+	plan->mod_name = mod_bin->ModName();
+}
+
+std::error_code FixupCommand::Fixup(ElfBin *elf_bin, const SymbolPlan &plan,
+				    llvm::raw_ostream &out)
+{
+	if (plan.create_klp_rela) {
+		return CreateKlpRela(elf_bin, out);
+	}
+	return RenameKlpSymbols(elf_bin, plan, out);
+}
+
 std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
-					       std::string_view mod_filename,
-					       std::string_view symbol_map,
-					       std::string_view thin_archive)
+					       const SymbolPlan &plan,
+					       llvm::raw_ostream &out)
 {
-	// Load names for all "defined" symbols in kernel module if specified.
-	std::unordered_set<std::string> mod_symbol_set;
+	Profiler::Stage stage("rename");
+	const std::unordered_set<std::string> &mod_symbol_set =
+		plan.mod_symbols;
 	std::string mod_name(kObjVmlinux);
-	if (!mod_filename.empty()) {
-		ElfBin mod_bin(mod_filename);
-		for (ElfSymbol *i : mod_bin.Symbols()) {
-			if (i->HasSectionIndex(
-				    ElfSymbol::SectionIndex::UNDEF)) {
-				continue;
-			}
-			mod_symbol_set.insert(std::string(i->Name()));
-		}
-		mod_name = mod_bin.ModName() + ".";
+	if (!plan.mod_name.empty()) {
+		mod_name = plan.mod_name + ".";
 	}
 
 	// Elf binary always starts w/ dummy undefined symbol. iterator from
@@ -244,10 +369,11 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 	// symbol if it's undefined. While renaming the symbol, it also builds
 	// up a memory buffer for symbol names. The buffer is used to update
 	// string section in ELF binary after this loop.
-	std::unique_ptr<ThinArchive> tar =
-		ThinArchive::Create(std::string(thin_archive));
-	std::unique_ptr<SymbolMap> sym_map =
-		SymbolMap::Create(std::string(symbol_map));
+	const SymbolMap *sym_map = plan.symbol_map;
+	// object that symbols belong to unless symbol map says otherwise. see
+	// ArchiveIndex.
+	const std::string kDefaultObjName =
+		plan.mod_name.empty() ? std::string(kVmlinux) : plan.mod_name;
 	for (ElfSymbol *i : elf_symbols) {
 		// __fentry__ is for kernel's ftrace. don't touch even though it's UND.
 		if (!i->HasSectionIndex(ElfSymbol::SectionIndex::UNDEF) ||
@@ -258,6 +384,7 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 
 		StringRef RealSymName = i->Name();
 		StringRef SrcFile;
+		std::string obj_name = kDefaultObjName;
 		std::string SymName = std::string(i->Name());
 		std::string RealSymNameStr = RealSymName.str();
 
@@ -269,9 +396,8 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 				RealSymName =
 					sym_entry[SymbolMap::ElemIndex::SYMBOL];
 				SrcFile = sym_entry[SymbolMap::ElemIndex::PATH];
-				mod_name =
-					sym_entry[SymbolMap::ElemIndex::MOD_NAME] +
-					".";
+				obj_name =
+					sym_entry[SymbolMap::ElemIndex::MOD_NAME];
 				RealSymNameStr.assign(RealSymName);
 			} else {
 				// with symbol map given, only llpatch symbol should be KLP
@@ -284,6 +410,10 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 				auto SplitName = RealSymName.split(':');
 				RealSymName = SplitName.second.split(':').first;
 				SrcFile = SplitName.second.split(':').second;
+				if (plan.file_ids) {
+					SrcFile = plan.file_ids->QueryPath(
+						SrcFile.str());
+				}
 				RealSymNameStr.assign(RealSymName);
 			}
 
@@ -316,27 +446,16 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 		//      symbol position is expressed numerically (0, 1,
 		//      2, ...). The symbol position of a unique symbol
 		//      is 0.
-		int pos = 0;
-		if (tar) {
-			const auto &symbol = RealSymName.str();
-			const auto &filename =
-				SrcFile.rsplit('.').first.str() + ".o";
-			pos = tar->QuerySymbol(symbol, filename);
-			if (pos < 0) {
-				errs() << "Symbol: " << symbol
-				       << ", Filename: " << filename << "\n"
-				       << "Fail to find the symbol in thin archive\n";
-				return Command::ErrorCode::SYM_FIND_FAILED;
-			}
+		std::string klp_sym_name;
+		std::error_code ec = KlpSymbolName(plan, obj_name, RealSymName,
+						   SrcFile, &klp_sym_name);
+		if (ec) {
+			return ec;
 		}
 
-		const std::string kKlpSymName = std::string(kKlpPrefix) +
-						mod_name + RealSymNameStr +
-						"," + std::to_string(pos);
-
-		out_ << "KLP Symbols::" << RealSymNameStr << " --> "
-		     << kKlpSymName << "\n";
-		RenameSymbol(i, kKlpSymName);
+		out << "KLP Symbols::" << RealSymNameStr << " --> "
+		     << klp_sym_name << "\n";
+		RenameSymbol(i, klp_sym_name);
 	}
 
 	// A new memory buffer for symbol name is built up in
@@ -350,6 +469,67 @@ std::error_code FixupCommand::RenameKlpSymbols(ElfBin *elf_bin,
 	return Command::ErrorCode::NO_ERROR;
 }
 
+std::error_code FixupCommand::FixupWrapper(Module *wrapper,
+					   const SymbolPlan &plan,
+					   llvm::raw_ostream &out)
+{
+	Profiler::Stage stage("rename");
+	const SymbolMap *sym_map = plan.symbol_map;
+	if (!sym_map) {
+		return Command::ErrorCode::NO_SYM_MAP;
+	}
+
+	// LLpatch symbols are declared by LLPATCH_DECLARE_SYMBOL and defined
+	// in vmlinux or kernel modules. collect them first since renaming
+	// below can erase some of them from the module.
+	std::vector<GlobalValue *> llpatch_symbols;
+	for (GlobalValue &i : wrapper->global_values()) {
+		if (i.isDeclaration() &&
+		    !ElfSymbol::LLpatchSymbolAlias(i.getName()).empty()) {
+			llpatch_symbols.push_back(&i);
+		}
+	}
+
+	for (GlobalValue *i : llpatch_symbols) {
+		auto alias = ElfSymbol::LLpatchSymbolAlias(i->getName());
+		const auto &sym_entry = sym_map->QueryAlias(alias.str());
+		const std::string &sym_name =
+			sym_entry[SymbolMap::ElemIndex::SYMBOL];
+		std::string klp_sym_name;
+		std::error_code ec = KlpSymbolName(
+			plan, sym_entry[SymbolMap::ElemIndex::MOD_NAME],
+			sym_name, sym_entry[SymbolMap::ElemIndex::PATH],
+			&klp_sym_name);
+		if (ec) {
+			return ec;
+		}
+
+		out << "KLP Symbols::" << sym_name << " --> " << klp_sym_name
+		    << "\n";
+
+		// Several aliases can be declared for the same symbol.
+		GlobalValue *klp_sym = wrapper->getNamedValue(klp_sym_name);
+		if (klp_sym) {
+			i->replaceAllUsesWith(
+				ConstantExpr::getPointerBitCastOrAddrSpaceCast(
+					klp_sym, i->getType()));
+			i->eraseFromParent();
+			continue;
+		}
+
+		// SHN_LIVEPATCH can't be set in LLVM IR. 'fixup --rela' sets it
+		// for KLP symbols in livepatch module later. Till then, weak
+		// binding keeps modpost from failing on the undefined symbol.
+		// dso_local avoids GOT relocations for the weak symbol, which
+		// kernel module loader doesn't handle.
+		i->setName(klp_sym_name);
+		i->setLinkage(GlobalValue::ExternalWeakLinkage);
+		i->setDSOLocal(true);
+	}
+
+	return Command::ErrorCode::NO_ERROR;
+}
+
 std::unique_ptr<FixupCommand> FixupCommand::Create(int argc, char **argv)
 	noexcept(false)
 {
@@ -373,7 +553,6 @@ std::unique_ptr<FixupCommand> FixupCommand::Create(int argc, char **argv)
 	auto *cmd = new FixupCommand(arguments.quiet_mode ? llvm::nulls() :
 								  llvm::outs());
 
-	cmd->quiet_mode_ = arguments.quiet_mode;
 	cmd->klp_patch_filename_ = arguments.klp_patch_filename;
 	if (arguments.mod_filename) {
 		cmd->mod_filename_ = arguments.mod_filename;
@@ -388,19 +567,72 @@ std::unique_ptr<FixupCommand> FixupCommand::Create(int argc, char **argv)
 		cmd->symbol_map_ = arguments.symbol_map;
 	}
 
+	if (arguments.file_ids) {
+		cmd->file_ids_ = arguments.file_ids;
+	}
+
+	cmd->archives_ = std::move(arguments.archives);
+
 	return std::unique_ptr<FixupCommand>(cmd);
 }
 
 std::error_code FixupCommand::Run()
 {
-	std::error_code ec;
+	SymbolPlan plan;
+	plan.create_klp_rela = create_klp_rela_;
+
+	std::unique_ptr<ThinArchive> tar;
+	std::unique_ptr<SymbolMap> sym_map;
+	std::unique_ptr<FileIdTable> file_ids;
+	std::unique_ptr<ArchiveIndex> archives;
+	if (!create_klp_rela_) {
+		if (!mod_filename_.empty()) {
+			ElfBin mod_bin(mod_filename_, ElfBin::OpenMode::LAZY);
+			LoadModule(&mod_bin, &plan);
+		}
+		tar = ThinArchive::Create(thin_archive_);
+		sym_map = SymbolMap::Create(symbol_map_);
+		plan.thin_archive = tar.get();
+		plan.symbol_map = sym_map.get();
+		file_ids = FileIdTable::Create(file_ids_);
+		plan.file_ids = file_ids.get();
+		archives = ArchiveIndex::Create(archives_);
+		plan.archives = archives.get();
+	}
+
+	if (IsWrapperIR(klp_patch_filename_)) {
+		return RunWrapper(plan);
+	}
+
 	ElfBin elf_bin(klp_patch_filename_);
-	if (create_klp_rela_) {
-		ec = CreateKlpRela(&elf_bin);
-	} else {
-		ec = RenameKlpSymbols(&elf_bin, mod_filename_, symbol_map_,
-				      thin_archive_);
+	return Fixup(&elf_bin, plan, out_);
+}
+
+std::error_code FixupCommand::RunWrapper(const SymbolPlan &plan)
+{
+	LLVMContext context;
+	std::unique_ptr<Module> wrapper;
+	{
+		Profiler::Stage stage("parse");
+		SMDiagnostic diag;
+		wrapper = parseIRFile(klp_patch_filename_, diag, context);
+	}
+	if (!wrapper) {
+		errs() << "Livepatch wrapper is not valid LLVM\n";
+		return ErrorCode::INVALID_LLVM_FILE;
 	}
 
+	std::error_code ec = FixupWrapper(wrapper.get(), plan, out_);
+	if (ec) {
+		return ec;
+	}
+
+	// the wrapper is updated in place, same as klp_patch.o.
+	Profiler::Stage stage("render");
+	raw_fd_ostream fout(klp_patch_filename_, ec);
+	if (ec) {
+		return ec;
+	}
+	wrapper->print(fout, nullptr);
 	return ec;
 }
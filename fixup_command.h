@@ -22,9 +22,16 @@
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <unordered_set>
+#include <vector>
 
+#include "archive_index.h"
 #include "command.h"
 #include "elf_bin.h"
+#include "file_id_table.h"
+#include "symbol_map.h"
+#include "thin_archive.h"
+#include "llvm/IR/Module.h"
 #include "llvm/Support/raw_ostream.h"
 
 // This class implements fixup command for kernel livepatch generation. The
@@ -35,6 +42,10 @@
 // https://www.kernel.org/doc/html/latest/livepatch/module-elf-format.html
 // It also creates a non-standard relocation section for kernel livepatch
 // subsystem.
+//
+// If LLVM IR of livepatch wrapper, .ll file, is given instead, LLpatch
+// symbols in the IR are renamed w/ symbol map. So, the wrapper is compiled
+// into livepatch.o w/ KLP symbols, and no fixup on livepatch.o is needed.
 class FixupCommand : public Command {
     public:
 	static constexpr std::string_view kCommandName = "fixup";
@@ -48,20 +59,56 @@ class FixupCommand : public Command {
 	static std::unique_ptr<FixupCommand> Create(int argc, char **argv)
 		noexcept(false);
 
+	// Symbols and databases to rename UND symbols w/.
+	struct SymbolPlan {
+		// Name of kernel module w/ livepatched functions. Empty for
+		// vmlinux.
+		std::string mod_name;
+		// "defined" symbols in the kernel module.
+		std::unordered_set<std::string> mod_symbols;
+		// Optional databases for symbol positions and llpatch aliases.
+		// If both thin_archive and archives are given, thin_archive is
+		// used.
+		const ThinArchive *thin_archive = nullptr;
+		const ArchiveIndex *archives = nullptr;
+		const SymbolMap *symbol_map = nullptr;
+		// Required if klp_patch.o has file IDs in symbol names.
+		const FileIdTable *file_ids = nullptr;
+		// If true, a relocation section for KLP is created instead of
+		// renaming UND symbols.
+		bool create_klp_rela = false;
+	};
+
 	// Runs fixup command to rename UND symbols and create a relocation
 	// section for kernel livepatch subsystem.
 	std::error_code Run() override;
 
+	// Loads name and "defined" symbols of a kernel module into plan.
+	static void LoadModule(ElfBin *mod_bin, SymbolPlan *plan);
+
+	// Renames UND symbols of klp_patch.o or creates a relocation section
+	// for KLP, depending on plan. Messages are printed out to out.
+	static std::error_code Fixup(ElfBin *elf_bin, const SymbolPlan &plan,
+				     llvm::raw_ostream &out);
+
+	// Renames LLpatch symbols, __llpatch_symbol_${alias}, in LLVM IR of
+	// livepatch wrapper to KLP symbols. plan.symbol_map is required.
+	// Messages are printed out to out.
+	static std::error_code FixupWrapper(llvm::Module *wrapper,
+					    const SymbolPlan &plan,
+					    llvm::raw_ostream &out);
+
     private:
 	FixupCommand(llvm::raw_ostream &out) : out_(out)
 	{
 	}
 
-	std::error_code CreateKlpRela(ElfBin *elf_bin);
-	std::error_code RenameKlpSymbols(ElfBin *elf_bin,
-					 std::string_view mod_filename,
-					 std::string_view symbol_map,
-					 std::string_view thin_archive);
+	static std::error_code CreateKlpRela(ElfBin *elf_bin,
+					     llvm::raw_ostream &out);
+	static std::error_code RenameKlpSymbols(ElfBin *elf_bin,
+						const SymbolPlan &plan,
+						llvm::raw_ostream &out);
+	std::error_code RunWrapper(const SymbolPlan &plan);
 
 	std::string klp_patch_filename_;
 	// If changes for livepatch are made in kernel module, the path to the
@@ -70,9 +117,11 @@ class FixupCommand : public Command {
 	std::string mod_filename_;
 	std::string symbol_map_;
 	std::string thin_archive_;
+	std::string file_ids_;
+	// "${obj_name}=${thin_archive}" for ArchiveIndex
+	std::vector<std::string> archives_;
 	bool create_klp_rela_ = false;
 	llvm::raw_ostream &out_;
-	bool quiet_mode_ = false;
 };
 
 #endif // FIXUP_COMMAND_H_
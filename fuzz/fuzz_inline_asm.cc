@@ -0,0 +1,61 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// libFuzzer harness for the filter of module-level inline assembly and
+// special globals in 'diff'. Input is the inline assembly, and each of its
+// lines also names a global variable, e.g., __ksymtab_foo or __initcall_bar.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+
+#include "../diff_command.h"
+#include "llvm/IR/GlobalVariable.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/Type.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const std::string input(reinterpret_cast<const char *>(data), size);
+	llvm::LLVMContext context;
+	llvm::Module mod("fuzz", context);
+	mod.setModuleInlineAsm(input);
+
+	std::istringstream lines(input);
+	std::string line;
+	while (std::getline(lines, line)) {
+		new llvm::GlobalVariable(mod, llvm::Type::getInt32Ty(context),
+					 /*isConstant=*/false,
+					 llvm::GlobalValue::ExternalLinkage,
+					 /*Initializer=*/nullptr, line);
+	}
+
+	DiffCommand::RemoveSpecialGlobals(&mod);
+	if (!mod.getModuleInlineAsm().empty()) {
+		std::abort();
+	}
+	for (const llvm::GlobalVariable &var : mod.globals()) {
+		if (var.getName().startswith("__ksymtab") ||
+		    var.getName().startswith("__kstrtab")) {
+			std::abort();
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// libFuzzer harness for parser of `gen-symbol-map` output, SymbolMap. The
+// last word of each line, an llpatch alias, is queried back.
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include "../symbol_map.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const std::string input(reinterpret_cast<const char *>(data), size);
+	std::istringstream symbol_map(input);
+	try {
+		SymbolMap map(symbol_map);
+
+		std::istringstream lines(input);
+		std::string line;
+		while (std::getline(lines, line)) {
+			try {
+				map.QueryAlias(line.substr(line.rfind(' ') + 1));
+			} catch (const std::error_code &ec) {
+				// not an alias.
+			}
+		}
+	} catch (const std::error_code &ec) {
+		// malformed symbol maps are rejected w/ an error code.
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// libFuzzer harness for parser of `nm -f posix` output, ThinArchive. Symbols
+// in the input are queried back w/ and w/o their object files.
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <system_error>
+
+#include "../thin_archive.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const std::string input(reinterpret_cast<const char *>(data), size);
+	std::istringstream nm_output(input);
+	try {
+		ThinArchive archive(nm_output);
+
+		// first word of each line is a symbol or an object file.
+		std::istringstream lines(input);
+		std::string line;
+		while (std::getline(lines, line)) {
+			const std::string word = line.substr(0, line.find(' '));
+			archive.QuerySymbol(word, "");
+			archive.QuerySymbol(word, word);
+		}
+	} catch (const std::error_code &ec) {
+		// malformed nm outputs are rejected w/ an error code.
+	}
+	return 0;
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// libFuzzer harness for .patch parser, UnifiedDiff. Input is a .patch file
+// for kernel/fork.c. Hunks are applied to lines of their own old side and
+// aligned, so that fuzzed line #s and counts reach Apply() and Align().
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "../unified_diff.h"
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	std::istringstream patch(
+		std::string(reinterpret_cast<const char *>(data), size));
+	try {
+		UnifiedDiff diff(patch, "kernel/fork.c");
+
+		std::vector<std::string> original;
+		for (const UnifiedDiff::Hunk &hunk : diff.hunks()) {
+			for (const std::string &line : hunk.lines) {
+				if (!line.empty() && line[0] != '+') {
+					original.push_back(line.substr(1));
+				}
+			}
+		}
+
+		std::vector<std::string> patched, aligned_original,
+			aligned_patched;
+		diff.Apply(original, /*fuzz=*/2, &patched, &aligned_original,
+			   &aligned_patched);
+		diff.Align(original, patched, &aligned_original,
+			   &aligned_patched);
+	} catch (const std::error_code &ec) {
+		// malformed .patch files are rejected w/ an error code.
+	}
+
+	patch.clear();
+	patch.seekg(0);
+	try {
+		UnifiedDiff::ChangedFiles(patch);
+	} catch (const std::error_code &ec) {
+	}
+	return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// Replays inputs through a harness w/o libFuzzer, e.g., w/ g++ or to check
+// corpora in regression runs. Files and dirs of files are given in argv, and
+// the same budgets as libFuzzer are taken, i.e.,
+//
+//   $ fuzz_unified_diff -timeout=2 -rss_limit_mb=512 corpus/unified_diff
+//
+// An input that takes longer than -timeout seconds or grows RSS over
+// -rss_limit_mb is reported and fails the run, same as a crash.
+
+#include <dirent.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <csignal>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+namespace
+{
+// input being run. reported when the timer fires.
+const char *current_input = "";
+
+void HandleAlarm(int sig)
+{
+	fprintf(stderr, "timeout: %s\n", current_input);
+	_exit(1);
+}
+
+long PeakRssMb()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss / 1024;
+}
+
+void CollectInputs(const std::string &path, std::vector<std::string> *inputs)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0) {
+		fprintf(stderr, "failed to stat %s\n", path.c_str());
+		exit(1);
+	}
+	if (!S_ISDIR(st.st_mode)) {
+		inputs->push_back(path);
+		return;
+	}
+
+	DIR *dir = opendir(path.c_str());
+	if (!dir) {
+		fprintf(stderr, "failed to open %s\n", path.c_str());
+		exit(1);
+	}
+	std::vector<std::string> files;
+	while (struct dirent *entry = readdir(dir)) {
+		if (entry->d_name[0] != '.') {
+			files.push_back(path + "/" + entry->d_name);
+		}
+	}
+	closedir(dir);
+	std::sort(files.begin(), files.end());
+	for (const std::string &file : files) {
+		CollectInputs(file, inputs);
+	}
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+	unsigned timeout = 0;
+	long rss_limit_mb = 0;
+	std::vector<std::string> inputs;
+	for (int i = 1; i < argc; i++) {
+		if (strncmp(argv[i], "-timeout=", 9) == 0) {
+			timeout = strtoul(argv[i] + 9, nullptr, 10);
+		} else if (strncmp(argv[i], "-rss_limit_mb=", 14) == 0) {
+			rss_limit_mb = strtol(argv[i] + 14, nullptr, 10);
+		} else if (argv[i][0] != '-') {
+			CollectInputs(argv[i], &inputs);
+		}
+		// other libFuzzer flags are ignored.
+	}
+
+	signal(SIGALRM, HandleAlarm);
+	for (const std::string &input : inputs) {
+		std::ifstream file(input, std::ios::binary);
+		std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)),
+					  std::istreambuf_iterator<char>());
+
+		current_input = input.c_str();
+		alarm(timeout);
+		auto start = std::chrono::steady_clock::now();
+		LLVMFuzzerTestOneInput(data.data(), data.size());
+		alarm(0);
+		auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+			std::chrono::steady_clock::now() - start);
+
+		if (rss_limit_mb && PeakRssMb() > rss_limit_mb) {
+			fprintf(stderr, "out of memory: %s, %ld MB\n",
+				input.c_str(), PeakRssMb());
+			return 1;
+		}
+		printf("ok: %s, %lld ms\n", input.c_str(),
+		       static_cast<long long>(elapsed.count()));
+	}
+	printf("%zu inputs are replayed\n", inputs.size());
+	return 0;
+}
@@ -22,13 +22,18 @@
 
 #include <filesystem>
 #include <fstream>
+#include <istream>
 #include <memory>
+#include <ostream>
+#include <sstream>
 #include <string>
 #include <string_view>
-#include <tuple>
+#include <utility>
+#include <vector>
 
 #include "elf_error.h"
 #include "elf_symbol.h"
+#include "profiler.h"
 #include "thin_archive.h"
 #include "llvm/Support/raw_ostream.h"
 
@@ -43,6 +48,7 @@ struct GenArgs {
 	char *mod_filename = nullptr;
 	char *klp_mod_name = nullptr;
 	char *thin_archive = nullptr;
+	char *file_ids = nullptr;
 };
 
 const char kGenArgsDoc[] = "<klp_patch.o>";
@@ -56,6 +62,8 @@ const struct argp_option kGenOptions[] = {
 	{ "name", 'n', "NAME", 0, "KLP module name" },
 	{ "thin_archive", 't', "THIN_ARCHIVE", 0,
 	  "Thin archive file for kernel module or vmlinux" },
+	{ "file_ids", 'i', "FILE_IDS", 0,
+	  "File ID table for symbol names created by 'diff --file_ids'" },
 	{ nullptr }
 };
 
@@ -63,6 +71,9 @@ constexpr std::string_view kLivepatchPrefixElf = "__livepatch_";
 constexpr std::string_view kLivepatchPrefixTmpl = "livepatch_";
 constexpr std::string_view kTemplateExtension = ".tmpl";
 constexpr std::string_view kPathToTemplate = "templates";
+constexpr std::string_view kWrapperName = "livepatch.c";
+constexpr std::string_view kLdScriptName = "livepatch.lds";
+constexpr std::string_view kMakefileName = "Makefile";
 
 error_t ParseGenOpt(int key, char *arg, struct argp_state *state)
 {
@@ -84,6 +95,9 @@ error_t ParseGenOpt(int key, char *arg, struct argp_state *state)
 	case 't':
 		args->thin_archive = arg;
 		break;
+	case 'i':
+		args->file_ids = arg;
+		break;
 	case ARGP_KEY_ARG:
 		if (!args->klp_patch_filename) {
 			args->klp_patch_filename = arg;
@@ -106,7 +120,7 @@ error_t ParseGenOpt(int key, char *arg, struct argp_state *state)
 // Reads in_file and dumps its contents onto out_file till read line
 // contains the given marker. Once this hits the marker, it returns the
 // marked line.
-std::string DumpToMarker(std::fstream &in_file, std::fstream &out_file,
+std::string DumpToMarker(std::istream &in_file, std::ostream &out_file,
 			 std::string_view marker)
 {
 	std::string line;
@@ -120,25 +134,37 @@ std::string DumpToMarker(std::fstream &in_file, std::fstream &out_file,
 	return "";
 }
 
-// Opens two files, in and out, for given in_filename and
-// out_filename. Then, it returns tuple with in&out fstreams and error
-// code.
-std::tuple<std::fstream, std::fstream, std::error_code>
-OpenInOutfiles(std::string_view in_filename, std::string_view out_filename)
+// Opens a template file for given output filename in template_directory.
+std::error_code OpenTemplate(std::string_view template_directory,
+			     std::string_view out_filename,
+			     std::fstream *tmpl_file)
 {
-	std::fstream in_file(in_filename.data(), std::ios::in);
-	std::fstream out_file(out_filename.data(),
-			      std::ios::out | std::ios::trunc);
-	std::error_code ec;
-	if (!in_file.is_open()) {
-		errs() << "filename: " << in_filename << "\n";
-		ec = Command::ErrorCode::FILE_OPEN_FAILED;
-	} else if (!out_file.is_open()) {
-		errs() << "filename: " << out_filename << "\n";
-		ec = Command::ErrorCode::FILE_OPEN_FAILED;
+	fs::path tmpl_filename = fs::path(template_directory) /
+				 fs::path(out_filename);
+	tmpl_filename += fs::path(kTemplateExtension);
+
+	tmpl_file->open(tmpl_filename, std::ios::in);
+	if (!tmpl_file->is_open()) {
+		errs() << "filename: " << tmpl_filename.native() << "\n";
+		return Command::ErrorCode::FILE_OPEN_FAILED;
 	}
+	return Command::ErrorCode::NO_ERROR;
+}
 
-	return { std::move(in_file), std::move(out_file), ec };
+// Writes contents to out_filename in output_directory.
+std::error_code WriteOutfile(std::string_view output_directory,
+			     std::string_view out_filename,
+			     const std::string &contents)
+{
+	const fs::path kOutFilename =
+		fs::path(output_directory) / fs::path(out_filename);
+	std::fstream out_file(kOutFilename, std::ios::out | std::ios::trunc);
+	if (!out_file.is_open()) {
+		errs() << "filename: " << kOutFilename.native() << "\n";
+		return Command::ErrorCode::FILE_OPEN_FAILED;
+	}
+	out_file << contents;
+	return Command::ErrorCode::NO_ERROR;
 }
 } // namespace
 
@@ -171,6 +197,9 @@ GenCommand::GenCommand(int argc, char **argv) noexcept(false)
 	if (arguments.thin_archive) {
 		thin_archive_ = arguments.thin_archive;
 	}
+	if (arguments.file_ids) {
+		file_ids_ = arguments.file_ids;
+	}
 
 	static constexpr int buf_size = 4096;
 	char livepatch_path[buf_size] = {};
@@ -186,15 +215,53 @@ GenCommand::GenCommand(int argc, char **argv) noexcept(false)
 }
 
 std::error_code GenCommand::Run()
+{
+	ElfBin elf_bin(klp_patch_filename_);
+	std::unique_ptr<ThinArchive> tar = ThinArchive::Create(thin_archive_);
+	std::unique_ptr<FileIdTable> file_ids = FileIdTable::Create(file_ids_);
+
+	GenSpec spec;
+	spec.template_directory =
+		(fs::path(livepatch_bin_directory_) / fs::path(kPathToTemplate))
+			.native();
+	spec.kernel_directory = kernel_directory_;
+	spec.klp_mod_name = klp_mod_name_;
+	spec.mod_name =
+		mod_filename_.empty() ?
+			"" :
+			ElfBin(mod_filename_, ElfBin::OpenMode::LAZY).ModName();
+	spec.thin_archive = tar.get();
+	spec.file_ids = file_ids.get();
+
+	GenOutput output;
+	std::error_code ec = Render(&elf_bin, spec, &output);
+	if (ec) {
+		return ec;
+	}
+
+	for (const auto &[out_filename, contents] :
+	     { std::make_pair(kWrapperName, &output.wrapper),
+	       std::make_pair(kLdScriptName, &output.ld_script),
+	       std::make_pair(kMakefileName, &output.makefile) }) {
+		ec = WriteOutfile(output_directory_, out_filename, *contents);
+		if (ec) {
+			return ec;
+		}
+	}
+
+	return FixupKlpSymbols(&elf_bin);
+}
+
+std::error_code GenCommand::Render(ElfBin *elf_bin, const GenSpec &spec,
+				   GenOutput *output)
 {
 	// To generate the wrapper and linker script, names of livepatched
 	// functions are required. Iterate through all symbols in ELF and get
 	// the names. A name of livepatched function has a special prefix,
 	// kLivepatchPrefixElf.
 	std::vector<std::pair<StringRef, StringRef> > klp_func_names;
-	ElfBin elf_bin(klp_patch_filename_);
 	size_t prefix_len = kLivepatchPrefixElf.length();
-	for (ElfSymbol *i : elf_bin.Symbols()) {
+	for (ElfSymbol *i : elf_bin->Symbols()) {
 		StringRef symbol = i->Name();
 
 		if (symbol.empty() || !symbol.startswith(kLivepatchPrefixElf)) {
@@ -211,6 +278,9 @@ std::error_code GenCommand::Run()
 
 		auto [func_name, src_file] =
 			symbol.drop_front(prefix_len).split(':');
+		if (spec.file_ids) {
+			src_file = spec.file_ids->QueryPath(src_file.str());
+		}
 		klp_func_names.emplace_back(
 			std::make_pair(func_name, src_file));
 	}
@@ -220,51 +290,44 @@ std::error_code GenCommand::Run()
 		return std::error_code{ Command::ErrorCode::NOTHING_TO_PATCH };
 	}
 
-	std::string mod_name =
-		mod_filename_.empty() ? "" : ElfBin(mod_filename_).ModName();
-	std::error_code ec = GenerateWrapper(klp_func_names, mod_name);
-	if (ec) {
-		return ec;
-	}
-
-	ec = GenerateLdScript(klp_func_names);
+	Profiler::Stage stage("render");
+	std::ostringstream out;
+	std::error_code ec = GenerateWrapper(klp_func_names, spec, out);
 	if (ec) {
 		return ec;
 	}
+	output->wrapper = out.str();
 
-	ec = GenerateMakefile();
+	out.str("");
+	ec = GenerateLdScript(klp_func_names, spec, out);
 	if (ec) {
 		return ec;
 	}
+	output->ld_script = out.str();
 
-	ec = FixupKlpSymbols(&elf_bin);
+	out.str("");
+	ec = GenerateMakefile(spec, out);
 	if (ec) {
 		return ec;
 	}
+	output->makefile = out.str();
 
 	return ErrorCode::NO_ERROR;
 }
 
 std::error_code GenCommand::GenerateWrapper(
 	const std::vector<std::pair<StringRef, StringRef> > &klp_func_names,
-	const std::string &mod_name)
+	const GenSpec &spec, std::ostream &out_file)
 {
-	static constexpr std::string_view kWrapperName = "livepatch.c";
 	static constexpr std::string_view kFuncMarker =
 		"{{LIST_OF_LIVEPATCH_FUNCTIONS}}";
 	static constexpr std::string_view kStructMarker =
 		"{{LIST_FOR_KLP_FUNC_STRUCT}}";
 	static constexpr std::string_view kObjMarker = "{{NAME_OF_OBJECT}}";
 
-	fs::path kTmplFilename = fs::path(livepatch_bin_directory_) /
-				 fs::path(kPathToTemplate) /
-				 fs::path(kWrapperName);
-	kTmplFilename += fs::path(kTemplateExtension);
-
-	const fs::path kOutFilename =
-		fs::path(output_directory_) / fs::path(kWrapperName);
-	auto [tmpl_file, out_file, ec] =
-		OpenInOutfiles(kTmplFilename.c_str(), kOutFilename.c_str());
+	std::fstream tmpl_file;
+	std::error_code ec =
+		OpenTemplate(spec.template_directory, kWrapperName, &tmpl_file);
 	if (ec) {
 		return ec;
 	}
@@ -276,8 +339,7 @@ std::error_code GenCommand::GenerateWrapper(
 			 << func_name.str() << "(void);\n";
 	}
 
-	std::unique_ptr<ThinArchive> tar =
-		ThinArchive::Create(std::string(thin_archive_));
+	const ThinArchive *tar = spec.thin_archive;
 	DumpToMarker(tmpl_file, out_file, kStructMarker);
 	for (auto [func_name, src_file] : klp_func_names) {
 		unsigned pos = 0;
@@ -307,6 +369,7 @@ std::error_code GenCommand::GenerateWrapper(
 	// .name = NULL,
 	// or
 	// .name = "${mod_name}"
+	const std::string &mod_name = spec.mod_name;
 	out_file << "\t\t.name = "
 		 << (mod_name.empty() ? "NULL" : "\"" + mod_name + "\"")
 		 << ",\n";
@@ -317,19 +380,12 @@ std::error_code GenCommand::GenerateWrapper(
 }
 
 std::error_code GenCommand::GenerateLdScript(
-	const std::vector<std::pair<StringRef, StringRef> > &klp_func_names)
+	const std::vector<std::pair<StringRef, StringRef> > &klp_func_names,
+	const GenSpec &spec, std::ostream &out_file)
 {
-	static constexpr std::string_view kLdScriptName = "livepatch.lds";
-
-	fs::path kTmplFilename = fs::path(livepatch_bin_directory_) /
-				 fs::path(kPathToTemplate) /
-				 fs::path(kLdScriptName);
-	kTmplFilename += fs::path(kTemplateExtension);
-
-	const fs::path kOutFilename =
-		fs::path(output_directory_) / fs::path(kLdScriptName);
-	auto [tmpl_file, out_file, ec] =
-		OpenInOutfiles(kTmplFilename.c_str(), kOutFilename.c_str());
+	std::fstream tmpl_file;
+	std::error_code ec =
+		OpenTemplate(spec.template_directory, kLdScriptName, &tmpl_file);
 	if (ec) {
 		return ec;
 	}
@@ -348,34 +404,29 @@ std::error_code GenCommand::GenerateLdScript(
 	return ErrorCode::NO_ERROR;
 }
 
-std::error_code GenCommand::GenerateMakefile()
+std::error_code GenCommand::GenerateMakefile(const GenSpec &spec,
+					     std::ostream &out_file)
 {
-	static constexpr std::string_view kMakefileName = "Makefile";
 	static constexpr std::string_view kKernelPath =
 		"{{PATH_TO_LINUX_KERNEL_SOURCE_TREE}}";
 	static constexpr std::string_view kKlpName = "{{NAME_OF_LIVEPATCH}}";
 
-	fs::path kTmplFilename = fs::path(livepatch_bin_directory_) /
-				 fs::path(kPathToTemplate) /
-				 fs::path(kMakefileName);
-	kTmplFilename += fs::path(kTemplateExtension);
-
-	const fs::path kOutFilename =
-		fs::path(output_directory_) / fs::path(kMakefileName);
-	auto [tmpl_file, out_file, ec] =
-		OpenInOutfiles(kTmplFilename.c_str(), kOutFilename.c_str());
+	std::fstream tmpl_file;
+	std::error_code ec =
+		OpenTemplate(spec.template_directory, kMakefileName, &tmpl_file);
 	if (ec) {
 		return ec;
 	}
 
 	std::string line = DumpToMarker(tmpl_file, out_file, kKernelPath);
 	//KLP_BUILD = ...
-	out_file << line.substr(0, line.find(kKernelPath)) + kernel_directory_ +
-			    "\n";
+	out_file << line.substr(0, line.find(kKernelPath)) +
+			    spec.kernel_directory + "\n";
 
 	line = DumpToMarker(tmpl_file, out_file, kKlpName);
 	//KLP_NAME = ...
-	out_file << line.substr(0, line.find(kKlpName)) + klp_mod_name_ + "\n";
+	out_file << line.substr(0, line.find(kKlpName)) + spec.klp_mod_name +
+			    "\n";
 
 	// "" marker doesn't exist. hence dump to the end of file.
 	DumpToMarker(tmpl_file, out_file, "");
@@ -385,6 +436,7 @@ std::error_code GenCommand::GenerateMakefile()
 
 std::error_code GenCommand::FixupKlpSymbols(ElfBin *elf_bin)
 {
+	Profiler::Stage stage("rename");
 	std::vector<char> sym_name_buf{ '\0' };
 	ElfSymbol elf_symbols = elf_bin->Symbols();
 
@@ -18,13 +18,17 @@
 #ifndef GEN_COMMAND_H_
 #define GEN_COMMAND_H_
 
+#include <ostream>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <utility>
 #include <vector>
 
 #include "command.h"
 #include "elf_bin.h"
+#include "file_id_table.h"
+#include "thin_archive.h"
 
 #include "llvm/ADT/StringRef.h"
 
@@ -48,22 +52,54 @@ class GenCommand : public Command {
 	GenCommand(const GenCommand &rhs) = delete;
 	GenCommand &operator=(const GenCommand &rhs) = delete;
 
+	// Inputs for the wrapper, makefile, and linker script.
+	struct GenSpec {
+		// Path to dir w/ template files, *.tmpl.
+		std::string template_directory;
+		std::string kernel_directory;
+		std::string klp_mod_name;
+		// Name of kernel module w/ livepatched functions. Empty for
+		// vmlinux.
+		std::string mod_name;
+		// Optional database for positions of livepatched functions.
+		const ThinArchive *thin_archive = nullptr;
+		// Required if klp_patch.o has file IDs in symbol names.
+		const FileIdTable *file_ids = nullptr;
+	};
+
+	// Contents of the wrapper, livepatch.c, linker script,
+	// livepatch.lds, and Makefile.
+	struct GenOutput {
+		std::string wrapper;
+		std::string ld_script;
+		std::string makefile;
+	};
+
 	// Runs gen command and generates the wrapper, makefile, and linker
 	// script.
 	std::error_code Run() override;
 
+	// Renders the wrapper, makefile, and linker script for livepatched
+	// functions in klp_patch.o.
+	static std::error_code Render(ElfBin *elf_bin, const GenSpec &spec,
+				      GenOutput *output);
+	// Strips source filenames off symbol names in klp_patch.o. This
+	// should be called after Render().
+	static std::error_code FixupKlpSymbols(ElfBin *elf_bin);
+
     private:
 	// Takes a vector of livepatched function names and generates a wrapper.
-	std::error_code GenerateWrapper(
+	static std::error_code GenerateWrapper(
 		const std::vector<std::pair<llvm::StringRef, llvm::StringRef> >
 			&klp_func_names,
-		const std::string &mod_name);
+		const GenSpec &spec, std::ostream &out_file);
 	// Takes a vector of livepatched function names and generates an ld script.
-	std::error_code GenerateLdScript(
+	static std::error_code GenerateLdScript(
 		const std::vector<std::pair<llvm::StringRef, llvm::StringRef> >
-			&klp_func_names);
-	std::error_code GenerateMakefile();
-	std::error_code FixupKlpSymbols(ElfBin *elf_bin);
+			&klp_func_names,
+		const GenSpec &spec, std::ostream &out_file);
+	static std::error_code GenerateMakefile(const GenSpec &spec,
+						std::ostream &out_file);
 
 	std::string klp_patch_filename_;
 	std::string output_directory_;
@@ -75,6 +111,7 @@ class GenCommand : public Command {
 	std::string mod_filename_;
 	std::string klp_mod_name_;
 	std::string thin_archive_;
+	std::string file_ids_;
 };
 
 #endif // GEN_COMMAND_H_
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "git_object_store.h"
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "llvm/Support/raw_ostream.h"
+
+GitObjectStore::GitObjectStore(std::string_view git_dir) noexcept(false)
+{
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+
+	// prepared before fork as the child only calls async-signal-safe
+	// functions.
+	const std::string dir(git_dir);
+	pid_ = fork();
+	if (pid_ < 0) {
+		int err = errno;
+		close(fds[0]);
+		close(fds[1]);
+		throw std::error_code{ err, std::system_category() };
+	}
+	if (pid_ == 0) {
+		// stdin and stdout of the child are the socket. dup2() clears
+		// close-on-exec of them.
+		if (dup2(fds[1], STDIN_FILENO) < 0 ||
+		    dup2(fds[1], STDOUT_FILENO) < 0) {
+			_exit(127);
+		}
+		execlp("git", "git", "-C", dir.c_str(), "cat-file", "--batch",
+		       nullptr);
+		_exit(127);
+	}
+	close(fds[1]);
+	fd_ = fds[0];
+}
+
+GitObjectStore::~GitObjectStore()
+{
+	// EOF on stdin makes the process exit.
+	shutdown(fd_, SHUT_WR);
+	close(fd_);
+	int status;
+	while (waitpid(pid_, &status, 0) < 0 && errno == EINTR) {
+	}
+}
+
+bool GitObjectStore::Read(std::string_view rev, std::string_view path,
+			  std::string *content) noexcept(false)
+{
+	// a request is a line. So, a newline in a path can't be requested.
+	if (rev.find('\n') != std::string_view::npos ||
+	    path.find('\n') != std::string_view::npos) {
+		return false;
+	}
+
+	std::string object = std::string(rev) + ":" + std::string(path);
+	std::string request = object + "\n";
+	for (std::string_view rest(request); !rest.empty();) {
+		ssize_t sent = send(fd_, rest.data(), rest.size(), MSG_NOSIGNAL);
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			llvm::errs() << "git cat-file exited while reading "
+				     << object << "\n";
+			throw std::error_code{ errno ? errno : EPIPE,
+					       std::system_category() };
+		}
+		rest.remove_prefix(sent);
+	}
+
+	// format: "${oid} ${type} ${size}\n${content}\n" or
+	// "${object} missing\n". ambiguous names are reported similarly.
+	std::string header;
+	ReadLine(&header);
+	if (header == object + " missing" || header == object + " ambiguous") {
+		return false;
+	}
+	size_t type_start = header.find(' ');
+	size_t size_start = header.rfind(' ');
+	if (type_start == std::string::npos || size_start == type_start) {
+		llvm::errs() << "unexpected response of git cat-file: "
+			     << header << "\n";
+		throw std::error_code{ EPROTO, std::system_category() };
+	}
+	std::string_view type(header);
+	type = type.substr(type_start + 1, size_start - type_start - 1);
+	size_t size = std::strtoull(header.c_str() + size_start + 1, nullptr, 10);
+
+	std::string data;
+	ReadBytes(size + 1, &data);
+	if (type != "blob") {
+		return false;
+	}
+	data.pop_back();
+	*content = std::move(data);
+	return true;
+}
+
+void GitObjectStore::ReadLine(std::string *line) noexcept(false)
+{
+	size_t eol;
+	while ((eol = buffer_.find('\n')) == std::string::npos) {
+		ReadBytes(buffer_.size() + 1, nullptr);
+	}
+	line->assign(buffer_, 0, eol);
+	buffer_.erase(0, eol + 1);
+}
+
+void GitObjectStore::ReadBytes(size_t size, std::string *data) noexcept(false)
+{
+	char buf[64 * 1024];
+	while (buffer_.size() < size) {
+		ssize_t received = recv(fd_, buf, sizeof(buf), 0);
+		if (received < 0 && errno == EINTR) {
+			continue;
+		}
+		if (received <= 0) {
+			llvm::errs() << "git cat-file exited unexpectedly\n";
+			throw std::error_code{ received ? errno : EPIPE,
+					       std::system_category() };
+		}
+		buffer_.append(buf, received);
+	}
+	if (data) {
+		data->assign(buffer_, 0, size);
+		buffer_.erase(0, size);
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef GIT_OBJECT_STORE_H_
+#define GIT_OBJECT_STORE_H_
+
+#include <sys/types.h>
+
+#include <string>
+#include <string_view>
+
+// This class reads files at commits from git object store of a repository
+// w/o checking them out. A single `git cat-file --batch` process is kept
+// running for the object, and each read is a request to the process, e.g.,
+// "v5.10:kernel/fork.c\n". So, contents of files before and after commits
+// are read in memory, and the work tree is neither read nor modified.
+//
+// The process is connected w/ a socket pair rather than pipes. So, a process
+// exited unexpectedly is an error, not SIGPIPE.
+class GitObjectStore final {
+    public:
+	// Starts `git cat-file --batch` in git_dir. Throws an exception if
+	// the process can't be started.
+	GitObjectStore(std::string_view git_dir) noexcept(false);
+	~GitObjectStore();
+
+	// Don't allow copy.
+	GitObjectStore(const GitObjectStore &rhs) = delete;
+	GitObjectStore &operator=(const GitObjectStore &rhs) = delete;
+
+	// Reads a file, path, at a commit, rev. Returns false if the file
+	// doesn't exist at the commit or isn't a regular file. Throws an
+	// exception if the process doesn't respond.
+	bool Read(std::string_view rev, std::string_view path,
+		  std::string *content) noexcept(false);
+
+    private:
+	// Reads a line w/o '\n' from the process.
+	void ReadLine(std::string *line) noexcept(false);
+	// Reads size bytes from the process. If data is nullptr, they are
+	// kept in buffer_.
+	void ReadBytes(size_t size, std::string *data) noexcept(false);
+
+	pid_t pid_ = -1;
+	int fd_ = -1;
+	// bytes received but not consumed yet.
+	std::string buffer_;
+};
+
+#endif // GIT_OBJECT_STORE_H_
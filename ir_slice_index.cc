@@ -0,0 +1,398 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "ir_slice_index.h"
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "artifact_cache.h"
+
+namespace
+{
+constexpr std::string_view kDefine = "define ";
+constexpr std::string_view kBlockAddress = "blockaddress(";
+constexpr std::string_view kUseListOrder = "uselistorder";
+constexpr std::string_view kStubBody = "\n  unreachable\n}";
+
+bool StartsWith(std::string_view str, std::string_view prefix)
+{
+	return str.substr(0, prefix.size()) == prefix;
+}
+
+bool IsNameChar(char c)
+{
+	return std::isalnum(static_cast<unsigned char>(c)) || c == '-' ||
+	       c == '$' || c == '.' || c == '_';
+}
+
+bool IsNumber(std::string_view str)
+{
+	return !str.empty() &&
+	       std::all_of(str.begin(), str.end(), [](char c) {
+		       return std::isdigit(static_cast<unsigned char>(c));
+	       });
+}
+
+// Returns the end of name which starts w/ a sigil, '@', '%' or '!', at
+// pos. Name is either quoted, e.g., @"foo bar", or a sequence of name
+// characters.
+size_t NameEnd(std::string_view text, size_t pos)
+{
+	size_t end = pos + 1;
+	if (end < text.size() && text[end] == '"') {
+		end = text.find('"', end + 1);
+		return end == std::string_view::npos ? text.size() : end + 1;
+	}
+	while (end < text.size() && IsNameChar(text[end])) {
+		end++;
+	}
+	return end;
+}
+
+// Returns canonical number for id. Numbers are assigned in order of first
+// appearance.
+std::string Canonical(std::unordered_map<std::string_view, size_t> *table,
+		      std::string_view id)
+{
+	auto it = table->try_emplace(id, table->size()).first;
+	return std::to_string(it->second);
+}
+
+// Normalizes text and returns its digest. Comments are dropped, and local
+// values, labels and metadata are renumbered. Quoted strings are kept as
+// they are. If refs is given, names of global values and types in text are
+// pushed onto it.
+std::string NormalizedDigest(std::string_view text,
+			     std::vector<std::string_view> *refs)
+{
+	std::unordered_map<std::string_view, size_t> locals;
+	std::unordered_map<std::string_view, size_t> metadata;
+	std::string normalized;
+	normalized.reserve(text.size());
+
+	bool line_start = true;
+	size_t pos = 0;
+	while (pos < text.size()) {
+		const char c = text[pos];
+		if (line_start && std::isdigit(static_cast<unsigned char>(c))) {
+			// Numbered label, e.g., '12:'. It shares numbering w/
+			// local values.
+			size_t end = pos;
+			while (end < text.size() &&
+			       std::isdigit(static_cast<unsigned char>(text[end]))) {
+				end++;
+			}
+			if (end < text.size() && text[end] == ':') {
+				normalized += Canonical(
+					&locals, text.substr(pos, end - pos));
+				normalized += ':';
+				pos = end + 1;
+				line_start = false;
+				continue;
+			}
+		}
+		line_start = false;
+
+		switch (c) {
+		case '\n':
+			line_start = true;
+			normalized += c;
+			pos++;
+			break;
+		case ';':
+			pos = text.find('\n', pos);
+			if (pos == std::string_view::npos) {
+				pos = text.size();
+			}
+			break;
+		case '"': {
+			size_t end = text.find('"', pos + 1);
+			end = end == std::string_view::npos ? text.size() :
+							      end + 1;
+			normalized += text.substr(pos, end - pos);
+			pos = end;
+			break;
+		}
+		case '%':
+		case '@':
+		case '!': {
+			const size_t end = NameEnd(text, pos);
+			std::string_view id = text.substr(pos + 1, end - pos - 1);
+			if (c != '@' && IsNumber(id)) {
+				normalized += c;
+				normalized += Canonical(
+					c == '%' ? &locals : &metadata, id);
+			} else {
+				normalized += text.substr(pos, end - pos);
+				if (refs && c != '!' && !id.empty()) {
+					refs->push_back(text.substr(pos, end - pos));
+				}
+			}
+			pos = end;
+			break;
+		}
+		default:
+			normalized += c;
+			pos++;
+			break;
+		}
+	}
+
+	return ArtifactCache::Digest(normalized);
+}
+
+} // namespace
+
+IrSliceIndex::IrSliceIndex(std::string_view text) : text_(text)
+{
+	size_t pos = 0;
+	while (pos < text_.size()) {
+		size_t eol = text_.find('\n', pos);
+		if (eol == std::string_view::npos) {
+			eol = text_.size();
+		}
+		std::string_view line = text_.substr(pos, eol - pos);
+
+		if (StartsWith(line, kDefine)) {
+			// Function body ends w/ '}' at the start of a line.
+			size_t end = text_.find("\n}", eol);
+			while (end != std::string_view::npos &&
+			       end + 2 < text_.size() && text_[end + 2] != '\n') {
+				end = text_.find("\n}", end + 2);
+			}
+			if (end == std::string_view::npos) {
+				// Leave it to LLVM parser to complain.
+				stubbable_ = false;
+				break;
+			}
+
+			Slice slice;
+			slice.begin = pos;
+			slice.end = end + 2;
+			size_t at = line.find('@');
+			if (at != std::string_view::npos) {
+				slice.name = line.substr(at, NameEnd(line, at) - at);
+			}
+			std::string_view header =
+				line.substr(0, line.find_last_not_of(" \t\r") + 1);
+			slice.header_end = pos + header.size();
+			slice.stubbable = !slice.name.empty() && !header.empty() &&
+					  header.back() == '{';
+			slice.digest = NormalizedDigest(
+				text_.substr(slice.begin, slice.end - slice.begin),
+				&slice.refs);
+
+			slice_by_name_.emplace(slice.name, slices_.size());
+			slices_.push_back(std::move(slice));
+			pos = end + 2;
+			continue;
+		}
+
+		if (StartsWith(line, "@") || StartsWith(line, "%")) {
+			// Global value or type, e.g., '@foo = global ...' or
+			// '%struct.foo = type { ... }'.
+			std::string_view name =
+				line.substr(0, NameEnd(line, /*pos=*/0));
+			Entity entity;
+			entity.digest = NormalizedDigest(line, &entity.refs);
+			entities_.emplace(name, std::move(entity));
+		} else if (StartsWith(line, kUseListOrder)) {
+			// Module-level uselistorder refers to uses in function
+			// bodies.
+			stubbable_ = false;
+		}
+		pos = eol + 1;
+	}
+
+	// Basic blocks of a function referred by blockaddress() should be
+	// kept.
+	for (size_t pos = text_.find(kBlockAddress);
+	     pos != std::string_view::npos;
+	     pos = text_.find(kBlockAddress, pos + 1)) {
+		size_t at = pos + kBlockAddress.size();
+		if (at < text_.size() && text_[at] == '@') {
+			address_taken_.insert(
+				text_.substr(at, NameEnd(text_, at) - at));
+		}
+	}
+}
+
+std::unordered_set<std::string_view>
+IrSliceIndex::ChangedEntities(const IrSliceIndex &original,
+			      const IrSliceIndex &patched)
+{
+	std::unordered_set<std::string_view> changed;
+	for (const auto &[name, entity] : original.entities_) {
+		auto it = patched.entities_.find(name);
+		if (it == patched.entities_.end() ||
+		    it->second.digest != entity.digest) {
+			changed.insert(name);
+		}
+	}
+	for (const auto &[name, entity] : patched.entities_) {
+		if (original.entities_.find(name) == original.entities_.end()) {
+			changed.insert(name);
+		}
+	}
+
+	// Initializers of global variables are compared deeply by 'diff'. So,
+	// an entity referring to a changed one is changed as well.
+	std::unordered_map<std::string_view, std::vector<std::string_view> >
+		users;
+	for (const IrSliceIndex *index : { &original, &patched }) {
+		for (const auto &[name, entity] : index->entities_) {
+			for (std::string_view ref : entity.refs) {
+				users[ref].push_back(name);
+			}
+		}
+	}
+	std::vector<std::string_view> worklist(changed.begin(), changed.end());
+	while (!worklist.empty()) {
+		std::string_view name = worklist.back();
+		worklist.pop_back();
+		auto it = users.find(name);
+		if (it == users.end()) {
+			continue;
+		}
+		for (std::string_view user : it->second) {
+			if (changed.insert(user).second) {
+				worklist.push_back(user);
+			}
+		}
+	}
+
+	return changed;
+}
+
+size_t IrSliceIndex::StubUnchanged(IrSliceIndex *original,
+				   IrSliceIndex *patched)
+{
+	if (!original->stubbable_ || !patched->stubbable_) {
+		return 0;
+	}
+
+	std::unordered_set<std::string_view> changed =
+		ChangedEntities(*original, *patched);
+	size_t count = 0;
+	for (Slice &slice : patched->slices_) {
+		auto it = original->slice_by_name_.find(slice.name);
+		if (it == original->slice_by_name_.end()) {
+			continue;
+		}
+		Slice &other = original->slices_[it->second];
+		if (!slice.stubbable || !other.stubbable ||
+		    slice.digest != other.digest) {
+			continue;
+		}
+		if (original->address_taken_.count(slice.name) ||
+		    patched->address_taken_.count(slice.name)) {
+			continue;
+		}
+		if (std::any_of(slice.refs.begin(), slice.refs.end(),
+				[&changed](std::string_view ref) {
+					return changed.count(ref) != 0;
+				})) {
+			continue;
+		}
+
+		slice.stub = true;
+		other.stub = true;
+		count++;
+	}
+
+	return count;
+}
+
+std::vector<std::string>
+IrSliceIndex::ChangedValues(const IrSliceIndex &lhs, const IrSliceIndex &rhs,
+			    const std::vector<std::string> &names)
+{
+	std::unordered_set<std::string_view> changed_entities =
+		ChangedEntities(lhs, rhs);
+	auto refers_changed = [&changed_entities](const Slice &slice) {
+		return std::any_of(slice.refs.begin(), slice.refs.end(),
+				   [&changed_entities](std::string_view ref) {
+					   return changed_entities.count(ref) !=
+						  0;
+				   });
+	};
+
+	std::vector<std::string> changed;
+	for (const std::string &name : names) {
+		auto lhs_slice = lhs.slice_by_name_.find(name);
+		auto rhs_slice = rhs.slice_by_name_.find(name);
+		const bool lhs_defined = lhs_slice != lhs.slice_by_name_.end();
+		const bool rhs_defined = rhs_slice != rhs.slice_by_name_.end();
+		if (!lhs_defined && !rhs_defined) {
+			// global variable or declaration
+			if (changed_entities.count(name)) {
+				changed.push_back(name);
+			}
+			continue;
+		}
+		if (!lhs_defined || !rhs_defined) {
+			changed.push_back(name);
+			continue;
+		}
+
+		const Slice &lhs_fn = lhs.slices_[lhs_slice->second];
+		const Slice &rhs_fn = rhs.slices_[rhs_slice->second];
+		if (lhs_fn.digest != rhs_fn.digest || refers_changed(lhs_fn) ||
+		    refers_changed(rhs_fn)) {
+			changed.push_back(name);
+		}
+	}
+
+	return changed;
+}
+
+std::vector<std::string> IrSliceIndex::FunctionNames() const
+{
+	std::vector<std::string> names;
+	names.reserve(slices_.size());
+	for (const Slice &slice : slices_) {
+		if (!slice.name.empty()) {
+			names.emplace_back(slice.name);
+		}
+	}
+	return names;
+}
+
+std::string IrSliceIndex::Render() const
+{
+	std::string text;
+	text.reserve(text_.size());
+
+	size_t pos = 0;
+	for (const Slice &slice : slices_) {
+		if (!slice.stub) {
+			continue;
+		}
+		text += text_.substr(pos, slice.header_end - pos);
+		text += kStubBody;
+		pos = slice.end;
+	}
+	text += text_.substr(pos);
+
+	return text;
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef IR_SLICE_INDEX_H_
+#define IR_SLICE_INDEX_H_
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// This class scans textual LLVM IR, .ll file, w/o parsing it and splits it
+// into per-function slices, 'define ... { ... }', and module preamble, which
+// is the rest of the file. For each slice, it computes digest of normalized
+// text. The normalization rewrites local values and labels, %N, and
+// metadata, !N, to canonical numbering so that a function has the same
+// digest even if metadata numbering of module is shifted.
+//
+// Two indexes for original and patched are compared by StubUnchanged(). A
+// function is unchanged if it has the same digest on both sides and none of
+// global variables and types it refers to is changed. Bodies of unchanged
+// functions are replaced w/ 'unreachable' so that LLVM parser skips most of
+// the file when a patch touches few functions in a huge translation
+// unit. Diff result is not affected as 'diff' command deletes bodies of
+// unchanged functions anyway.
+//
+// Note that the index refers to the text given to the constructor. So, the
+// text should outlive the index.
+class IrSliceIndex final {
+    public:
+	IrSliceIndex(std::string_view text);
+	~IrSliceIndex() = default;
+
+	// Don't allow copy.
+	IrSliceIndex(const IrSliceIndex &rhs) = delete;
+	IrSliceIndex &operator=(const IrSliceIndex &rhs) = delete;
+
+	// Marks unchanged functions in both indexes to be stubbed and returns
+	// the number of them.
+	static size_t StubUnchanged(IrSliceIndex *original,
+				    IrSliceIndex *patched);
+
+	// Returns global values among names, e.g., '@foo', that differ
+	// between two indexes, e.g., the 'original' of a previous build and
+	// that of a new kernel. A function differs if it's defined on one
+	// side only, has a different digest or refers to a changed global
+	// value or type. Values declared on both sides, e.g., external
+	// functions, are taken as unchanged.
+	static std::vector<std::string>
+	ChangedValues(const IrSliceIndex &lhs, const IrSliceIndex &rhs,
+		      const std::vector<std::string> &names);
+
+	// Returns names of functions defined in the text, e.g., '@foo'.
+	std::vector<std::string> FunctionNames() const;
+
+	// Returns the text w/ bodies of the stubbed functions replaced.
+	std::string Render() const;
+
+    private:
+	// A function definition. Offsets are relative to the text.
+	struct Slice {
+		// 'define' line to '{' at the end of the line.
+		size_t begin = 0;
+		size_t header_end = 0;
+		// right after '}' closing the function.
+		size_t end = 0;
+		std::string_view name;
+		std::string digest;
+		// global values and types referred by the function.
+		std::vector<std::string_view> refs;
+		bool stubbable = false;
+		bool stub = false;
+	};
+
+	// A definition of global value or type in the preamble.
+	struct Entity {
+		std::string digest;
+		std::vector<std::string_view> refs;
+	};
+
+	// Returns names of entities that differ between two indexes. If an
+	// entity refers to a changed one, it's also changed.
+	static std::unordered_set<std::string_view>
+	ChangedEntities(const IrSliceIndex &original,
+			const IrSliceIndex &patched);
+
+	std::string_view text_;
+	std::vector<Slice> slices_;
+	// key: function name
+	std::unordered_map<std::string_view, size_t> slice_by_name_;
+	// key: name of global value, '@...', or type, '%...'
+	std::unordered_map<std::string_view, Entity> entities_;
+	// functions whose basic blocks are referred by blockaddress().
+	std::unordered_set<std::string_view> address_taken_;
+	// false if the text has what the index can't handle, e.g.,
+	// module-level uselistorder directives.
+	bool stubbable_ = true;
+};
+
+#endif // IR_SLICE_INDEX_H_
@@ -202,3 +202,22 @@ function util::__find_obj_parent()
 	# file. default to 'vmlinux'
 	eval "${__RETVAL}"="${G_KERNEL_VMLINUX}"
 }
+
+# takes suffix of text files for thin archives and dirs w/ the files,
+# ${name}.a.${suffix}, and echoes --archive options for 'livepatch fixup'.
+# An archive is keyed by its object, vmlinux or module name. Like
+# KBUILD_MODNAME, module name has '_' instead of '-'.
+function util::get_archive_opts()
+{
+	local -r SUFFIX="${1}"
+	shift
+
+	local dir="" txt=""
+	for dir in "$@"; do
+		for txt in "${dir}/"*".a.${SUFFIX}"; do
+			[[ -f "${txt}" ]] || continue
+			local obj_name="$(basename "${txt}" ".a.${SUFFIX}")"
+			printf -- "--archive=%s=%s " "${obj_name//-/_}" "${txt}"
+		done
+	done
+}
@@ -0,0 +1,158 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "livepatch.h"
+
+#include <exception>
+#include <new>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "command.h"
+#include "diff_command.h"
+#include "elf_bin.h"
+#include "fixup_command.h"
+#include "gen_command.h"
+#include "unified_diff.h"
+
+namespace
+{
+// Runs func and returns its error. An exception thrown by func is returned
+// as well. Exceptions other than std::error_code, e.g., from STL or LLVM,
+// are mapped to error codes so that none escapes the APIs.
+template <typename Func> std::error_code CatchError(Func func)
+{
+	try {
+		return func();
+	} catch (std::error_code e) {
+		return e;
+	} catch (const std::system_error &e) {
+		return e.code();
+	} catch (const std::bad_alloc &e) {
+		return std::make_error_code(std::errc::not_enough_memory);
+	} catch (const std::exception &e) {
+		llvm::errs() << "unexpected exception: " << e.what() << "\n";
+		return Command::ErrorCode::UNEXPECTED_ERROR;
+	} catch (...) {
+		llvm::errs() << "unexpected exception\n";
+		return Command::ErrorCode::UNEXPECTED_ERROR;
+	}
+}
+
+// Splits text into lines same as std::getline() does.
+std::vector<std::string> SplitLines(std::string_view text)
+{
+	std::vector<std::string> lines;
+	size_t pos = 0;
+	while (pos < text.size()) {
+		size_t eol = text.find('\n', pos);
+		if (eol == std::string_view::npos) {
+			eol = text.size();
+		}
+		lines.emplace_back(text.substr(pos, eol - pos));
+		pos = eol + 1;
+	}
+	return lines;
+}
+
+// Joins lines into text. Every line ends w/ a newline.
+std::string JoinLines(const std::vector<std::string> &lines)
+{
+	std::string text;
+	for (const std::string &line : lines) {
+		text += line;
+		text += '\n';
+	}
+	return text;
+}
+} // namespace
+
+namespace livepatch
+{
+std::error_code Align(std::string_view original, std::string_view patch,
+		      std::string_view diffed_file, size_t fuzz,
+		      AlignedSource *source)
+{
+	return CatchError([&]() {
+		std::istringstream patch_stream{ std::string(patch) };
+		UnifiedDiff diff(patch_stream, diffed_file);
+
+		std::vector<std::string> patched, aligned_original,
+			aligned_patched;
+		diff.Apply(SplitLines(original), fuzz, &patched,
+			   &aligned_original, &aligned_patched);
+		source->patched = JoinLines(patched);
+		source->aligned_original = JoinLines(aligned_original);
+		source->aligned_patched = JoinLines(aligned_patched);
+		return std::error_code{ Command::ErrorCode::NO_ERROR };
+	});
+}
+
+std::error_code DistillDiff(llvm::Module &original, llvm::Module &patched,
+			    std::string_view base_dir, llvm::raw_ostream &out,
+			    bool file_ids)
+{
+	return CatchError([&]() {
+		return DiffCommand::DistillDiff(
+			&original, &patched,
+			llvm::StringRef(base_dir.data(), base_dir.size()), out,
+			file_ids);
+	});
+}
+
+std::error_code LoadModule(ElfImage &mod_image, SymbolPlan *plan)
+{
+	return CatchError([&]() {
+		ElfBin mod_bin(&mod_image, ElfBin::OpenMode::LAZY);
+		FixupCommand::LoadModule(&mod_bin, plan);
+		return std::error_code{ Command::ErrorCode::NO_ERROR };
+	});
+}
+
+std::error_code Fixup(ElfImage &klp_patch, const SymbolPlan &plan,
+		      llvm::raw_ostream &out)
+{
+	return CatchError([&]() {
+		ElfBin elf_bin(&klp_patch);
+		return FixupCommand::Fixup(&elf_bin, plan, out);
+	});
+}
+
+std::error_code FixupWrapper(llvm::Module &wrapper, const SymbolPlan &plan,
+			     llvm::raw_ostream &out)
+{
+	return CatchError([&]() {
+		return FixupCommand::FixupWrapper(&wrapper, plan, out);
+	});
+}
+
+std::error_code Gen(ElfImage &klp_patch, const GenSpec &spec,
+		    GenOutput *output)
+{
+	return CatchError([&]() {
+		ElfBin elf_bin(&klp_patch);
+		std::error_code ec = GenCommand::Render(&elf_bin, spec, output);
+		if (ec) {
+			return ec;
+		}
+		return GenCommand::FixupKlpSymbols(&elf_bin);
+	});
+}
+} // namespace livepatch
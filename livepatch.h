@@ -0,0 +1,90 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef LIVEPATCH_H_
+#define LIVEPATCH_H_
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "fixup_command.h"
+#include "gen_command.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+// APIs of liblivepatch. They do what 'align', 'diff', 'fixup' and 'gen'
+// commands do, but on buffers and objects in memory rather than files. So,
+// a program can run a livepatch pipeline in its own process w/o creating
+// temp files. Errors are returned as std::error_code, same as the commands
+// return, and no exception is thrown. Other exceptions, e.g., from STL, are
+// mapped to error codes: std::system_error to its code, std::bad_alloc to
+// std::errc::not_enough_memory and others to UNEXPECTED_ERROR.
+namespace livepatch
+{
+// Elf binary in memory, e.g., klp_patch.o or kernel module.
+using ElfImage = std::vector<char>;
+
+// See FixupCommand::SymbolPlan and GenCommand::GenSpec for details.
+using SymbolPlan = FixupCommand::SymbolPlan;
+using GenSpec = GenCommand::GenSpec;
+using GenOutput = GenCommand::GenOutput;
+
+// Sources of a diffed file created by Align().
+struct AlignedSource {
+	std::string patched;
+	std::string aligned_original;
+	std::string aligned_patched;
+};
+
+// Applies a .patch to original of diffed_file and aligns __LINE__ of
+// original and patched. Up to fuzz lines of context can be ignored.
+std::error_code Align(std::string_view original, std::string_view patch,
+		      std::string_view diffed_file, size_t fuzz,
+		      AlignedSource *source);
+
+// Distills difference between two LLVM modules. patched is left w/
+// patched/new C functions and global variables only. If file_ids is true,
+// symbol names have FileIdTable::FileId() of the source file, which should
+// be added to the table given to Fixup() and Gen().
+std::error_code DistillDiff(llvm::Module &original, llvm::Module &patched,
+			    std::string_view base_dir = "",
+			    llvm::raw_ostream &out = llvm::nulls(),
+			    bool file_ids = false);
+
+// Loads name and symbols of a kernel module into plan for Fixup().
+std::error_code LoadModule(ElfImage &mod_image, SymbolPlan *plan);
+
+// Renames UND symbols of klp_patch.o or creates a relocation section for
+// KLP, depending on plan.
+std::error_code Fixup(ElfImage &klp_patch, const SymbolPlan &plan,
+		      llvm::raw_ostream &out = llvm::nulls());
+
+// Renames LLpatch symbols in LLVM IR of livepatch wrapper to KLP symbols.
+// plan.symbol_map is required.
+std::error_code FixupWrapper(llvm::Module &wrapper, const SymbolPlan &plan,
+			     llvm::raw_ostream &out = llvm::nulls());
+
+// Generates the wrapper, makefile, and linker script for klp_patch.o and
+// strips source filenames off its symbols.
+std::error_code Gen(ElfImage &klp_patch, const GenSpec &spec,
+		    GenOutput *output);
+} // namespace livepatch
+
+#endif // LIVEPATCH_H_
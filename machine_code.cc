@@ -0,0 +1,507 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "machine_code.h"
+
+#include <gelf.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "elf_error.h"
+#include "profiler.h"
+
+namespace
+{
+// Max distance from addend of PC-relative relocation to its target, e.g.,
+// x86 RIP-relative operand followed by 4-byte immediate.
+constexpr int64_t kMaxPcBias = 8;
+
+constexpr std::string_view kLivepatchPrefix = "__livepatch_";
+constexpr std::string_view kKlpLocalPrefix = "klp.local.sym:";
+
+// Sections that only list code sites, e.g., for ftrace, objtool and
+// retpoline. They don't change behavior of code at the sites.
+constexpr std::string_view kSiteSections[] = {
+	"__mcount_loc",	 "__patchable_function_entries",
+	".orc_unwind_ip", ".eh_frame",
+	".retpoline_sites", ".return_sites",
+	".call_sites",	 ".ibt_endbr_seal",
+	".smp_locks",
+};
+constexpr std::string_view kDiscardPrefix = ".discard.";
+// lists ftrace sites, i.e., `call __fentry__`.
+constexpr std::string_view kMcountLocSection = "__mcount_loc";
+constexpr std::string_view kFentryName = "__fentry__";
+
+// Defined symbol in a section.
+struct Symbol {
+	// normalized name. see MachineCode::NormalizeName()
+	std::string name;
+	uint64_t start = 0;
+	uint64_t size = 0;
+	bool is_func = false;
+
+	bool Covers(int64_t offset) const
+	{
+		return offset >= static_cast<int64_t>(start) &&
+		       offset < static_cast<int64_t>(start + std::max<uint64_t>(
+								     size, 1));
+	}
+};
+
+// key: section index, value: symbols defined in the section sorted by start
+using SymbolTable = std::unordered_map<size_t, std::vector<Symbol> >;
+
+bool IsSiteSection(std::string_view name)
+{
+	if (name.substr(0, kDiscardPrefix.size()) == kDiscardPrefix) {
+		return true;
+	}
+	return std::find(std::begin(kSiteSections), std::end(kSiteSections),
+			 name) != std::end(kSiteSections);
+}
+
+bool IsDefined(size_t sec)
+{
+	return sec != static_cast<size_t>(ElfSymbol::SectionIndex::UNDEF) &&
+	       sec < static_cast<size_t>(ElfSymbol::SectionIndex::LORESERVE);
+}
+
+const Symbol *FindFunction(const SymbolTable &symbols, size_t sec,
+			   int64_t offset)
+{
+	auto sec_symbols = symbols.find(sec);
+	if (sec_symbols == symbols.end()) {
+		return nullptr;
+	}
+	for (const Symbol &i : sec_symbols->second) {
+		if (i.is_func && i.Covers(offset)) {
+			return &i;
+		}
+	}
+	return nullptr;
+}
+
+// Returns true if relocations, l and r, are the same type at the same offset
+// and share any of their target candidates. w/ by_section, targets w/o
+// candidates are compared by their section and offset.
+bool SameReloc(const MachineCode::Reloc &l, const MachineCode::Reloc &r,
+	       bool by_section)
+{
+	if (l.offset != r.offset || l.type != r.type) {
+		return false;
+	}
+	if (by_section && l.targets.empty() && r.targets.empty() &&
+	    !l.section_target.empty()) {
+		return l.section_target == r.section_target;
+	}
+	for (const std::string &target : l.targets) {
+		if (std::find(r.targets.begin(), r.targets.end(), target) !=
+		    r.targets.end()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+const Symbol *FindSymbol(const SymbolTable &symbols, size_t sec,
+			 const std::string &name)
+{
+	auto sec_symbols = symbols.find(sec);
+	if (sec_symbols == symbols.end()) {
+		return nullptr;
+	}
+	for (const Symbol &i : sec_symbols->second) {
+		if (i.name == name) {
+			return &i;
+		}
+	}
+	return nullptr;
+}
+
+// Builds normalized targets of relocations. Section data is loaded on
+// demand.
+class TargetBuilder final {
+    public:
+	TargetBuilder(ElfBin *elf_bin, const SymbolTable &symbols)
+		: elf_bin_(elf_bin), symbols_(symbols)
+	{
+	}
+
+	// Don't allow copy.
+	TargetBuilder(const TargetBuilder &rhs) = delete;
+	TargetBuilder &operator=(const TargetBuilder &rhs) = delete;
+
+	std::vector<std::string> Targets(ElfRela *rela, int64_t addend)
+	{
+		const size_t sec = rela->SymbolSection();
+		if (rela->SymbolType() != ElfSymbol::SymbolType::SECTION) {
+			const std::string name =
+				MachineCode::NormalizeName(rela->Name());
+			const Symbol *symbol =
+				IsDefined(sec) ?
+					FindSymbol(symbols_, sec, name) :
+					nullptr;
+			if (symbol) {
+				return { Key(sec, *symbol, addend) };
+			}
+			return { name + "+" + std::to_string(addend) };
+		}
+
+		// Assembler turns reference to local symbol into an offset
+		// from section symbol.
+		const GElf_Shdr header = elf_bin_->SectionHeader(sec);
+		if (header.sh_flags & SHF_MERGE) {
+			return { MergedKey(sec, header, addend) };
+		}
+
+		// The target is the symbol covering addend + bias where the
+		// bias is the same in both objects but unknown here. So, all
+		// symbols in the range are the candidates.
+		std::vector<std::string> targets;
+		auto sec_symbols = symbols_.find(sec);
+		if (sec_symbols == symbols_.end()) {
+			return targets;
+		}
+		for (const Symbol &i : sec_symbols->second) {
+			for (int64_t bias = 0; bias <= kMaxPcBias; bias++) {
+				if (i.Covers(addend + bias)) {
+					targets.emplace_back(Key(
+						sec, i,
+						addend - static_cast<int64_t>(
+								 i.start)));
+					break;
+				}
+			}
+		}
+		return targets;
+	}
+
+    private:
+	const std::vector<char> &Data(size_t sec)
+	{
+		auto data = data_.find(sec);
+		if (data != data_.end()) {
+			return *data->second;
+		}
+		if (elf_bin_->SectionHeader(sec).sh_type == SHT_NOBITS) {
+			return *data_.emplace(sec,
+					      std::make_unique<std::vector<char> >())
+					.first->second;
+		}
+		return *data_.emplace(sec, elf_bin_->GetSection(sec))
+				.first->second;
+	}
+
+	// symbol + addend. contents of read-only data are part of the key.
+	std::string Key(size_t sec, const Symbol &symbol, int64_t addend)
+	{
+		std::string key = symbol.name + "+" + std::to_string(addend);
+		const GElf_Shdr header = elf_bin_->SectionHeader(sec);
+		if ((header.sh_flags & (SHF_WRITE | SHF_EXECINSTR)) ||
+		    header.sh_type == SHT_NOBITS) {
+			return key;
+		}
+		const std::vector<char> &data = Data(sec);
+		if (symbol.start + symbol.size <= data.size()) {
+			key.append(":").append(data.data() + symbol.start,
+					       symbol.size);
+		}
+		return key;
+	}
+
+	// Data in merged sections, e.g., string literals, has no symbol and
+	// its offset differs across objects. So, the key is bytes in the
+	// window covering all possible targets, [addend, addend + bias +
+	// entry], where entry is a string for SHF_STRINGS.
+	std::string MergedKey(size_t sec, const GElf_Shdr &header,
+			      int64_t addend)
+	{
+		const std::vector<char> &data = Data(sec);
+		const int64_t size = data.size();
+		const int64_t begin = std::clamp<int64_t>(addend, 0, size);
+		int64_t end = std::clamp<int64_t>(
+			addend + kMaxPcBias +
+				std::max<int64_t>(header.sh_entsize, 1),
+			0, size);
+		if (header.sh_flags & SHF_STRINGS) {
+			while (end < size && data[end - 1] != '\0') {
+				end++;
+			}
+		}
+		return std::string(elf_bin_->SectionName(sec)) + "@" +
+		       std::to_string(begin - addend) + ":" +
+		       std::string(data.data() + begin, end - begin);
+	}
+
+	ElfBin *elf_bin_;
+	const SymbolTable &symbols_;
+	std::unordered_map<size_t, std::unique_ptr<std::vector<char> > >
+		data_;
+};
+} // namespace
+
+MachineCode::MachineCode(ElfBin *elf_bin) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	SymbolTable symbols;
+	for (ElfSymbol *i : elf_bin->Symbols()) {
+		const ElfSymbol::SymbolType type = i->Type();
+		if (type != ElfSymbol::SymbolType::FUNC &&
+		    type != ElfSymbol::SymbolType::OBJECT) {
+			continue;
+		}
+		const size_t sec = i->Section();
+		if (!IsDefined(sec)) {
+			continue;
+		}
+		symbols[sec].push_back({ NormalizeName(i->Name()), i->Value(),
+					 i->Size(),
+					 type == ElfSymbol::SymbolType::FUNC });
+	}
+
+	for (auto &[sec, sec_symbols] : symbols) {
+		std::sort(sec_symbols.begin(), sec_symbols.end(),
+			  [](const Symbol &lhs, const Symbol &rhs) {
+				  return lhs.start < rhs.start;
+			  });
+		if (!(elf_bin->SectionHeader(sec).sh_flags & SHF_EXECINSTR)) {
+			continue;
+		}
+
+		std::unique_ptr<std::vector<char> > code =
+			elf_bin->GetSection(sec);
+		for (const Symbol &i : sec_symbols) {
+			if (!i.is_func || ambiguous_.count(i.name)) {
+				continue;
+			}
+			if (functions_.count(i.name)) {
+				functions_.erase(i.name);
+				ambiguous_.insert(i.name);
+				continue;
+			}
+			if (i.start + i.size > code->size()) {
+				continue;
+			}
+			functions_[i.name].code.assign(code->data() + i.start,
+						       i.size);
+		}
+	}
+
+	TargetBuilder target_builder(elf_bin, symbols);
+	try {
+		for (ElfRela *i : elf_bin->Relas()) {
+			const GElf_Rela entry = *i->Entry();
+			const size_t sec = i->SectionId();
+			const int64_t offset = entry.r_offset;
+
+			// relocation in code.
+			if (elf_bin->SectionHeader(sec).sh_flags &
+			    SHF_EXECINSTR) {
+				const Symbol *func =
+					FindFunction(symbols, sec, offset);
+				if (!func || !functions_.count(func->name)) {
+					continue;
+				}
+				// x86 call w/ rel32 operand at 1 byte offset.
+				if (i->Name() == kFentryName &&
+				    offset > static_cast<int64_t>(func->start)) {
+					functions_[func->name]
+						.ftrace_sites.push_back(
+							offset - func->start -
+							1);
+				}
+				Reloc reloc = { offset - func->start,
+						static_cast<uint32_t>(
+							GELF_R_TYPE(entry.r_info)),
+						target_builder.Targets(
+							i, entry.r_addend) };
+				if (reloc.targets.empty()) {
+					reloc.section_target =
+						std::string(elf_bin->SectionName(
+							i->SymbolSection())) +
+						"+" +
+						std::to_string(entry.r_addend);
+				}
+				functions_[func->name].relocs.push_back(
+					std::move(reloc));
+				continue;
+			}
+
+			// relocation in data referring to code inside a
+			// function. the start of function, e.g., function
+			// pointer, doesn't matter. sites are only recorded
+			// for ftrace.
+			const std::string_view sec_name =
+				elf_bin->SectionName(sec);
+			const bool is_mcount_loc = sec_name == kMcountLocSection;
+			if (IsSiteSection(sec_name) && !is_mcount_loc) {
+				continue;
+			}
+			const size_t target_sec = i->SymbolSection();
+			if (!IsDefined(target_sec)) {
+				continue;
+			}
+			int64_t target = entry.r_addend;
+			if (i->SymbolType() != ElfSymbol::SymbolType::SECTION) {
+				const Symbol *symbol = FindSymbol(
+					symbols, target_sec,
+					NormalizeName(i->Name()));
+				if (!symbol) {
+					continue;
+				}
+				target += symbol->start;
+			}
+			const Symbol *func =
+				FindFunction(symbols, target_sec, target);
+			if (!func || !functions_.count(func->name)) {
+				continue;
+			}
+			if (is_mcount_loc) {
+				functions_[func->name].ftrace_sites.push_back(
+					target - func->start);
+			} else if (target != static_cast<int64_t>(func->start)) {
+				functions_[func->name].has_side_data = true;
+			}
+		}
+	} catch (const std::error_code &ec) {
+		if (ec != ElfErrorCode::NO_RELA_SECTION) {
+			throw;
+		}
+	}
+
+	for (auto &[name, func] : functions_) {
+		std::sort(func.relocs.begin(), func.relocs.end(),
+			  [](const Reloc &lhs, const Reloc &rhs) {
+				  return lhs.offset < rhs.offset;
+			  });
+	}
+}
+
+const MachineCode::Function *MachineCode::Find(const std::string &name) const
+{
+	auto func = functions_.find(name);
+	if (func == functions_.end()) {
+		return nullptr;
+	}
+	return &func->second;
+}
+
+std::vector<std::string> MachineCode::Names() const
+{
+	std::vector<std::string> names;
+	names.reserve(functions_.size());
+	for (const auto &[name, func] : functions_) {
+		names.push_back(name);
+	}
+	std::sort(names.begin(), names.end());
+	return names;
+}
+
+bool MachineCode::Equivalent(const Function &lhs, const Function &rhs)
+{
+	if (lhs.has_side_data || rhs.has_side_data || lhs.code != rhs.code ||
+	    lhs.relocs.size() != rhs.relocs.size()) {
+		return false;
+	}
+
+	for (size_t i = 0; i < lhs.relocs.size(); i++) {
+		if (!SameReloc(lhs.relocs[i], rhs.relocs[i],
+			       /*by_section=*/false)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool MachineCode::SameCode(const Function &lhs, const Function &rhs,
+			   uint64_t *diff_offset)
+{
+	// the call is a NOP on one side and a relocated call on the other. so,
+	// sites of either side are masked on both.
+	const size_t size = std::min(lhs.code.size(), rhs.code.size());
+	std::vector<bool> masked(size, false);
+	for (const Function *func : { &lhs, &rhs }) {
+		for (uint64_t site : func->ftrace_sites) {
+			for (uint64_t i = site;
+			     i < std::min<uint64_t>(site + kFtraceCallSize, size);
+			     i++) {
+				masked[i] = true;
+			}
+		}
+	}
+
+	uint64_t first = size;
+	for (size_t i = 0; i < size; i++) {
+		if (!masked[i] && lhs.code[i] != rhs.code[i]) {
+			first = i;
+			break;
+		}
+	}
+	if (first == size && lhs.code.size() == rhs.code.size()) {
+		// relocations are compared in order of offset. Ones at masked
+		// sites are skipped on both.
+		auto next = [&masked, size](const std::vector<Reloc> &relocs,
+					    size_t i) {
+			while (i < relocs.size() && relocs[i].offset < size &&
+			       masked[relocs[i].offset]) {
+				i++;
+			}
+			return i;
+		};
+		size_t l = next(lhs.relocs, 0);
+		size_t r = next(rhs.relocs, 0);
+		while (l < lhs.relocs.size() && r < rhs.relocs.size()) {
+			if (!SameReloc(lhs.relocs[l], rhs.relocs[r],
+				       /*by_section=*/true)) {
+				break;
+			}
+			l = next(lhs.relocs, l + 1);
+			r = next(rhs.relocs, r + 1);
+		}
+		if (l == lhs.relocs.size() && r == rhs.relocs.size()) {
+			return true;
+		}
+		first = std::min(l < lhs.relocs.size() ? lhs.relocs[l].offset :
+							 size,
+				 r < rhs.relocs.size() ? rhs.relocs[r].offset :
+							 size);
+	}
+
+	if (diff_offset) {
+		*diff_offset = first;
+	}
+	return false;
+}
+
+std::string MachineCode::NormalizeName(std::string_view name)
+{
+	for (std::string_view prefix : { kLivepatchPrefix, kKlpLocalPrefix }) {
+		if (name.substr(0, prefix.size()) == prefix) {
+			name.remove_prefix(prefix.size());
+			return std::string(name.substr(0, name.find(':')));
+		}
+	}
+	return std::string(name);
+}
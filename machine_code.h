@@ -0,0 +1,116 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef MACHINE_CODE_H_
+#define MACHINE_CODE_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "elf_bin.h"
+
+// This class holds machine code of functions in a relocatable object, e.g.,
+// klp_patch.o or an object compiled from the 'original'. It's used to tell
+// whether a livepatched function is really changed by codegen, since IR of
+// the function can differ only in ways that don't survive codegen, e.g.,
+// metadata or order of values.
+//
+// Relocation targets are normalized through the symbol table. So, the same
+// target has the same name in both objects even though 'diff' renames it or
+// the assembler turns it into an offset from a section symbol. e.g.,
+//
+//   klp.local.sym:foo:kernel/foo.c + 4  (in klp_patch.o)
+//   .bss + 12, where foo is at 8        (in the 'original')
+//
+// are the same, foo + 4.
+class MachineCode final {
+    public:
+	// Relocation in a function.
+	struct Reloc {
+		// offset from the start of the function
+		uint64_t offset = 0;
+		uint32_t type = 0;
+		// Candidates of the normalized target. An offset from a section
+		// symbol can be inside more than one symbol, since PC-relative
+		// addend has a bias. See MachineCode::MachineCode().
+		std::vector<std::string> targets;
+		// section + offset if no symbol covers the target, e.g., a
+		// jump table. It's only comparable between objects compiled
+		// from the same source. See SameCode().
+		std::string section_target;
+	};
+
+	struct Function {
+		std::string code;
+		std::vector<Reloc> relocs;
+		// true if a section other than site lists, e.g., __jump_table
+		// or __ex_table, refers to code inside the function. Data in
+		// such sections can change behavior of the function w/o changes
+		// in its code. So, the function is never equivalent to others.
+		bool has_side_data = false;
+		// offsets of `call __fentry__` for ftrace, listed in
+		// __mcount_loc or found by relocations. objtool or
+		// recordmcount turns them into NOPs in objects built by kbuild.
+		std::vector<uint64_t> ftrace_sites;
+	};
+
+	MachineCode(ElfBin *elf_bin) noexcept(false);
+	~MachineCode() = default;
+
+	// Don't allow copy.
+	MachineCode(const MachineCode &rhs) = delete;
+	MachineCode &operator=(const MachineCode &rhs) = delete;
+
+	// Returns function for given name after NormalizeName(). If the name
+	// is not found or is ambiguous, nullptr is returned.
+	const Function *Find(const std::string &name) const;
+
+	// Returns names of functions that Find() returns, in sorted order.
+	std::vector<std::string> Names() const;
+
+	// Returns true if lhs and rhs have the same code bytes and relocations
+	// to the same targets.
+	static bool Equivalent(const Function &lhs, const Function &rhs);
+
+	// Returns true if lhs and rhs have the same code bytes and relocations
+	// except at ftrace sites of either. Unlike Equivalent(), data referring
+	// to code inside the functions isn't considered. If not the same,
+	// offset of the first difference is stored in diff_offset.
+	static bool SameCode(const Function &lhs, const Function &rhs,
+			     uint64_t *diff_offset = nullptr);
+
+	// Strips off prefix and source file that 'diff' adds to a symbol name.
+	// e.g., __livepatch_foo:kernel/foo.c and klp.local.sym:foo:1f0a3c9e
+	// are foo.
+	static std::string NormalizeName(std::string_view name);
+
+    private:
+	// size of x86 `call __fentry__` at an ftrace site.
+	static constexpr uint64_t kFtraceCallSize = 5;
+
+	// key: normalized function name
+	std::unordered_map<std::string, Function> functions_;
+	// functions w/ the same normalized name, e.g., static functions of
+	// the same name in different source files of klp_patch.o.
+	std::unordered_set<std::string> ambiguous_;
+};
+
+#endif // MACHINE_CODE_H_
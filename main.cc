@@ -21,11 +21,25 @@
 #include <string>
 #include <system_error>
 
+#include "auto_cleanup.h"
 #include "command.h"
+#include "cpu_profiler.h"
+#include "profiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 int main(int argc, char **argv)
 {
+	// Prints out per-stage statistics if LIVEPATCH_PROFILE is set.
+	AutoCleanup profile_report(
+		[]() { Profiler::Get().Report(llvm::errs()); });
+
+	// Samples CPU and writes out a pprof profile if --cpu-profile is given.
+	const std::string cpu_profile = CpuProfiler::ParseOption(&argc, argv);
+	if (!cpu_profile.empty() && !CpuProfiler::Get().Start(cpu_profile)) {
+		llvm::errs() << "failed to start CPU profiler\n";
+	}
+	AutoCleanup cpu_profile_write([]() { CpuProfiler::Get().Stop(); });
+
 	try {
 		std::unique_ptr<Command> command = Command::Create(argc, argv);
 		std::error_code ec = command->Run();
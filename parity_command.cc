@@ -0,0 +1,157 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "parity_command.h"
+
+#include <argp.h>
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "elf_bin.h"
+#include "profiler.h"
+#include "llvm/Support/Format.h"
+
+using namespace llvm;
+
+namespace
+{
+struct ParityArgs {
+	char *kbuild_obj = nullptr;
+	char *compiled_obj = nullptr;
+	bool quiet = false;
+};
+
+const char kParityArgsDoc[] = "<kbuild.o> <compiled.o>";
+const char kParityPrgDoc[] = "common parity options:\n";
+const struct argp_option kParityOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"quiet", /*key=*/'q', /*arg=*/nullptr,
+	  /*flag=*/0, /*doc=*/"Don't print out functions that differ" },
+	{ nullptr }
+};
+
+error_t ParseParityOpt(int key, char *arg, struct argp_state *state)
+{
+	ParityArgs *args = static_cast<ParityArgs *>(state->input);
+
+	switch (key) {
+	case 'q':
+		args->quiet = true;
+		break;
+	case ARGP_KEY_ARG:
+		if (!args->kbuild_obj) {
+			args->kbuild_obj = arg;
+		} else if (!args->compiled_obj) {
+			args->compiled_obj = arg;
+		} else {
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (!args->compiled_obj) {
+			errs() << "<kbuild.o> <compiled.o> are not given\n";
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+} // namespace
+
+ParityCommand::ParityCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	ParityArgs arguments;
+	struct argp argp = { /*options=*/kParityOptions,
+			     /*parser=*/ParseParityOpt,
+			     /*args_doc=*/kParityArgsDoc,
+			     /*args_doc=*/kParityPrgDoc };
+
+	// First argument is a command, 'parity' and it's already consumed.
+	// So, argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	kbuild_obj_ = arguments.kbuild_obj;
+	compiled_obj_ = arguments.compiled_obj;
+	quiet_ = arguments.quiet;
+}
+
+std::error_code ParityCommand::Compare(const MachineCode &kbuild,
+				       const MachineCode &compiled,
+				       raw_ostream &out, size_t *num_mismatches)
+{
+	Profiler::Stage stage("diff");
+	const std::vector<std::string> kbuild_names = kbuild.Names();
+	const std::vector<std::string> compiled_names = compiled.Names();
+	std::vector<std::string> names;
+	std::set_union(kbuild_names.begin(), kbuild_names.end(),
+		       compiled_names.begin(), compiled_names.end(),
+		       std::back_inserter(names));
+
+	size_t mismatches = 0;
+	for (const std::string &name : names) {
+		const MachineCode::Function *lhs = kbuild.Find(name);
+		const MachineCode::Function *rhs = compiled.Find(name);
+		if (!rhs) {
+			// e.g., inlined into all of its callers or dropped.
+			out << "Only in kbuild: " << name << "\n";
+		} else if (!lhs) {
+			out << "Only in compiled: " << name << "\n";
+		} else {
+			uint64_t offset = 0;
+			if (MachineCode::SameCode(*lhs, *rhs, &offset)) {
+				continue;
+			}
+			out << "Different machine code: " << name << " at +"
+			    << format_hex(offset, 0) << ", size "
+			    << lhs->code.size() << " vs " << rhs->code.size()
+			    << "\n";
+		}
+		mismatches++;
+	}
+
+	out << mismatches << " of " << names.size()
+	    << " functions differ from kbuild\n";
+	*num_mismatches = mismatches;
+	return mismatches ? ErrorCode::CODEGEN_MISMATCH : ErrorCode::NO_ERROR;
+}
+
+std::error_code ParityCommand::Run()
+{
+	ElfBin kbuild_bin(kbuild_obj_, ElfBin::OpenMode::LAZY);
+	ElfBin compiled_bin(compiled_obj_, ElfBin::OpenMode::LAZY);
+	MachineCode kbuild(&kbuild_bin);
+	MachineCode compiled(&compiled_bin);
+
+	size_t num_mismatches = 0;
+	return Compare(kbuild, compiled, quiet_ ? nulls() : outs(),
+		       &num_mismatches);
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef PARITY_COMMAND_H_
+#define PARITY_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "command.h"
+#include "llvm/Support/raw_ostream.h"
+#include "machine_code.h"
+
+// This class implements parity command to check that code compiled the way
+// livepatch-compile does, i.e., to LLVM IR w/o -g and then to an object, is
+// the same as code built by kbuild. Livepatched functions call into and are
+// inlined w/ assumptions on the kernel's code. If codegen of the pipeline
+// differs, e.g., by flags it drops or adds, unchanged callees and the
+// patched functions don't behave as they do in the running kernel. The
+// 'parity' command takes an object built by kbuild and one compiled by
+// livepatch-compile from the same c file, e.g.,
+//
+//   $ livepatch parity kernel/fork.o fork__original.o
+//
+// and compares machine code of every function w/ normalized relocation
+// targets. ftrace sites are ignored since kbuild objects have NOPs for them.
+// Functions w/ different code or defined in only one of the objects are
+// printed out, and CODEGEN_MISMATCH is returned if any.
+class ParityCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "parity";
+
+	ParityCommand(int argc, char **argv) noexcept(false);
+	~ParityCommand() override = default;
+
+	// Don't allow copy.
+	ParityCommand(const ParityCommand &rhs) = delete;
+	ParityCommand &operator=(const ParityCommand &rhs) = delete;
+
+	// Compares functions in the kbuild object w/ the compiled one.
+	std::error_code Run() override;
+
+	// Compares all functions in kbuild and compiled, and prints out ones
+	// that differ. Number of functions that differ is stored in
+	// num_mismatches.
+	static std::error_code Compare(const MachineCode &kbuild,
+				       const MachineCode &compiled,
+				       llvm::raw_ostream &out,
+				       size_t *num_mismatches);
+
+    private:
+	std::string kbuild_obj_;
+	std::string compiled_obj_;
+	bool quiet_ = false;
+};
+
+#endif // PARITY_COMMAND_H_
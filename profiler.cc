@@ -0,0 +1,406 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "profiler.h"
+
+#include <linux/perf_event.h>
+#include <malloc.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iterator>
+#include <string>
+#include <string_view>
+
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace
+{
+constexpr std::string_view kProfileEnv = "LIVEPATCH_PROFILE";
+
+// Allocation counters updated by Profiler::CountAlloc(). They're always
+// updated since relaxed atomic increment is cheap.
+std::atomic<uint64_t> g_allocs{ 0 };
+std::atomic<uint64_t> g_alloc_bytes{ 0 };
+
+enum class CounterMode : int { UNKNOWN = -1, NONE, SOFTWARE, HARDWARE };
+
+// All threads should collect the same kind of counters to sum them up. The
+// first thread opening counters decides the mode.
+std::atomic<CounterMode> g_counter_mode{ CounterMode::UNKNOWN };
+
+struct CounterConfig {
+	uint32_t type;
+	uint64_t config;
+	const char *name;
+};
+
+constexpr CounterConfig kHwCounters[Profiler::kNumCounters] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses" },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses" },
+};
+
+constexpr CounterConfig kSwCounters[Profiler::kNumCounters] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, "task-clock(ns)" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, "page-faults" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "ctx-switches" },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS, "migrations" },
+};
+
+// A group of perf counters for the calling thread. The first counter is
+// the group leader, which reads all counters at once.
+class PerfCounters final {
+    public:
+	PerfCounters()
+	{
+		CounterMode mode = g_counter_mode.load();
+		if (mode == CounterMode::UNKNOWN) {
+			mode = Open(kHwCounters) ? CounterMode::HARDWARE :
+			       Open(kSwCounters) ? CounterMode::SOFTWARE :
+						   CounterMode::NONE;
+			CounterMode expected = CounterMode::UNKNOWN;
+			if (!g_counter_mode.compare_exchange_strong(expected,
+								    mode) &&
+			    expected != mode) {
+				// another thread decided a different mode.
+				Close();
+			}
+			return;
+		}
+
+		if (mode == CounterMode::HARDWARE) {
+			Open(kHwCounters);
+		} else if (mode == CounterMode::SOFTWARE) {
+			Open(kSwCounters);
+		}
+	}
+	~PerfCounters()
+	{
+		Close();
+	}
+
+	// Don't allow copy.
+	PerfCounters(const PerfCounters &rhs) = delete;
+	PerfCounters &operator=(const PerfCounters &rhs) = delete;
+
+	// Reads all counters. If counters are not available, zeros are
+	// returned.
+	std::array<uint64_t, Profiler::kNumCounters> Read() const
+	{
+		std::array<uint64_t, Profiler::kNumCounters> values = {};
+		if (fds_[0] < 0) {
+			return values;
+		}
+
+		// format for PERF_FORMAT_GROUP: { u64 nr; u64 values[nr]; }
+		uint64_t buf[Profiler::kNumCounters + 1] = {};
+		if (read(fds_[0], buf, sizeof(buf)) != sizeof(buf) ||
+		    buf[0] != Profiler::kNumCounters) {
+			return values;
+		}
+		std::copy(buf + 1, buf + 1 + Profiler::kNumCounters,
+			  values.begin());
+		return values;
+	}
+
+    private:
+	bool Open(const CounterConfig (&configs)[Profiler::kNumCounters])
+	{
+		for (size_t i = 0; i < Profiler::kNumCounters; i++) {
+			struct perf_event_attr attr;
+			std::memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = configs[i].type;
+			attr.config = configs[i].config;
+			attr.read_format = PERF_FORMAT_GROUP;
+			// user space only. this is allowed w/o privilege unless
+			// perf_event_paranoid is 3.
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+
+			fds_[i] = syscall(SYS_perf_event_open, &attr, /*pid=*/0,
+					  /*cpu=*/-1, /*group_fd=*/fds_[0],
+					  PERF_FLAG_FD_CLOEXEC);
+			if (fds_[i] < 0) {
+				Close();
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void Close()
+	{
+		for (int &fd : fds_) {
+			if (fd >= 0) {
+				close(fd);
+			}
+			fd = -1;
+		}
+	}
+
+	int fds_[Profiler::kNumCounters] = { -1, -1, -1, -1 };
+};
+
+const PerfCounters &ThreadCounters()
+{
+	thread_local PerfCounters counters;
+	return counters;
+}
+
+// Innermost running stage in the calling thread.
+thread_local Profiler::Stage *t_current_stage = nullptr;
+
+// Heap in scope of the calling thread.
+thread_local Profiler::Heap *t_current_heap = nullptr;
+} // namespace
+
+Profiler::Profiler()
+{
+	const char *env = std::getenv(kProfileEnv.data());
+	enabled_ = env && *env && std::string_view(env) != "0";
+}
+
+Profiler &Profiler::Get()
+{
+	static Profiler profiler;
+	return profiler;
+}
+
+void Profiler::CountAlloc(size_t size)
+{
+	g_allocs.fetch_add(1, std::memory_order_relaxed);
+	g_alloc_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void Profiler::CountHeapAlloc(void *ptr)
+{
+	Heap *heap = t_current_heap;
+	if (!heap || !ptr) {
+		return;
+	}
+
+	const int64_t size = malloc_usable_size(ptr);
+	const int64_t live =
+		heap->live_bytes_.fetch_add(size, std::memory_order_relaxed) +
+		size;
+	int64_t peak = heap->peak_bytes_.load(std::memory_order_relaxed);
+	while (live > peak && !heap->peak_bytes_.compare_exchange_weak(
+				      peak, live, std::memory_order_relaxed)) {
+	}
+}
+
+void Profiler::CountHeapFree(void *ptr)
+{
+	// a block allocated out of the scope makes live bytes lower. It only
+	// underestimates the peak of the heap.
+	Heap *heap = t_current_heap;
+	if (heap && ptr) {
+		heap->live_bytes_.fetch_sub(malloc_usable_size(ptr),
+					    std::memory_order_relaxed);
+	}
+}
+
+Profiler::HeapScope::HeapScope(Heap *heap) : parent_(t_current_heap)
+{
+	t_current_heap = heap;
+}
+
+Profiler::HeapScope::~HeapScope()
+{
+	t_current_heap = parent_;
+}
+
+uint64_t Profiler::Allocs()
+{
+	return g_allocs.load(std::memory_order_relaxed);
+}
+
+uint64_t Profiler::AllocBytes()
+{
+	return g_alloc_bytes.load(std::memory_order_relaxed);
+}
+
+void Profiler::Accumulate(std::string_view name, const StageStats &stats)
+{
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto stage = std::find_if(stages_.begin(), stages_.end(),
+				  [name](const auto &i) { return i.first == name; });
+	if (stage == stages_.end()) {
+		stages_.emplace_back(std::string(name), StageStats{});
+		stage = std::prev(stages_.end());
+	}
+
+	StageStats &total = stage->second;
+	total.calls += stats.calls;
+	total.wall += stats.wall;
+	for (size_t i = 0; i < kNumCounters; i++) {
+		total.counters[i] += stats.counters[i];
+	}
+	total.allocs += stats.allocs;
+	total.alloc_bytes += stats.alloc_bytes;
+}
+
+void Profiler::AddQueue(std::string_view name, const QueueStats &stats)
+{
+	if (!enabled_) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto queue = std::find_if(queues_.begin(), queues_.end(),
+				  [name](const auto &i) { return i.first == name; });
+	if (queue == queues_.end()) {
+		queues_.emplace_back(std::string(name), QueueStats{});
+		queue = std::prev(queues_.end());
+	}
+
+	QueueStats &total = queue->second;
+	total.capacity = std::max(total.capacity, stats.capacity);
+	total.pushes += stats.pushes;
+	total.depth_sum += stats.depth_sum;
+	total.max_depth = std::max(total.max_depth, stats.max_depth);
+	total.full_wait += stats.full_wait;
+	total.empty_wait += stats.empty_wait;
+}
+
+void Profiler::Report(llvm::raw_ostream &out)
+{
+	if (!enabled_) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (stages_.empty()) {
+		return;
+	}
+
+	const CounterMode mode = g_counter_mode.load();
+	const CounterConfig(&configs)[kNumCounters] =
+		(mode == CounterMode::HARDWARE) ? kHwCounters : kSwCounters;
+
+	out << "livepatch profile ("
+	    << (mode == CounterMode::HARDWARE ? "hardware counters" :
+		mode == CounterMode::SOFTWARE ? "software counters" :
+						  "no counters available")
+	    << ")\n";
+	out << llvm::left_justify("stage", 10) << " "
+	    << llvm::right_justify("calls", 6) << " "
+	    << llvm::right_justify("wall(ms)", 10);
+	for (const auto &config : configs) {
+		out << " " << llvm::right_justify(config.name, 15);
+	}
+	out << " " << llvm::right_justify("allocs", 10) << " "
+	    << llvm::right_justify("alloc-bytes", 14) << "\n";
+
+	for (const auto &[name, stats] : stages_) {
+		out << llvm::format("%-10s %6llu %10.3f", name.c_str(),
+				    stats.calls, stats.wall.count() / 1e6);
+		for (uint64_t count : stats.counters) {
+			if (mode == CounterMode::NONE) {
+				out << " " << llvm::right_justify("-", 15);
+			} else {
+				out << llvm::format(" %15llu", count);
+			}
+		}
+		out << llvm::format(" %10llu %14llu\n", stats.allocs,
+				    stats.alloc_bytes);
+	}
+
+	if (queues_.empty()) {
+		return;
+	}
+	out << llvm::left_justify("queue", 10) << " "
+	    << llvm::right_justify("capacity", 8) << " "
+	    << llvm::right_justify("pushes", 8) << " "
+	    << llvm::right_justify("avg-depth", 9) << " "
+	    << llvm::right_justify("max-depth", 9) << " "
+	    << llvm::right_justify("full-wait(ms)", 14) << " "
+	    << llvm::right_justify("empty-wait(ms)", 14) << "\n";
+	for (const auto &[name, stats] : queues_) {
+		const double avg_depth =
+			stats.pushes ? double(stats.depth_sum) / stats.pushes :
+				       0.0;
+		out << llvm::format("%-10s %8llu %8llu %9.2f %9llu %14.3f %14.3f\n",
+				    name.c_str(), stats.capacity, stats.pushes,
+				    avg_depth, stats.max_depth,
+				    stats.full_wait.count() / 1e6,
+				    stats.empty_wait.count() / 1e6);
+	}
+}
+
+Profiler::Stage::Stage(std::string_view name)
+	: name_(name), enabled_(Profiler::Get().Enabled())
+{
+	if (!enabled_) {
+		return;
+	}
+
+	parent_ = t_current_stage;
+	t_current_stage = this;
+
+	allocs_ = Profiler::Allocs();
+	alloc_bytes_ = Profiler::AllocBytes();
+	counters_ = ThreadCounters().Read();
+	start_ = std::chrono::steady_clock::now();
+}
+
+Profiler::Stage::~Stage()
+{
+	if (!enabled_) {
+		return;
+	}
+
+	StageStats stats;
+	stats.wall = std::chrono::steady_clock::now() - start_;
+	const auto counters = ThreadCounters().Read();
+	for (size_t i = 0; i < kNumCounters; i++) {
+		stats.counters[i] = counters[i] - counters_[i];
+	}
+	stats.calls = 1;
+	stats.allocs = Profiler::Allocs() - allocs_;
+	stats.alloc_bytes = Profiler::AllocBytes() - alloc_bytes_;
+
+	t_current_stage = parent_;
+	if (parent_) {
+		// the whole time of this stage is excluded from the parent.
+		parent_->nested_.wall += stats.wall;
+		for (size_t i = 0; i < kNumCounters; i++) {
+			parent_->nested_.counters[i] += stats.counters[i];
+		}
+		parent_->nested_.allocs += stats.allocs;
+		parent_->nested_.alloc_bytes += stats.alloc_bytes;
+	}
+
+	stats.wall -= nested_.wall;
+	for (size_t i = 0; i < kNumCounters; i++) {
+		stats.counters[i] -= nested_.counters[i];
+	}
+	stats.allocs -= nested_.allocs;
+	stats.alloc_bytes -= nested_.alloc_bytes;
+
+	Profiler::Get().Accumulate(name_, stats);
+}
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "llvm/Support/raw_ostream.h"
+
+// This class implements an optional per-stage profiler for livepatch
+// commands. It's enabled by setting the environment variable,
+// LIVEPATCH_PROFILE, to a non-empty value other than "0". When enabled,
+// each named stage (read, parse, precheck, diff, distill, rename, rela,
+// update, render, write) collects wall-clock time, hardware counters from
+// perf_event_open (cycles, instructions, cache misses and branch misses),
+// and the number of allocations and allocated bytes counted by a global
+// operator new hook.
+// The hook is in alloc_hooks.cc, which is not part of liblivepatch. So,
+// allocations are not counted for programs embedding the library.
+// Occupancy of queues between pipelined stages is reported as well.
+//
+// If PMU is not accessible (e.g., in a container), software counters (task
+// clock, page faults, context switches and cpu migrations) are collected
+// instead. Counters are opened once per thread and read at the boundaries
+// of a stage, so the profiler is cheap enough to be left on.
+class Profiler final {
+    public:
+	static constexpr size_t kNumCounters = 4;
+
+	// Accumulated statistics for a named stage.
+	struct StageStats {
+		uint64_t calls = 0;
+		std::chrono::nanoseconds wall{ 0 };
+		std::array<uint64_t, kNumCounters> counters = {};
+		uint64_t allocs = 0;
+		uint64_t alloc_bytes = 0;
+	};
+
+	// Accumulated statistics for a named bounded queue between stages,
+	// e.g., of batch diff. Depth is sampled on each push. Waits are time
+	// producers are blocked on a full queue, i.e., backpressure, and time
+	// consumers are blocked on an empty one.
+	struct QueueStats {
+		uint64_t capacity = 0;
+		uint64_t pushes = 0;
+		uint64_t depth_sum = 0;
+		uint64_t max_depth = 0;
+		std::chrono::nanoseconds full_wait{ 0 };
+		std::chrono::nanoseconds empty_wait{ 0 };
+	};
+
+	// Scoped stage. Statistics are collected from its construction to its
+	// destruction and accumulated to the stage with the given name. Stages
+	// can be nested in a thread, and statistics of a nested stage are only
+	// accounted to the innermost one. It's a no-op if the profiler is
+	// disabled.
+	class Stage final {
+	    public:
+		Stage(std::string_view name);
+		~Stage();
+
+		// Don't allow copy.
+		Stage(const Stage &rhs) = delete;
+		Stage &operator=(const Stage &rhs) = delete;
+
+	    private:
+		std::string_view name_;
+		bool enabled_ = false;
+		std::chrono::steady_clock::time_point start_;
+		std::array<uint64_t, kNumCounters> counters_ = {};
+		uint64_t allocs_ = 0;
+		uint64_t alloc_bytes_ = 0;
+		// Enclosing stage in the same thread and statistics of nested
+		// stages, which are excluded from this stage.
+		Stage *parent_ = nullptr;
+		StageStats nested_;
+	};
+
+	// Heap of a unit of work, e.g., a C file in batch diff, whose stages may
+	// run on different threads. Memory allocated and freed by operator
+	// new/delete in a thread is accounted to the heap in scope of the
+	// thread, so the peak isn't inflated by other units running
+	// concurrently. Like allocation counters, it's counted only w/ the hook
+	// in alloc_hooks.cc.
+	class Heap final {
+	    public:
+		Heap() = default;
+
+		// Don't allow copy.
+		Heap(const Heap &rhs) = delete;
+		Heap &operator=(const Heap &rhs) = delete;
+
+		// High-water mark of bytes live in the heap.
+		uint64_t PeakBytes() const
+		{
+			return peak_bytes_.load(std::memory_order_relaxed);
+		}
+
+	    private:
+		std::atomic<int64_t> live_bytes_{ 0 };
+		std::atomic<int64_t> peak_bytes_{ 0 };
+
+		friend class Profiler;
+	};
+
+	// Scoped heap of the calling thread. Scopes can be nested, and the
+	// innermost one is in effect.
+	class HeapScope final {
+	    public:
+		HeapScope(Heap *heap);
+		~HeapScope();
+
+		// Don't allow copy.
+		HeapScope(const HeapScope &rhs) = delete;
+		HeapScope &operator=(const HeapScope &rhs) = delete;
+
+	    private:
+		Heap *parent_ = nullptr;
+	};
+
+	// Don't allow copy.
+	Profiler(const Profiler &rhs) = delete;
+	Profiler &operator=(const Profiler &rhs) = delete;
+
+	static Profiler &Get();
+
+	bool Enabled() const
+	{
+		return enabled_;
+	}
+
+	// Prints out statistics for all stages. Does nothing if the profiler is
+	// disabled or no stage has been run.
+	void Report(llvm::raw_ostream &out);
+
+	// Accumulates statistics for a queue w/ the given name. Does nothing if
+	// the profiler is disabled.
+	void AddQueue(std::string_view name, const QueueStats &stats);
+
+	// Counts an allocation of size bytes.
+	static void CountAlloc(size_t size);
+
+	// Accounts an allocated or freed block from malloc to the heap in scope
+	// of the calling thread, if any.
+	static void CountHeapAlloc(void *ptr);
+	static void CountHeapFree(void *ptr);
+
+	// Total number of allocations and allocated bytes so far.
+	static uint64_t Allocs();
+	static uint64_t AllocBytes();
+
+    private:
+	Profiler();
+
+	void Accumulate(std::string_view name, const StageStats &stats);
+
+	bool enabled_ = false;
+	std::mutex mutex_;
+	// Stages in the order they are first seen.
+	std::vector<std::pair<std::string, StageStats> > stages_;
+	std::vector<std::pair<std::string, QueueStats> > queues_;
+
+	friend class Stage;
+};
+
+#endif // PROFILER_H_
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "prune_command.h"
+
+#include <argp.h>
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "elf_bin.h"
+#include "elf_symbol.h"
+#include "profiler.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Transforms/Utils/ModuleUtils.h"
+
+using namespace llvm;
+
+namespace
+{
+struct PruneArgs {
+	char *original_obj = nullptr;
+	char *klp_diff_obj = nullptr;
+	char *klp_diff_filename = nullptr;
+	bool quiet = false;
+};
+
+const char kPruneArgsDoc[] =
+	"<original.o> <klp_diff.o> <klp_diff.ll>";
+const char kPrunePrgDoc[] = "common prune options:\n";
+const struct argp_option kPruneOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"quiet", /*key=*/'q', /*arg=*/nullptr,
+	  /*flag=*/0, /*doc=*/"Don't print out pruned functions" },
+	{ nullptr }
+};
+
+constexpr std::string_view kLivepatchPrefix = "__livepatch_";
+
+error_t ParsePruneOpt(int key, char *arg, struct argp_state *state)
+{
+	PruneArgs *args = static_cast<PruneArgs *>(state->input);
+
+	switch (key) {
+	case 'q':
+		args->quiet = true;
+		break;
+	case ARGP_KEY_ARG:
+		if (!args->original_obj) {
+			args->original_obj = arg;
+		} else if (!args->klp_diff_obj) {
+			args->klp_diff_obj = arg;
+		} else if (!args->klp_diff_filename) {
+			args->klp_diff_filename = arg;
+		} else {
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (!args->klp_diff_filename) {
+			errs() << "<original.o> <klp_diff.o> <klp_diff.ll> are "
+				  "not given\n";
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+// Removes value from 'llvm.used' list, which 'diff' adds livepatched
+// functions to.
+void RemoveFromUsed(Module *mod, GlobalValue *value)
+{
+	GlobalVariable *used = mod->getGlobalVariable("llvm.used");
+	if (!used) {
+		return;
+	}
+
+	std::vector<GlobalValue *> kept;
+	if (auto *init = dyn_cast<ConstantArray>(used->getInitializer())) {
+		for (Value *i : init->operands()) {
+			auto *gv = dyn_cast<GlobalValue>(i->stripPointerCasts());
+			if (gv && gv != value) {
+				kept.push_back(gv);
+			}
+		}
+	}
+	used->eraseFromParent();
+	if (!kept.empty()) {
+		appendToUsed(*mod, kept);
+	}
+}
+
+// Turns a livepatched function, __livepatch_${name}:${file}, back into a
+// declaration of the function in the 'original'.
+void RevertLivepatchedFunction(Function *fn)
+{
+	// the function is not referred by 'gen' any longer.
+	RemoveFromUsed(fn->getParent(), fn);
+	fn->deleteBody();
+
+	// Same name as 'diff' gives to unchanged functions. See
+	// ElfSymbol::CreateLivepatchedSymbolName().
+	StringRef name_file = fn->getName().drop_front(kLivepatchPrefix.size());
+	std::string name = fn->isDSOLocal() ?
+				   ElfSymbol::CreateKlpLocalSymName(name_file) :
+				   name_file.split(':').first.str();
+
+	// Others in the klp_diff can't declare the name, but just in case.
+	if (GlobalValue *existing = fn->getParent()->getNamedValue(name)) {
+		existing->replaceAllUsesWith(
+			ConstantExpr::getPointerBitCastOrAddrSpaceCast(
+				fn, existing->getType()));
+		existing->eraseFromParent();
+	}
+	fn->setName(name);
+}
+} // namespace
+
+PruneCommand::PruneCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	PruneArgs arguments;
+	struct argp argp = { /*options=*/kPruneOptions,
+			     /*parser=*/ParsePruneOpt,
+			     /*args_doc=*/kPruneArgsDoc,
+			     /*args_doc=*/kPrunePrgDoc };
+
+	// First argument is a command, 'prune' and it's already consumed.
+	// So, argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	original_obj_ = arguments.original_obj;
+	klp_diff_obj_ = arguments.klp_diff_obj;
+	klp_diff_filename_ = arguments.klp_diff_filename;
+	quiet_ = arguments.quiet;
+}
+
+std::error_code PruneCommand::Prune(Module *klp_diff,
+				    const MachineCode &original,
+				    const MachineCode &patched, raw_ostream &out,
+				    size_t *num_pruned) noexcept(false)
+{
+	Profiler::Stage stage("prune");
+	size_t num_livepatched = 0;
+	std::vector<Function *> pruned;
+	for (Function &fn : *klp_diff) {
+		if (fn.isDeclaration() ||
+		    !fn.getName().startswith(kLivepatchPrefix)) {
+			continue;
+		}
+		num_livepatched++;
+
+		const std::string name = MachineCode::NormalizeName(fn.getName());
+		const MachineCode::Function *lhs = original.Find(name);
+		const MachineCode::Function *rhs = patched.Find(name);
+		if (lhs && rhs && MachineCode::Equivalent(*lhs, *rhs)) {
+			pruned.push_back(&fn);
+		}
+	}
+
+	for (Function *fn : pruned) {
+		out << "Same machine code: "
+		    << MachineCode::NormalizeName(fn->getName()) << "\n";
+		RevertLivepatchedFunction(fn);
+	}
+
+	*num_pruned = pruned.size();
+	if (num_livepatched == pruned.size()) {
+		return ErrorCode::NOTHING_TO_PATCH;
+	}
+	return ErrorCode::NO_ERROR;
+}
+
+std::error_code PruneCommand::Run()
+{
+	ElfBin original_bin(original_obj_, ElfBin::OpenMode::LAZY);
+	ElfBin patched_bin(klp_diff_obj_, ElfBin::OpenMode::LAZY);
+	MachineCode original(&original_bin);
+	MachineCode patched(&patched_bin);
+
+	LLVMContext context;
+	std::unique_ptr<Module> klp_diff;
+	{
+		Profiler::Stage stage("parse");
+		SMDiagnostic diag;
+		klp_diff = parseIRFile(klp_diff_filename_, diag, context);
+	}
+	if (!klp_diff) {
+		errs() << klp_diff_filename_ << " is not valid LLVM\n";
+		return ErrorCode::INVALID_LLVM_FILE;
+	}
+
+	size_t num_pruned = 0;
+	std::error_code ret = Prune(klp_diff.get(), original, patched,
+				    quiet_ ? nulls() : outs(), &num_pruned);
+	if (num_pruned == 0) {
+		return ret;
+	}
+
+	// the klp_diff is updated in place, so it's compiled again.
+	Profiler::Stage stage("render");
+	std::error_code ec;
+	raw_fd_ostream fout(klp_diff_filename_, ec);
+	if (ec) {
+		return ec;
+	}
+	klp_diff->print(fout, nullptr);
+	return ret;
+}
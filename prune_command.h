@@ -0,0 +1,74 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef PRUNE_COMMAND_H_
+#define PRUNE_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "command.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+#include "machine_code.h"
+
+// This class implements prune command to drop livepatched functions whose
+// machine code is not changed. 'diff' compares functions in IR, so a
+// function can be livepatched only because of changes that don't survive
+// codegen, e.g., renumbered values or reordered basic blocks that end up
+// in the same layout. The 'prune' command takes an object compiled from
+// the 'original', an object compiled from the *.c__klp_diff.ll and the
+// *.c__klp_diff.ll itself, e.g.,
+//
+//   $ livepatch prune foo.c__original.o foo.c__klp_diff.o foo.c__klp_diff.ll
+//
+// and turns livepatched functions w/ the same machine code in both objects
+// back into declarations, same as 'diff' does for unchanged functions. The
+// *.c__klp_diff.ll is updated in place only if any function is pruned, and
+// NOTHING_TO_PATCH is returned if no livepatched function is left.
+class PruneCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "prune";
+
+	PruneCommand(int argc, char **argv) noexcept(false);
+	~PruneCommand() override = default;
+
+	// Don't allow copy.
+	PruneCommand(const PruneCommand &rhs) = delete;
+	PruneCommand &operator=(const PruneCommand &rhs) = delete;
+
+	// Prunes functions w/ the same machine code out of the klp_diff.
+	std::error_code Run() override;
+
+	// Prunes livepatched functions in klp_diff that are equivalent in
+	// original and patched. Number of pruned functions is stored in
+	// num_pruned.
+	static std::error_code Prune(llvm::Module *klp_diff,
+				     const MachineCode &original,
+				     const MachineCode &patched,
+				     llvm::raw_ostream &out,
+				     size_t *num_pruned) noexcept(false);
+
+    private:
+	std::string original_obj_;
+	std::string klp_diff_obj_;
+	std::string klp_diff_filename_;
+	bool quiet_ = false;
+};
+
+#endif // PRUNE_COMMAND_H_
@@ -0,0 +1,253 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "rebase_command.h"
+
+#include <argp.h>
+
+#include <algorithm>
+#include <cctype>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "ir_slice_index.h"
+#include "machine_code.h"
+#include "profiler.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace
+{
+struct RebaseArgs {
+	char *prev_original_filename = nullptr;
+	char *klp_diff_filename = nullptr;
+	char *new_original_filename = nullptr;
+	bool quiet = false;
+};
+
+const char kRebaseArgsDoc[] =
+	"<prev_original.ll> <prev_klp_diff.ll> <new_original.ll>";
+const char kRebasePrgDoc[] = "common rebase options:\n";
+const struct argp_option kRebaseOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"quiet", /*key=*/'q', /*arg=*/nullptr,
+	  /*flag=*/0, /*doc=*/"Don't print out changed functions" },
+	{ nullptr }
+};
+
+constexpr std::string_view kLivepatchPrefix = "__livepatch_";
+
+error_t ParseRebaseOpt(int key, char *arg, struct argp_state *state)
+{
+	RebaseArgs *args = static_cast<RebaseArgs *>(state->input);
+
+	switch (key) {
+	case 'q':
+		args->quiet = true;
+		break;
+	case ARGP_KEY_ARG:
+		if (!args->prev_original_filename) {
+			args->prev_original_filename = arg;
+		} else if (!args->klp_diff_filename) {
+			args->klp_diff_filename = arg;
+		} else if (!args->new_original_filename) {
+			args->new_original_filename = arg;
+		} else {
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (!args->new_original_filename) {
+			errs() << "<prev_original.ll> <prev_klp_diff.ll> "
+				  "<new_original.ll> are not given\n";
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+// Returns name of global value as it's written in textual LLVM IR, e.g.,
+// @foo or @"foo:bar".
+std::string IrName(std::string_view name)
+{
+	const bool quoted =
+		name.empty() || std::isdigit(static_cast<unsigned char>(name[0])) ||
+		std::any_of(name.begin(), name.end(), [](char c) {
+			return !std::isalnum(static_cast<unsigned char>(c)) &&
+			       c != '-' && c != '$' && c != '.' && c != '_';
+		});
+	if (quoted) {
+		return "@\"" + std::string(name) + "\"";
+	}
+	return "@" + std::string(name);
+}
+
+// Adds global values a user refers to, including ones in constant
+// expressions, e.g., getelementptr or bitcast of a global variable.
+void AddReferences(const User *user, SmallPtrSetImpl<const GlobalValue *> *refs,
+		   SmallPtrSetImpl<const Constant *> *visited)
+{
+	for (const Value *operand : user->operands()) {
+		if (const auto *value = dyn_cast<GlobalValue>(operand)) {
+			refs->insert(value);
+		} else if (const auto *constant = dyn_cast<Constant>(operand)) {
+			if (visited->insert(constant).second) {
+				AddReferences(constant, refs, visited);
+			}
+		}
+	}
+}
+} // namespace
+
+RebaseCommand::RebaseCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	RebaseArgs arguments;
+	struct argp argp = { /*options=*/kRebaseOptions,
+			     /*parser=*/ParseRebaseOpt,
+			     /*args_doc=*/kRebaseArgsDoc,
+			     /*args_doc=*/kRebasePrgDoc };
+
+	// First argument is a command, 'rebase' and it's already consumed.
+	// So, argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	prev_original_filename_ = arguments.prev_original_filename;
+	klp_diff_filename_ = arguments.klp_diff_filename;
+	new_original_filename_ = arguments.new_original_filename;
+	quiet_ = arguments.quiet;
+}
+
+std::vector<std::string>
+RebaseCommand::DependentValues(const llvm::Module &klp_diff)
+{
+	// values referred to by definitions in the klp_diff, i.e., by
+	// livepatched functions and functions and variables new in the patch.
+	SmallPtrSet<const GlobalValue *, 32> refs;
+	SmallPtrSet<const Constant *, 32> visited;
+	for (const Function &fn : klp_diff) {
+		for (const Instruction &inst : instructions(fn)) {
+			AddReferences(&inst, &refs, &visited);
+		}
+	}
+	for (const GlobalVariable &var : klp_diff.globals()) {
+		if (var.hasInitializer()) {
+			AddReferences(&var, &refs, &visited);
+		}
+	}
+
+	std::vector<std::string> names;
+	for (const GlobalValue &value : klp_diff.global_values()) {
+		const StringRef name = value.getName();
+		if (name.empty() || name.startswith("llvm.")) {
+			continue;
+		}
+		if (value.isDeclaration()) {
+			// functions and variables in the kernel, e.g., callees.
+			if (!refs.count(&value)) {
+				continue;
+			}
+		} else if (!name.startswith(kLivepatchPrefix) &&
+			   (isa<Function>(value) || value.hasLocalLinkage())) {
+			// definitions w/o the prefix, e.g., new functions or
+			// .str, are new in the klp_diff. values they refer to
+			// are compared instead.
+			continue;
+		}
+		names.push_back(IrName(MachineCode::NormalizeName(name)));
+	}
+
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+	return names;
+}
+
+std::error_code RebaseCommand::Run()
+{
+	LLVMContext context;
+	std::unique_ptr<Module> klp_diff;
+	{
+		Profiler::Stage stage("parse");
+		SMDiagnostic diag;
+		klp_diff = parseIRFile(klp_diff_filename_, diag, context);
+	}
+	if (!klp_diff) {
+		errs() << klp_diff_filename_ << " is not valid LLVM\n";
+		return ErrorCode::INVALID_LLVM_FILE;
+	}
+
+	auto prev_buf = MemoryBuffer::getFile(prev_original_filename_);
+	if (!prev_buf) {
+		errs() << "failed to read " << prev_original_filename_ << "\n";
+		return prev_buf.getError();
+	}
+	auto new_buf = MemoryBuffer::getFile(new_original_filename_);
+	if (!new_buf) {
+		errs() << "failed to read " << new_original_filename_ << "\n";
+		return new_buf.getError();
+	}
+
+	Profiler::Stage stage("rebase");
+	StringRef prev_text = (*prev_buf)->getBuffer();
+	StringRef new_text = (*new_buf)->getBuffer();
+	IrSliceIndex prev_index(
+		std::string_view(prev_text.data(), prev_text.size()));
+	IrSliceIndex new_index(std::string_view(new_text.data(), new_text.size()));
+
+	// functions inlined into the patch aren't in the klp_diff. So, every
+	// function in the translation unit is compared.
+	std::vector<std::string> names = DependentValues(*klp_diff);
+	for (const IrSliceIndex *index : { &prev_index, &new_index }) {
+		std::vector<std::string> functions = index->FunctionNames();
+		names.insert(names.end(), functions.begin(), functions.end());
+	}
+	std::sort(names.begin(), names.end());
+	names.erase(std::unique(names.begin(), names.end()), names.end());
+
+	std::vector<std::string> changed =
+		IrSliceIndex::ChangedValues(prev_index, new_index, names);
+	if (changed.empty()) {
+		return ErrorCode::NO_ERROR;
+	}
+
+	if (!quiet_) {
+		for (const std::string &name : changed) {
+			outs() << "Changed in new kernel: " << name << "\n";
+		}
+	}
+	return ErrorCode::STALE_DIFF;
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef REBASE_COMMAND_H_
+#define REBASE_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "command.h"
+#include "llvm/IR/Module.h"
+
+// This class implements rebase command to check if a klp_diff generated
+// against a kernel can be reused for a new build of the kernel, e.g., a
+// stable update that doesn't touch livepatched code. The 'rebase' command
+// takes the 'original' and the *.c__klp_diff.ll of a previous build and
+// the 'original' of the new kernel, e.g.,
+//
+//   $ livepatch rebase old/foo__original.ll old/foo.c__klp_diff.ll new.ll
+//
+// Per-function fingerprints from IrSliceIndex are compared for every
+// function defined in the translation unit, as a function called by the
+// patch may be inlined into it and isn't in the klp_diff, and for global
+// variables and functions that any function defined in the klp_diff refers
+// to, including ones new in the patch. If none of them is changed, the
+// klp_diff is valid for the new kernel as is. Otherwise, changed ones are
+// printed out and STALE_DIFF is returned so that the file is diffed again.
+class RebaseCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "rebase";
+
+	RebaseCommand(int argc, char **argv) noexcept(false);
+	~RebaseCommand() override = default;
+
+	// Don't allow copy.
+	RebaseCommand(const RebaseCommand &rhs) = delete;
+	RebaseCommand &operator=(const RebaseCommand &rhs) = delete;
+
+	// Checks the klp_diff against the new 'original'.
+	std::error_code Run() override;
+
+	// Returns names of global values in klp_diff that need to be same in
+	// both 'original', e.g., '@foo' for __livepatch_foo:kernel/foo.c.
+	static std::vector<std::string>
+	DependentValues(const llvm::Module &klp_diff);
+
+    private:
+	std::string prev_original_filename_;
+	std::string klp_diff_filename_;
+	std::string new_original_filename_;
+	bool quiet_ = false;
+};
+
+#endif // REBASE_COMMAND_H_
@@ -0,0 +1,526 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "stalls_command.h"
+
+#include <argp.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu_profiler.h"
+#include "elf_bin.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+namespace fs = std::filesystem;
+
+namespace
+{
+struct StallsArgs {
+	char *snapshot_dir = nullptr;
+	char *klp_module = nullptr;
+	char *manifest = nullptr;
+	char *jobs = nullptr;
+};
+
+const char kStallsArgsDoc[] = "<snapshot_dir>";
+const char kStallsPrgDoc[] = "common stalls options:\n";
+const struct argp_option kStallsOptions[] = {
+	// name, key, arg, flags, doc,
+	{ /*name=*/"klp_module", /*key=*/'k', /*arg=*/"KLP_MODULE",
+	  /*flag=*/0, /*doc=*/"Livepatch module w/ patched functions" },
+	{ /*name=*/"manifest", /*key=*/'m', /*arg=*/"MANIFEST",
+	  /*flag=*/0, /*doc=*/"File w/ a patched function per line" },
+	{ /*name=*/"jobs", /*key=*/'j', /*arg=*/"JOBS",
+	  /*flag=*/0,
+	  /*doc=*/"Number of threads scanning stacks. default: # of CPUs" },
+	{ nullptr }
+};
+
+constexpr std::string_view kLivepatchPrefixElf = "__livepatch_";
+constexpr std::string_view kLivepatchPrefixTmpl = "livepatch_";
+constexpr std::string_view kSysfsLivepatch = "sys/kernel/livepatch";
+
+error_t ParseStallsOpt(int key, char *arg, struct argp_state *state)
+{
+	StallsArgs *args = static_cast<StallsArgs *>(state->input);
+
+	switch (key) {
+	case 'k':
+		args->klp_module = arg;
+		break;
+	case 'm':
+		args->manifest = arg;
+		break;
+	case 'j':
+		args->jobs = arg;
+		break;
+	case ARGP_KEY_ARG:
+		if (!args->snapshot_dir) {
+			args->snapshot_dir = arg;
+		} else {
+			argp_usage(state);
+		}
+		break;
+	case ARGP_KEY_END:
+		if (!args->snapshot_dir) {
+			errs() << "<snapshot_dir> is not given\n";
+			argp_usage(state);
+		}
+		break;
+	default:
+		return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+// Reads the first line of a file. It's empty if the file can't be read,
+// e.g., a task exited while the snapshot was taken.
+std::string ReadFirstLine(const fs::path &path)
+{
+	std::ifstream in_file(path);
+	std::string line;
+	std::getline(in_file, line);
+	return line;
+}
+
+// Livepatch in the snapshot.
+struct PatchState {
+	std::string name;
+	bool enabled = false;
+	bool transition = false;
+	// patched functions w/o sympos.
+	std::vector<std::string> funcs;
+};
+
+// Reads livepatches in sysfs of the snapshot. Directories for patched
+// functions are named ${func},${sympos} under directories for objects.
+std::vector<PatchState> ReadPatchStates(const fs::path &snapshot)
+{
+	std::vector<PatchState> patches;
+	std::error_code ec;
+	for (const fs::directory_entry &patch_dir :
+	     fs::directory_iterator(snapshot / kSysfsLivepatch, ec)) {
+		if (!patch_dir.is_directory(ec)) {
+			continue;
+		}
+
+		PatchState &patch = patches.emplace_back();
+		patch.name = patch_dir.path().filename();
+		patch.enabled = ReadFirstLine(patch_dir.path() / "enabled") == "1";
+		patch.transition =
+			ReadFirstLine(patch_dir.path() / "transition") == "1";
+		for (const fs::directory_entry &obj_dir :
+		     fs::directory_iterator(patch_dir.path(), ec)) {
+			if (!obj_dir.is_directory(ec)) {
+				continue;
+			}
+			for (const fs::directory_entry &func_dir :
+			     fs::directory_iterator(obj_dir.path(), ec)) {
+				const std::string func = func_dir.path().filename();
+				size_t sympos = func.find(',');
+				if (func_dir.is_directory(ec) &&
+				    sympos != std::string::npos) {
+					patch.funcs.emplace_back(func, 0, sympos);
+				}
+			}
+		}
+	}
+
+	std::sort(patches.begin(), patches.end(),
+		  [](const PatchState &lhs, const PatchState &rhs) {
+			  return lhs.name < rhs.name;
+		  });
+	return patches;
+}
+
+// Reads patched functions from symbols of a livepatch module. New
+// functions are named w/ kLivepatchPrefixElf.
+std::vector<std::string> ReadKlpModuleFuncs(const std::string &klp_module)
+	noexcept(false)
+{
+	// The module is opened read-only not to require write permission,
+	// e.g., for one in /lib/modules. Only its symbols are paged in.
+	if (access(klp_module.c_str(), R_OK) < 0) {
+		errs() << "failed to open " << klp_module << "\n";
+		throw std::error_code{ Command::ErrorCode::FILE_OPEN_FAILED };
+	}
+
+	ElfBin elf_bin(klp_module, ElfBin::OpenMode::LAZY);
+	std::vector<std::string> funcs;
+	for (ElfSymbol *i : elf_bin.Symbols()) {
+		StringRef symbol = i->Name();
+		if (symbol.startswith(kLivepatchPrefixElf)) {
+			// klp_patch.o before 'gen' has source filename, too.
+			funcs.emplace_back(symbol.drop_front(
+						       kLivepatchPrefixElf.size())
+						   .split(':')
+						   .first);
+		}
+	}
+	return funcs;
+}
+
+// Reads patched functions from a manifest. Empty lines and lines starting
+// w/ '#' are ignored. ",${sympos}" is allowed as in sysfs.
+std::vector<std::string> ReadManifest(const std::string &manifest)
+	noexcept(false)
+{
+	std::ifstream in_file(manifest);
+	if (!in_file.is_open()) {
+		errs() << "failed to open " << manifest << "\n";
+		throw std::error_code{ Command::ErrorCode::FILE_OPEN_FAILED };
+	}
+
+	std::vector<std::string> funcs;
+	std::string line;
+	while (std::getline(in_file, line)) {
+		StringRef func = StringRef(line).trim();
+		if (!func.empty() && !func.startswith("#")) {
+			funcs.emplace_back(func.split(',').first.rtrim());
+		}
+	}
+	return funcs;
+}
+
+// Index from symbols on stacks to patched functions. New functions are
+// indexed as well since they are on stacks while unpatching.
+using FuncIndex = std::unordered_map<std::string, std::string>;
+
+FuncIndex BuildFuncIndex(const std::vector<std::string> &funcs)
+{
+	FuncIndex index;
+	for (const std::string &func : funcs) {
+		index.emplace(func, func);
+		index.emplace(std::string(kLivepatchPrefixElf) + func, func);
+		index.emplace(std::string(kLivepatchPrefixTmpl) + func, func);
+	}
+	return index;
+}
+
+// Task, i.e., thread, in proc directory of the snapshot. Each thread has
+// its own stack and switches to the new universe on its own.
+struct TaskId {
+	long pid = 0;
+	long tid = 0;
+};
+
+// Task w/ patched functions on its stack.
+struct BlockingTask {
+	long pid = 0;
+	long tid = 0;
+	std::string comm;
+	// e.g., "D (disk sleep)"
+	std::string state;
+	// patched functions on the stack from the top.
+	std::vector<std::string> funcs;
+};
+
+// Returns symbol of a stack frame. e.g., "schedule" for
+// "[<0>] schedule+0x45/0x80" or "foo" for
+// "[<ffffffffc0a1b2c3>] foo+0x1f/0x30 [mod]"
+StringRef FrameSymbol(StringRef frame)
+{
+	size_t pos = frame.find("] ");
+	if (pos == StringRef::npos) {
+		return "";
+	}
+	StringRef symbol = frame.drop_front(pos + 2);
+	return symbol.take_until([](char c) { return c == '+' || c == ' '; });
+}
+
+// Scans stack of a task. funcs of the task is left empty if no patched
+// function is on the stack or the task already switched to target_state,
+// the patch_state of tasks that completed the transition.
+void ScanTask(const fs::path &task_dir, const FuncIndex &index,
+	      const std::string &target_state, BlockingTask *task)
+{
+	if (!target_state.empty() &&
+	    ReadFirstLine(task_dir / "patch_state") == target_state) {
+		return;
+	}
+
+	std::ifstream stack(task_dir / "stack");
+	std::string frame;
+	while (std::getline(stack, frame)) {
+		auto func = index.find(FrameSymbol(frame).str());
+		if (func != index.end() &&
+		    std::find(task->funcs.begin(), task->funcs.end(),
+			      func->second) == task->funcs.end()) {
+			task->funcs.push_back(func->second);
+		}
+	}
+	if (task->funcs.empty()) {
+		return;
+	}
+
+	task->comm = ReadFirstLine(task_dir / "comm");
+	std::ifstream status(task_dir / "status");
+	std::string line;
+	while (std::getline(status, line)) {
+		StringRef field = line;
+		if (field.consume_front("State:")) {
+			task->state = field.trim().str();
+			break;
+		}
+	}
+	if (task->state.empty()) {
+		task->state = "unknown";
+	}
+}
+
+// Returns numeric names of entries in a directory in ascending order, e.g.,
+// pids in proc directory or tids in ${pid}/task.
+std::vector<long> ListIds(const fs::path &dir, std::error_code &ec)
+{
+	std::vector<long> ids;
+	for (const fs::directory_entry &entry : fs::directory_iterator(dir, ec)) {
+		const std::string name = entry.path().filename();
+		char *end = nullptr;
+		long id = std::strtol(name.c_str(), &end, 10);
+		if (!name.empty() && *end == '\0') {
+			ids.push_back(id);
+		}
+	}
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+// Lists tasks in proc directory of the snapshot in ascending order of pid
+// and tid. /proc/${pid}/stack is the stack of the main thread only, so
+// threads are listed from /proc/${pid}/task. A process w/o task directory,
+// e.g., in a snapshot taken w/o it, is taken as a single thread.
+std::vector<TaskId> ListTasks(const fs::path &proc_dir) noexcept(false)
+{
+	std::error_code ec;
+	std::vector<long> pids = ListIds(proc_dir, ec);
+	if (ec) {
+		errs() << "failed to open " << proc_dir.native() << "\n";
+		throw std::error_code{ Command::ErrorCode::FILE_OPEN_FAILED };
+	}
+
+	std::vector<TaskId> tasks;
+	for (long pid : pids) {
+		// the process may exit while it's listed.
+		std::vector<long> tids =
+			ListIds(proc_dir / std::to_string(pid) / "task", ec);
+		if (tids.empty()) {
+			tids.push_back(pid);
+		}
+		for (long tid : tids) {
+			tasks.push_back({ pid, tid });
+		}
+	}
+	return tasks;
+}
+
+// Returns directory of a task. It's ${pid} for a process w/o task
+// directory.
+fs::path TaskDir(const fs::path &proc_dir, const TaskId &task)
+{
+	const fs::path pid_dir = proc_dir / std::to_string(task.pid);
+	fs::path task_dir = pid_dir / "task" / std::to_string(task.tid);
+	std::error_code ec;
+	return fs::is_directory(task_dir, ec) ? task_dir : pid_dir;
+}
+
+// Scans stacks of tasks w/ jobs threads and returns blocking tasks in
+// ascending order of pid and tid. Threads take tasks one by one, so a task
+// w/ a slow read doesn't hold up the others.
+std::vector<BlockingTask> ScanTasks(const fs::path &proc_dir,
+				    const std::vector<TaskId> &task_ids,
+				    const FuncIndex &index,
+				    const std::string &target_state,
+				    unsigned jobs)
+{
+	std::vector<BlockingTask> tasks(task_ids.size());
+	std::atomic<size_t> next_task{ 0 };
+	auto scan = [&]() {
+		CpuProfiler::RegisterThread();
+		for (size_t i = next_task++; i < task_ids.size();
+		     i = next_task++) {
+			tasks[i].pid = task_ids[i].pid;
+			tasks[i].tid = task_ids[i].tid;
+			ScanTask(TaskDir(proc_dir, task_ids[i]), index,
+				 target_state, &tasks[i]);
+		}
+	};
+
+	jobs = std::max(1u, std::min<unsigned>(jobs, task_ids.size()));
+	std::vector<std::thread> workers;
+	for (unsigned i = 1; i < jobs; i++) {
+		workers.emplace_back(scan);
+	}
+	scan();
+	for (std::thread &worker : workers) {
+		worker.join();
+	}
+
+	tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+				   [](const BlockingTask &task) {
+					   return task.funcs.empty();
+				   }),
+		    tasks.end());
+	return tasks;
+}
+
+// Prints out blocking tasks grouped by patched function and wait state.
+// Functions blocking more tasks come first.
+void Report(const std::vector<PatchState> &patches,
+	    const std::vector<BlockingTask> &tasks, size_t num_scanned,
+	    raw_ostream &out)
+{
+	for (const PatchState &patch : patches) {
+		out << "livepatch " << patch.name
+		    << ": enabled=" << patch.enabled
+		    << " transition=" << patch.transition;
+		if (patch.transition) {
+			out << (patch.enabled ? " (patching)" : " (unpatching)");
+		}
+		out << "\n";
+	}
+	out << "scanned " << num_scanned << " tasks, " << tasks.size()
+	    << " blocking\n";
+
+	using TasksByState =
+		std::map<std::string, std::vector<const BlockingTask *> >;
+	std::map<std::string, TasksByState> blocked_funcs;
+	std::map<std::string, size_t> num_tasks;
+	for (const BlockingTask &task : tasks) {
+		for (const std::string &func : task.funcs) {
+			blocked_funcs[func][task.state].push_back(&task);
+			num_tasks[func]++;
+		}
+	}
+
+	std::vector<std::pair<std::string, size_t> > funcs(num_tasks.begin(),
+							    num_tasks.end());
+	std::stable_sort(funcs.begin(), funcs.end(),
+			 [](const auto &lhs, const auto &rhs) {
+				 return lhs.second > rhs.second;
+			 });
+	for (const auto &[func, count] : funcs) {
+		out << "\n" << func << ": " << count << " tasks\n";
+		for (const auto &[state, state_tasks] : blocked_funcs[func]) {
+			out << "  " << state << ": " << state_tasks.size()
+			    << " tasks\n";
+			for (const BlockingTask *task : state_tasks) {
+				out << "    " << task->tid << " " << task->comm;
+				if (task->tid != task->pid) {
+					out << " (pid " << task->pid << ")";
+				}
+				out << "\n";
+			}
+		}
+	}
+}
+} // namespace
+
+StallsCommand::StallsCommand(int argc, char **argv) noexcept(false)
+{
+	if (argc < 1) {
+		throw std::error_code{ ErrorCode::NOT_ENOUGH_ARGS };
+	}
+
+	StallsArgs arguments;
+	struct argp argp = { /*options=*/kStallsOptions,
+			     /*parser=*/ParseStallsOpt,
+			     /*args_doc=*/kStallsArgsDoc,
+			     /*args_doc=*/kStallsPrgDoc };
+
+	// First argument is a command, 'stalls' and it's already consumed.
+	// So, argv[0] = argv[0] + argv[1] to let others used for options.
+	std::string command = std::string(argv[0]) + " " + argv[1];
+	--argc;
+	++argv;
+	argv[0] = const_cast<char *>(command.c_str());
+	argp_parse(&argp, argc, argv, /*flags=*/0,
+		   /*arg_index=*/nullptr, /*input=*/&arguments);
+
+	snapshot_dir_ = arguments.snapshot_dir;
+	klp_module_ = arguments.klp_module ? arguments.klp_module : "";
+	manifest_ = arguments.manifest ? arguments.manifest : "";
+	jobs_ = arguments.jobs ? std::strtoul(arguments.jobs, nullptr, 10) :
+				 std::thread::hardware_concurrency();
+	jobs_ = std::max(jobs_, 1u);
+}
+
+std::error_code StallsCommand::Run()
+{
+	const fs::path snapshot(snapshot_dir_);
+	const fs::path proc_dir = snapshot / "proc";
+	std::vector<TaskId> task_ids = ListTasks(proc_dir);
+	std::vector<PatchState> patches = ReadPatchStates(snapshot);
+
+	// patch_state of a task is the universe it's in: 1 for patched, 0
+	// for unpatched and -1 w/o transition. Tasks already in the target
+	// universe of the transition don't block it.
+	std::string target_state;
+	for (const PatchState &patch : patches) {
+		if (patch.transition) {
+			target_state = patch.enabled ? "1" : "0";
+		}
+	}
+
+	std::vector<std::string> funcs;
+	if (!klp_module_.empty()) {
+		funcs = ReadKlpModuleFuncs(klp_module_);
+	}
+	if (!manifest_.empty()) {
+		std::vector<std::string> manifest_funcs = ReadManifest(manifest_);
+		funcs.insert(funcs.end(), manifest_funcs.begin(),
+			     manifest_funcs.end());
+	}
+	if (klp_module_.empty() && manifest_.empty()) {
+		// Only livepatches in transition block tasks. If none is,
+		// e.g., transition completed before the snapshot, take all.
+		bool in_transition = std::any_of(
+			patches.begin(), patches.end(),
+			[](const PatchState &patch) { return patch.transition; });
+		for (const PatchState &patch : patches) {
+			if (!in_transition || patch.transition) {
+				funcs.insert(funcs.end(), patch.funcs.begin(),
+					     patch.funcs.end());
+			}
+		}
+	}
+
+	if (funcs.empty()) {
+		errs() << "There are no livepatched functions.\n";
+		return ErrorCode::NOTHING_TO_PATCH;
+	}
+
+	std::vector<BlockingTask> tasks =
+		ScanTasks(proc_dir, task_ids, BuildFuncIndex(funcs),
+			  target_state, jobs_);
+	Report(patches, tasks, task_ids.size(), outs());
+
+	return ErrorCode::NO_ERROR;
+}
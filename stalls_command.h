@@ -0,0 +1,68 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef STALLS_COMMAND_H_
+#define STALLS_COMMAND_H_
+
+#include <string>
+#include <string_view>
+#include <system_error>
+
+#include "command.h"
+
+// This class implements stalls command to find out why a livepatch
+// transition doesn't complete. A task can't switch to the new universe
+// while a patched function is on its stack. The 'stalls' command reads a
+// snapshot of a machine, which has the same layout as its root directory,
+//
+//   ${SNAPSHOT}/proc/${pid}/task/${tid}/{stack,comm,status,patch_state}
+//   ${SNAPSHOT}/sys/kernel/livepatch/${patch}/{enabled,transition}
+//   ${SNAPSHOT}/sys/kernel/livepatch/${patch}/${object}/${func},${sympos}
+//
+// and reports tasks, i.e., threads, that have patched functions on their
+// stacks, grouped by patched function and wait state of the task. Tasks
+// whose patch_state shows they already switched are skipped. A process w/o
+// task directory is read from ${SNAPSHOT}/proc/${pid}/ instead. Stacks are
+// scanned in parallel. '/' works as a snapshot of the running machine.
+//
+// Patched functions come from a livepatch module, e.g., klp_foo.ko, from a
+// manifest w/ a function name per line, or from livepatches in transition
+// in the snapshot if neither is given.
+class StallsCommand : public Command {
+    public:
+	static constexpr std::string_view kCommandName = "stalls";
+
+	StallsCommand(int argc, char **argv) noexcept(false);
+	~StallsCommand() override = default;
+
+	// Don't allow copy.
+	StallsCommand(const StallsCommand &rhs) = delete;
+	StallsCommand &operator=(const StallsCommand &rhs) = delete;
+
+	// Scans stacks in the snapshot and reports blocking tasks.
+	std::error_code Run() override;
+
+    private:
+	std::string snapshot_dir_;
+	// livepatch module and manifest for patched functions. both optional.
+	std::string klp_module_;
+	std::string manifest_;
+	// number of threads scanning stacks.
+	unsigned jobs_ = 1;
+};
+
+#endif // STALLS_COMMAND_H_
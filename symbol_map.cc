@@ -20,6 +20,7 @@
 #include <cctype>
 #include <cstring>
 #include <fstream>
+#include <istream>
 #include <string>
 #include <string_view>
 #include <system_error>
@@ -28,6 +29,7 @@
 
 #include "auto_cleanup.h"
 #include "command.h"
+#include "profiler.h"
 
 #include <iostream>
 
@@ -57,12 +59,24 @@ std::unique_ptr<SymbolMap> SymbolMap::Create(const std::string &filename)
 
 SymbolMap::SymbolMap(std::string_view filename) noexcept(false)
 {
+	Profiler::Stage stage("parse");
 	std::fstream file(filename.data(), std::ios::in);
 	if (!file.is_open()) {
 		throw std::error_code{ errno, std::system_category() };
 	}
 	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
 
+	Parse(file);
+}
+
+SymbolMap::SymbolMap(std::istream &symbol_map) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	Parse(symbol_map);
+}
+
+void SymbolMap::Parse(std::istream &file) noexcept(false)
+{
 	std::string line;
 	while (getline(file, line)) {
 		auto tokens = TokenizeSymbolLine(line);
@@ -83,11 +97,12 @@ SymbolMap::SymbolMap(std::string_view filename) noexcept(false)
 }
 
 const std::array<std::string, SymbolMap::ElemIndex::NUM_OF_ELEMS> &
-SymbolMap::QueryAlias(const std::string &alias)
+SymbolMap::QueryAlias(const std::string &alias) const
 {
-	if (symbol_entries_.find(alias) == symbol_entries_.end()) {
+	auto entry = symbol_entries_.find(alias);
+	if (entry == symbol_entries_.end()) {
 		throw std::error_code{ Command::ErrorCode::INVALID_SYM_MAP };
 	}
 
-	return symbol_entries_[alias];
+	return entry->second;
 }
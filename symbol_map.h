@@ -19,6 +19,7 @@
 #define SYMBOL_MAP_H_
 
 #include <array>
+#include <istream>
 #include <list>
 #include <memory>
 #include <string>
@@ -36,6 +37,9 @@ class SymbolMap final {
 	enum ElemIndex { MOD_NAME = 0, PATH = 1, SYMBOL = 2, NUM_OF_ELEMS = 3 };
 
 	SymbolMap(std::string_view filename) noexcept(false);
+	// Parses the output of `gen-symbol-map` from a stream, e.g., one in
+	// memory.
+	SymbolMap(std::istream &symbol_map) noexcept(false);
 	~SymbolMap() = default;
 
 	// Don't allow copy.
@@ -45,11 +49,13 @@ class SymbolMap final {
 	// Returns array of (mod_name, path, symbol) for given llpatch alias
 	// name. If no match found, it throws an exception
 	const std::array<std::string, NUM_OF_ELEMS> &
-	QueryAlias(const std::string &alias) noexcept(false);
+	QueryAlias(const std::string &alias) const noexcept(false);
 
 	static std::unique_ptr<SymbolMap> Create(const std::string &filename);
 
     private:
+	void Parse(std::istream &file) noexcept(false);
+
 	// key: alias name, value: array of (mod_name, path, symbol)
 	std::unordered_map<std::string, std::array<std::string, NUM_OF_ELEMS> >
 		symbol_entries_;
@@ -0,0 +1,335 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// Tests for RemoteCache against a stub HTTP server in the test process.
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../artifact_cache.h"
+
+namespace
+{
+// This class is a minimal HTTP/1.1 server for the layout of the remote
+// cache, i.e., GET and PUT of /${prefix}/(ac|cas)/${digest}. Each
+// connection serves a single request as RemoteCache sends
+// "Connection: close".
+class StubServer final {
+    public:
+	StubServer()
+	{
+		listen_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t len = sizeof(addr);
+		if (listen_fd_ < 0 ||
+		    bind(listen_fd_, reinterpret_cast<struct sockaddr *>(&addr),
+			 sizeof(addr)) ||
+		    listen(listen_fd_, 64) ||
+		    getsockname(listen_fd_,
+				reinterpret_cast<struct sockaddr *>(&addr),
+				&len)) {
+			std::abort();
+		}
+		port_ = ntohs(addr.sin_port);
+		acceptor_ = std::thread(&StubServer::Accept, this);
+	}
+
+	~StubServer()
+	{
+		// accept() fails once the socket is shut down.
+		shutdown(listen_fd_, SHUT_RDWR);
+		acceptor_.join();
+		close(listen_fd_);
+		for (std::thread &handler : handlers_) {
+			handler.join();
+		}
+	}
+
+	// Don't allow copy.
+	StubServer(const StubServer &rhs) = delete;
+	StubServer &operator=(const StubServer &rhs) = delete;
+
+	std::string Url(const std::string &prefix = "") const
+	{
+		return "http://127.0.0.1:" + std::to_string(port_) + prefix;
+	}
+
+	// PUT requests get 500 w/o storing the entry.
+	void FailUploads()
+	{
+		fail_uploads_ = true;
+	}
+
+	// Delays responses to GET requests.
+	void DelayDownloads(std::chrono::milliseconds delay)
+	{
+		delay_ = delay;
+	}
+
+	// Returns the paths of stored entries under /${prefix}/${kind}/.
+	std::vector<std::string> Paths(const std::string &kind)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		std::vector<std::string> paths;
+		for (const auto &[path, content] : entries_) {
+			if (path.find("/" + kind + "/") != std::string::npos) {
+				paths.push_back(path);
+			}
+		}
+		return paths;
+	}
+
+	void Set(const std::string &path, const std::string &content)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		entries_[path] = content;
+	}
+
+	std::string Entry(const std::string &path)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return entries_[path];
+	}
+
+	int Requests(const std::string &method)
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		return requests_[method];
+	}
+
+	int MaxConcurrentDownloads() const
+	{
+		return max_downloads_;
+	}
+
+    private:
+	void Accept()
+	{
+		int fd;
+		while ((fd = accept4(listen_fd_, nullptr, nullptr,
+				     SOCK_CLOEXEC)) >= 0) {
+			std::lock_guard<std::mutex> lock(mutex_);
+			handlers_.emplace_back(&StubServer::Serve, this, fd);
+		}
+	}
+
+	void Serve(int fd)
+	{
+		std::string raw;
+		char buf[4096];
+		size_t header_end;
+		ssize_t received;
+		while ((header_end = raw.find("\r\n\r\n")) == std::string::npos &&
+		       (received = recv(fd, buf, sizeof(buf), 0)) > 0) {
+			raw.append(buf, received);
+		}
+		if (header_end == std::string::npos) {
+			close(fd);
+			return;
+		}
+
+		size_t content_length = 0;
+		size_t pos = raw.find("Content-Length: ");
+		if (pos != std::string::npos && pos < header_end) {
+			content_length = std::strtoul(raw.c_str() + pos + 16,
+						      nullptr, 10);
+		}
+		while (raw.size() < header_end + 4 + content_length &&
+		       (received = recv(fd, buf, sizeof(buf), 0)) > 0) {
+			raw.append(buf, received);
+		}
+
+		// format: ${method} ${path} HTTP/1.1
+		const std::string method = raw.substr(0, raw.find(' '));
+		const size_t path_start = method.size() + 1;
+		const std::string path = raw.substr(
+			path_start, raw.find(' ', path_start) - path_start);
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			requests_[method]++;
+		}
+
+		std::string response;
+		if (method == "GET") {
+			response = Get(path);
+		} else if (method == "PUT" && !fail_uploads_) {
+			Set(path, raw.substr(header_end + 4, content_length));
+			response = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n";
+		} else {
+			response = "HTTP/1.1 500 Internal Server Error\r\n"
+				   "Content-Length: 0\r\n\r\n";
+		}
+		send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+		close(fd);
+	}
+
+	std::string Get(const std::string &path)
+	{
+		int downloads = ++downloads_;
+		for (int max = max_downloads_;
+		     downloads > max &&
+		     !max_downloads_.compare_exchange_weak(max, downloads);) {
+		}
+		std::this_thread::sleep_for(delay_.load());
+		downloads_--;
+
+		std::lock_guard<std::mutex> lock(mutex_);
+		auto entry = entries_.find(path);
+		if (entry == entries_.end()) {
+			return "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+		}
+		return "HTTP/1.1 200 OK\r\nContent-Length: " +
+		       std::to_string(entry->second.size()) + "\r\n\r\n" +
+		       entry->second;
+	}
+
+	int listen_fd_ = -1;
+	int port_ = 0;
+	std::thread acceptor_;
+	std::atomic<bool> fail_uploads_{ false };
+	std::atomic<std::chrono::milliseconds> delay_{
+		std::chrono::milliseconds(0)
+	};
+	std::atomic<int> downloads_{ 0 };
+	std::atomic<int> max_downloads_{ 0 };
+
+	std::mutex mutex_;
+	std::vector<std::thread> handlers_;
+	std::map<std::string, std::string> entries_;
+	std::map<std::string, int> requests_;
+};
+
+TEST(RemoteCacheTest, Hit)
+{
+	StubServer server;
+	RemoteCache cache(server.Url("/llpatch/"));
+
+	cache.Put("key", "artifact");
+	cache.Flush();
+
+	// blob is uploaded to cas/ by its digest and the action result to ac/
+	// by the digest of the key.
+	ASSERT_EQ(server.Paths("cas"),
+		  std::vector<std::string>{ "/llpatch/cas/" +
+					    ArtifactCache::Digest("artifact") });
+	ASSERT_EQ(server.Paths("ac"),
+		  std::vector<std::string>{ "/llpatch/ac/" +
+					    ArtifactCache::Digest("key") });
+
+	std::string artifact;
+	EXPECT_TRUE(cache.Get("key", &artifact));
+	EXPECT_EQ(artifact, "artifact");
+
+	// the other client w/ the same server shares the artifact.
+	RemoteCache other(server.Url("/llpatch"));
+	artifact.clear();
+	EXPECT_TRUE(other.Get("key", &artifact));
+	EXPECT_EQ(artifact, "artifact");
+}
+
+TEST(RemoteCacheTest, Miss)
+{
+	StubServer server;
+	RemoteCache cache(server.Url());
+
+	std::string artifact;
+	EXPECT_FALSE(cache.Get("key", &artifact));
+	// blob isn't requested w/o the action result.
+	EXPECT_EQ(server.Requests("GET"), 1);
+
+	// unreachable server is a miss, too.
+	RemoteCache unreachable("http://127.0.0.1:1");
+	EXPECT_FALSE(unreachable.Get("key", &artifact));
+}
+
+TEST(RemoteCacheTest, CorruptBlob)
+{
+	StubServer server;
+	RemoteCache cache(server.Url());
+
+	cache.Put("key", "artifact");
+	cache.Flush();
+	const std::string blob = "/cas/" + ArtifactCache::Digest("artifact");
+	ASSERT_EQ(server.Entry(blob), "artifact");
+
+	std::string artifact;
+	server.Set(blob, "artifacT");
+	EXPECT_FALSE(cache.Get("key", &artifact));
+	server.Set(blob, "artif");
+	EXPECT_FALSE(cache.Get("key", &artifact));
+
+	// action result that can't be decoded is a miss.
+	server.Set(blob, "artifact");
+	server.Set("/ac/" + ArtifactCache::Digest("key"), "\xff\xff\xff");
+	EXPECT_FALSE(cache.Get("key", &artifact));
+}
+
+TEST(RemoteCacheTest, UploadFailure)
+{
+	StubServer server;
+	server.FailUploads();
+	{
+		RemoteCache cache(server.Url());
+		cache.Put("key", "artifact");
+		cache.Put("other key", "other artifact");
+		// destructor waits for pending uploads.
+	}
+	// action result isn't uploaded once its blob fails.
+	EXPECT_EQ(server.Requests("PUT"), 2);
+	EXPECT_TRUE(server.Paths("cas").empty());
+	EXPECT_TRUE(server.Paths("ac").empty());
+
+	RemoteCache cache(server.Url());
+	std::string artifact;
+	EXPECT_FALSE(cache.Get("key", &artifact));
+}
+
+TEST(RemoteCacheTest, BoundedDownloads)
+{
+	StubServer server;
+	server.DelayDownloads(std::chrono::milliseconds(20));
+	RemoteCache cache(server.Url());
+
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 16; i++) {
+		threads.emplace_back([&cache, i]() {
+			std::string artifact;
+			cache.Get("key" + std::to_string(i), &artifact);
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	EXPECT_EQ(server.Requests("GET"), 16);
+	EXPECT_LE(server.MaxConcurrentDownloads(), 4);
+}
+} // namespace
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// Tests for CacheIndex shared by threads, each w/ its own mapping of the
+// index as processes do, and for recovery from crashed processes.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../cache_index.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// layout of the index in cache_index.cc, which is used to leave slots as
+// crashed processes do.
+constexpr size_t kHeaderSize = 4096;
+constexpr size_t kSlotSize = 12 * sizeof(uint64_t);
+constexpr size_t kTotalBytes = 5;
+constexpr size_t kState = 0;
+constexpr size_t kSize = 9;
+constexpr size_t kClaimed = 11;
+constexpr uint64_t kBusy = 1;
+
+// Returns a key whose first word, i.e., the home slot, is spread by i.
+CacheIndex::Digest Key(uint64_t i)
+{
+	// splitmix64
+	uint64_t words[4] = { i + 0x9e3779b97f4a7c15ULL, i, 0, 0 };
+	words[0] = (words[0] ^ (words[0] >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	words[0] = (words[0] ^ (words[0] >> 27)) * 0x94d049bb133111ebULL;
+	words[0] ^= words[0] >> 31;
+	CacheIndex::Digest key;
+	std::memcpy(key.data(), words, key.size());
+	return key;
+}
+
+// Returns an entry that can be checked against its key.
+CacheIndex::Entry EntryOf(const CacheIndex::Digest &key)
+{
+	CacheIndex::Entry entry;
+	for (size_t i = 0; i < entry.blob.size(); i++) {
+		entry.blob[i] = ~key[i];
+	}
+	entry.size = key[8] + 1;
+	return entry;
+}
+
+class CacheIndexTest : public ::testing::Test {
+    protected:
+	void SetUp() override
+	{
+		char dir[] = "/tmp/cache_index_test.XXXXXX";
+		ASSERT_NE(mkdtemp(dir), nullptr);
+		dir_ = dir;
+		path_ = dir_ + "/index";
+	}
+
+	void TearDown() override
+	{
+		std::error_code ec;
+		fs::remove_all(dir_, ec);
+	}
+
+	// Maps the index file as words.
+	uint64_t *Map(size_t num_slots)
+	{
+		const size_t size = kHeaderSize + num_slots * kSlotSize;
+		int fd = open(path_.c_str(), O_RDWR | O_CLOEXEC);
+		void *base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, fd, 0);
+		close(fd);
+		return base == MAP_FAILED ? nullptr : static_cast<uint64_t *>(base);
+	}
+
+	uint64_t *SlotOf(uint64_t *base, const CacheIndex::Digest &key,
+			 size_t num_slots)
+	{
+		uint64_t home;
+		std::memcpy(&home, key.data(), sizeof(home));
+		return base + (kHeaderSize + (home % num_slots) * kSlotSize) /
+				      sizeof(uint64_t);
+	}
+
+	std::string dir_;
+	std::string path_;
+};
+
+TEST_F(CacheIndexTest, ConcurrentInsertLookup)
+{
+	constexpr int kThreads = 8;
+	constexpr uint64_t kKeys = 256;
+	std::atomic<bool> inconsistent{ false };
+	std::atomic<int> hits{ 0 };
+
+	// keys overlap among threads and don't fit in the index. So, slots
+	// are claimed, evicted and read concurrently.
+	std::vector<std::thread> threads;
+	for (int t = 0; t < kThreads; t++) {
+		threads.emplace_back([&, t]() {
+			std::unique_ptr<CacheIndex> index =
+				CacheIndex::Create(path_, 128, 1ULL << 40);
+			ASSERT_NE(index, nullptr);
+			for (int round = 0; round < 20; round++) {
+				for (uint64_t i = 0; i < kKeys; i++) {
+					const CacheIndex::Digest key =
+						Key((i + t * 32) % kKeys);
+					CacheIndex::Entry entry;
+					if (index->Lookup(key, &entry)) {
+						const CacheIndex::Entry expected =
+							EntryOf(key);
+						if (entry.blob != expected.blob ||
+						    entry.size != expected.size) {
+							inconsistent = true;
+						}
+						hits++;
+						continue;
+					}
+					bool evicted = false;
+					index->Insert(key, EntryOf(key), &evicted);
+				}
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	EXPECT_FALSE(inconsistent);
+	EXPECT_GT(hits, 0);
+
+	// entries that fit in the index are all found once inserted.
+	std::unique_ptr<CacheIndex> index =
+		CacheIndex::Create(dir_ + "/small", 1024, 1ULL << 40);
+	ASSERT_NE(index, nullptr);
+	threads.clear();
+	for (int t = 0; t < kThreads; t++) {
+		threads.emplace_back([&, t]() {
+			std::unique_ptr<CacheIndex> index = CacheIndex::Create(
+				dir_ + "/small", 1024, 1ULL << 40);
+			ASSERT_NE(index, nullptr);
+			for (uint64_t i = t; i < kKeys; i += kThreads) {
+				bool evicted = false;
+				EXPECT_TRUE(index->Insert(Key(i), EntryOf(Key(i)),
+							  &evicted));
+				EXPECT_FALSE(evicted);
+			}
+		});
+	}
+	for (std::thread &thread : threads) {
+		thread.join();
+	}
+	for (uint64_t i = 0; i < kKeys; i++) {
+		CacheIndex::Entry entry;
+		ASSERT_TRUE(index->Lookup(Key(i), &entry));
+		EXPECT_EQ(entry.blob, EntryOf(Key(i)).blob);
+	}
+	EXPECT_EQ(index->Blobs().size(), kKeys);
+}
+
+TEST_F(CacheIndexTest, Recover)
+{
+	constexpr size_t kSlots = 64;
+	const CacheIndex::Digest kept = Key(1);
+	const CacheIndex::Digest crashed = Key(2);
+	const CacheIndex::Digest filling = Key(3);
+	{
+		std::unique_ptr<CacheIndex> index =
+			CacheIndex::Create(path_, kSlots, 1000);
+		ASSERT_NE(index, nullptr);
+		bool evicted = false;
+		ASSERT_TRUE(index->Insert(kept, { EntryOf(kept).blob, 100 },
+					  &evicted));
+	}
+
+	// a process crashed after counting its blob long ago, and the other
+	// is still filling a slot.
+	uint64_t *base = Map(kSlots);
+	ASSERT_NE(base, nullptr);
+	uint64_t *slot = SlotOf(base, crashed, kSlots);
+	ASSERT_EQ(slot[kState], 0);
+	slot[kState] = (0x1234ULL << 32) | (1 << 2) | kBusy;
+	slot[kSize] = 500;
+	slot[kClaimed] = 1;
+	base[kTotalBytes] += 500;
+	uint64_t *busy = SlotOf(base, filling, kSlots);
+	ASSERT_EQ(busy[kState], 0);
+	busy[kState] = (0x5678ULL << 32) | (1 << 2) | kBusy;
+	busy[kClaimed] = std::chrono::duration_cast<std::chrono::seconds>(
+				 std::chrono::system_clock::now().time_since_epoch())
+				 .count();
+
+	// total size isn't recounted while a slot is being filled.
+	{
+		std::unique_ptr<CacheIndex> index =
+			CacheIndex::Create(path_, kSlots, 1000);
+		ASSERT_NE(index, nullptr);
+		EXPECT_EQ(slot[kState] & 0x3, 3);
+		EXPECT_EQ(busy[kState] & 0x3, kBusy);
+		EXPECT_EQ(base[kTotalBytes], 600);
+	}
+
+	// the other process is done.
+	busy[kState] = (0x5678ULL << 32) | (2 << 2) | 3;
+	std::unique_ptr<CacheIndex> index =
+		CacheIndex::Create(path_, kSlots, 1000);
+	ASSERT_NE(index, nullptr);
+	EXPECT_EQ(base[kTotalBytes], 100);
+
+	// the blob of the crashed process doesn't count. So, nothing is
+	// evicted.
+	bool evicted = false;
+	EXPECT_TRUE(index->Insert(crashed, { EntryOf(crashed).blob, 800 },
+				  &evicted));
+	EXPECT_FALSE(evicted);
+	CacheIndex::Entry entry;
+	EXPECT_TRUE(index->Lookup(kept, &entry));
+	EXPECT_TRUE(index->Lookup(crashed, &entry));
+	EXPECT_EQ(entry.size, 800);
+
+	// exceeding the limit evicts the least recently accessed entry.
+	EXPECT_TRUE(index->Insert(filling, { EntryOf(filling).blob, 200 },
+				  &evicted));
+	EXPECT_TRUE(evicted);
+	EXPECT_FALSE(index->Lookup(kept, &entry));
+	EXPECT_EQ(index->Blobs().size(), 2);
+
+	munmap(base, kHeaderSize + kSlots * kSlotSize);
+}
+} // namespace
@@ -0,0 +1,143 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// Tests for StallsCommand against a snapshot made in a temporary dir.
+
+#include <stdlib.h>
+
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../stalls_command.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+class StallsCommandTest : public ::testing::Test {
+    protected:
+	void SetUp() override
+	{
+		char dir[] = "/tmp/stalls_command_test.XXXXXX";
+		ASSERT_NE(mkdtemp(dir), nullptr);
+		snapshot_ = dir;
+	}
+
+	void TearDown() override
+	{
+		std::error_code ec;
+		fs::remove_all(snapshot_, ec);
+	}
+
+	void Write(const fs::path &path, const std::string &content)
+	{
+		fs::create_directories((snapshot_ / path).parent_path());
+		std::ofstream(snapshot_ / path) << content;
+	}
+
+	// Adds a task w/ a stack of frames and patch_state. task_dir is
+	// relative to proc/.
+	void AddTask(const fs::path &task_dir, const std::string &comm,
+		     const std::vector<std::string> &frames,
+		     const std::string &patch_state)
+	{
+		const fs::path dir = fs::path("proc") / task_dir;
+		std::string stack;
+		for (const std::string &frame : frames) {
+			stack += "[<0>] " + frame + "+0x10/0x40\n";
+		}
+		Write(dir / "stack", stack);
+		Write(dir / "comm", comm + "\n");
+		Write(dir / "status", "Name:\t" + comm + "\nState:\tS (sleeping)\n");
+		Write(dir / "patch_state", patch_state + "\n");
+	}
+
+	// Runs 'livepatch stalls' and returns its output.
+	std::string Run(std::vector<std::string> args, std::error_code *ec)
+	{
+		args.insert(args.begin(), { "livepatch", "stalls" });
+		args.push_back(snapshot_.string());
+		std::vector<char *> argv;
+		for (std::string &arg : args) {
+			argv.push_back(arg.data());
+		}
+		argv.push_back(nullptr);
+
+		testing::internal::CaptureStdout();
+		StallsCommand command(argv.size() - 1, argv.data());
+		*ec = command.Run();
+		llvm::outs().flush();
+		return testing::internal::GetCapturedStdout();
+	}
+
+	fs::path snapshot_;
+};
+
+TEST_F(StallsCommandTest, ScansEveryThread)
+{
+	Write("sys/kernel/livepatch/klp_fix/enabled", "1\n");
+	Write("sys/kernel/livepatch/klp_fix/transition", "1\n");
+	fs::create_directories(snapshot_ /
+			       "sys/kernel/livepatch/klp_fix/vmlinux/do_foo,1");
+
+	// /proc/100/stack is only the stack of the main thread, which
+	// doesn't block. Its threads do unless they already switched.
+	AddTask("100", "main", { "schedule" }, "0");
+	AddTask("100/task/100", "main", { "schedule" }, "0");
+	AddTask("100/task/101", "worker", { "schedule", "do_foo" }, "0");
+	AddTask("100/task/102", "switched", { "schedule", "do_foo" }, "1");
+	// a process w/o task directory is read from /proc/${pid}.
+	AddTask("200", "single", { "do_foo", "do_syscall_64" }, "0");
+
+	for (const char *jobs : { "1", "4" }) {
+		std::error_code ec;
+		const std::string out = Run({ "-j", jobs }, &ec);
+		EXPECT_FALSE(ec);
+		EXPECT_NE(out.find("transition=1 (patching)"), std::string::npos);
+		EXPECT_NE(out.find("scanned 4 tasks, 2 blocking"),
+			  std::string::npos)
+			<< out;
+		EXPECT_NE(out.find("do_foo: 2 tasks"), std::string::npos);
+		EXPECT_NE(out.find("S (sleeping): 2 tasks"), std::string::npos);
+		EXPECT_NE(out.find("101 worker (pid 100)"), std::string::npos);
+		EXPECT_NE(out.find("200 single\n"), std::string::npos);
+		EXPECT_EQ(out.find("switched"), std::string::npos);
+	}
+}
+
+TEST_F(StallsCommandTest, Manifest)
+{
+	// w/o transition, tasks aren't skipped by patch_state.
+	AddTask("300/task/300", "main", { "__livepatch_do_bar" }, "-1");
+	AddTask("300/task/301", "worker", { "do_baz" }, "-1");
+	Write("manifest", "# patched\ndo_bar,1\n\ndo_qux\n");
+
+	std::error_code ec;
+	const std::string out =
+		Run({ "--manifest", (snapshot_ / "manifest").string() }, &ec);
+	EXPECT_FALSE(ec);
+	EXPECT_NE(out.find("scanned 2 tasks, 1 blocking"), std::string::npos)
+		<< out;
+	EXPECT_NE(out.find("do_bar: 1 tasks"), std::string::npos);
+	EXPECT_NE(out.find("300 main\n"), std::string::npos);
+}
+} // namespace
@@ -0,0 +1,114 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+// Tests for path stripping and fuzz of UnifiedDiff.
+
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "../unified_diff.h"
+
+namespace
+{
+constexpr char kPatch[] = "--- a/kernel/fork.c\t2021-01-01\n"
+			  "+++ b/kernel/fork.c\t2021-01-01\n"
+			  "@@ -2,5 +2,5 @@\n"
+			  " 2\n"
+			  " 3\n"
+			  "-4\n"
+			  "+four\n"
+			  " 5\n"
+			  " 6\n";
+
+size_t Hunks(const std::string &patch, const std::string &diffed_file,
+	     size_t strip)
+{
+	std::istringstream stream(patch);
+	return UnifiedDiff(stream, diffed_file, strip).hunks().size();
+}
+
+TEST(UnifiedDiffTest, StripLevel)
+{
+	EXPECT_EQ(Hunks(kPatch, "kernel/fork.c", 1), 1);
+	EXPECT_EQ(Hunks(kPatch, "fork.c", 2), 1);
+	EXPECT_EQ(Hunks(kPatch, "a/kernel/fork.c", 0), 1);
+	EXPECT_EQ(Hunks(kPatch, "kernel/fork.c", 0), 0);
+	EXPECT_EQ(Hunks(kPatch, "kernel/fork.c", 2), 0);
+	// path w/o enough components matches nothing.
+	EXPECT_EQ(Hunks(kPatch, "fork.c", 3), 0);
+
+	// paths w/o prefixes, e.g., by 'git diff --no-prefix', for -p0.
+	std::string no_prefix = kPatch;
+	no_prefix.replace(no_prefix.find("a/"), 2, "");
+	no_prefix.replace(no_prefix.find("b/"), 2, "");
+	EXPECT_EQ(Hunks(no_prefix, "kernel/fork.c", 0), 1);
+	EXPECT_EQ(Hunks(no_prefix, "fork.c", 1), 1);
+
+	// adjacent slashes count as one.
+	std::string slashes = kPatch;
+	slashes.replace(slashes.find("b/"), 2, "b//");
+	EXPECT_EQ(Hunks(slashes, "kernel/fork.c", 1), 1);
+
+	std::istringstream stream(kPatch);
+	EXPECT_EQ(UnifiedDiff::ChangedFiles(stream, 2),
+		  (std::vector<std::pair<std::string, size_t> >{
+			  { "fork.c", 2 } }));
+}
+
+TEST(UnifiedDiffTest, Fuzz)
+{
+	std::istringstream stream(kPatch);
+	UnifiedDiff diff(stream, "kernel/fork.c");
+
+	// the first and last context lines don't match.
+	const std::vector<std::string> original = { "1", "2 changed", "3", "4",
+						    "5", "6 changed", "7" };
+	std::vector<std::string> patched, aligned_original, aligned_patched;
+	EXPECT_THROW(diff.Apply(original, 0, &patched, &aligned_original,
+				&aligned_patched),
+		     std::error_code);
+
+	diff.Apply(original, 2, &patched, &aligned_original, &aligned_patched);
+	EXPECT_EQ(patched, (std::vector<std::string>{ "1", "2 changed", "3",
+						      "four", "5", "6 changed",
+						      "7" }));
+}
+
+TEST(UnifiedDiffTest, FileNotInPatch)
+{
+	std::istringstream stream(kPatch);
+	UnifiedDiff diff(stream, "kernel/exit.c");
+	EXPECT_FALSE(diff.has_file());
+
+	// e.g., a C file including a header changed by the patch is aligned
+	// as is.
+	const std::vector<std::string> original = { "1", "2", "3" };
+	std::vector<std::string> patched, aligned_original, aligned_patched;
+	diff.Apply(original, 0, &patched, &aligned_original, &aligned_patched);
+	EXPECT_EQ(patched, original);
+	EXPECT_EQ(aligned_original, original);
+	EXPECT_EQ(aligned_patched, original);
+
+	std::istringstream changed(kPatch);
+	EXPECT_TRUE(UnifiedDiff(changed, "kernel/fork.c").has_file());
+}
+} // namespace
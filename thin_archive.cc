@@ -19,7 +19,7 @@
 
 #include <cctype>
 #include <fstream>
-#include <regex>
+#include <istream>
 #include <string>
 #include <string_view>
 #include <system_error>
@@ -28,6 +28,7 @@
 
 #include "auto_cleanup.h"
 #include "elf_error.h"
+#include "profiler.h"
 #include "llvm/Support/raw_ostream.h"
 
 namespace
@@ -43,7 +44,9 @@ ParseSymbolLine(const std::string& line)
 	char symbol_type = '?';
 	if (sym_end != std::string::npos) {
 		size_t sym_type_pos = line.find_first_not_of(' ', sym_end);
-		symbol_type = toupper(line.at(sym_type_pos));
+		if (sym_type_pos != std::string::npos) {
+			symbol_type = toupper(line[sym_type_pos]);
+		}
 	}
 
 	// V: The symbol is a weak object. W: The symbol is a weak symbol.
@@ -51,6 +54,24 @@ ParseSymbolLine(const std::string& line)
 	symbol_type = (symbol_type == 'V') ? 'W' : symbol_type;
 	return std::make_pair(symbol_name, symbol_type);
 }
+
+// Returns true if a given line is a header for an object file in thin
+// archive, i.e., ${thin_archive_name}.a[${full_path_to_obj_file}.o]:
+bool IsObjectFileHeader(std::string_view line)
+{
+	static constexpr std::string_view kArchiveSuffix = ".a[";
+	static constexpr std::string_view kObjSuffix = ".o]:";
+
+	if (line.size() < kObjSuffix.size() ||
+	    line.substr(line.size() - kObjSuffix.size()) != kObjSuffix) {
+		return false;
+	}
+
+	// both names for archive and object file should not be empty.
+	size_t pos = line.find(kArchiveSuffix, 1);
+	return pos != std::string_view::npos &&
+	       pos + kArchiveSuffix.size() < line.size() - kObjSuffix.size();
+}
 } // namespace
 
 std::unique_ptr<ThinArchive> ThinArchive::Create(const std::string &filename)
@@ -63,12 +84,24 @@ std::unique_ptr<ThinArchive> ThinArchive::Create(const std::string &filename)
 
 ThinArchive::ThinArchive(std::string_view filename) noexcept(false)
 {
+	Profiler::Stage stage("parse");
 	std::fstream file(filename.data(), std::ios::in);
 	if (!file.is_open()) {
 		throw std::error_code{ errno, std::system_category() };
 	}
 	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
 
+	Parse(file);
+}
+
+ThinArchive::ThinArchive(std::istream &nm_output) noexcept(false)
+{
+	Profiler::Stage stage("parse");
+	Parse(nm_output);
+}
+
+void ThinArchive::Parse(std::istream &file) noexcept(false)
+{
 	// Two pass algorithm to build unique_symbols_ and duplicated_symbols_
 	// Step 1: Build unique_symbols_ while finding duplicated symbols.
 	std::unordered_set<std::string> dup_symbols;
@@ -105,14 +138,13 @@ ThinArchive::ThinArchive(std::string_view filename) noexcept(false)
 	// Step 2: Build duplicated symbols by inserting filename to
 	// duplicated_symbols_.
 	std::string current_filename;
-	// matching format example: built-in.a[arch/x86/kernel/head_64.o]:
-	std::regex file_path_match(".+\\.a\\[.+\\.o\\]:");
 	std::unordered_set<std::string> same_sym_file;
 	std::string symbol_name;
 	file.clear();
 	file.seekg(0);
 	while (getline(file, line)) {
-		if (std::regex_match(line, file_path_match)) {
+		// format example: built-in.a[arch/x86/kernel/head_64.o]:
+		if (IsObjectFileHeader(line)) {
 			auto pos_start = line.find("[") + 1;
 			auto pos_end = line.find("]");
 			current_filename =
@@ -142,13 +174,15 @@ ThinArchive::ThinArchive(std::string_view filename) noexcept(false)
 			};
 		}
 
-		duplicated_symbols_[symbol_name].push_back(
-			current_filename);
+		// pos for duplicated symbols starts from 1 in the order of
+		// appearance.
+		auto &files = duplicated_symbols_[symbol_name];
+		files.emplace(current_filename, files.size() + 1);
 	}
 }
 
 int ThinArchive::QuerySymbol(const std::string &symbol,
-			     const std::string &filename)
+			     const std::string &filename) const
 {
 	if (unique_symbols_.find(symbol) != unique_symbols_.end()) {
 		// pos for unique symbols is always 0
@@ -157,12 +191,9 @@ int ThinArchive::QuerySymbol(const std::string &symbol,
 
 	auto dup_symbol = duplicated_symbols_.find(symbol);
 	if (dup_symbol != duplicated_symbols_.end()) {
-		int pos = 1;
-		for (std::string_view fn : dup_symbol->second) {
-			if (filename == fn) {
-				return pos;
-			}
-			pos++;
+		auto file = dup_symbol->second.find(filename);
+		if (file != dup_symbol->second.end()) {
+			return file->second;
 		}
 	}
 
@@ -18,7 +18,7 @@
 #ifndef THIN_ARCHIVE_H_
 #define THIN_ARCHIVE_H_
 
-#include <list>
+#include <istream>
 #include <memory>
 #include <string>
 #include <string_view>
@@ -47,6 +47,8 @@
 class ThinArchive final {
     public:
 	ThinArchive(std::string_view filename) noexcept(false);
+	// Parses the output of `nm` from a stream, e.g., one in memory.
+	ThinArchive(std::istream &nm_output) noexcept(false);
 	~ThinArchive() = default;
 
 	// Don't allow copy.
@@ -58,14 +60,17 @@ class ThinArchive final {
 	// symbols is aware of relocatable symbols, such as UND, OBJECT and FUNC. filename
 	// is used to match duplicated symbols. NOTE that filename is ignored if symbol is
 	// unique. If no symbol found, returns negative value.
-	int QuerySymbol(const std::string &symbol, const std::string &filename);
+	int QuerySymbol(const std::string &symbol,
+			const std::string &filename) const;
 
 	static std::unique_ptr<ThinArchive> Create(const std::string &filename);
 
     private:
+	void Parse(std::istream &file) noexcept(false);
+
 	std::unordered_set<std::string> unique_symbols_;
-	// key: symbol name, value: list of filename
-	std::unordered_map<std::string, std::list<std::string> >
+	// key: symbol name, value: map from filename to pos of the symbol
+	std::unordered_map<std::string, std::unordered_map<std::string, int> >
 		duplicated_symbols_;
 };
 
@@ -25,7 +25,9 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Support/type_traits.h"
+#include <algorithm>
 #include <utility>
+#include <vector>
 
 using namespace llvm;
 
@@ -607,13 +609,6 @@ public:
   }
 };
 
-struct DiffEntry {
-  DiffEntry() : Cost(0) {}
-
-  unsigned Cost;
-  llvm::SmallVector<char, 8> Path; // actually of DifferenceEngine::DiffChange
-};
-
 bool FunctionDifferenceEngine::matchForBlockDiff(const Instruction *L,
                                                  const Instruction *R) {
   return !diff(L, R, false, false);
@@ -625,12 +620,18 @@ void FunctionDifferenceEngine::runBlockDiff(BasicBlock::const_iterator LStart,
   BasicBlock::const_iterator RE = RStart->getParent()->end();
 
   unsigned NL = std::distance(LStart, LE);
+  unsigned NR = std::distance(RStart, RE);
 
-  SmallVector<DiffEntry, 20> Paths1(NL+1);
-  SmallVector<DiffEntry, 20> Paths2(NL+1);
+  // Only costs of the current and next rows are kept while the last step
+  // taken for each cell is recorded in Steps. The path is recovered by
+  // walking Steps backward. Copying the whole path into each cell makes
+  // the diff cubic to the size of blocks.
+  SmallVector<unsigned, 20> Costs1(NL+1);
+  SmallVector<unsigned, 20> Costs2(NL+1);
+  std::vector<char> Steps(size_t(NL+1) * (NR+1));
 
-  DiffEntry *Cur = Paths1.data();
-  DiffEntry *Next = Paths2.data();
+  unsigned *Cur = Costs1.data();
+  unsigned *Next = Costs2.data();
 
   const unsigned LeftCost = 2;
   const unsigned RightCost = 2;
@@ -640,43 +641,52 @@ void FunctionDifferenceEngine::runBlockDiff(BasicBlock::const_iterator LStart,
 
   // Initialize the first column.
   for (unsigned I = 0; I != NL+1; ++I) {
-    Cur[I].Cost = I * LeftCost;
-    for (unsigned J = 0; J != I; ++J)
-      Cur[I].Path.push_back(DC_left);
+    Cur[I] = I * LeftCost;
+    Steps[I] = DC_left;
   }
 
-  for (BasicBlock::const_iterator RI = RStart; RI != RE; ++RI) {
+  unsigned Row = 1;
+  for (BasicBlock::const_iterator RI = RStart; RI != RE; ++RI, ++Row) {
+    char *Step = &Steps[size_t(Row) * (NL+1)];
+
     // Initialize the first row.
-    Next[0] = Cur[0];
-    Next[0].Cost += RightCost;
-    Next[0].Path.push_back(DC_right);
+    Next[0] = Cur[0] + RightCost;
+    Step[0] = DC_right;
 
     unsigned Index = 1;
     for (BasicBlock::const_iterator LI = LStart; LI != LE; ++LI, ++Index) {
       if (matchForBlockDiff(&*LI, &*RI)) {
-        Next[Index] = Cur[Index-1];
-        Next[Index].Cost += MatchCost;
-        Next[Index].Path.push_back(DC_match);
+        Next[Index] = Cur[Index-1] + MatchCost;
+        Step[Index] = DC_match;
         TentativeValues.insert(std::make_pair(&*LI, &*RI));
-      } else if (Next[Index-1].Cost <= Cur[Index].Cost) {
-        Next[Index] = Next[Index-1];
-        Next[Index].Cost += LeftCost;
-        Next[Index].Path.push_back(DC_left);
+      } else if (Next[Index-1] <= Cur[Index]) {
+        Next[Index] = Next[Index-1] + LeftCost;
+        Step[Index] = DC_left;
       } else {
-        Next[Index] = Cur[Index];
-        Next[Index].Cost += RightCost;
-        Next[Index].Path.push_back(DC_right);
+        Next[Index] = Cur[Index] + RightCost;
+        Step[Index] = DC_right;
       }
     }
 
     std::swap(Cur, Next);
   }
 
+  // Recover the path from the last cell.
+  SmallVector<char, 20> Path;
+  for (unsigned I = NL, J = NR; I != 0 || J != 0;) {
+    char S = Steps[size_t(J) * (NL+1) + I];
+    Path.push_back(S);
+    if (S != DC_right)
+      --I;
+    if (S != DC_left)
+      --J;
+  }
+  std::reverse(Path.begin(), Path.end());
+
   // We don't need the tentative values anymore; everything from here
   // on out should be non-tentative.
   TentativeValues.clear();
 
-  SmallVectorImpl<char> &Path = Cur[NL].Path;
   BasicBlock::const_iterator LI = LStart, RI = RStart;
 
   DiffLogBuilder Diff(Engine.getConsumer());
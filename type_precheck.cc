@@ -0,0 +1,287 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "type_precheck.h"
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+using namespace llvm;
+
+namespace
+{
+// Affected functions are printed out up to this number.
+constexpr size_t kMaxAffected = 10;
+
+bool IsAnonymous(StringRef name)
+{
+	return name.startswith("struct.anon") || name.startswith("union.anon");
+}
+
+// Returns name w/o the suffix, .${N}, LLVM adds to a struct whose name is
+// already taken in the context.
+StringRef StripSuffix(StringRef name)
+{
+	auto [base, suffix] = name.rsplit('.');
+	if (suffix.empty() || base.empty() ||
+	    suffix.find_first_not_of("0123456789") != StringRef::npos) {
+		return name;
+	}
+	return base;
+}
+
+// Returns true if type refers to target. Unlike layout, pointee of a typed
+// pointer counts, e.g., a function taking struct foo * depends on struct foo.
+bool RefersTo(Type *type, Type *target, std::unordered_set<Type *> *visited)
+{
+	if (type == target) {
+		return true;
+	}
+	if (!visited->insert(type).second) {
+		return false;
+	}
+	for (Type *contained : type->subtypes()) {
+		if (RefersTo(contained, target, visited)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool RefersTo(Type *type, Type *target)
+{
+	std::unordered_set<Type *> visited;
+	return RefersTo(type, target, &visited);
+}
+
+// Returns true if prototype or instructions of fn refer to target.
+bool FunctionRefersTo(Function &fn, Type *target)
+{
+	if (RefersTo(fn.getFunctionType(), target)) {
+		return true;
+	}
+	for (Instruction &inst : instructions(fn)) {
+		if (RefersTo(inst.getType(), target)) {
+			return true;
+		}
+		if (auto *gep = dyn_cast<GetElementPtrInst>(&inst)) {
+			if (RefersTo(gep->getSourceElementType(), target)) {
+				return true;
+			}
+		} else if (auto *alloca = dyn_cast<AllocaInst>(&inst)) {
+			if (RefersTo(alloca->getAllocatedType(), target)) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Prints out names of affected functions in a line.
+void PrintAffected(StringRef title, const std::vector<StringRef> &names,
+		   raw_ostream &out)
+{
+	if (names.empty()) {
+		return;
+	}
+
+	out << "  " << title << ":";
+	for (size_t i = 0; i < names.size() && i < kMaxAffected; i++) {
+		out << " " << names[i];
+	}
+	if (names.size() > kMaxAffected) {
+		out << " and " << names.size() - kMaxAffected << " more";
+	}
+	out << "\n";
+}
+} // namespace
+
+TypePrecheck::TypePrecheck(Module *original, Module *patched)
+	: original_(original), patched_(patched)
+{
+}
+
+size_t TypePrecheck::Check(raw_ostream &out)
+{
+	size_t num_changes = 0;
+	for (auto [original_type, patched_type] : MatchStructs()) {
+		if (SameLayout(original_type, patched_type)) {
+			continue;
+		}
+		num_changes++;
+		out << "incompatible change: layout of "
+		    << original_type->getName() << " is changed\n";
+
+		std::vector<StringRef> users;
+		for (Function &fn : *original_) {
+			if (FunctionRefersTo(fn, original_type)) {
+				users.push_back(fn.getName());
+			}
+		}
+		for (GlobalVariable &gvar : original_->globals()) {
+			if (RefersTo(gvar.getValueType(), original_type)) {
+				users.push_back(gvar.getName());
+			}
+		}
+		PrintAffected("used by", users, out);
+	}
+
+	for (Function &fn : *patched_) {
+		if (!fn.hasName() || fn.isIntrinsic()) {
+			continue;
+		}
+		Function *original_fn = original_->getFunction(fn.getName());
+		if (!original_fn || original_fn->hasLocalLinkage() ||
+		    SameLayout(original_fn->getFunctionType(),
+			       fn.getFunctionType())) {
+			continue;
+		}
+		num_changes++;
+		out << "incompatible change: prototype of " << fn.getName()
+		    << " is changed\n"
+		    << "  from: " << *original_fn->getFunctionType() << "\n"
+		    << "  to:   " << *fn.getFunctionType() << "\n";
+
+		std::vector<StringRef> callers;
+		for (User *user : original_fn->users()) {
+			auto *inst = dyn_cast<Instruction>(user);
+			if (!inst) {
+				continue;
+			}
+			StringRef caller = inst->getFunction()->getName();
+			if (std::find(callers.begin(), callers.end(), caller) ==
+			    callers.end()) {
+				callers.push_back(caller);
+			}
+		}
+		PrintAffected("called by", callers, out);
+	}
+
+	return num_changes;
+}
+
+bool TypePrecheck::SameLayout(Type *lhs, Type *rhs)
+{
+	if (lhs == rhs) {
+		return true;
+	}
+	if (lhs->getTypeID() != rhs->getTypeID()) {
+		return false;
+	}
+
+	auto memo = same_layout_.find({ lhs, rhs });
+	if (memo != same_layout_.end()) {
+		return memo->second;
+	}
+
+	bool same = true;
+	if (auto *lhs_int = dyn_cast<IntegerType>(lhs)) {
+		same = lhs_int->getBitWidth() ==
+		       cast<IntegerType>(rhs)->getBitWidth();
+	} else if (lhs->isPointerTy()) {
+		same = lhs->getPointerAddressSpace() ==
+		       rhs->getPointerAddressSpace();
+	} else if (auto *lhs_array = dyn_cast<ArrayType>(lhs)) {
+		auto *rhs_array = cast<ArrayType>(rhs);
+		same = lhs_array->getNumElements() ==
+			       rhs_array->getNumElements() &&
+		       SameLayout(lhs_array->getElementType(),
+				  rhs_array->getElementType());
+	} else if (auto *lhs_vector = dyn_cast<VectorType>(lhs)) {
+		auto *rhs_vector = cast<VectorType>(rhs);
+		same = lhs_vector->getElementCount() ==
+			       rhs_vector->getElementCount() &&
+		       SameLayout(lhs_vector->getElementType(),
+				  rhs_vector->getElementType());
+	} else if (auto *lhs_struct = dyn_cast<StructType>(lhs)) {
+		// An opaque struct, e.g., one only used by pointers in a
+		// module, has nothing to compare.
+		auto *rhs_struct = cast<StructType>(rhs);
+		if (!lhs_struct->isOpaque() && !rhs_struct->isOpaque()) {
+			same = lhs_struct->isPacked() == rhs_struct->isPacked() &&
+			       lhs_struct->getNumElements() ==
+				       rhs_struct->getNumElements();
+			for (unsigned i = 0;
+			     same && i < lhs_struct->getNumElements(); i++) {
+				same = SameLayout(lhs_struct->getElementType(i),
+						  rhs_struct->getElementType(i));
+			}
+		}
+	} else if (auto *lhs_fn = dyn_cast<FunctionType>(lhs)) {
+		auto *rhs_fn = cast<FunctionType>(rhs);
+		same = lhs_fn->isVarArg() == rhs_fn->isVarArg() &&
+		       lhs_fn->getNumParams() == rhs_fn->getNumParams() &&
+		       SameLayout(lhs_fn->getReturnType(),
+				  rhs_fn->getReturnType());
+		for (unsigned i = 0; same && i < lhs_fn->getNumParams(); i++) {
+			same = SameLayout(lhs_fn->getParamType(i),
+					  rhs_fn->getParamType(i));
+		}
+	}
+
+	same_layout_.emplace(std::make_pair(lhs, rhs), same);
+	return same;
+}
+
+std::vector<std::pair<StructType *, StructType *> >
+TypePrecheck::MatchStructs() const
+{
+	std::unordered_map<std::string, StructType *> original_structs;
+	for (StructType *type : original_->getIdentifiedStructTypes()) {
+		if (type->hasName() && !IsAnonymous(type->getName())) {
+			original_structs.emplace(type->getName().str(), type);
+		}
+	}
+
+	// Suffixes are stripped only if LLVM could have added them.
+	const bool same_context =
+		&original_->getContext() == &patched_->getContext();
+	std::vector<std::pair<StructType *, StructType *> > pairs;
+	std::unordered_map<StructType *, size_t> num_matches;
+	for (StructType *type : patched_->getIdentifiedStructTypes()) {
+		if (!type->hasName() || IsAnonymous(type->getName())) {
+			continue;
+		}
+		auto original = original_structs.find(type->getName().str());
+		if (original == original_structs.end() && same_context) {
+			original = original_structs.find(
+				StripSuffix(type->getName()).str());
+		}
+		if (original == original_structs.end() ||
+		    original->second == type) {
+			continue;
+		}
+		pairs.emplace_back(original->second, type);
+		num_matches[original->second]++;
+	}
+
+	// A struct of the 'original' matched by more than one is ambiguous.
+	pairs.erase(std::remove_if(pairs.begin(), pairs.end(),
+				   [&num_matches](const auto &pair) {
+					   return num_matches[pair.first] > 1;
+				   }),
+		    pairs.end());
+	return pairs;
+}
@@ -0,0 +1,78 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef TYPE_PRECHECK_H_
+#define TYPE_PRECHECK_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/raw_ostream.h"
+
+// This class finds changes that a livepatch can't carry before functions are
+// diffed. Unchanged code, e.g., in other translation units or on stacks,
+// keeps using the old layout of a struct and the old prototype of a
+// function. So, a livepatch w/ such changes builds fine but breaks at
+// runtime. Two kinds of changes are reported;
+//
+// 1) layout of a named struct in both modules is changed. Anonymous
+//    structs are skipped since they have no names to match.
+// 2) prototype of a non-static function is changed. Static functions are
+//    fine as all their callers are in the same file and diffed.
+//
+// Types are compared by layout, i.e., sizes and offsets they imply, and
+// results are memoized for structs nested in many others. Pointers are the
+// same regardless of pointee. A change of the pointee is caught by 1) if it
+// matters.
+//
+// The 'patched' is parsed into the context of the 'original'. So, LLVM
+// renames a struct of the 'patched', e.g., struct.foo to struct.foo.12.
+// Such a suffix is stripped off to match the struct in the 'original'.
+class TypePrecheck final {
+    public:
+	TypePrecheck(llvm::Module *original, llvm::Module *patched);
+	~TypePrecheck() = default;
+
+	// Don't allow copy.
+	TypePrecheck(const TypePrecheck &rhs) = delete;
+	TypePrecheck &operator=(const TypePrecheck &rhs) = delete;
+
+	// Prints out incompatible changes and functions affected by them in
+	// the 'original' to out. Returns the number of incompatible changes.
+	// Note that bodies of unchanged functions may be stubbed, see
+	// IrSliceIndex. So, affected functions are found by their prototypes
+	// and, if they have bodies, by instructions.
+	size_t Check(llvm::raw_ostream &out);
+
+	// Returns true if lhs and rhs have the same layout.
+	bool SameLayout(llvm::Type *lhs, llvm::Type *rhs);
+
+    private:
+	// Returns pairs of (original, patched) named structs.
+	std::vector<std::pair<llvm::StructType *, llvm::StructType *> >
+	MatchStructs() const;
+
+	llvm::Module *original_;
+	llvm::Module *patched_;
+	// key: (lhs, rhs) of SameLayout()
+	std::map<std::pair<llvm::Type *, llvm::Type *>, bool> same_layout_;
+};
+
+#endif // TYPE_PRECHECK_H_
@@ -0,0 +1,460 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#include "unified_diff.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "auto_cleanup.h"
+#include "command.h"
+
+namespace
+{
+bool StartsWith(std::string_view str, std::string_view prefix)
+{
+	return str.substr(0, prefix.size()) == prefix;
+}
+
+// Converts a given string to a number. Throws an exception if it's not a number.
+size_t ToNumber(const std::string &number) noexcept(false)
+{
+	if (number.empty() ||
+	    number.find_first_not_of("0123456789") != std::string::npos) {
+		throw std::error_code{ Command::ErrorCode::INVALID_PATCH_FILE };
+	}
+
+	errno = 0;
+	size_t value = std::strtoull(number.c_str(), nullptr, 10);
+	if (errno == ERANGE) {
+		throw std::error_code{ Command::ErrorCode::INVALID_PATCH_FILE };
+	}
+	return value;
+}
+
+std::pair</*offset*/ size_t, /*lines*/ size_t>
+GetOffsetLinesPair(const std::string &pair) noexcept(false)
+{
+	// format of pair: [-+]${line#},${lines_changed}
+	// ",${lines_changed}" is omitted if a single line is changed.
+	if (pair.size() < 2 || (pair[0] != '-' && pair[0] != '+')) {
+		throw std::error_code{ Command::ErrorCode::INVALID_PATCH_FILE };
+	}
+
+	const auto pos = pair.find(',');
+	if (pos == std::string::npos) {
+		return { ToNumber(pair.substr(1)), 1 };
+	}
+
+	return { ToNumber(pair.substr(1, pos - 1)),
+		 ToNumber(pair.substr(pos + 1)) };
+}
+
+// Returns a path in '---' or '+++' line w/ 'strip' leading components
+// stripped, same as 'patch -p${strip}'. e.g., "+++ b/kernel/fork.c\t2021-01-01"
+// returns "kernel/fork.c" for 1 and "fork.c" for 2. Like 'patch', adjacent
+// slashes count as one. If the path doesn't have that many components, an
+// empty path is returned so that it doesn't match any file.
+std::string_view StrippedPath(std::string_view line, size_t strip)
+{
+	std::string_view path = line.substr(4);
+	path = path.substr(0, path.find('\t'));
+	for (size_t i = 0; i < strip; i++) {
+		const size_t slash = path.find('/');
+		if (slash == std::string_view::npos) {
+			return {};
+		}
+		path = path.substr(slash + 1);
+		path = path.substr(std::min(path.find_first_not_of('/'),
+					    path.size()));
+	}
+	return path;
+}
+
+// Parses a hunk that starts w/ a given header.
+UnifiedDiff::Hunk ParseHunk(const std::string &header, std::istream &file)
+	noexcept(false)
+{
+	// format: @@ -${line#},${lines_changed} +${line#},{lines_changed} @@ ...
+	// e.g.,: @@ -37,16 +37,17 @@ ...
+	UnifiedDiff::Hunk hunk;
+	std::string token;
+	std::istringstream iss(header);
+	std::getline(iss, token, ' '); // @@. so simply skip
+	std::getline(iss, token, ' '); // -${line#},${lines_changed}
+	std::tie(hunk.old_start, hunk.old_lines) = GetOffsetLinesPair(token);
+	std::getline(iss, token, ' '); // +${line#},${lines_changed}
+	std::tie(hunk.new_start, hunk.new_lines) = GetOffsetLinesPair(token);
+
+	size_t old_left = hunk.old_lines;
+	size_t new_left = hunk.new_lines;
+	std::string line;
+	while ((old_left || new_left) && std::getline(file, line)) {
+		if (line.empty()) {
+			// Some editors strip the space of empty context line.
+			line = " ";
+		}
+		switch (line[0]) {
+		case ' ':
+			if (!old_left || !new_left) {
+				throw std::error_code{
+					Command::ErrorCode::INVALID_PATCH_FILE
+				};
+			}
+			old_left--;
+			new_left--;
+			break;
+		case '-':
+			if (!old_left) {
+				throw std::error_code{
+					Command::ErrorCode::INVALID_PATCH_FILE
+				};
+			}
+			old_left--;
+			break;
+		case '+':
+			if (!new_left) {
+				throw std::error_code{
+					Command::ErrorCode::INVALID_PATCH_FILE
+				};
+			}
+			new_left--;
+			break;
+		case '\\':
+			// "\ No newline at end of file"
+			continue;
+		default:
+			throw std::error_code{
+				Command::ErrorCode::INVALID_PATCH_FILE
+			};
+		}
+		hunk.lines.push_back(std::move(line));
+	}
+	if (old_left || new_left) {
+		throw std::error_code{ Command::ErrorCode::INVALID_PATCH_FILE };
+	}
+
+	return hunk;
+}
+
+// Returns the number of context lines before the first change in a hunk.
+size_t LeadingContext(const UnifiedDiff::Hunk &hunk)
+{
+	auto it = std::find_if(
+		hunk.lines.begin(), hunk.lines.end(),
+		[](const std::string &line) { return line[0] != ' '; });
+	return it - hunk.lines.begin();
+}
+
+// Returns the number of context lines after the last change in a hunk.
+size_t TrailingContext(const UnifiedDiff::Hunk &hunk)
+{
+	auto it = std::find_if(
+		hunk.lines.rbegin(), hunk.lines.rend(),
+		[](const std::string &line) { return line[0] != ' '; });
+	return it - hunk.lines.rbegin();
+}
+
+// Finds where old lines of a hunk are in original. The search starts from
+// expected and goes outwards, but not below lower to avoid overlapping w/
+// the previous hunk. If an exact match is not found, up to fuzz lines of
+// leading and trailing context are ignored. Returns false if not found.
+//
+// As 'patch' does, a hunk w/ less leading context than the others in the
+// .patch file is anchored to the start of file, and a hunk w/ less trailing
+// context is anchored to the end of file.
+bool FindHunk(const std::vector<std::string> &original,
+	      const std::vector<std::string_view> &old_lines, size_t leading,
+	      size_t trailing, size_t context, size_t lower, size_t expected,
+	      size_t fuzz, size_t *pos)
+{
+	if (original.size() < old_lines.size() ||
+	    original.size() - old_lines.size() < lower) {
+		return false;
+	}
+	const size_t upper = original.size() - old_lines.size();
+
+	for (size_t f = 0; f <= fuzz; f++) {
+		if (f > context) {
+			// Nothing more to ignore.
+			break;
+		}
+		const bool at_start = f + leading < context;
+		const bool at_end = f + trailing < context;
+		const size_t begin = at_start ? 0 : f + leading - context;
+		const size_t end =
+			old_lines.size() - (at_end ? 0 : f + trailing - context);
+		auto matches = [&](size_t at) {
+			for (size_t i = begin; i < end; i++) {
+				if (original[at + i] != old_lines[i]) {
+					return false;
+				}
+			}
+			return true;
+		};
+
+		if (at_start || at_end) {
+			const size_t at = at_start ? 0 : upper;
+			if ((!at_start || !at_end || upper == 0) && at >= lower &&
+			    matches(at)) {
+				*pos = at;
+				return true;
+			}
+			continue;
+		}
+
+		const size_t center = std::clamp(expected, lower, upper);
+		for (size_t d = 0; d <= center - lower || center + d <= upper;
+		     d++) {
+			if (center + d <= upper && matches(center + d)) {
+				*pos = center + d;
+				return true;
+			}
+			if (d && d <= center - lower && matches(center - d)) {
+				*pos = center - d;
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+} // namespace
+
+UnifiedDiff::UnifiedDiff(std::string_view patch_filename,
+			 std::string_view diffed_file, size_t strip)
+	noexcept(false)
+{
+	std::fstream file(std::string(patch_filename), std::ios::in);
+	if (!file.is_open()) {
+		throw std::error_code{ errno, std::system_category() };
+	}
+	AutoCleanup fd_close([&file_ = file]() { file_.close(); });
+
+	Parse(file, diffed_file, strip);
+}
+
+UnifiedDiff::UnifiedDiff(std::istream &patch, std::string_view diffed_file,
+			 size_t strip) noexcept(false)
+{
+	Parse(patch, diffed_file, strip);
+}
+
+void UnifiedDiff::Parse(std::istream &patch, std::string_view diffed_file,
+			size_t strip) noexcept(false)
+{
+	// NOTE: patch file can be generated without using 'git diff'
+	// command. So, rely on '---' and '+++' lines rather than 'diff' line.
+	std::string old_path;
+	bool matched = false;
+	std::string line;
+	while (std::getline(patch, line)) {
+		std::string_view line_view(line);
+		if (StartsWith(line_view, "--- ")) {
+			old_path = StrippedPath(line_view, strip);
+		} else if (StartsWith(line_view, "+++ ")) {
+			matched = old_path == diffed_file ||
+				  StrippedPath(line_view, strip) == diffed_file;
+			has_file_ = has_file_ || matched;
+		} else if (StartsWith(line_view, "diff ")) {
+			matched = false;
+		} else if (matched && StartsWith(line_view, "@@ ")) {
+			hunks_.push_back(ParseHunk(line, patch));
+		}
+	}
+}
+
+std::vector<std::pair<std::string, size_t> >
+UnifiedDiff::ChangedFiles(std::istream &patch, size_t strip) noexcept(false)
+{
+	std::vector<std::pair<std::string, size_t> > files;
+	std::string old_path;
+	std::string line;
+	while (std::getline(patch, line)) {
+		std::string_view line_view(line);
+		if (StartsWith(line_view, "--- ")) {
+			old_path = StrippedPath(line_view, strip);
+		} else if (StartsWith(line_view, "+++ ")) {
+			// a removed file has /dev/null for its new path.
+			files.emplace_back(StartsWith(line_view, "+++ /dev/null") ?
+						   old_path :
+						   std::string(StrippedPath(line_view,
+									    strip)),
+					   0);
+		} else if (!files.empty() && StartsWith(line_view, "@@ ")) {
+			for (const std::string &hunk_line :
+			     ParseHunk(line, patch).lines) {
+				if (hunk_line[0] == '+' || hunk_line[0] == '-') {
+					files.back().second++;
+				}
+			}
+		}
+	}
+	return files;
+}
+
+void UnifiedDiff::Apply(const std::vector<std::string> &original, size_t fuzz,
+			std::vector<std::string> *patched,
+			std::vector<std::string> *aligned_original,
+			std::vector<std::string> *aligned_patched) const
+	noexcept(false)
+{
+	std::vector<Position> positions;
+	patched->clear();
+
+	// lines of context that hunks have unless they're at the start or end
+	// of file. Usually 3.
+	size_t context = 0;
+	for (const Hunk &hunk : hunks_) {
+		context = std::max(
+			{ context, LeadingContext(hunk), TrailingContext(hunk) });
+	}
+
+	// next line to copy from original.
+	size_t cursor = 0;
+	// how far hunks are found from their line #s.
+	ptrdiff_t offset = 0;
+	std::vector<std::string_view> old_lines;
+	for (const Hunk &hunk : hunks_) {
+		old_lines.clear();
+		for (const std::string &line : hunk.lines) {
+			if (line[0] != '+') {
+				old_lines.push_back(std::string_view(line).substr(1));
+			}
+		}
+
+		// If no line is in original side, the hunk goes after
+		// old_start.
+		const size_t start =
+			hunk.old_lines ? hunk.old_start - 1 : hunk.old_start;
+		const ptrdiff_t expected = static_cast<ptrdiff_t>(start) + offset;
+		size_t pos;
+		if (!FindHunk(original, old_lines, LeadingContext(hunk),
+			      TrailingContext(hunk), context, cursor,
+			      expected < 0 ? 0 : expected, fuzz, &pos)) {
+			throw std::error_code{ Command::ErrorCode::PATCH_FAILED };
+		}
+		offset = static_cast<ptrdiff_t>(pos) - static_cast<ptrdiff_t>(start);
+
+		patched->insert(patched->end(), original.begin() + cursor,
+				original.begin() + pos);
+		positions.push_back({ pos, patched->size() });
+
+		// Context lines come from original as they can be different
+		// from the hunk w/ fuzz.
+		size_t index = pos;
+		for (const std::string &line : hunk.lines) {
+			switch (line[0]) {
+			case ' ':
+				patched->push_back(original[index++]);
+				break;
+			case '-':
+				index++;
+				break;
+			case '+':
+				patched->push_back(line.substr(1));
+				break;
+			}
+		}
+		cursor = index;
+	}
+	patched->insert(patched->end(), original.begin() + cursor,
+			original.end());
+
+	AlignLines(original, *patched, positions, aligned_original,
+		   aligned_patched);
+}
+
+void UnifiedDiff::Align(const std::vector<std::string> &original,
+			const std::vector<std::string> &patched,
+			std::vector<std::string> *aligned_original,
+			std::vector<std::string> *aligned_patched) const
+{
+	std::vector<Position> positions;
+	for (const Hunk &hunk : hunks_) {
+		positions.push_back(
+			{ hunk.old_lines ? hunk.old_start - 1 : hunk.old_start,
+			  hunk.new_lines ? hunk.new_start - 1 :
+					   hunk.new_start });
+	}
+
+	AlignLines(original, patched, positions, aligned_original,
+		   aligned_patched);
+}
+
+void UnifiedDiff::AlignLines(const std::vector<std::string> &original,
+			     const std::vector<std::string> &patched,
+			     const std::vector<Position> &positions,
+			     std::vector<std::string> *aligned_original,
+			     std::vector<std::string> *aligned_patched) const
+{
+	aligned_original->clear();
+	aligned_patched->clear();
+
+	size_t original_pos = 0;
+	size_t patched_pos = 0;
+	for (size_t i = 0; i < hunks_.size(); i++) {
+		const Hunk &hunk = hunks_[i];
+		size_t removed = 0;
+		size_t added = 0;
+		for (const std::string &line : hunk.lines) {
+			removed += line[0] == '-';
+			added += line[0] == '+';
+		}
+
+		// Empty lines go right before the first changed line.
+		const size_t leading = LeadingContext(hunk);
+		const size_t original_change =
+			std::clamp(positions[i].original + leading,
+				   original_pos, original.size());
+		const size_t patched_change =
+			std::clamp(positions[i].patched + leading, patched_pos,
+				   patched.size());
+		aligned_original->insert(aligned_original->end(),
+					 original.begin() + original_pos,
+					 original.begin() + original_change);
+		aligned_patched->insert(aligned_patched->end(),
+					patched.begin() + patched_pos,
+					patched.begin() + patched_change);
+		if (added > removed) {
+			aligned_original->insert(aligned_original->end(),
+						 added - removed, "");
+		} else {
+			aligned_patched->insert(aligned_patched->end(),
+						removed - added, "");
+		}
+		original_pos = original_change;
+		patched_pos = patched_change;
+	}
+	aligned_original->insert(aligned_original->end(),
+				 original.begin() + original_pos,
+				 original.end());
+	aligned_patched->insert(aligned_patched->end(),
+				patched.begin() + patched_pos, patched.end());
+}
@@ -0,0 +1,115 @@
+/*
+ * Copyright 2021 Google LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ *     Author: Yonghyun Hwang <yonghyun@google.com>
+ */
+#ifndef UNIFIED_DIFF_H_
+#define UNIFIED_DIFF_H_
+
+#include <istream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// This class parses hunks of a unified diff, .patch file, for a single file
+// and applies them to lines of the file in memory. The file is matched w/
+// paths in '---' and '+++' lines after stripping 'strip' leading
+// components, i.e., same as 'patch -p${strip}'. If the .patch file doesn't
+// change the file, there's no hunk.
+//
+// Like 'patch', a hunk is searched around its line # in the hunk header
+// w/ offset accumulated by previous hunks, and up to 'fuzz' lines of
+// leading and trailing context can be ignored.
+//
+// The class also aligns __LINE__ of original and patched. For each hunk,
+// empty lines are added to the shorter side at the first changed line so
+// that lines after the hunk have the same line # on both sides.
+class UnifiedDiff final {
+    public:
+	struct Hunk {
+		// line # and the number of lines in the hunk header.
+		size_t old_start = 0;
+		size_t old_lines = 0;
+		size_t new_start = 0;
+		size_t new_lines = 0;
+		// lines w/ their prefixes, ' ', '-' or '+'.
+		std::vector<std::string> lines;
+	};
+
+	UnifiedDiff(std::string_view patch_filename, std::string_view diffed_file,
+		    size_t strip = 1) noexcept(false);
+	// Parses the .patch file from a stream, e.g., one in memory.
+	UnifiedDiff(std::istream &patch, std::string_view diffed_file,
+		    size_t strip = 1) noexcept(false);
+	~UnifiedDiff() = default;
+
+	// Don't allow copy.
+	UnifiedDiff(const UnifiedDiff &rhs) = delete;
+	UnifiedDiff &operator=(const UnifiedDiff &rhs) = delete;
+
+	const std::vector<Hunk> &hunks() const
+	{
+		return hunks_;
+	}
+
+	// Returns true if the .patch file has diffed_file, w/ or w/o hunks.
+	bool has_file() const
+	{
+		return has_file_;
+	}
+
+	// Returns paths of files changed by a .patch file w/ the number of
+	// added and removed lines, in the order of the .patch file. Paths are
+	// stripped the same way as diffed_file is matched.
+	static std::vector<std::pair<std::string, size_t> >
+	ChangedFiles(std::istream &patch, size_t strip = 1) noexcept(false);
+
+	// Applies hunks to original and outputs patched along w/ aligned
+	// original and patched. Throws an exception if a hunk doesn't apply
+	// w/ the given fuzz.
+	void Apply(const std::vector<std::string> &original, size_t fuzz,
+		   std::vector<std::string> *patched,
+		   std::vector<std::string> *aligned_original,
+		   std::vector<std::string> *aligned_patched) const
+		noexcept(false);
+
+	// Aligns original and patched that the .patch file was already applied
+	// to. Line #s in the hunk headers are used as they are.
+	void Align(const std::vector<std::string> &original,
+		   const std::vector<std::string> &patched,
+		   std::vector<std::string> *aligned_original,
+		   std::vector<std::string> *aligned_patched) const;
+
+    private:
+	// 0-based index of the first line of a hunk in original and patched.
+	struct Position {
+		size_t original = 0;
+		size_t patched = 0;
+	};
+
+	void Parse(std::istream &patch, std::string_view diffed_file,
+		   size_t strip) noexcept(false);
+	void AlignLines(const std::vector<std::string> &original,
+			const std::vector<std::string> &patched,
+			const std::vector<Position> &positions,
+			std::vector<std::string> *aligned_original,
+			std::vector<std::string> *aligned_patched) const;
+
+	std::vector<Hunk> hunks_;
+	bool has_file_ = false;
+};
+
+#endif // UNIFIED_DIFF_H_